@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <new>
+#include <stdexcept>
+#include "arena.hpp"
+
+struct alignas(SlabPool::ALIGNMENT) SlabPool::Slab {
+    // Objects follow this header, starting at the next cache line
+    Slab* next;
+};
+
+struct SlabPool::FreeObject {
+    FreeObject* next;
+};
+
+static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+SlabPool::SlabPool(size_t object_size, size_t slab_size) {
+    this->object_size = round_up(object_size, ALIGNMENT);
+    this->slab_size = round_up(slab_size, ALIGNMENT);
+    if (this->slab_size < sizeof(Slab) + this->object_size)
+        throw std::invalid_argument("slab is too small for one object");
+
+    this->bytes_reserved = 0;
+    this->first = nullptr;
+    this->current = nullptr;
+    this->bump = nullptr;
+    this->end = nullptr;
+    this->free_list = nullptr;
+}
+
+SlabPool::~SlabPool() {
+    // Release all slabs in bulk; the objects in them are not visited
+    Slab* slab = this->first;
+    while (slab != nullptr) {
+        Slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+void* SlabPool::allocate() {
+    if (this->free_list != nullptr) {
+        FreeObject* result = this->free_list;
+        this->free_list = result->next;
+        return result;
+    }
+    if (this->bump + this->object_size <= this->end) {
+        void* result = this->bump;
+        this->bump += this->object_size;
+        return result;
+    }
+    return this->allocate_from_next_slab();
+}
+
+void* SlabPool::allocate_from_next_slab() {
+    // The current slab is used up. Move on to the next slab if a previous
+    // `clear` left one behind; otherwise get a new slab from the heap.
+
+    Slab* slab = this->first;
+    if (this->current != nullptr)
+        slab = this->current->next;
+    if (slab == nullptr) {
+        slab = static_cast<Slab*>(aligned_alloc(ALIGNMENT, this->slab_size));
+        if (slab == nullptr)
+            throw std::bad_alloc();
+        slab->next = nullptr;
+        if (this->current != nullptr)
+            this->current->next = slab;
+        else
+            this->first = slab;
+        this->bytes_reserved += this->slab_size;
+    }
+
+    this->current = slab;
+    this->bump = reinterpret_cast<char*>(slab) + sizeof(Slab);
+    this->end = reinterpret_cast<char*>(slab) + this->slab_size;
+
+    void* result = this->bump;
+    this->bump += this->object_size;
+    return result;
+}
+
+void SlabPool::release(void* object) {
+    auto freed = static_cast<FreeObject*>(object);
+    freed->next = this->free_list;
+    this->free_list = freed;
+}
+
+void SlabPool::clear() {
+    // Rewind to the first slab; later slabs are picked up again by
+    // allocate_from_next_slab
+    this->current = nullptr;
+    this->bump = nullptr;
+    this->end = nullptr;
+    this->free_list = nullptr;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+
+// Fixed-size object pool backed by cache-line-aligned slabs.
+//
+// Each tree keeps one pool per object type, so objects of one tree are packed
+// together and trees on different threads never contend on the global heap.
+// Objects are carved from the current slab with a bump pointer; released
+// objects go onto a free list and are handed out again first.
+//
+// Objects must be trivially destructible: `clear` and the destructor drop
+// them without running any destructor.
+class SlabPool {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t DEFAULT_SLAB_SIZE = 64 * 1024;
+
+    explicit SlabPool(size_t object_size,
+                      size_t slab_size = DEFAULT_SLAB_SIZE);
+    ~SlabPool();
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    // Returns uninitialized memory for one object
+    void* allocate();
+    // Puts an object back onto the free list
+    void release(void* object);
+    // Forgets every object in O(1). Slabs are kept and reused.
+    void clear();
+
+    size_t get_object_size() const { return this->object_size; }
+    size_t get_bytes_reserved() const { return this->bytes_reserved; }
+
+private:
+    struct Slab;
+    struct FreeObject;
+
+    void* allocate_from_next_slab();
+
+    size_t object_size;
+    size_t slab_size;
+    size_t bytes_reserved;
+    Slab* first;
+    Slab* current;
+    char* bump;
+    char* end;
+    FreeObject* free_list;
+};
@@ -0,0 +1,152 @@
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+#include "ball_filter.hpp"
+#include "hitbox.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BALL_FILTER_X86 1
+#include <immintrin.h>
+#endif
+
+
+// Scalar version
+//
+// The distance from the center to a box is the distance to its nearest
+// point: per axis, how far the center is outside the interval, or 0.
+
+static bool touches(const Hitbox* hb, float x, float y, float r2) {
+    // (max drops a NaN second operand, so NaN sides are tested apart)
+    bool ordered = !(isnan(hb->a1) | isnan(hb->b1)
+                     | isnan(hb->a2) | isnan(hb->b2));
+    float dx = std::max(std::max(hb->a1 - x, x - hb->b1), 0.0f);
+    float dy = std::max(std::max(hb->a2 - y, y - hb->b2), 0.0f);
+    return ordered & (dx * dx + dy * dy <= r2);
+}
+
+static size_t scalar_filter(Hitbox* const* boxes, size_t n, float x,
+                            float y, float rad, Hitbox** out) {
+    float r2 = rad * rad;
+    size_t hits = 0;
+    for (size_t i = 0; i < n; i++) {
+        // (written unconditionally: out[hits] is never ahead of boxes[i])
+        Hitbox* hb = boxes[i];
+        out[hits] = hb;
+        hits += touches(hb, x, y, r2);
+    }
+    return hits;
+}
+
+#ifdef BALL_FILTER_X86
+
+// AVX2 version
+//
+// Eight boxes at a time. Each box is one 16-byte row (a1, b1, a2, b2); the
+// rows of boxes j and j + 4 share a register, so that transposing within
+// the 128-bit lanes gives one register per side, box j in lane j.
+
+static constexpr size_t PREFETCH_DISTANCE = 32;
+
+__attribute__((target("avx2")))
+static size_t avx2_filter(Hitbox* const* boxes, size_t n, float x, float y,
+                          float rad, Hitbox** out) {
+    __m256 x8 = _mm256_set1_ps(x);
+    __m256 y8 = _mm256_set1_ps(y);
+    __m256 r2 = _mm256_set1_ps(rad * rad);
+    __m256 zero = _mm256_setzero_ps();
+    size_t hits = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        // The boxes are wherever their owners put them; ask for those of a
+        // later round early
+        for (size_t j = i + PREFETCH_DISTANCE;
+             j < std::min(i + PREFETCH_DISTANCE + 8, n); j++) {
+            _mm_prefetch((const char*) boxes[j], _MM_HINT_T0);
+        }
+        __m256 rows[4];
+        for (size_t j = 0; j < 4; j++) {
+            __m128 lo = _mm_loadu_ps(&(boxes[i + j]->a1));
+            __m128 hi = _mm_loadu_ps(&(boxes[i + j + 4]->a1));
+            rows[j] = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        }
+        __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+        __m256 a1 = _mm256_castpd_ps(_mm256_unpacklo_pd(
+            _mm256_castps_pd(t0), _mm256_castps_pd(t2)));
+        __m256 b1 = _mm256_castpd_ps(_mm256_unpackhi_pd(
+            _mm256_castps_pd(t0), _mm256_castps_pd(t2)));
+        __m256 a2 = _mm256_castpd_ps(_mm256_unpacklo_pd(
+            _mm256_castps_pd(t1), _mm256_castps_pd(t3)));
+        __m256 b2 = _mm256_castpd_ps(_mm256_unpackhi_pd(
+            _mm256_castps_pd(t1), _mm256_castps_pd(t3)));
+
+        // max_ps returns its second operand if either is NaN: zero goes
+        // first so that a NaN center misses, and NaN sides are tested apart
+        __m256 dx = _mm256_max_ps(zero, _mm256_max_ps(_mm256_sub_ps(a1, x8),
+                                                      _mm256_sub_ps(x8, b1)));
+        __m256 dy = _mm256_max_ps(zero, _mm256_max_ps(_mm256_sub_ps(a2, y8),
+                                                      _mm256_sub_ps(y8, b2)));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                  _mm256_mul_ps(dy, dy));
+        __m256 hit = _mm256_and_ps(
+            _mm256_cmp_ps(d2, r2, _CMP_LE_OQ),
+            _mm256_and_ps(_mm256_cmp_ps(a1, b1, _CMP_ORD_Q),
+                          _mm256_cmp_ps(a2, b2, _CMP_ORD_Q)));
+        unsigned mask = _mm256_movemask_ps(hit);
+        while (mask != 0) {
+            out[hits++] = boxes[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+    }
+    return hits + scalar_filter(boxes + i, n - i, x, y, rad, out + hits);
+}
+
+#endif  // BALL_FILTER_X86
+
+
+// Dispatch
+
+BallFilterFn ball_filter = scalar_filter;
+static BallFilterImpl current_impl = BallFilterImpl::SCALAR;
+
+bool set_ball_filter_impl(BallFilterImpl impl) {
+    switch (impl) {
+#ifdef BALL_FILTER_X86
+    case BallFilterImpl::AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        ball_filter = avx2_filter;
+        break;
+#endif
+    case BallFilterImpl::SCALAR:
+        ball_filter = scalar_filter;
+        break;
+    default:
+        return false;
+    }
+    current_impl = impl;
+    return true;
+}
+
+BallFilterImpl get_ball_filter_impl() {
+    return current_impl;
+}
+
+const char* ball_filter_impl_name(BallFilterImpl impl) {
+    switch (impl) {
+    case BallFilterImpl::AVX2: return "avx2";
+    default:                   return "scalar";
+    }
+}
+
+static bool pick_best_impl() {
+#ifdef BALL_FILTER_X86
+    __builtin_cpu_init();
+#endif
+    return set_ball_filter_impl(BallFilterImpl::AVX2)
+        || set_ball_filter_impl(BallFilterImpl::SCALAR);
+}
+
+[[maybe_unused]] static bool picked_best_impl = pick_best_impl();
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+// The exact test behind ball queries: which hitboxes touch a disc.
+//
+// A ball query only narrows the hitboxes down to those whose keys are in a
+// range of magnitudes. This keeps the ones whose box [a1, b1] X [a2, b2] is
+// within `rad` of the center (x, y), touching included. Boxes with a NaN
+// side never touch.
+
+struct Hitbox;
+
+enum class BallFilterImpl : unsigned char {
+    SCALAR,
+    AVX2
+};
+
+using BallFilterFn = size_t (*)(Hitbox* const* boxes, size_t n, float x,
+                                float y, float rad, Hitbox** out);
+
+extern BallFilterFn ball_filter;
+
+// Write the hitboxes of boxes[0, n) that touch the disc of radius `rad` at
+// (x, y) to `out`, in the same order. Returns how many. `out` may be
+// `boxes` itself.
+inline size_t filter_ball_hits(Hitbox* const* boxes, size_t n, float x,
+                               float y, float rad, Hitbox** out) {
+    return ball_filter(boxes, n, x, y, rad, out);
+}
+
+// Picked at startup by CPU feature detection, like the key search (see
+// keysearch.hpp). The setter returns false if the CPU lacks `impl`.
+BallFilterImpl get_ball_filter_impl();
+bool set_ball_filter_impl(BallFilterImpl impl);
+const char* ball_filter_impl_name(BallFilterImpl impl);
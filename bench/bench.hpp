@@ -0,0 +1,37 @@
+#pragma once
+
+// Tiny helpers shared by the benchmark programs. Each bench/*.cpp file is a
+// standalone program; build them with `make bench`.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <vector>
+
+static inline uint64_t now_ns() {
+    using namespace std::chrono;
+    auto t = steady_clock::now().time_since_epoch();
+    return (uint64_t) duration_cast<nanoseconds>(t).count();
+}
+
+static inline std::mt19937& bench_rng() {
+    // fixed seed so runs are comparable
+    static std::mt19937 rng{12345};
+    return rng;
+}
+
+static inline std::vector<size_t> shuffled_indices(size_t size) {
+    std::vector<size_t> indices(size);
+    std::iota(indices.begin(), indices.end(), 0);
+    std::shuffle(indices.begin(), indices.end(), bench_rng());
+    return indices;
+}
+
+// Keep the optimizer from throwing away a result
+template<class T>
+static inline void do_not_optimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
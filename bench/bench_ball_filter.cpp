@@ -0,0 +1,156 @@
+// Exact ball queries in a 2D world. The key range of a ball query is an
+// annulus, so most candidates are far away in angle.
+//
+// First the queries end to end, filtered in the search callback by hand vs.
+// by ExactHitboxIndex, with how selective the filter is. Then the filter
+// kernels alone on arrays of candidates, the boxes in memory order or
+// scattered.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 2000;
+constexpr float WORLD = 10000.0f;
+constexpr float HALF_SIZE = 2.0f;
+constexpr int REPEATS = 3;
+
+struct Query {
+    float x, y;
+};
+
+class HandFilteredIndex : public FlatHitboxIndex<HandFilteredIndex> {
+public:
+    float x = 0.0f, y = 0.0f, rad = 0.0f;
+    size_t hits = 0;
+
+    void search_callback(Hitbox* const* hitboxes, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            Hitbox* hb = hitboxes[i];
+            float dx = std::max(std::max(hb->a1 - x, x - hb->b1), 0.0f);
+            float dy = std::max(std::max(hb->a2 - y, y - hb->b2), 0.0f);
+            this->hits += (dx * dx + dy * dy <= rad * rad);
+        }
+    }
+};
+
+class ExactIndex : public ExactHitboxIndex<ExactIndex> {
+public:
+    size_t hits = 0;
+
+    void search_callback(Hitbox* const* hitboxes, size_t n) {
+        this->hits += n;
+    }
+};
+
+static void run_queries(std::vector<Hitbox>& boxes) {
+    auto by_hand = new HandFilteredIndex();
+    auto exact = new ExactIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        Hitbox* hb = &(boxes[i]);
+        float x = hb->a1 + HALF_SIZE, y = hb->a2 + HALF_SIZE;
+        by_hand->insert(sqrtf(x * x + y * y), hb);
+        exact->insert(sqrtf(x * x + y * y), hb);
+    }
+    const float R = HALF_SIZE * sqrtf(2.0f);
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    std::vector<Query> queries(NUM_QUERIES);
+    for (auto& q : queries) {
+        q = {coord(bench_rng()), coord(bench_rng())};
+    }
+
+    printf("%8s %12s %10s %12s %12s\n", "radius", "candidates", "hits",
+           "by hand ns", "exact ns");
+    auto hand_acc = by_hand->make_iteration_buffer();
+    auto acc = exact->make_iteration_buffer();
+    for (float rad : {10.0f, 100.0f, 500.0f}) {
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        BallFilterStats total = {0, 0};
+        for (int r = 0; r < REPEATS; r++) {
+            by_hand->hits = 0;
+            uint64_t t0 = now_ns();
+            for (auto& q : queries) {
+                by_hand->x = q.x, by_hand->y = q.y, by_hand->rad = rad;
+                by_hand->ball_query(sqrtf(q.x * q.x + q.y * q.y), rad, R,
+                                    hand_acc);
+            }
+            best[0] = std::min(best[0], now_ns() - t0);
+
+            total = {0, 0};
+            t0 = now_ns();
+            for (auto& q : queries) {
+                BallFilterStats stats = exact->ball_query(q.x, q.y, rad, R,
+                                                          acc);
+                total.candidates += stats.candidates;
+                total.hits += stats.hits;
+            }
+            best[1] = std::min(best[1], now_ns() - t0);
+        }
+        if (by_hand->hits != total.hits)
+            printf("hits differ: %zu vs %zu\n", by_hand->hits, total.hits);
+        printf("%8.0f %12.1f %10.2f %12.1f %12.1f\n", rad,
+               (double) total.candidates / NUM_QUERIES,
+               (double) total.hits / NUM_QUERIES,
+               (double) best[0] / NUM_QUERIES,
+               (double) best[1] / NUM_QUERIES);
+    }
+    by_hand->destroy_iteration_buffer(hand_acc);
+    exact->destroy_iteration_buffer(acc);
+    delete by_hand;
+    delete exact;
+}
+
+static void run_kernels(std::vector<Hitbox>& boxes) {
+    // Filtered in chunks the size of a large search's buffers; "in cache"
+    // filters the first chunk over and over
+    constexpr size_t CHUNK = 4096;
+    printf("\n%10s %12s %12s %12s\n", "layout", "scalar ns", "avx2 ns",
+           "speedup");
+    std::vector<Hitbox*> candidates(SIZE);
+    std::vector<Hitbox*> out(CHUNK);
+    const BallFilterImpl best_impl = get_ball_filter_impl();
+    for (const char* layout : {"in cache", "in order", "scattered"}) {
+        for (size_t i = 0; i < SIZE; i++) {
+            candidates[i] = &(boxes[i]);
+        }
+        if (strcmp(layout, "scattered") == 0)
+            std::shuffle(candidates.begin(), candidates.end(), bench_rng());
+        size_t stride = (strcmp(layout, "in cache") == 0) ? 0 : CHUNK;
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        for (int r = 0; r < REPEATS; r++) {
+            for (auto impl : {BallFilterImpl::SCALAR, BallFilterImpl::AVX2}) {
+                if (!set_ball_filter_impl(impl))
+                    continue;
+                size_t hits = 0;
+                uint64_t t0 = now_ns();
+                for (size_t i = 0; i < SIZE / CHUNK; i++) {
+                    hits += filter_ball_hits(&(candidates[i * stride]), CHUNK,
+                                             0.0f, 0.0f, WORLD / 2,
+                                             out.data());
+                }
+                size_t slot = (impl == BallFilterImpl::AVX2);
+                best[slot] = std::min(best[slot], now_ns() - t0);
+                do_not_optimize(hits);
+            }
+        }
+        size_t n = SIZE / CHUNK * CHUNK;
+        printf("%10s %12.2f %12.2f %12.2f\n", layout, (double) best[0] / n,
+               (double) best[1] / n, (double) best[0] / best[1]);
+    }
+    set_ball_filter_impl(best_impl);
+}
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    for (auto& hb : boxes) {
+        float x = coord(bench_rng()), y = coord(bench_rng());
+        hb = {x - HALF_SIZE, x + HALF_SIZE, y - HALF_SIZE, y + HALF_SIZE};
+    }
+    run_queries(boxes);
+    run_kernels(boxes);
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Static colliders of very different sizes, queried by small balls (as a
+// projectile would): the B+tree on the magnitude of each center, which
+// needs an `R` as big as the biggest collider, vs. the bounding volume
+// hierarchy. Then the cost of moving small hitboxes in the hierarchy with a
+// few margins.
+
+#include <math.h>
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "../bvh_hitbox.hpp"
+#include "bench.hpp"
+
+constexpr float WORLD = 10000.0f;
+constexpr float MIN_SIZE = 1.0f;
+constexpr float MAX_SIZE = 500.0f;
+constexpr size_t NUM_QUERIES = 20000;
+constexpr float RAD = 2.0f;
+constexpr size_t NUM_MOVING = 100000;
+constexpr float STEP = 0.25f;
+constexpr int TICKS = 10;
+constexpr int REPEATS = 3;
+
+class TreeIndex : public HitboxIndex<TreeIndex> {
+public:
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+class HierarchyIndex : public BVHHitboxIndex<HierarchyIndex> {
+public:
+    using BVHHitboxIndex::BVHHitboxIndex;
+
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+static float key_of(const Hitbox& box) {
+    float x = (box.a1 + box.b1) / 2, y = (box.a2 + box.b2) / 2;
+    return sqrtf(x * x + y * y);
+}
+
+template<class Query>
+static uint64_t time_best(Query query) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        query();
+        best = std::min(best, now_ns() - t0);
+    }
+    return best;
+}
+
+static void bench_colliders() {
+    printf("%10s %10s %12s %12s %12s\n", "colliders", "index", "candidates",
+           "ns/query", "speedup");
+    std::uniform_real_distribution<float> coord(0.0f, WORLD);
+    // sizes spread evenly over orders of magnitude
+    std::uniform_real_distribution<float> log_size(logf(MIN_SIZE),
+                                                   logf(MAX_SIZE));
+    for (size_t n : {1000, 10000, 100000}) {
+        std::vector<Hitbox> boxes(n);
+        float R = 0.0f;
+        for (auto& box : boxes) {
+            float x = coord(bench_rng()), y = coord(bench_rng());
+            float w = expf(log_size(bench_rng()));
+            float h = expf(log_size(bench_rng()));
+            box = {x - w / 2, x + w / 2, y - h / 2, y + h / 2};
+            R = std::max(R, sqrtf(w * w + h * h) / 2);
+        }
+        std::vector<float> qx(NUM_QUERIES), qy(NUM_QUERIES);
+        for (size_t q = 0; q < NUM_QUERIES; q++) {
+            qx[q] = coord(bench_rng());
+            qy[q] = coord(bench_rng());
+        }
+
+        auto tree = new TreeIndex();
+        auto bvh = new HierarchyIndex(0.0f);
+        for (size_t i : shuffled_indices(n)) {
+            tree->insert(key_of(boxes[i]), &(boxes[i]));
+            bvh->insert(key_of(boxes[i]), &(boxes[i]));
+        }
+        auto tree_acc = tree->make_iteration_buffer();
+        uint64_t base = time_best([&]() {
+            for (size_t q = 0; q < NUM_QUERIES; q++) {
+                tree->ball_query(qx[q], qy[q], RAD, R, tree_acc);
+            }
+        });
+        auto bvh_acc = bvh->make_iteration_buffer();
+        uint64_t t = time_best([&]() {
+            for (size_t q = 0; q < NUM_QUERIES; q++) {
+                bvh->ball_query(qx[q], qy[q], RAD, R, bvh_acc);
+            }
+        });
+        printf("%10zu %10s %12.1f %12.1f %12.2f\n", n, "tree",
+               (double) tree->candidates / (REPEATS * NUM_QUERIES),
+               (double) base / NUM_QUERIES, 1.0);
+        printf("%10zu %10s %12.1f %12.1f %12.2f\n", n, "bvh",
+               (double) bvh->candidates / (REPEATS * NUM_QUERIES),
+               (double) t / NUM_QUERIES, (double) base / t);
+        tree->destroy_iteration_buffer(tree_acc);
+        bvh->destroy_iteration_buffer(bvh_acc);
+        delete tree;
+        delete bvh;
+    }
+}
+
+static void bench_moving() {
+    printf("\n%10s %12s %12s %12s\n", "margin", "ns/insert", "ns/update",
+           "height");
+    std::uniform_real_distribution<float> coord(0.0f, WORLD);
+    std::uniform_real_distribution<float> step(-STEP, STEP);
+    std::vector<Hitbox> start(NUM_MOVING);
+    for (auto& box : start) {
+        float x = coord(bench_rng()), y = coord(bench_rng());
+        box = {x, x + MIN_SIZE, y, y + MIN_SIZE};
+    }
+    std::vector<Hitbox> boxes;
+    for (float margin : {0.0f, 0.5f, 2.0f}) {
+        auto bvh = new HierarchyIndex(margin);
+        uint64_t insert_ns = UINT64_MAX, update_ns = UINT64_MAX;
+        for (int r = 0; r < REPEATS; r++) {
+            bvh->clear();
+            boxes = start;
+            uint64_t t0 = now_ns();
+            for (size_t i = 0; i < NUM_MOVING; i++) {
+                bvh->insert(0.0f, &(boxes[i]));
+            }
+            insert_ns = std::min(insert_ns, now_ns() - t0);
+            t0 = now_ns();
+            for (int tick = 0; tick < TICKS; tick++) {
+                for (auto& box : boxes) {
+                    float dx = step(bench_rng()), dy = step(bench_rng());
+                    box = {box.a1 + dx, box.b1 + dx, box.a2 + dy,
+                           box.b2 + dy};
+                    bvh->update(0.0f, 0.0f, &box);
+                }
+            }
+            update_ns = std::min(update_ns, now_ns() - t0);
+        }
+        printf("%10.1f %12.1f %12.1f %12zu\n", margin,
+               (double) insert_ns / NUM_MOVING,
+               (double) update_ns / (TICKS * NUM_MOVING), bvh->get_height());
+        delete bvh;
+    }
+}
+
+int main() {
+    bench_colliders();
+    bench_moving();
+    return 0;
+}
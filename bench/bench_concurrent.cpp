@@ -0,0 +1,119 @@
+// Query throughput vs. reader threads, next to one writer thread.
+//
+// The writer keeps moving hitboxes around with update(). "mutex" guards a
+// plain index with one global mutex, the way it had to be done before;
+// "olc" uses thread-safe mode, where readers do not lock anything.
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+class CountingIndex : public HitboxIndex<CountingIndex> {
+public:
+    static thread_local size_t count;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            count++;
+        }
+    }
+};
+
+thread_local size_t CountingIndex::count = 0;
+
+constexpr size_t SIZE = 1000000;
+constexpr uint64_t DURATION_NS = 500000000;
+
+struct Result {
+    double queries_per_s;
+    double updates_per_s;
+};
+
+static Result run(size_t num_readers, bool thread_safe) {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    auto index = new CountingIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        keys[i] = (float) i;
+        index->insert(keys[i], &(boxes[i]));
+    }
+    index->set_thread_safe(thread_safe);
+
+    std::mutex global;
+    std::atomic<bool> running{true};
+    std::atomic<size_t> num_queries{0};
+    auto reader = [&](unsigned seed) {
+        auto acc = index->make_iteration_buffer();
+        std::mt19937 rng{seed};
+        std::uniform_real_distribution<float> pick(0.0f, (float) SIZE);
+        size_t n = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            float center = pick(rng);
+            if (thread_safe) {
+                index->ball_query(center, 4.0f, 4.0f, acc);
+            } else {
+                std::lock_guard<std::mutex> guard(global);
+                index->ball_query(center, 4.0f, 4.0f, acc);
+            }
+            n++;
+        }
+        num_queries += n;
+        index->destroy_iteration_buffer(acc);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < num_readers; r++) {
+        threads.emplace_back(reader, (unsigned) r + 1);
+    }
+
+    // The writer: small moves, like objects in a simulation step
+    std::uniform_int_distribution<size_t> pick(0, SIZE - 1);
+    std::uniform_real_distribution<float> step(-2.0f, 2.0f);
+    size_t num_updates = 0;
+    uint64_t t0 = now_ns();
+    uint64_t t1 = t0;
+    while (t1 - t0 < DURATION_NS) {
+        for (int k = 0; k < 64; k++) {
+            size_t i = pick(bench_rng());
+            float new_key = keys[i] + step(bench_rng());
+            if (thread_safe) {
+                index->update(keys[i], new_key, &(boxes[i]));
+            } else {
+                std::lock_guard<std::mutex> guard(global);
+                index->update(keys[i], new_key, &(boxes[i]));
+            }
+            keys[i] = new_key;
+        }
+        num_updates += 64;
+        t1 = now_ns();
+    }
+    running.store(false);
+    for (auto& t : threads) {
+        t.join();
+    }
+    delete index;
+
+    double seconds = (double) (t1 - t0) * 1e-9;
+    return {num_queries.load() / seconds, num_updates / seconds};
+}
+
+int main() {
+    size_t max_readers = std::thread::hardware_concurrency();
+    if (max_readers < 2)
+        max_readers = 2;
+
+    printf("%8s %16s %16s %16s %16s\n", "readers", "mutex queries/s",
+           "olc queries/s", "mutex updates/s", "olc updates/s");
+    for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+        Result locked = run(readers, false);
+        Result olc = run(readers, true);
+        printf("%8zu %16.0f %16.0f %16.0f %16.0f\n", readers,
+               locked.queries_per_s, olc.queries_per_s,
+               locked.updates_per_s, olc.updates_per_s);
+    }
+    return 0;
+}
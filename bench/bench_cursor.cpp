@@ -0,0 +1,78 @@
+// Collecting the candidates of wide range searches into a per-frame vector:
+// through the search callback vs. reading a cursor into the vector directly.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 2000;
+constexpr float HALF_WIDTH = 2000.0f;
+constexpr int REPEATS = 5;
+
+class CollectingIndex : public HitboxIndex<CollectingIndex> {
+public:
+    std::vector<Hitbox*> candidates;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            this->candidates.push_back(iter->next());
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new CollectingIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        index->insert((float) i, &(boxes[i]));
+    }
+    std::vector<float> starts(NUM_QUERIES);
+    std::uniform_real_distribution<float> pick(0.0f, SIZE - 2 * HALF_WIDTH);
+    for (auto& k0 : starts) {
+        k0 = pick(bench_rng());
+    }
+
+    auto acc = index->make_iteration_buffer();
+    std::vector<Hitbox*>& candidates = index->candidates;
+    candidates.reserve(4 * HALF_WIDTH);
+    uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+    size_t total = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        for (float k0 : starts) {
+            candidates.clear();
+            index->range_search(k0, k0 + 2 * HALF_WIDTH, acc);
+            total += candidates.size();
+        }
+        best[0] = std::min(best[0], now_ns() - t0);
+
+        t0 = now_ns();
+        for (float k0 : starts) {
+            // (the vector is reserved for the whole range up front)
+            candidates.resize(candidates.capacity());
+            auto cursor = index->open_range(k0, k0 + 2 * HALF_WIDTH);
+            size_t n = 0;
+            while (size_t got = index->next_batch(
+                       &cursor, candidates.data() + n,
+                       candidates.size() - n)) {
+                n += got;
+                if (n == candidates.size())
+                    candidates.resize(2 * n);
+            }
+            candidates.resize(n);
+            total += n;
+        }
+        best[1] = std::min(best[1], now_ns() - t0);
+    }
+    index->destroy_iteration_buffer(acc);
+
+    // (both methods find the same hits in every round)
+    double hits = (double) total / (2 * REPEATS);
+    printf("%10s %12s %12s\n", "method", "ns/hit", "speedup");
+    printf("%10s %12.2f %12.2f\n", "callback", best[0] / hits, 1.0);
+    printf("%10s %12.2f %12.2f\n", "cursor", best[1] / hits,
+           (double) best[0] / best[1]);
+    delete index;
+    return 0;
+}
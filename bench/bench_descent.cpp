@@ -0,0 +1,75 @@
+// Descent cost per tree level with each node search implementation.
+//
+// For trees of increasing height, time point lookups of keys that are in the
+// tree and divide by the number of levels. "scalar" is the early-exit loop we
+// used before the SIMD versions existed.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "../keysearch.hpp"
+#include "bench.hpp"
+
+class CountingIndex : public HitboxIndex<CountingIndex> {
+public:
+    size_t count = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->count++;
+        }
+    }
+};
+
+constexpr size_t NUM_QUERIES = 1000000;
+
+static double time_lookups(CountingIndex* index, const std::vector<float>& q) {
+    auto acc = index->make_iteration_buffer();
+    uint64_t t0 = now_ns();
+    for (float key : q) {
+        index->range_search(key, key, acc);
+    }
+    uint64_t t1 = now_ns();
+    index->destroy_iteration_buffer(acc);
+    return (double) (t1 - t0) / q.size();
+}
+
+int main() {
+    const KeySearchImpl impls[] = {
+        KeySearchImpl::SCALAR, KeySearchImpl::SSE2, KeySearchImpl::AVX2
+    };
+    const size_t sizes[] = {10, 200, 4000, 80000, 1600000};
+    const KeySearchImpl best = get_key_search_impl();
+
+    printf("%10s %7s %8s %12s %12s\n",
+           "size", "height", "impl", "ns/lookup", "ns/level");
+
+    for (size_t size : sizes) {
+        std::vector<Hitbox> boxes(size);
+        auto index = new CountingIndex();
+        for (size_t i : shuffled_indices(size)) {
+            boxes[i].a1 = (float) i;
+            index->insert((float) i, &(boxes[i]));
+        }
+        size_t height = index->get_height();
+
+        std::uniform_int_distribution<size_t> pick(0, size - 1);
+        std::vector<float> queries(NUM_QUERIES);
+        for (auto& q : queries) {
+            q = (float) pick(bench_rng());
+        }
+
+        for (KeySearchImpl impl : impls) {
+            if (!set_key_search_impl(impl))
+                continue;
+            time_lookups(index, queries);  // warm up
+            double ns = time_lookups(index, queries);
+            printf("%10zu %7zu %8s %12.1f %12.1f\n", size, height,
+                   key_search_impl_name(impl), ns, ns / height);
+        }
+        delete index;
+    }
+
+    set_key_search_impl(best);
+    return 0;
+}
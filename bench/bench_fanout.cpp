@@ -0,0 +1,84 @@
+// Node size presets across workloads.
+//
+// For each preset and tree size, time random insertion, point lookups, short
+// range scans and random deletion, and report the node memory per key after
+// all insertions.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+template<class Tree>
+class CountingIndex : public HitboxIndex<CountingIndex<Tree>, Tree> {
+public:
+    size_t count = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->count++;
+        }
+    }
+};
+
+constexpr size_t NUM_QUERIES = 500000;
+constexpr float SCAN_WIDTH = 64.0f;
+
+template<class Tree>
+static void run(const char* name, size_t size) {
+    std::vector<Hitbox> boxes(size);
+    std::vector<size_t> order = shuffled_indices(size);
+    std::uniform_int_distribution<size_t> pick(0, size - 1);
+    std::vector<float> queries(NUM_QUERIES);
+    for (auto& q : queries) {
+        q = (float) pick(bench_rng());
+    }
+
+    auto index = new CountingIndex<Tree>();
+    uint64_t t0 = now_ns();
+    for (size_t i : order) {
+        index->insert((float) i, &(boxes[i]));
+    }
+    uint64_t t1 = now_ns();
+    double bytes_per_key = (double) index->get_node_bytes() / size;
+
+    auto acc = index->make_iteration_buffer();
+    uint64_t t2 = now_ns();
+    for (float key : queries) {
+        index->range_search(key, key, acc);
+    }
+    uint64_t t3 = now_ns();
+    for (float key : queries) {
+        index->range_search(key, key + SCAN_WIDTH, acc);
+    }
+    uint64_t t4 = now_ns();
+    index->destroy_iteration_buffer(acc);
+
+    order = shuffled_indices(size);
+    uint64_t t5 = now_ns();
+    for (size_t i : order) {
+        index->del((float) i, &(boxes[i]));
+    }
+    uint64_t t6 = now_ns();
+    delete index;
+
+    printf("%6s %9zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, size,
+           (double) (t1 - t0) / size, (double) (t3 - t2) / NUM_QUERIES,
+           (double) (t4 - t3) / NUM_QUERIES, (double) (t6 - t5) / size,
+           bytes_per_key);
+}
+
+int main() {
+    const size_t sizes[] = {10000, 200000, 2000000};
+
+    printf("%6s %9s %10s %10s %10s %10s %10s\n", "node", "size",
+           "insert ns", "lookup ns", "scan ns", "delete ns", "bytes/key");
+
+    for (size_t size : sizes) {
+        run<BPTree256>("256", size);
+        run<BPTree512>("512", size);
+        run<BPTree1K>("1K", size);
+        run<BPTree4K>("4K", size);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Reading the results of wide range searches through HitboxIterator vs. as
+// flat arrays (FlatHitboxIndex), with and without sets of equal keys
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 2000;
+constexpr float WIDTH = 4000.0f;
+constexpr int REPEATS = 5;
+
+class IteratingIndex : public HitboxIndex<IteratingIndex> {
+public:
+    float sum = 0.0f;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            this->sum += iter->next()->a1;
+        }
+    }
+};
+
+class FlatIndex : public FlatHitboxIndex<FlatIndex> {
+public:
+    float sum = 0.0f;
+
+    void search_callback(Hitbox* const* hitboxes, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            this->sum += hitboxes[i]->a1;
+        }
+    }
+};
+
+template<class Index>
+static uint64_t run(Index* index, const std::vector<float>& starts) {
+    auto acc = index->make_iteration_buffer();
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        for (float k0 : starts) {
+            index->range_search(k0, k0 + WIDTH, acc);
+        }
+        best = std::min(best, now_ns() - t0);
+    }
+    index->destroy_iteration_buffer(acc);
+    do_not_optimize(index->sum);
+    return best;
+}
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> starts(NUM_QUERIES);
+    std::uniform_real_distribution<float> pick(0.0f, SIZE - WIDTH);
+    for (auto& k0 : starts) {
+        k0 = pick(bench_rng());
+    }
+
+    printf("%10s %12s %12s %12s\n", "set size", "iterator ns", "flat ns",
+           "speedup");
+    for (size_t set_size : {1, 4, 16}) {
+        auto iterating = new IteratingIndex();
+        auto flat = new FlatIndex();
+        for (size_t i = 0; i < SIZE; i++) {
+            boxes[i].a1 = (float) i;
+            float key = (float) (i / set_size * set_size);
+            iterating->insert(key, &(boxes[i]));
+            flat->insert(key, &(boxes[i]));
+        }
+        uint64_t t_iter = run(iterating, starts);
+        uint64_t t_flat = run(flat, starts);
+        printf("%10zu %12.1f %12.1f %12.2f\n", set_size,
+               (double) t_iter / NUM_QUERIES, (double) t_flat / NUM_QUERIES,
+               (double) t_iter / t_flat);
+        delete iterating;
+        delete flat;
+    }
+    return 0;
+}
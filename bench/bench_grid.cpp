@@ -0,0 +1,129 @@
+// Ball queries in a dense 2D world of small objects: the B+tree on
+// magnitude keys, which searches the whole ring of magnitudes, vs. the grid
+// with a few cell sizes, at a few densities. Each query is centered on an
+// object and both indices take it through the same (x, y) overload. Also
+// times building each index and a tick of small moves.
+
+#include <math.h>
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "../grid_hitbox.hpp"
+#include "bench.hpp"
+
+constexpr float WORLD = 2000.0f;
+constexpr float BOX_SIZE = 2.0f;
+constexpr size_t NUM_QUERIES = 20000;
+constexpr float RAD = 10.0f;
+constexpr float R = 1.0f;
+constexpr float STEP = 0.5f;
+constexpr int REPEATS = 3;
+
+class TreeIndex : public HitboxIndex<TreeIndex> {
+public:
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+class CellIndex : public GridHitboxIndex<CellIndex> {
+public:
+    using GridHitboxIndex::GridHitboxIndex;
+
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+static float key_of(const Hitbox& box) {
+    float x = (box.a1 + box.b1) / 2, y = (box.a2 + box.b2) / 2;
+    return sqrtf(x * x + y * y);
+}
+
+template<class Index>
+static void measure(const char* name, Index* index, std::vector<Hitbox>& boxes,
+                    const std::vector<Hitbox>& queries) {
+    // Build, query and move every box a little, each timed; the index is
+    // built anew for each repeat
+    size_t n = boxes.size();
+    std::vector<Hitbox> start = boxes;
+    std::vector<size_t> order = shuffled_indices(n);
+    std::uniform_real_distribution<float> step(-STEP, STEP);
+    uint64_t best[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+    size_t candidates = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        index->clear();
+        boxes = start;
+        uint64_t t0 = now_ns();
+        for (size_t i : order) {
+            index->insert(key_of(boxes[i]), &(boxes[i]));
+        }
+        best[0] = std::min(best[0], now_ns() - t0);
+
+        auto acc = index->make_iteration_buffer();
+        index->candidates = 0;
+        t0 = now_ns();
+        for (const Hitbox& q : queries) {
+            index->ball_query((q.a1 + q.b1) / 2, (q.a2 + q.b2) / 2, RAD, R,
+                              acc);
+        }
+        best[1] = std::min(best[1], now_ns() - t0);
+        candidates = index->candidates;
+        index->destroy_iteration_buffer(acc);
+
+        t0 = now_ns();
+        for (size_t i = 0; i < n; i++) {
+            float old_key = key_of(boxes[i]);
+            float dx = step(bench_rng()), dy = step(bench_rng());
+            boxes[i] = {boxes[i].a1 + dx, boxes[i].b1 + dx,
+                        boxes[i].a2 + dy, boxes[i].b2 + dy};
+            index->update(old_key, key_of(boxes[i]), &(boxes[i]));
+        }
+        best[2] = std::min(best[2], now_ns() - t0);
+    }
+    boxes = start;
+    printf("%10zu %10s %12.1f %12.1f %12.1f %12.1f\n", n, name,
+           (double) candidates / NUM_QUERIES,
+           (double) best[1] / NUM_QUERIES, (double) best[0] / n,
+           (double) best[2] / n);
+}
+
+int main() {
+    printf("%10s %10s %12s %12s %12s %12s\n", "objects", "index",
+           "candidates", "ns/query", "ns/insert", "ns/update");
+    std::uniform_real_distribution<float> coord(0.0f, WORLD);
+    for (size_t n : {10000, 100000, 1000000}) {
+        std::vector<Hitbox> boxes(n);
+        for (auto& box : boxes) {
+            float x = coord(bench_rng()), y = coord(bench_rng());
+            box = {x - BOX_SIZE / 2, x + BOX_SIZE / 2, y - BOX_SIZE / 2,
+                   y + BOX_SIZE / 2};
+        }
+        std::vector<Hitbox> queries(NUM_QUERIES);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        for (auto& q : queries) {
+            q = boxes[pick(bench_rng())];
+        }
+
+        auto tree = new TreeIndex();
+        measure("tree", tree, boxes, queries);
+        delete tree;
+        for (float cell_size : {4.0f, 11.0f, 22.0f}) {
+            char name[32];
+            snprintf(name, sizeof(name), "grid %.0f", cell_size);
+            auto grid = new CellIndex(cell_size);
+            measure(name, grid, boxes, queries);
+            delete grid;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Ball queries that read every hitbox they find: an index of pointers to
+// hitboxes scattered over memory vs. one that holds the hitboxes inline.
+//
+// Both get the same random inserts; the pointed-to hitboxes are laid out in
+// random key order, as objects of a game world would be.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "../inline_hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 4000000;
+constexpr size_t NUM_QUERIES = 20000;
+constexpr float HALF_WIDTH = 100.0f;
+constexpr int REPEATS = 5;
+
+class PointerIndex : public HitboxIndex<PointerIndex> {
+public:
+    float sum = 0.0f;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            Hitbox* hb = iter->next();
+            this->sum += hb->a1 + hb->b2;
+        }
+    }
+};
+
+class InlineIndex : public InlineHitboxIndex<InlineIndex> {
+public:
+    float sum = 0.0f;
+
+    void search_callback(const float* keys, const InlineHitbox* boxes,
+                         size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            this->sum += boxes[i].box.a1 + boxes[i].box.b2;
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<size_t> placement = shuffled_indices(SIZE);
+    auto pointers = new PointerIndex();
+    auto inlined = new InlineIndex();
+    uint64_t t0 = now_ns();
+    for (size_t i : shuffled_indices(SIZE)) {
+        Hitbox* hb = &(boxes[placement[i]]);
+        *hb = {(float) i, (float) i + 1, 0.0f, 1.0f};
+        pointers->insert((float) i, hb);
+    }
+    uint64_t pointer_build = now_ns() - t0;
+    t0 = now_ns();
+    for (size_t i : shuffled_indices(SIZE)) {
+        inlined->insert((float) i, boxes[placement[i]], i);
+    }
+    uint64_t inline_build = now_ns() - t0;
+
+    std::vector<BallQuery> queries(NUM_QUERIES);
+    std::uniform_real_distribution<float> pick(HALF_WIDTH,
+                                               SIZE - HALF_WIDTH);
+    for (auto& q : queries) {
+        q = {pick(bench_rng()), HALF_WIDTH / 2, HALF_WIDTH / 2};
+    }
+
+    uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+    auto acc = pointers->make_iteration_buffer();
+    for (int r = 0; r < REPEATS; r++) {
+        t0 = now_ns();
+        for (auto& q : queries) {
+            pointers->ball_query(q.mag, q.rad, q.R, acc);
+        }
+        best[0] = std::min(best[0], now_ns() - t0);
+        t0 = now_ns();
+        for (auto& q : queries) {
+            inlined->ball_query(q.mag, q.rad, q.R);
+        }
+        best[1] = std::min(best[1], now_ns() - t0);
+    }
+    pointers->destroy_iteration_buffer(acc);
+
+    printf("%10s %12s %12s %12s\n", "index", "MiB", "ns/insert",
+           "ns/query");
+    printf("%10s %12zu %12.1f %12.1f\n", "pointers",
+           (pointers->get_node_bytes() + SIZE * sizeof(Hitbox)) >> 20,
+           (double) pointer_build / SIZE, (double) best[0] / NUM_QUERIES);
+    printf("%10s %12zu %12.1f %12.1f\n", "inline",
+           inlined->get_node_bytes() >> 20,
+           (double) inline_build / SIZE, (double) best[1] / NUM_QUERIES);
+    do_not_optimize(pointers->sum + inlined->sum);
+    delete pointers;
+    delete inlined;
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Per-key insertion vs. insert_batch for spawn waves.
+//
+// Each frame spawns a wave of hitboxes clustered around a few distances, on
+// top of a tree that already holds a large static population.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+class NullIndex : public HitboxIndex<NullIndex> {
+public:
+    void search_callback(HitboxIterator* iter) {}
+};
+
+constexpr size_t BASE_SIZE = 200000;
+constexpr size_t NUM_FRAMES = 20;
+constexpr size_t CLUSTERS = 4;
+
+static NullIndex* make_base_index(std::vector<Hitbox>& boxes) {
+    auto index = new NullIndex();
+    for (size_t i : shuffled_indices(BASE_SIZE)) {
+        index->insert((float) i, &(boxes[i]));
+    }
+    return index;
+}
+
+static void make_waves(size_t wave, std::vector<float>* keys) {
+    std::uniform_real_distribution<float> center(0.0f, (float) BASE_SIZE);
+    std::normal_distribution<float> spread(0.0f, 25.0f);
+    keys->resize(NUM_FRAMES * wave);
+    for (size_t f = 0; f < NUM_FRAMES; f++) {
+        float centers[CLUSTERS];
+        for (auto& c : centers) {
+            c = center(bench_rng());
+        }
+        for (size_t i = 0; i < wave; i++) {
+            (*keys)[f * wave + i] = centers[i % CLUSTERS] + spread(bench_rng());
+        }
+    }
+}
+
+int main() {
+    const size_t waves[] = {100, 1000, 10000};
+    std::vector<Hitbox> base(BASE_SIZE);
+
+    printf("%8s %14s %14s %8s\n", "wave", "insert ns/key", "batch ns/key",
+           "speedup");
+
+    for (size_t wave : waves) {
+        std::vector<float> keys;
+        make_waves(wave, &keys);
+        std::vector<Hitbox> spawned(keys.size());
+        std::vector<Hitbox*> values(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            spawned[i].a1 = keys[i];
+            values[i] = &(spawned[i]);
+        }
+
+        auto index = make_base_index(base);
+        uint64_t t0 = now_ns();
+        for (size_t i = 0; i < keys.size(); i++) {
+            index->insert(keys[i], values[i]);
+        }
+        uint64_t t1 = now_ns();
+        delete index;
+
+        index = make_base_index(base);
+        uint64_t t2 = now_ns();
+        for (size_t f = 0; f < NUM_FRAMES; f++) {
+            index->insert_batch(&(keys[f * wave]), &(values[f * wave]), wave);
+        }
+        uint64_t t3 = now_ns();
+        delete index;
+
+        double single = (double) (t1 - t0) / keys.size();
+        double batch = (double) (t3 - t2) / keys.size();
+        printf("%8zu %14.1f %14.1f %7.2fx\n", wave, single, batch,
+               single / batch);
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+// The k nearest hitboxes to a point: knn, walking the leaves outward from
+// the key of the point, vs. what callers did before, ball queries with a
+// guessed radius that doubles until k hitboxes are in reach, sorted by
+// distance afterwards.
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 2000;
+constexpr float WORLD = 10000.0f;
+constexpr float BOX_SIZE = 2.0f;
+constexpr float R = BOX_SIZE;
+constexpr int REPEATS = 3;
+
+static float distance_to(const Hitbox& box, float x, float y) {
+    float dx = std::max(std::max(box.a1 - x, x - box.b1), 0.0f);
+    float dy = std::max(std::max(box.a2 - y, y - box.b2), 0.0f);
+    return sqrtf(dx * dx + dy * dy);
+}
+
+class GuessingIndex : public HitboxIndex<GuessingIndex> {
+public:
+    float x = 0.0f, y = 0.0f;
+    std::vector<HitboxNeighbor> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            Hitbox* hb = iter->next();
+            this->found.push_back({hb, distance_to(*hb, this->x, this->y)});
+        }
+    }
+
+    size_t knn_by_guessing(float x, float y, size_t k, float guess,
+                           Acc* acc) {
+        // Returns the number of ball queries it took
+        this->x = x;
+        this->y = y;
+        float mag = sqrtf(x * x + y * y);
+        size_t tries = 0;
+        for (float rad = guess;; rad *= 2) {
+            this->found.clear();
+            this->ball_query(mag, rad, R, acc);
+            tries++;
+            // a candidate in the ring may be further off than rad, so the
+            // k nearest are only known once k of them are within rad
+            auto in_reach = [&](const HitboxNeighbor& n) {
+                return n.distance <= rad;
+            };
+            size_t count = std::count_if(this->found.begin(),
+                                         this->found.end(), in_reach);
+            if (count >= k || rad > 4 * WORLD)
+                break;
+        }
+        size_t n = std::min(k, this->found.size());
+        std::partial_sort(this->found.begin(), this->found.begin() + n,
+                          this->found.end(),
+                          [](const HitboxNeighbor& l, const HitboxNeighbor& r) {
+                              return l.distance < r.distance;
+                          });
+        this->found.resize(n);
+        return tries;
+    }
+};
+
+int main() {
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new GuessingIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        float x = coord(bench_rng()), y = coord(bench_rng());
+        boxes[i] = {x - BOX_SIZE / 2, x + BOX_SIZE / 2, y - BOX_SIZE / 2,
+                    y + BOX_SIZE / 2};
+        index->insert(sqrtf(x * x + y * y), &(boxes[i]));
+    }
+    std::vector<float> qx(NUM_QUERIES), qy(NUM_QUERIES);
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+        qx[q] = coord(bench_rng());
+        qy[q] = coord(bench_rng());
+    }
+
+    printf("%6s %12s %10s %12s %12s %10s\n", "k", "guess", "tries",
+           "guess ns", "knn ns", "speedup");
+    auto acc = index->make_iteration_buffer();
+    std::vector<HitboxNeighbor> out;
+    for (size_t k : {1, 8, 64}) {
+        uint64_t knn_ns = UINT64_MAX;
+        for (int r = 0; r < REPEATS; r++) {
+            uint64_t t0 = now_ns();
+            for (size_t q = 0; q < NUM_QUERIES; q++) {
+                index->knn(qx[q], qy[q], k, R, &out);
+                do_not_optimize(out.data());
+            }
+            knn_ns = std::min(knn_ns, now_ns() - t0);
+        }
+        // A good guess, one that is too small and one that is too big
+        float good = WORLD * sqrtf((float) k / SIZE);
+        for (float guess : {good / 8, good, good * 8}) {
+            uint64_t guess_ns = UINT64_MAX;
+            size_t tries = 0;
+            for (int r = 0; r < REPEATS; r++) {
+                tries = 0;
+                uint64_t t0 = now_ns();
+                for (size_t q = 0; q < NUM_QUERIES; q++) {
+                    tries += index->knn_by_guessing(qx[q], qy[q], k, guess,
+                                                    acc);
+                }
+                guess_ns = std::min(guess_ns, now_ns() - t0);
+            }
+            printf("%6zu %12.1f %10.2f %12.1f %12.1f %10.2f\n", k, guess,
+                   (double) tries / NUM_QUERIES,
+                   (double) guess_ns / NUM_QUERIES,
+                   (double) knn_ns / NUM_QUERIES, (double) guess_ns / knn_ns);
+        }
+    }
+    index->destroy_iteration_buffer(acc);
+    delete index;
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Overlapping pairs tick after tick while objects jitter: updating the
+// index and sweeping it anew each tick (find_pairs), vs. an index that
+// keeps a PairTracker up to date and reports only what changed. Then the
+// cost of despawning objects from the tracker.
+
+#include <math.h>
+#include <stdio.h>
+#include "../pair_tracker.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 100000;
+constexpr float WORLD = 1000.0f;
+constexpr float HALF_SIZE = 1.0f;
+constexpr int TICKS = 20;
+
+class PlainIndex : public HitboxIndex<PlainIndex> {
+public:
+    void search_callback(HitboxIterator* iter) {}
+};
+
+class TrackedIndex : public TrackingHitboxIndex<TrackedIndex> {
+public:
+    void search_callback(HitboxIterator* iter) {}
+};
+
+struct Object {
+    float x, y;
+};
+
+static float key_of(const Object& o) {
+    return sqrtf(o.x * o.x + o.y * o.y);
+}
+
+static Hitbox box_of(const Object& o) {
+    return {o.x - HALF_SIZE, o.x + HALF_SIZE, o.y - HALF_SIZE,
+            o.y + HALF_SIZE};
+}
+
+int main() {
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    std::vector<Object> start(SIZE);
+    for (auto& o : start) {
+        o = {coord(bench_rng()), coord(bench_rng())};
+    }
+    const float R = HALF_SIZE * sqrtf(2.0f);
+
+    printf("%8s %8s %12s %12s %12s %12s\n", "moving", "step", "sweep ms",
+           "tracker ms", "speedup", "swaps");
+    for (float share : {0.01f, 0.1f, 1.0f}) {
+        for (float step : {0.05f, 0.5f}) {
+            std::vector<Object> objects = start;
+            std::vector<Hitbox> plain_boxes(SIZE), tracked_boxes(SIZE);
+            auto plain = new PlainIndex();
+            auto tracked = new TrackedIndex();
+            std::vector<float> keys(SIZE);
+            std::vector<Hitbox*> plain_ptrs(SIZE), tracked_ptrs(SIZE);
+            for (size_t i = 0; i < SIZE; i++) {
+                keys[i] = key_of(objects[i]);
+                plain_boxes[i] = tracked_boxes[i] = box_of(objects[i]);
+                plain_ptrs[i] = &(plain_boxes[i]);
+                tracked_ptrs[i] = &(tracked_boxes[i]);
+            }
+            plain->insert_batch(keys.data(), plain_ptrs.data(), SIZE);
+            tracked->insert_batch(keys.data(), tracked_ptrs.data(), SIZE);
+            PairTracker* tracker = tracked->get_pair_tracker();
+            std::vector<HitboxPair> started, stopped;
+            tracker->take_changes(&started, &stopped);
+            size_t swaps = tracker->get_num_swaps();
+
+            std::uniform_real_distribution<float> jitter(-step, step);
+            std::bernoulli_distribution moves(share);
+            uint64_t t_sweep = 0, t_tracker = 0;
+            std::vector<HitboxPair> pairs;
+            for (int tick = 0; tick < TICKS; tick++) {
+                std::vector<size_t> moved;
+                std::vector<float> old_keys;
+                for (size_t i = 0; i < SIZE; i++) {
+                    if (!moves(bench_rng()))
+                        continue;
+                    moved.push_back(i);
+                    old_keys.push_back(key_of(objects[i]));
+                    objects[i].x += jitter(bench_rng());
+                    objects[i].y += jitter(bench_rng());
+                }
+
+                uint64_t t0 = now_ns();
+                for (size_t m = 0; m < moved.size(); m++) {
+                    size_t i = moved[m];
+                    plain_boxes[i] = box_of(objects[i]);
+                    plain->update(old_keys[m], key_of(objects[i]),
+                                  &(plain_boxes[i]));
+                }
+                pairs.clear();
+                plain->find_pairs(R, &pairs);
+                t_sweep += now_ns() - t0;
+
+                t0 = now_ns();
+                for (size_t m = 0; m < moved.size(); m++) {
+                    size_t i = moved[m];
+                    tracked_boxes[i] = box_of(objects[i]);
+                    tracked->update(old_keys[m], key_of(objects[i]),
+                                    &(tracked_boxes[i]));
+                }
+                started.clear();
+                stopped.clear();
+                tracker->take_changes(&started, &stopped);
+                t_tracker += now_ns() - t0;
+            }
+            if (pairs.size() != tracker->get_num_pairs())
+                printf("pairs differ: %zu vs %zu\n", pairs.size(),
+                       tracker->get_num_pairs());
+            printf("%7.0f%% %8.2f %12.2f %12.2f %12.2f %12.0f\n",
+                   share * 100, step, t_sweep / 1e6 / TICKS,
+                   t_tracker / 1e6 / TICKS, (double) t_sweep / t_tracker,
+                   (double) (tracker->get_num_swaps() - swaps) / TICKS);
+            delete plain;
+            delete tracked;
+        }
+    }
+
+    printf("\n%8s %12s\n", "deleted", "ns/del");
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<Hitbox*> ptrs(SIZE);
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = box_of(start[i]);
+        ptrs[i] = &(boxes[i]);
+    }
+    for (float share : {0.01f, 0.1f, 0.9f}) {
+        PairTracker tracker;
+        tracker.insert_batch(ptrs.data(), SIZE);
+        std::vector<size_t> order = shuffled_indices(SIZE);
+        auto n = (size_t) (share * SIZE);
+        uint64_t t0 = now_ns();
+        for (size_t d = 0; d < n; d++) {
+            tracker.del(ptrs[order[d]]);
+        }
+        uint64_t t = now_ns() - t0;
+        printf("%7.0f%% %12.1f\n", share * 100, (double) t / n);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+// All overlapping pairs of a tick: a ball query per hitbox, testing what
+// it finds (which finds every pair twice), vs. one sweep along the leaves
+// with find_pairs, on one thread and on a pool.
+
+#include <math.h>
+#include <stdio.h>
+#include <thread>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 200000;
+constexpr float WORLD = 2000.0f;
+constexpr float HALF_SIZE = 1.0f;
+constexpr int REPEATS = 3;
+
+class PairingIndex : public HitboxIndex<PairingIndex> {
+public:
+    Hitbox* query = nullptr;
+    std::vector<HitboxPair> pairs;
+
+    void search_callback(HitboxIterator* iter) {
+        const Hitbox& l = *(this->query);
+        while (iter->has_next()) {
+            Hitbox* hb = iter->next();
+            const Hitbox& r = *hb;
+            // (each pair once, as the sweep reports it)
+            if (hb > this->query && l.a1 <= r.b1 && r.a1 <= l.b1
+                && l.a2 <= r.b2 && r.a2 <= l.b2)
+                this->pairs.push_back({this->query, hb});
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    auto index = new PairingIndex();
+    for (size_t i = 0; i < SIZE; i++) {
+        float x = coord(bench_rng()), y = coord(bench_rng());
+        boxes[i] = {x - HALF_SIZE, x + HALF_SIZE, y - HALF_SIZE,
+                    y + HALF_SIZE};
+        keys[i] = sqrtf(x * x + y * y);
+    }
+    for (size_t i : shuffled_indices(SIZE)) {
+        index->insert(keys[i], &(boxes[i]));
+    }
+    const float R = HALF_SIZE * sqrtf(2.0f);
+
+    uint64_t best[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+    size_t found[3] = {0, 0, 0};
+    auto acc = index->make_iteration_buffer();
+    size_t num_threads = std::max(2u, std::thread::hardware_concurrency());
+    QueryPool pool(num_threads);
+    for (int r = 0; r < REPEATS; r++) {
+        index->pairs.clear();
+        uint64_t t0 = now_ns();
+        for (size_t i = 0; i < SIZE; i++) {
+            index->query = &(boxes[i]);
+            index->ball_query(keys[i], R, R, acc);
+        }
+        best[0] = std::min(best[0], now_ns() - t0);
+        found[0] = index->pairs.size();
+
+        std::vector<HitboxPair> pairs;
+        t0 = now_ns();
+        index->find_pairs(R, &pairs);
+        best[1] = std::min(best[1], now_ns() - t0);
+        found[1] = pairs.size();
+
+        std::vector<std::vector<HitboxPair>> per_worker;
+        t0 = now_ns();
+        index->find_pairs(R, &pool, &per_worker);
+        best[2] = std::min(best[2], now_ns() - t0);
+        found[2] = 0;
+        for (auto& worker_pairs : per_worker) {
+            found[2] += worker_pairs.size();
+        }
+    }
+    index->destroy_iteration_buffer(acc);
+
+    const char* names[3] = {"queries", "sweep", "pool"};
+    printf("%10s %10s %12s %12s\n", "method", "pairs", "ms", "speedup");
+    for (int m = 0; m < 3; m++) {
+        printf("%10s %10zu %12.2f %12.2f\n", names[m], found[m],
+               best[m] / 1e6, (double) best[0] / best[m]);
+    }
+    printf("(pool: %zu threads on %u cores)\n", num_threads,
+           std::thread::hardware_concurrency());
+    delete index;
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Ball queries in a 2D world: the single-key index, which searches the
+// whole ring of magnitudes, vs. the polar index with a few numbers of
+// sectors. Objects are spread uniformly or in clusters, and each query is
+// centered on an object.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "../hitbox.hpp"
+#include "../polar_hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 20000;
+constexpr float WORLD = 10000.0f;
+constexpr size_t NUM_CLUSTERS = 50;
+constexpr float CLUSTER_SIZE = 300.0f;
+constexpr float RAD = 50.0f;
+constexpr float R = 2.0f;
+constexpr int REPEATS = 3;
+
+struct Point {
+    float x, y;
+};
+
+class RingIndex : public HitboxIndex<RingIndex> {
+public:
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+class SectorIndex : public PolarHitboxIndex<SectorIndex> {
+public:
+    using PolarHitboxIndex::PolarHitboxIndex;
+
+    size_t candidates = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->candidates++;
+        }
+    }
+};
+
+static std::vector<Point> make_points(const char* distribution) {
+    std::vector<Point> points(SIZE);
+    std::uniform_real_distribution<float> coord(-WORLD, WORLD);
+    if (strcmp(distribution, "uniform") == 0) {
+        for (auto& p : points) {
+            p = {coord(bench_rng()), coord(bench_rng())};
+        }
+        return points;
+    }
+    std::vector<Point> centers(NUM_CLUSTERS);
+    for (auto& c : centers) {
+        c = {coord(bench_rng()), coord(bench_rng())};
+    }
+    std::normal_distribution<float> spread(0.0f, CLUSTER_SIZE);
+    std::uniform_int_distribution<size_t> pick(0, NUM_CLUSTERS - 1);
+    for (auto& p : points) {
+        Point c = centers[pick(bench_rng())];
+        p = {c.x + spread(bench_rng()), c.y + spread(bench_rng())};
+    }
+    return points;
+}
+
+template<class Query>
+static uint64_t time_queries(Query query) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        query();
+        best = std::min(best, now_ns() - t0);
+    }
+    return best;
+}
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    printf("%10s %10s %12s %12s %12s\n", "points", "sectors", "candidates",
+           "ns/query", "speedup");
+    for (const char* distribution : {"uniform", "clustered"}) {
+        std::vector<Point> points = make_points(distribution);
+        std::vector<Point> queries(NUM_QUERIES);
+        std::uniform_int_distribution<size_t> pick(0, SIZE - 1);
+        for (auto& q : queries) {
+            q = points[pick(bench_rng())];
+        }
+
+        auto ring = new RingIndex();
+        for (size_t i : shuffled_indices(SIZE)) {
+            float x = points[i].x, y = points[i].y;
+            ring->insert(sqrtf(x * x + y * y), &(boxes[i]));
+        }
+        auto acc = ring->make_iteration_buffer();
+        uint64_t base = time_queries([&]() {
+            for (auto& q : queries) {
+                ring->ball_query(sqrtf(q.x * q.x + q.y * q.y), RAD, R, acc);
+            }
+        });
+        printf("%10s %10s %12.1f %12.1f %12.2f\n", distribution, "-",
+               (double) ring->candidates / (REPEATS * NUM_QUERIES),
+               (double) base / NUM_QUERIES, 1.0);
+        ring->destroy_iteration_buffer(acc);
+        delete ring;
+
+        for (size_t num_sectors : {16, 64, 256, 1024}) {
+            auto polar = new SectorIndex(num_sectors);
+            for (size_t i : shuffled_indices(SIZE)) {
+                polar->insert(points[i].x, points[i].y, &(boxes[i]));
+            }
+            auto polar_acc = polar->make_iteration_buffer();
+            uint64_t t = time_queries([&]() {
+                for (auto& q : queries) {
+                    polar->ball_query(q.x, q.y, RAD, R, polar_acc);
+                }
+            });
+            printf("%10s %10zu %12.1f %12.1f %12.2f\n", distribution,
+                   num_sectors,
+                   (double) polar->candidates / (REPEATS * NUM_QUERIES),
+                   (double) t / NUM_QUERIES, (double) base / t);
+            polar->destroy_iteration_buffer(polar_acc);
+            delete polar;
+        }
+    }
+    return 0;
+}
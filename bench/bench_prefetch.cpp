@@ -0,0 +1,78 @@
+// Wide range scans with leaf prefetching, on an index larger than the LLC.
+//
+// The index is built by random inserts, so neighboring leaves are scattered
+// over the node slabs, and the hitboxes are laid out in random key order.
+// Each query is a ball query whose annulus holds ~2000 keys; the callback
+// reads every hitbox it gets. Distance 0 is the plain leaf scan.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 8000000;
+constexpr size_t NUM_QUERIES = 2000;
+constexpr float HALF_WIDTH = 1000.0f;
+constexpr int REPEATS = 5;
+
+class ReadingIndex : public HitboxIndex<ReadingIndex> {
+public:
+    size_t count = 0;
+    float sum = 0.0f;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            this->sum += iter->next()->a1;
+            this->count++;
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<size_t> placement = shuffled_indices(SIZE);
+    auto index = new ReadingIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        Hitbox* hb = &(boxes[placement[i]]);
+        hb->a1 = (float) i;
+        index->insert((float) i, hb);
+    }
+    printf("%zu hitboxes, %zu MiB of nodes\n", SIZE,
+           index->get_node_bytes() >> 20);
+
+    std::vector<BallQuery> queries(NUM_QUERIES);
+    std::uniform_real_distribution<float> pick(HALF_WIDTH,
+                                               SIZE - HALF_WIDTH);
+    for (auto& q : queries) {
+        q = {pick(bench_rng()), HALF_WIDTH / 2, HALF_WIDTH / 2};
+    }
+
+    // Rounds go through all distances in turn, so that drift in the
+    // machine's load affects them alike
+    const size_t distances[] = {0, 1, 2, 4, 8, 16, 32};
+    constexpr size_t NUM_DISTANCES = sizeof(distances) / sizeof(distances[0]);
+    std::vector<uint64_t> best(NUM_DISTANCES, UINT64_MAX);
+    size_t hits = 0;
+    auto acc = index->make_iteration_buffer();
+    for (int r = 0; r < REPEATS; r++) {
+        for (size_t d = 0; d < NUM_DISTANCES; d++) {
+            index->set_prefetch_distance(distances[d]);
+            index->count = 0;
+            uint64_t t0 = now_ns();
+            for (auto& q : queries) {
+                index->ball_query(q.mag, q.rad, q.R, acc);
+            }
+            best[d] = std::min(best[d], now_ns() - t0);
+            hits = index->count;
+        }
+    }
+
+    printf("%10s %12s %12s\n", "distance", "ns/hit", "speedup");
+    for (size_t d = 0; d < NUM_DISTANCES; d++) {
+        printf("%10zu %12.2f %12.2f\n", distances[d],
+               (double) best[d] / hits, (double) best[0] / best[d]);
+    }
+    do_not_optimize(index->sum);
+    index->destroy_iteration_buffer(acc);
+    delete index;
+    return 0;
+}
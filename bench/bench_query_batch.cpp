@@ -0,0 +1,79 @@
+// Query batch throughput vs. worker threads on a read-only index.
+//
+// "loop" runs the queries one by one on one thread; "batch" hands them to
+// query_batch with a pool of the given size. The hits of each query are
+// counted in batch_callback.
+
+#include <stdio.h>
+#include <thread>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 1000000;
+constexpr int REPEATS = 3;
+
+class CountingIndex : public HitboxIndex<CountingIndex> {
+public:
+    std::vector<size_t> counts;  // per query
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->counts[0]++;
+        }
+    }
+
+    void batch_callback(size_t query, HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->counts[query]++;
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new CountingIndex();
+    for (size_t i : shuffled_indices(SIZE)) {
+        index->insert((float) i, &(boxes[i]));
+    }
+
+    std::vector<BallQuery> queries(NUM_QUERIES);
+    std::uniform_real_distribution<float> pick(0.0f, (float) SIZE);
+    for (auto& q : queries) {
+        q = {pick(bench_rng()), 4.0f, 4.0f};
+    }
+    index->counts.assign(NUM_QUERIES, 0);
+
+    uint64_t best = UINT64_MAX;
+    auto acc = index->make_iteration_buffer();
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        for (auto& q : queries) {
+            index->ball_query(q.mag, q.rad, q.R, acc);
+        }
+        best = std::min(best, now_ns() - t0);
+    }
+    index->destroy_iteration_buffer(acc);
+    double loop_rate = NUM_QUERIES / (best * 1e-9);
+    printf("%8s %16s %10s\n", "workers", "queries/s", "speedup");
+    printf("%8s %16.0f %10s\n", "loop", loop_rate, "1.00");
+
+    size_t max_workers = std::thread::hardware_concurrency();
+    if (max_workers < 2)
+        max_workers = 2;
+    for (size_t workers = 1; workers <= max_workers; workers *= 2) {
+        QueryPool pool(workers);
+        best = UINT64_MAX;
+        for (int r = 0; r < REPEATS; r++) {
+            uint64_t t0 = now_ns();
+            index->query_batch(queries.data(), NUM_QUERIES, &pool);
+            best = std::min(best, now_ns() - t0);
+        }
+        double rate = NUM_QUERIES / (best * 1e-9);
+        printf("%8zu %16.0f %10.2f\n", workers, rate, rate / loop_rate);
+    }
+    delete index;
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Many hitboxes under one key, as when a level places them all on the same
+// ring: inserting them, moving them out of the set and back with update,
+// deleting them in random order, and iterating the set, by set size. Sets
+// below SET_INDEX_MIN_SIZE are searched linearly, bigger ones by their
+// index.
+
+#include <math.h>
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t TOTAL = 1 << 18;
+constexpr int REPEATS = 3;
+
+class CountingIndex : public HitboxIndex<CountingIndex> {
+public:
+    size_t count = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            do_not_optimize(iter->next());
+            this->count++;
+        }
+    }
+};
+
+int main() {
+    // The same number of hitboxes for each set size, spread over as many
+    // keys as there are sets
+    std::vector<Hitbox> boxes(TOTAL);
+    for (size_t i = 0; i < TOTAL; i++) {
+        boxes[i] = {(float) i, (float) i + 1, 0.0f, 1.0f};
+    }
+
+    printf("%10s %12s %12s %12s %12s\n", "set size", "ns/insert",
+           "ns/update", "ns/del", "ns/hitbox");
+    auto index = new CountingIndex();
+    auto acc = index->make_iteration_buffer();
+    for (size_t size : {4, 16, 64, 256, 4096, 65536}) {
+        size_t num_sets = TOTAL / size;
+        std::vector<size_t> order = shuffled_indices(TOTAL);
+        uint64_t insert_ns = UINT64_MAX, update_ns = UINT64_MAX,
+                 del_ns = UINT64_MAX, iter_ns = UINT64_MAX;
+        for (int r = 0; r < REPEATS; r++) {
+            index->clear();
+            uint64_t t0 = now_ns();
+            for (size_t i : order) {
+                index->insert((float) (i % num_sets), &(boxes[i]));
+            }
+            insert_ns = std::min(insert_ns, now_ns() - t0);
+
+            // Out to a key of its own and back into its set
+            t0 = now_ns();
+            for (size_t i : order) {
+                float key = (float) (i % num_sets);
+                index->update(key, -1.0f - i, &(boxes[i]));
+                index->update(-1.0f - i, key, &(boxes[i]));
+            }
+            update_ns = std::min(update_ns, now_ns() - t0);
+
+            index->count = 0;
+            t0 = now_ns();
+            index->range_search(-INFINITY, INFINITY, acc);
+            iter_ns = std::min(iter_ns, now_ns() - t0);
+            if (index->count != TOTAL)
+                return 1;
+
+            t0 = now_ns();
+            for (size_t i : order) {
+                index->del((float) (i % num_sets), &(boxes[i]));
+            }
+            del_ns = std::min(del_ns, now_ns() - t0);
+            if (!index->is_empty())
+                return 1;
+        }
+        printf("%10zu %12.1f %12.1f %12.1f %12.2f\n", size,
+               (double) insert_ns / TOTAL, (double) update_ns / (2 * TOTAL),
+               (double) del_ns / TOTAL, (double) iter_ns / TOTAL);
+    }
+    index->destroy_iteration_buffer(acc);
+    delete index;
+    return 0;
+}
@@ -0,0 +1,55 @@
+// update() vs. del() + insert() for objects that move a little every tick.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "bench.hpp"
+
+class NullIndex : public HitboxIndex<NullIndex> {
+public:
+    void search_callback(HitboxIterator* iter) {}
+};
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_TICKS = 5;
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    std::uniform_real_distribution<float> position(0.0f, 10000.0f);
+    std::uniform_real_distribution<float> step(-0.001f, 0.001f);
+    for (size_t i = 0; i < SIZE; i++) {
+        keys[i] = position(bench_rng());
+    }
+
+    printf("%16s %12s\n", "method", "ns/object");
+    for (int method = 0; method < 2; method++) {
+        auto index = new NullIndex();
+        std::vector<float> current = keys;
+        for (size_t i = 0; i < SIZE; i++) {
+            index->insert(current[i], &(boxes[i]));
+        }
+
+        uint64_t elapsed = 0;
+        for (size_t tick = 0; tick < NUM_TICKS; tick++) {
+            std::vector<float> next(SIZE);
+            for (size_t i = 0; i < SIZE; i++) {
+                next[i] = current[i] + step(bench_rng());
+            }
+            uint64_t t0 = now_ns();
+            for (size_t i = 0; i < SIZE; i++) {
+                if (method == 0) {
+                    index->update(current[i], next[i], &(boxes[i]));
+                } else {
+                    index->del(current[i], &(boxes[i]));
+                    index->insert(next[i], &(boxes[i]));
+                }
+            }
+            elapsed += now_ns() - t0;
+            current.swap(next);
+        }
+        printf("%16s %12.1f\n", method == 0 ? "update" : "del + insert",
+               (double) elapsed / (SIZE * NUM_TICKS));
+        delete index;
+    }
+    return 0;
+}
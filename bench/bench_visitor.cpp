@@ -0,0 +1,82 @@
+// Ball queries through the CRTP index (virtual callback, HitboxIterator)
+// vs. the statically dispatched one (visitor inlined into the leaf scan).
+// The visitor does what a broad phase would: count the hitboxes whose
+// interval [a1, b1] contains the query point.
+
+#include <stdio.h>
+#include "../hitbox.hpp"
+#include "../static_hitbox.hpp"
+#include "bench.hpp"
+
+constexpr size_t SIZE = 1000000;
+constexpr size_t NUM_QUERIES = 200000;
+constexpr int REPEATS = 5;
+
+class CountingIndex : public HitboxIndex<CountingIndex> {
+public:
+    float point = 0.0f;
+    size_t count = 0;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            Hitbox* hb = iter->next();
+            this->count += (hb->a1 <= this->point) & (this->point <= hb->b1);
+        }
+    }
+};
+
+int main() {
+    std::vector<Hitbox> boxes(SIZE);
+    auto crtp = new CountingIndex();
+    auto visiting = new StaticHitboxIndex<>();
+    std::vector<float> keys(SIZE);
+    for (size_t i : shuffled_indices(SIZE)) {
+        // a quarter of the hitboxes are in sets of four
+        keys[i] = (float) (i - (i % 16 < 4 ? i % 16 : 0));
+        boxes[i] = {(float) i - 2.0f, (float) i + 2.0f, 0.0f, 0.0f};
+        crtp->insert(keys[i], &(boxes[i]));
+        visiting->insert(keys[i], &(boxes[i]));
+    }
+    std::uniform_real_distribution<float> pick(0.0f, SIZE);
+    std::vector<float> points(NUM_QUERIES);
+    for (auto& p : points) {
+        p = pick(bench_rng());
+    }
+
+    printf("%10s %12s %12s %12s\n", "radius", "crtp ns", "visitor ns",
+           "speedup");
+    auto acc = crtp->make_iteration_buffer();
+    for (float rad : {1.0f, 8.0f, 64.0f, 512.0f}) {
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        size_t counts[2] = {0, 0};
+        for (int r = 0; r < REPEATS; r++) {
+            crtp->count = 0;
+            uint64_t t0 = now_ns();
+            for (float p : points) {
+                crtp->point = p;
+                crtp->ball_query(p, rad, 0.0f, acc);
+            }
+            best[0] = std::min(best[0], now_ns() - t0);
+            counts[0] = crtp->count;
+
+            size_t count = 0;
+            t0 = now_ns();
+            for (float p : points) {
+                visiting->ball_query(p, rad, 0.0f, [&](Hitbox* hb) {
+                    count += (hb->a1 <= p) & (p <= hb->b1);
+                });
+            }
+            best[1] = std::min(best[1], now_ns() - t0);
+            counts[1] = count;
+        }
+        if (counts[0] != counts[1])
+            printf("counts differ: %zu vs %zu\n", counts[0], counts[1]);
+        printf("%10.0f %12.1f %12.1f %12.2f\n", rad,
+               (double) best[0] / NUM_QUERIES, (double) best[1] / NUM_QUERIES,
+               (double) best[0] / best[1]);
+    }
+    crtp->destroy_iteration_buffer(acc);
+    delete crtp;
+    delete visiting;
+    return 0;
+}
@@ -1,52 +1,314 @@
+#include <float.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <math.h>
 #include <string.h>
 #include <limits>
 #include <stdexcept>
+#include <string>
 #include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <new>
+#include <vector>
 #include "bptree.hpp"
+#include "bptree_node.hpp"
+#include "epoch.hpp"
+#include "keysearch.hpp"
 
-constexpr size_t MAX_WEIGHT = 20;
-constexpr size_t MIN_WEIGHT = MAX_WEIGHT / 2 - 1;
-constexpr size_t BUFFER_SIZE = 80;
-
-
-struct alignas(64) BaseBPTree::Node {
-    union {
-        BaseBPTree::Node* next;
-        size_t index_of_next;
-    };
-    float keys[MAX_WEIGHT];
-    union {
-        void* p;
-        BaseBPTree::Node* b;
-        size_t i;
-    } values[MAX_WEIGHT + 1];
+static_assert(std::numeric_limits<float>::is_iec559, "need IEEE 754");
+
+// A saved tree (see save_p) is laid out as
+//
+//     MappedHeader | MappedNode... | records... | keys...
+//
+// with each part starting at a multiple of 64 bytes. The keys of all
+// records are there only if the leaves hold packed keys. Numbers are stored
+// in the byte order of the machine that saved the tree.
+struct MappedHeader {
+    char magic[8];
+    uint32_t fanout;
+    uint32_t record_size;
+    uint64_t num_records;
+    uint64_t num_nodes;
+    uint64_t nodes_offset;
+    uint64_t records_offset;
+    uint64_t keys_offset;  // 0 without packed leaves
+    uint32_t root;         // NO_NODE if there are no records
+    uint32_t leaf_keys;    // a LeafKeys
 };
 
-using BPTreeNode = BaseBPTree::Node;
-static_assert(struct_size_is_appropriate<BPTreeNode>());
-static_assert(std::numeric_limits<float>::is_iec559, "need IEEE 754");
+constexpr char MAPPED_MAGIC[8] = {'B', 'P', 'T', 'R', 'E', 'E', '0', '1'};
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+template<size_t Fanout>
+struct alignas(64) MappedNode {
+    // BPTreeNode as saved: nodes are numbered in the file. The records of a
+    // leaf are first, first + 1, ... in the order of its keys, and `next` is
+    // the number of the next leaf (NO_NODE after the last one). An internal
+    // node has `next` set to its own number.
+    uint32_t next;
+    uint32_t first;
+    float keys[Fanout];
+    uint32_t children[Fanout + 1];
+};
 
-static BPTreeNode* make_bptree_node() {
-    BPTreeNode* result = new BPTreeNode();
+template<size_t Fanout, class Delta>
+struct alignas(64) MappedPackedLeaf {
+    // A leaf of a tree saved with packed keys, in the space of a MappedNode.
+    // Key i is stored as the step deltas[i] on a scale from `base` (the
+    // smallest key) to `last` (the largest). Steps are rounded down, so
+    // they are in the order of the keys; keys that share a step with a
+    // search bound are compared exactly, as found in the keys part.
+    static constexpr size_t HEADER_SIZE = 6 * sizeof(uint32_t);
+    static constexpr size_t CAPACITY =
+        (sizeof(MappedNode<Fanout>) - HEADER_SIZE) / sizeof(Delta);
+
+    uint32_t next;
+    uint32_t first;
+    uint32_t weight;
+    float base, last;
+    float scale;  // steps per unit of key; 0 puts all keys in step 0
+    Delta deltas[CAPACITY];
+};
+
+template<class Delta>
+static Delta quantize_key(float key, float base, float scale) {
+    // The step of `key`, clamped to the steps there are. Never decreases as
+    // `key` grows, which is all that searches rely on.
+    constexpr float top = std::numeric_limits<Delta>::max();
+    float step = (key - base) * scale;
+    if (!(step >= 0.0f))
+        return 0;
+    if (step >= top)
+        return std::numeric_limits<Delta>::max();
+    return (Delta) step;
+}
+
+template<size_t Fanout, class Delta>
+static MappedNode<Fanout> make_packed_leaf(const float* keys, size_t weight,
+                                           uint32_t first, uint32_t next) {
+    // A leaf with packed keys[0, weight), stored as a MappedNode. Unused
+    // steps are the largest one, so that they never count as less than a
+    // search bound.
+    static_assert(sizeof(MappedPackedLeaf<Fanout, Delta>)
+                  == sizeof(MappedNode<Fanout>));
+    MappedPackedLeaf<Fanout, Delta> leaf;
+    memset(&leaf, 0, sizeof(leaf));
+    leaf.next = next;
+    leaf.first = first;
+    leaf.weight = weight;
+    leaf.base = keys[0];
+    leaf.last = keys[weight - 1];
+    float scale = std::numeric_limits<Delta>::max() / (leaf.last - leaf.base);
+    leaf.scale = isfinite(scale) ? scale : 0.0f;
+    for (size_t x = 0; x < leaf.CAPACITY; x++) {
+        leaf.deltas[x] = (x < weight)
+            ? quantize_key<Delta>(keys[x], leaf.base, leaf.scale)
+            : std::numeric_limits<Delta>::max();
+    }
+    MappedNode<Fanout> node;
+    memcpy(&node, &leaf, sizeof(node));
+    return node;
+}
+
+template<size_t Fanout, class Delta>
+static size_t count_packed_keys(const MappedPackedLeaf<Fanout, Delta>* leaf,
+                                const float* exact, float key,
+                                bool or_equal) {
+    // The number of keys in `leaf` that are less than `key` (or equal, if
+    // `or_equal`). `exact` has the exact keys of all records.
+    if (key < leaf->base)
+        return 0;
+    if (key > leaf->last || (or_equal && key == leaf->last))
+        return leaf->weight;
+    Delta step = quantize_key<Delta>(key, leaf->base, leaf->scale);
+    size_t i = 0;
+    for (size_t x = 0; x < leaf->CAPACITY; x++) {
+        i += leaf->deltas[x] < step;
+    }
+    // Keys in the step of `key` itself may be on either side of it
+    const float* keys = exact + leaf->first;
+    while (i < leaf->weight && leaf->deltas[i] == step
+           && (keys[i] < key || (or_equal && keys[i] == key))) {
+        i++;
+    }
+    return i;
+}
+
+static const MappedHeader* get_mapped_header(const MappedFile* file) {
+    return reinterpret_cast<const MappedHeader*>(file->get_data());
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* make_bptree_node(SlabPool* pool,
+                                                uint32_t version) {
+    auto result = new (pool->allocate()) BPTreeNode<MAX_WEIGHT>();
     for (size_t i = 0; i < MAX_WEIGHT; i++) {
         result->keys[i] = INFINITY;
         result->values[i].p = nullptr;
     }
     result->values[MAX_WEIGHT].p = nullptr;
     result->next = nullptr;
+    result->version.store(version, std::memory_order_relaxed);
+    result->prev = nullptr;
     return result;
 }
 
+template<size_t MAX_WEIGHT>
+struct BPTreeWriter {
+    // What the modifying paths need besides the nodes themselves
+    SlabPool* pool;
+    // Thread-safe mode only (otherwise null): the nodes latched by the
+    // current operation, and where unlinked nodes are retired to
+    std::vector<BPTreeNode<MAX_WEIGHT>*>* latched;
+    EpochManager* epochs;
+    // The version of new nodes
+    uint32_t version;
+    // Only while snapshots may see the tree (otherwise null): where copied
+    // nodes are retired to
+    SnapshotManager* snapshots;
+    bool* links_stale;
+};
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* make_node(BPTreeWriter<MAX_WEIGHT>* w) {
+    return make_bptree_node<MAX_WEIGHT>(w->pool, w->version);
+}
 
-class BaseBPTree::Acc {
+template<size_t MAX_WEIGHT>
+static void link_leaf(BPTreeWriter<MAX_WEIGHT>* w,
+                      BPTreeNode<MAX_WEIGHT>* leaf,
+                      BPTreeNode<MAX_WEIGHT>* next) {
+    // While the leaf links are stale, any of them may point to a node that
+    // was recycled since, maybe into `leaf` itself (which would then look
+    // like an internal node). No links are made until they are rebuilt.
+    bool stale = w->links_stale != nullptr && *(w->links_stale);
+    leaf->next = stale ? nullptr : next;
+    // (searches that may run meanwhile never read the back links)
+    if (!stale && next != nullptr)
+        next->prev = leaf;
+}
+
+template<size_t MAX_WEIGHT>
+static void latch(BPTreeWriter<MAX_WEIGHT>* w, BPTreeNode<MAX_WEIGHT>* node) {
+    // Make the version odd before the first change to a node that readers
+    // can reach. All latches are released together by unlatch_all at the
+    // end of the operation, so a child that was split or merged stays
+    // latched until its parent has caught up.
+    //
+    // New nodes need no latch: readers only find them through latched ones.
+
+    if (w->epochs == nullptr)
+        return;
+    uint32_t v = node->version.load(std::memory_order_relaxed);
+    if (v & 1)
+        return;  // already latched
+    node->version.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    w->latched->push_back(node);
+}
+
+template<size_t MAX_WEIGHT>
+static void unlatch_all(BPTreeWriter<MAX_WEIGHT>* w) {
+    if (w->epochs == nullptr)
+        return;
+    for (auto node : *(w->latched)) {
+        uint32_t v = node->version.load(std::memory_order_relaxed);
+        node->version.store(v + 1, std::memory_order_release);
+    }
+    w->latched->clear();
+}
+
+template<size_t MAX_WEIGHT>
+static void retire_node(BPTreeWriter<MAX_WEIGHT>* w,
+                        BPTreeNode<MAX_WEIGHT>* node) {
+    // Recycle a node that was unlinked from the tree
+
+    if (w->snapshots != nullptr) {
+        w->snapshots->retire(node, w->pool, node->version.load());
+        return;
+    }
+    if (w->epochs == nullptr) {
+        w->pool->release(node);
+        return;
+    }
+    // the node stays latched for good
+    latch(w, node);
+    auto& latched = *(w->latched);
+    latched.erase(std::find(latched.begin(), latched.end(), node));
+    w->epochs->retire(node, w->pool);
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* own(BPTreeWriter<MAX_WEIGHT>* w,
+                                   BPTreeNode<MAX_WEIGHT>* node) {
+    // Copy-on-write: return a node that the writer may modify in place,
+    // which is `node` itself unless a snapshot can see it. The caller links
+    // the copy into the parent (which it owns already) in place of `node`.
+
+    if (w->snapshots == nullptr
+            || node->version.load() > w->snapshots->get_newest())
+        return node;
+    auto copy = make_node(w);
+    memcpy(copy->keys, node->keys, sizeof(node->keys));
+    memcpy(copy->values, node->values, sizeof(node->values));
+    if (node->next == node) {
+        copy->next = copy;  // mark as internal node
+    } else {
+        // the left sibling still links to the original
+        *(w->links_stale) = true;
+        link_leaf(w, copy, node->next);
+    }
+    retire_node(w, node);
+    return copy;
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* own_root(BPTreeWriter<MAX_WEIGHT>* w,
+        std::atomic<BPTreeNode<MAX_WEIGHT>*>* root) {
+    auto curr = root->load(std::memory_order_relaxed);
+    auto owned = own(w, curr);
+    if (owned != curr)
+        root->store(owned, std::memory_order_relaxed);
+    return owned;
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* own_child(BPTreeWriter<MAX_WEIGHT>* w,
+                                         BPTreeNode<MAX_WEIGHT>* parent,
+                                         size_t i) {
+    // (the parent must be owned)
+    auto owned = own(w, parent->values[i].b);
+    parent->values[i].b = owned;
+    return owned;
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* own_path(BPTreeWriter<MAX_WEIGHT>* w,
+        std::atomic<BPTreeNode<MAX_WEIGHT>*>* root, float key) {
+    // find_leaf, owning every node on the way
+    auto curr = own_root(w, root);
+    while (curr->next == curr) {
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, key);
+        curr = own_child(w, curr, i);
+    }
+    return curr;
+}
+
+
+template<size_t F, size_t B>
+class BasicBPTree<F, B>::Acc {
 public:
-    Acc(BaseBPTree* parent) {
+    Acc(BasicBPTree* parent, ResultSink* sink) {
         this->parent = parent;
+        this->sink = sink;
         this->size = 0;
+        parent->epochs.add_slot(&(this->slot));
+    }
+    ~Acc() {
+        this->parent->epochs.remove_slot(&(this->slot));
     }
-    ~Acc() = default;
 
     void put(void* item) {
         this->buffer[this->size] = item;
@@ -55,79 +317,650 @@ public:
 
     void ensure_space() {
         if (this->size > BUFFER_SIZE - MAX_WEIGHT) {
-            this->parent->callback(this->buffer, this->size);
+            this->sink->callback(this->buffer, this->size);
             this->size = 0;
         }
     }
 
     void flush() {
         if (this->size > 0) {
-            this->parent->callback(this->buffer, this->size);
+            this->sink->callback(this->buffer, this->size);
             this->size = 0;
         }
     }
 
+    // Optimistic reads put values first and take them back if the node
+    // turns out to have changed meanwhile
+    size_t get_size() {
+        return this->size;
+    }
+
+    void rollback(size_t size) {
+        this->size = size;
+    }
+
+    // The epoch of the thread that uses this buffer
+    EpochSlot slot;
+
 private:
-    BaseBPTree* parent;
+    BasicBPTree* parent;
+    ResultSink* sink;
     size_t size;
     void* buffer[BUFFER_SIZE];
 };
 
 
-BaseBPTree::BaseBPTree() {
-    this->root = make_bptree_node();
+template<size_t F, size_t B>
+BasicBPTree<F, B>::BasicBPTree() : node_pool(sizeof(Node)) {
+    // Layout checks: keys follow the `next` pointer, and the values fill
+    // the node up to (less than) one cache line of padding
+    static_assert(struct_size_is_appropriate<Node>());
+    static_assert(offsetof(Node, keys) == sizeof(void*));
+    static_assert(sizeof(Node) - sizeof(Node::values) - offsetof(Node, values)
+                  < 64, "fanout leaves a whole cache line unused");
+
+    this->root.store(make_bptree_node<MAX_WEIGHT>(
+        &(this->node_pool), this->snapshots.get_generation()));
+    this->thread_safe = false;
+    this->links_stale = false;
+    this->prefetch_distance = 0;
+}
+
+template<size_t F, size_t B>
+BasicBPTree<F, B>::~BasicBPTree() {
+    // Nothing to do: the nodes are released in bulk with `node_pool`
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::clear() {
+    // Drop every node at once. The slabs are kept for the next rebuild.
+    //
+    // In thread-safe mode, readers may still be in the old nodes: unlink
+    // them, and wait for the readers to leave. Objects that are waiting to
+    // be reclaimed are dropped as well, so derived classes have to clear the
+    // pools that they retired objects to.
+    //
+    // While there are snapshots, the nodes are retired one by one instead,
+    // and derived classes have to do the same with their objects.
+
+    if (this->mapped.is_open()) {
+        // the nodes were cleared when the file was mapped
+        this->mapped.close();
+        return;
+    }
+    if (this->thread_safe) {
+        this->root.store(nullptr);
+        this->epochs.synchronize();
+        this->epochs.forget_retired();
+    }
+    auto w = this->start_write();
+    if (w.snapshots != nullptr)
+        retire_subtree(&w, this->root.load(std::memory_order_relaxed));
+    else
+        this->node_pool.clear();
+    this->root.store(make_node(&w), std::memory_order_release);
+    this->links_stale = false;
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::set_thread_safe(bool thread_safe) {
+    // The version of a node means something else in either mode, so all
+    // of them are reset
+    if (thread_safe == this->thread_safe)
+        return;
+    this->snapshots.collect();
+    if (this->snapshots.has_snapshots())
+        throw std::logic_error("release the snapshots before switching");
+    if (!thread_safe) {
+        // nobody is reading anymore; reclaim what is left
+        this->epochs.synchronize();
+        this->epochs.collect();
+    }
+    // (optimistic readers need even versions, and the leaf links)
+    this->reset_nodes(thread_safe ? 0 : this->snapshots.get_generation());
+    this->thread_safe = thread_safe;
+}
+
+template<size_t F, size_t B>
+Snapshot* BasicBPTree<F, B>::snapshot() {
+    auto lock = this->lock_for_writing();
+    if (this->thread_safe)
+        throw std::logic_error("snapshots are not for thread-safe mode");
+    this->snapshots.collect();
+    return this->snapshots.take(this->root.load(std::memory_order_relaxed));
+}
+
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::is_mapped() {
+    return this->mapped.is_open();
+}
+
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::has_snapshots() {
+    return this->snapshots.has_snapshots();
+}
+
+template<size_t F, size_t B>
+uint32_t BasicBPTree<F, B>::get_generation() {
+    return this->snapshots.get_generation();
+}
+
+template<size_t F, size_t B>
+uint32_t BasicBPTree<F, B>::get_newest_snapshot() {
+    return this->snapshots.get_newest();
+}
+
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::values_are_shared() {
+    return this->thread_safe || this->snapshots.has_snapshots();
+}
+
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::is_thread_safe() {
+    return this->thread_safe;
+}
+
+template<size_t F, size_t B>
+std::unique_lock<std::recursive_mutex> BasicBPTree<F, B>::lock_for_writing() {
+    if (this->mapped.is_open())
+        throw std::logic_error("the tree is mapped read-only");
+    std::unique_lock<std::recursive_mutex> lock(this->write_mutex,
+                                                std::defer_lock);
+    if (this->thread_safe)
+        lock.lock();
+    return lock;
 }
 
-BaseBPTree::~BaseBPTree() {
-    // not implemented
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::retire(void* object, SlabPool* pool) {
+    if (this->thread_safe)
+        this->epochs.retire(object, pool);
+    else
+        this->snapshots.retire(object, pool, 0);
+}
+
+template<size_t F, size_t B>
+BPTreeWriter<F> BasicBPTree<F, B>::start_write() {
+    if (this->mapped.is_open())
+        throw std::logic_error("the tree is mapped read-only");
+    // In thread-safe mode, the caller holds the writer lock
+    if (this->thread_safe)
+        return {&(this->node_pool), &(this->latched), &(this->epochs), 0,
+                nullptr, nullptr};
+
+    this->snapshots.collect();
+    if (this->links_stale && !this->snapshots.has_snapshots()) {
+        // the last snapshot is gone; link the leaves up again
+        this->reset_nodes(this->snapshots.get_generation());
+    }
+    SnapshotManager* snapshots = this->snapshots.has_snapshots()
+        ? &(this->snapshots)
+        : nullptr;
+    return {&(this->node_pool), &(this->latched), nullptr,
+            this->snapshots.get_generation(), snapshots, &(this->links_stale)};
 }
 
-BaseBPTree::Acc* BaseBPTree::make_iteration_buffer() {
-    return new BaseBPTree::Acc(this);
+template<size_t F, size_t B>
+typename BasicBPTree<F, B>::Acc* BasicBPTree<F, B>::make_iteration_buffer(
+        ResultSink* sink) {
+    return new Acc(this, (sink != nullptr) ? sink : this);
 }
 
-void BaseBPTree::destroy_iteration_buffer(Acc* acc) {
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::destroy_iteration_buffer(Acc* acc) {
     delete acc;
 }
 
-static inline BPTreeNode* find_leaf(float key, BPTreeNode* curr) {
+template<size_t MAX_WEIGHT>
+static size_t get_node_weight(BPTreeNode<MAX_WEIGHT>* node) {
+    return count_keys_lt(node->keys, MAX_WEIGHT, INFINITY);
+}
+
+template<size_t MAX_WEIGHT>
+static void retire_subtree(BPTreeWriter<MAX_WEIGHT>* w,
+                           BPTreeNode<MAX_WEIGHT>* curr) {
+    if (curr->next == curr) {
+        size_t weight = get_node_weight(curr);
+        for (size_t c = 0; c <= weight; c++) {
+            retire_subtree(w, curr->values[c].b);
+        }
+    }
+    retire_node(w, curr);
+}
+
+template<size_t MAX_WEIGHT>
+static void collect_leaves(BPTreeNode<MAX_WEIGHT>* curr,
+                           std::vector<BPTreeNode<MAX_WEIGHT>*>* out) {
+    if (curr->next != curr) {
+        out->push_back(curr);
+        return;
+    }
+    size_t weight = get_node_weight(curr);
+    for (size_t c = 0; c <= weight; c++) {
+        collect_leaves(curr->values[c].b, out);
+    }
+}
+
+template<size_t MAX_WEIGHT>
+static void renumber_subtree(BPTreeNode<MAX_WEIGHT>* curr, uint32_t version,
+                             BPTreeNode<MAX_WEIGHT>** prev_leaf) {
+    // Set the version of every node, and link the leaves up again in order
+    // (both ways)
+    curr->version.store(version, std::memory_order_relaxed);
+    if (curr->next != curr) {
+        if (*prev_leaf != nullptr)
+            (*prev_leaf)->next = curr;
+        curr->next = nullptr;
+        curr->prev = *prev_leaf;
+        *prev_leaf = curr;
+        return;
+    }
+    size_t weight = get_node_weight(curr);
+    for (size_t c = 0; c <= weight; c++) {
+        renumber_subtree(curr->values[c].b, version, prev_leaf);
+    }
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::reset_nodes(uint32_t version) {
+    Node* prev_leaf = nullptr;
+    renumber_subtree(this->root.load(std::memory_order_relaxed), version,
+                     &prev_leaf);
+    this->links_stale = false;
+}
+
+template<size_t MAX_WEIGHT>
+static inline BPTreeNode<MAX_WEIGHT>* find_leaf(float key,
+                                                BPTreeNode<MAX_WEIGHT>* curr) {
     // Tail recursive helper method for finding the leaf node
     // The returned leaf node has keys greater than or equal to `key`
 
     while (curr != nullptr && curr->next == curr) {
-        size_t i = 0;
-        while (curr->keys[i] <= key)
-            i++;
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, key);
         curr = curr->values[i].b;
     }
     return curr;
 }
 
-void BaseBPTree::search_p(float key, BaseBPTree::Acc* out) {
+template<size_t MAX_WEIGHT>
+static inline BPTreeNode<MAX_WEIGHT>* prefetch_next_leaf(
+        BPTreeNode<MAX_WEIGHT>* leaf, float k1) {
+    // One step of the prefetching range scan: the scan is at `leaf` or
+    // behind it. Start loading the next leaf, unless the scan stops before
+    // it, and return it (nullptr at the end).
+    //
+    // `leaf` was prefetched one step earlier than its successor, so reading
+    // its link is a cache hit by the time the scan gets far enough behind.
+
+    if (leaf == nullptr || leaf->keys[0] > k1)
+        return nullptr;
+    auto next = leaf->next;
+    if (next != nullptr) {
+        auto bytes = reinterpret_cast<const char*>(next);
+        for (size_t offset = 0; offset < sizeof(*next); offset += 64) {
+            __builtin_prefetch(bytes + offset);
+        }
+    }
+    return next;
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::search_p(float key, Acc* out) {
     this->range_search_p(key, key, out);
 }
 
-void BaseBPTree::range_search_p(float k0, float k1, BaseBPTree::Acc* out) {
-    auto curr = find_leaf(k0, this->root);
-    size_t i = 0;
+template<size_t MAX_WEIGHT>
+static inline bool read_version(BPTreeNode<MAX_WEIGHT>* node, uint32_t* v) {
+    // Start an optimistic read. Returns false if a writer has the node.
+    *v = node->version.load(std::memory_order_acquire);
+    return (*v & 1) == 0;
+}
+
+template<size_t MAX_WEIGHT>
+static inline bool validate(BPTreeNode<MAX_WEIGHT>* node, uint32_t v) {
+    // Finish an optimistic read. Returns true if the node did not change
+    // since read_version, i.e. if what was read is consistent.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return node->version.load(std::memory_order_relaxed) == v;
+}
+
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* find_leaf_optimistically(
+        float key, std::atomic<BPTreeNode<MAX_WEIGHT>*>* root, uint32_t* v) {
+    // find_leaf for thread-safe mode. Uses lock coupling: the parent is
+    // validated again after the version of the child was read, so that the
+    // child was the right one at that moment. Starts over from the root if a
+    // node on the way changed.
+    //
+    // Returns the leaf and its version, or nullptr if the tree is being
+    // cleared.
+
+    for (;;) {
+        auto curr = root->load(std::memory_order_acquire);
+        if (curr == nullptr)
+            return nullptr;
+        // a latched root may be about to be replaced by a new one
+        if (!read_version(curr, v)
+                || root->load(std::memory_order_acquire) != curr) {
+            cpu_relax();
+            continue;
+        }
+
+        bool consistent = true;
+        while (curr->next == curr) {
+            size_t i = count_keys_le(curr->keys, MAX_WEIGHT, key);
+            auto child = curr->values[i].b;
+            uint32_t child_v;
+            if (!validate(curr, *v) || !read_version(child, &child_v)
+                    || !validate(curr, *v)) {
+                consistent = false;
+                break;
+            }
+            curr = child;
+            *v = child_v;
+        }
+        if (consistent)
+            return curr;
+        cpu_relax();
+    }
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::search_optimistically(float k0, float k1, Acc* out) {
+    // range_search_p for thread-safe mode
+    //
+    // The values of a leaf are put into `out` before the leaf is validated,
+    // and taken back if it changed meanwhile. The next leaf is entered with
+    // lock coupling like in find_leaf_optimistically, because keys move
+    // between siblings. Whenever a validation fails, the search starts over
+    // from the root, right after the last key that was kept.
+
+    EpochGuard guard(&(this->epochs), &(out->slot));
+    float from = k0;
+    bool after = false;  // resume after `from`, rather than at it
+    uint32_t v;
+    Node* leaf = find_leaf_optimistically(from, &(this->root), &v);
+    while (leaf != nullptr) {
+        size_t mark = out->get_size();
+        size_t lo = after
+            ? count_keys_le(leaf->keys, MAX_WEIGHT, from)
+            : count_keys_lt(leaf->keys, MAX_WEIGHT, from);
+        size_t hi = count_keys_le(leaf->keys, MAX_WEIGHT, k1);
+        for (size_t i = lo; i < hi; i++) {
+            out->put(leaf->values[i + 1].p);
+        }
+        float last = (hi > lo) ? leaf->keys[hi - 1] : from;
+        // the range ends in this leaf if it has a key beyond k1
+        bool done = hi < MAX_WEIGHT && !isinf(leaf->keys[hi]);
+        Node* next = leaf->next;
+
+        uint32_t next_v = 0;
+        bool consistent = validate(leaf, v);
+        if (consistent && !done && next != nullptr)
+            consistent = read_version(next, &next_v) && validate(leaf, v);
+        if (!consistent) {
+            out->rollback(mark);
+            cpu_relax();
+            leaf = find_leaf_optimistically(from, &(this->root), &v);
+            continue;
+        }
+
+        if (hi > lo) {
+            from = last;
+            after = true;
+        }
+        if (done || next == nullptr)
+            break;
+        out->ensure_space();
+        leaf = next;
+        v = next_v;
+    }
+    out->flush();
+}
+
+template<size_t MAX_WEIGHT, class Acc>
+static void search_subtree(BPTreeNode<MAX_WEIGHT>* curr, float k0, float k1,
+                           Acc* out) {
+    // range_search_p without the leaf links: go down into every child that
+    // overlaps [k0, k1], in order
+
+    size_t weight = get_node_weight(curr);
+    if (curr->next != curr) {
+        size_t lo = count_keys_lt(curr->keys, MAX_WEIGHT, k0);
+        size_t hi = std::min(count_keys_le(curr->keys, MAX_WEIGHT, k1), weight);
+        for (size_t i = lo; i < hi; i++) {
+            out->put(curr->values[i + 1].p);
+        }
+        out->ensure_space();
+        return;
+    }
+    size_t first = count_keys_le(curr->keys, MAX_WEIGHT, k0);
+    size_t last = std::min(count_keys_le(curr->keys, MAX_WEIGHT, k1), weight);
+    for (size_t c = first; c <= last; c++) {
+        search_subtree(curr->values[c].b, k0, k1, out);
+    }
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::range_search_p(float k0, float k1, Acc* out,
+                                       const Snapshot* snapshot) {
+    // The nodes of a snapshot never change, so nothing needs to be locked
+    // or validated
+    search_subtree(static_cast<Node*>(snapshot->get_root()), k0, k1, out);
+    out->flush();
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::range_search_p(float k0, float k1, Acc* out) {
+    // Unused keys are INFINITY, so an infinite k1 would count them as well
+    k1 = std::min(k1, FLT_MAX);
+    if (this->mapped.is_open()) {
+        this->search_mapped(k0, k1, out);
+        return;
+    }
+    if (this->thread_safe) {
+        this->search_optimistically(k0, k1, out);
+        return;
+    }
+    if (this->links_stale) {
+        search_subtree(this->root.load(std::memory_order_relaxed), k0, k1,
+                       out);
+        out->flush();
+        return;
+    }
+
+    auto curr = find_leaf(k0, this->root.load(std::memory_order_relaxed));
+    size_t distance = this->prefetch_distance;
+    Node* ahead = curr;
+    for (size_t d = 0; d < distance; d++) {
+        ahead = prefetch_next_leaf(ahead, k1);
+    }
     while (curr != nullptr && curr->keys[0] <= k1) {
         // go through a leaf node and extract keys in the range [k0, k1]
-        while (curr->keys[i] <= k1) {
-            if (curr->keys[i] >= k0)
-                out->put(curr->values[i + 1].p);
-            i++;
+        size_t lo = count_keys_lt(curr->keys, MAX_WEIGHT, k0);
+        size_t hi = count_keys_le(curr->keys, MAX_WEIGHT, k1);
+        if (distance > 0) {
+            // the callback reads what the values point to
+            for (size_t i = lo; i < hi; i++) {
+                __builtin_prefetch(curr->values[i + 1].p);
+            }
+            ahead = prefetch_next_leaf(ahead, k1);
+        }
+        for (size_t i = lo; i < hi; i++) {
+            out->put(curr->values[i + 1].p);
         }
         // go to the next sibling leaf node
         // (because we may have stopped at an INFINITY mark)
         curr = curr->next;
-        i = 0;
         out->ensure_space();
     }
     out->flush();
 }
 
-void BaseBPTree::test_if_values_are_sorted(float since) {
-    auto curr = find_leaf(since, this->root);
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* find_next_leaf(BPTreeNode<MAX_WEIGHT>* curr,
+                                              float last_key) {
+    // The leaf after the one that ends with `last_key`, found from the root
+    // `curr` instead of the leaf links, which may be stale. nullptr after
+    // the last leaf.
+
+    BPTreeNode<MAX_WEIGHT>* right = nullptr;
+    while (curr->next == curr) {
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, last_key);
+        if (i < get_node_weight(curr))
+            right = curr->values[i + 1].b;
+        curr = curr->values[i].b;
+    }
+    if (right == nullptr)
+        return nullptr;
+    while (right->next == right) {
+        right = right->values[0].b;
+    }
+    return right;
+}
+
+template<size_t MAX_WEIGHT>
+static size_t rank_mapped(const char* data, float key, bool or_equal) {
+    // The number of records of a mapped tree with keys less than `key` (or
+    // equal, if `or_equal`)
+
+    auto header = reinterpret_cast<const MappedHeader*>(data);
+    if (header->root == NO_NODE)
+        return 0;
+    auto nodes = reinterpret_cast<const MappedNode<MAX_WEIGHT>*>(
+        data + header->nodes_offset);
+    uint32_t index = header->root;
+    while (nodes[index].next == index) {
+        size_t i = or_equal ? count_keys_le(nodes[index].keys, MAX_WEIGHT, key)
+                            : count_keys_lt(nodes[index].keys, MAX_WEIGHT, key);
+        index = nodes[index].children[i];
+    }
+
+    auto exact = reinterpret_cast<const float*>(data + header->keys_offset);
+    size_t count;
+    switch ((LeafKeys) header->leaf_keys) {
+    case LeafKeys::DELTA16:
+        count = count_packed_keys(
+            reinterpret_cast<const MappedPackedLeaf<MAX_WEIGHT, uint16_t>*>(
+                &(nodes[index])), exact, key, or_equal);
+        break;
+    case LeafKeys::DELTA8:
+        count = count_packed_keys(
+            reinterpret_cast<const MappedPackedLeaf<MAX_WEIGHT, uint8_t>*>(
+                &(nodes[index])), exact, key, or_equal);
+        break;
+    default:
+        count = or_equal ? count_keys_le(nodes[index].keys, MAX_WEIGHT, key)
+                         : count_keys_lt(nodes[index].keys, MAX_WEIGHT, key);
+        break;
+    }
+    // (an infinite key counts the unused keys of the last leaf too)
+    return std::min<size_t>(nodes[index].first + count, header->num_records);
+}
+
+template<size_t F, size_t B>
+typename BasicBPTree<F, B>::Cursor BasicBPTree<F, B>::open_range_p(float k0,
+                                                                   float k1) {
+    if (this->thread_safe)
+        throw std::logic_error("cursors need the tree to themselves");
+
+    Cursor cursor;
+    cursor.leaf = nullptr;
+    cursor.index = 0;
+    cursor.k1 = k1;
+    cursor.next_record = 0;
+    cursor.end_record = 0;
+    if (this->mapped.is_open()) {
+        // Records are in key order, so the range is known up front
+        const char* data = this->mapped.get_data();
+        cursor.next_record = rank_mapped<MAX_WEIGHT>(data, k0, false);
+        cursor.end_record = std::max(cursor.next_record,
+                                     rank_mapped<MAX_WEIGHT>(data, k1, true));
+        return cursor;
+    }
+    if (k0 <= k1) {
+        cursor.leaf = find_leaf(k0, this->root.load(std::memory_order_relaxed));
+        cursor.index = count_keys_lt(cursor.leaf->keys, MAX_WEIGHT, k0);
+    }
+    return cursor;
+}
+
+template<size_t F, size_t B>
+size_t BasicBPTree<F, B>::next_batch_p(Cursor* cursor, void** out,
+                                       size_t cap) {
+    if (this->mapped.is_open()) {
+        auto header = get_mapped_header(&(this->mapped));
+        const char* records = this->mapped.get_data()
+            + header->records_offset;
+        size_t n = std::min(cap, cursor->end_record - cursor->next_record);
+        for (size_t i = 0; i < n; i++) {
+            // (the records are read-only, like the rest of the mapping)
+            out[i] = const_cast<char*>(
+                records + (cursor->next_record + i) * header->record_size);
+        }
+        cursor->next_record += n;
+        return n;
+    }
+
+    size_t n = 0;
+    while (n < cap && cursor->leaf != nullptr) {
+        Node* leaf = cursor->leaf;
+        size_t weight = get_node_weight(leaf);
+        size_t hi = std::min(count_keys_le(leaf->keys, MAX_WEIGHT, cursor->k1),
+                             weight);
+        if (cursor->index < hi) {
+            size_t count = std::min(hi - cursor->index, cap - n);
+            for (size_t i = 0; i < count; i++) {
+                out[n + i] = leaf->values[cursor->index + i + 1].p;
+            }
+            n += count;
+            cursor->index += count;
+            if (cursor->index < hi)
+                break;
+        }
+        if (hi < weight || weight == 0) {
+            // the leaf goes on past k1 (or the tree is empty)
+            cursor->leaf = nullptr;
+            break;
+        }
+        Node* next = this->links_stale
+            ? find_next_leaf(this->root.load(std::memory_order_relaxed),
+                             leaf->keys[weight - 1])
+            : leaf->next;
+        cursor->leaf = (next != nullptr && next->keys[0] <= cursor->k1)
+            ? next : nullptr;
+        cursor->index = 0;
+    }
+    return n;
+}
+
+template<size_t F, size_t B>
+typename BasicBPTree<F, B>::Node* BasicBPTree<F, B>::get_scan_root() {
+    if (this->thread_safe || this->links_stale || this->mapped.is_open())
+        return nullptr;
+    return this->root.load(std::memory_order_relaxed);
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::set_prefetch_distance(size_t leaves) {
+    this->prefetch_distance = leaves;
+}
+
+template<size_t F, size_t B>
+size_t BasicBPTree<F, B>::get_prefetch_distance() {
+    return this->prefetch_distance;
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::test_if_values_are_sorted(float since) {
+    // Follow the leaf links (checking the back links on the way), or while
+    // they are stale, list the leaves from the root
+    std::vector<Node*> leaves;
+    if (this->links_stale)
+        collect_leaves(this->root.load(), &leaves);
+    auto curr = find_leaf(since, this->root.load());
+    auto it = std::find(leaves.begin(), leaves.end(), curr);
+
     float last_key = -INFINITY;
     while (curr != nullptr) {
         if (last_key > curr->keys[0]) {
@@ -142,11 +975,18 @@ void BaseBPTree::test_if_values_are_sorted(float since) {
                 break;
             }
         }
-        curr = curr->next;
+        if (this->links_stale) {
+            curr = (++it == leaves.end()) ? nullptr : *it;
+        } else {
+            if (curr->next != nullptr && curr->next->prev != curr)
+                throw std::logic_error("leaf links disagree");
+            curr = curr->next;
+        }
     }
 }
 
-static void insertion_sort(BPTreeNode* self, size_t idx) {
+template<size_t MAX_WEIGHT>
+static void insertion_sort(BPTreeNode<MAX_WEIGHT>* self, size_t idx) {
     float original = self->keys[idx];
     while (idx > 0 && self->keys[idx - 1] > original) {
         // swap keys[idx - 1] and keys[idx]
@@ -159,7 +999,7 @@ static void insertion_sort(BPTreeNode* self, size_t idx) {
             self->values[idx + 1].p = self->values[idx].p;
             self->values[idx].p = temp;
         } else {
-            BPTreeNode* temp = self->values[idx + 1].b;
+            auto temp = self->values[idx + 1].b;
             self->values[idx + 1].b = self->values[idx].b;
             self->values[idx].b = temp;
         }
@@ -167,27 +1007,24 @@ static void insertion_sort(BPTreeNode* self, size_t idx) {
     }
 }
 
-template<class T>
-static void swap_values(BPTreeNode* self, size_t i, T** vo) {
-    throw std::logic_error("not implemented");
-}
-template<>
-void swap_values<void>(BPTreeNode* self, size_t i, void** vo) {
-    // leaf node
-    void* temp = self->values[i + 1].p;
-    self->values[i + 1].p = *vo;
-    *vo = temp;
-}
-template<>
-void swap_values<BPTreeNode>(BPTreeNode* self, size_t i, BPTreeNode** vo) {
-    // internal node
-    BPTreeNode* temp = self->values[i + 1].b;
-    self->values[i + 1].b = *vo;
-    *vo = temp;
+template<class T, size_t MAX_WEIGHT>
+static void swap_values(BPTreeNode<MAX_WEIGHT>* self, size_t i, T** vo) {
+    if constexpr (std::is_void<T>::value) {
+        // leaf node
+        void* temp = self->values[i + 1].p;
+        self->values[i + 1].p = *vo;
+        *vo = temp;
+    } else {
+        // internal node
+        T* temp = self->values[i + 1].b;
+        self->values[i + 1].b = *vo;
+        *vo = temp;
+    }
 }
 
-template<class T>
-static bool insert_into(BPTreeNode* self, float key, T** value_out) {
+template<class T, size_t MAX_WEIGHT>
+static bool insert_into(BPTreeNode<MAX_WEIGHT>* self, float key,
+                        T** value_out) {
     // Insert key and value into a non-full node, and put the old value into
     // `value_out`. If the key is new, put a nullptr into `value_out`.
     //
@@ -198,10 +1035,10 @@ static bool insert_into(BPTreeNode* self, float key, T** value_out) {
         throw std::logic_error("node is full");
 #endif
 
-    // find the first empty slot in the node
-    size_t i = 0;
-    while (self->keys[i] != key && !isinf(self->keys[i]))
-        i++;
+    // find the slot of an existing key, or else the first empty slot
+    size_t i = count_keys_lt(self->keys, MAX_WEIGHT, key);
+    if (self->keys[i] != key)
+        i = count_keys_lt(self->keys, MAX_WEIGHT, INFINITY);
 
     // insert key and value into the empty slot
     // or if they key already exists, it's original slot
@@ -214,20 +1051,24 @@ static bool insert_into(BPTreeNode* self, float key, T** value_out) {
     return i == MAX_WEIGHT - 1;
 }
 
+template<size_t MAX_WEIGHT>
 constexpr size_t index_to_split_at() {
     return MAX_WEIGHT / 2;
 }
 
-static BPTreeNode* split_node(BPTreeNode* self, float* key_out) {
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* split_node(BPTreeNode<MAX_WEIGHT>* self,
+                                          float* key_out,
+                                          BPTreeWriter<MAX_WEIGHT>* w) {
     // Split a full node into two. Return the new node that is allocated.
     // The "lifted key" is written to `key_out`
 
-    constexpr size_t i = index_to_split_at();
+    constexpr size_t i = index_to_split_at<MAX_WEIGHT>();
     size_t bytes_f = (MAX_WEIGHT - i - 1) * sizeof(self->keys[0]);
     size_t bytes_p = (MAX_WEIGHT - i) * sizeof(self->values[0]);
 
     *key_out = self->keys[i];  // the key to be lifted
-    BPTreeNode* new_node = make_bptree_node();
+    auto new_node = make_node(w);
 
     if (self->next == self) {
         // internal node
@@ -239,8 +1080,8 @@ static BPTreeNode* split_node(BPTreeNode* self, float* key_out) {
         new_node->keys[0] = self->keys[i];
         memcpy(&(new_node->keys[1]),   &(self->keys[i + 1]),   bytes_f);
         memcpy(&(new_node->values[1]), &(self->values[i + 1]), bytes_p);
-        new_node->next = self->next;
-        self->next = new_node;
+        link_leaf(w, new_node, self->next);
+        link_leaf(w, self, new_node);
     }
 
     // zero out portions of the original node
@@ -252,7 +1093,10 @@ static BPTreeNode* split_node(BPTreeNode* self, float* key_out) {
     return new_node;
 }
 
-static BPTreeNode* insert(float* key_out, void** value_out, BPTreeNode* curr) {
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* insert(float* key_out, void** value_out,
+                                      BPTreeNode<MAX_WEIGHT>* curr,
+                                      BPTreeWriter<MAX_WEIGHT>* w) {
     // Private recursive method for inserting a key into the tree
     //
     // Returns a new BPTreeNode if there was a need to create one. If no new
@@ -263,105 +1107,543 @@ static BPTreeNode* insert(float* key_out, void** value_out, BPTreeNode* curr) {
     // inserting operation replaces an existing value under the same key, the
     // "old value" will be written to `value_out`; otherwise, a nullptr will be
     // written to `value_out`.
+    //
+    // `curr` must be owned (see own); so are the nodes that it descends to.
 
     if (curr != curr->next) {
         // base case: leaf node
+        latch(w, curr);
         if (insert_into<void>(curr, *key_out, value_out))
-            return split_node(curr, key_out);  // node becomes full
+            return split_node(curr, key_out, w);  // node becomes full
         else
             return nullptr;
     } else {
         // internal node case
         float kxchg = *key_out;
         // find the appropriate index
-        size_t i = 0;
-        while (curr->keys[i] <= kxchg) i++;
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, kxchg);
         // descend into a child node
 #ifdef DEBUG
         if (curr->values[i].b == nullptr)
             throw std::logic_error("corrupted internal node");
 #endif
-        BPTreeNode* new_node = insert(&kxchg, value_out, curr->values[i].b);
+        auto new_node = insert(&kxchg, value_out, own_child(w, curr, i), w);
         if (new_node != nullptr) {
             // a new node was created; the lifted key was written into kxchg
             // we should insert kxchg into the current node
-            if (insert_into<BPTreeNode>(curr, kxchg, &new_node))
-                return split_node(curr, key_out);
+            latch(w, curr);
+            if (insert_into<BPTreeNode<MAX_WEIGHT>>(curr, kxchg, &new_node))
+                return split_node(curr, key_out, w);
         }
         return nullptr;
     }
 }
 
-void* BaseBPTree::replace_p(float key, void* value) {
-    BPTreeNode* new_node = insert(&key, &value, this->root);
+template<size_t F, size_t B>
+void* BasicBPTree<F, B>::replace_p(float key, void* value) {
+    auto w = this->start_write();
+    Node* old_root = own_root(&w, &(this->root));
+    auto new_node = insert(&key, &value, old_root, &w);
     if (new_node != nullptr) {
         // root node was full and was split into two
         // a new node was allocated; lifted key was written to `key`
         // make a new root
         // add the lifted key to the new root
-        BPTreeNode* new_root = make_bptree_node();
+        auto new_root = make_node(&w);
         new_root->keys[0] = key;
-        new_root->values[0].b = this->root;
+        new_root->values[0].b = old_root;
         new_root->values[1].b = new_node;
         new_root->next = new_root;  // mark as internal node
-        this->root = new_root;
+        this->root.store(new_root, std::memory_order_release);
     }
+    unlatch_all(&w);
     return value;
 }
 
-void BaseBPTree::test_if_root_is_non_degenerate() {
-    auto ptr = this->root->next;
+template<size_t MAX_WEIGHT>
+struct LiftedNode {
+    float key;
+    BPTreeNode<MAX_WEIGHT>* node;
+    size_t after;  // index of the child that the node was split off from
+};
+
+template<size_t MAX_WEIGHT>
+struct BatchScratch {
+    // Buffers reused across the whole batch
+    //
+    // `lifted` is used as a stack: every call appends the siblings it split
+    // off, and the caller pops them after merging them into its own node.
+    std::vector<LiftedNode<MAX_WEIGHT>> lifted;
+    std::vector<float> keys;
+    std::vector<void*> values;
+    std::vector<BPTreeNode<MAX_WEIGHT>*> children;
+    BPTreeWriter<MAX_WEIGHT>* writer;
+};
+
+template<size_t MAX_WEIGHT>
+static size_t count_split_parts(size_t total, size_t max) {
+    // Number of nodes to spread `total` entries over. A node that overflows
+    // is split once into as many parts as needed; each part is about 2/3
+    // full so that the next few insertions do not split it again.
+    if (total <= max)
+        return 1;
+    constexpr size_t target = MAX_WEIGHT * 2 / 3;
+    return (total + target - 1) / target;
+}
+
+template<size_t MAX_WEIGHT>
+static void batch_insert_leaf(BPTreeNode<MAX_WEIGHT>* leaf, const float* keys,
+                              void* const* values, void** replaced, size_t n,
+                              BatchScratch<MAX_WEIGHT>* scratch) {
+    // Merge a sorted run of keys into a leaf. If the merged entries do not
+    // fit, the leaf is split into several siblings, which are pushed onto
+    // `scratch->lifted` together with their smallest keys.
+
+    auto& tk = scratch->keys;
+    auto& tv = scratch->values;
+    tk.clear();
+    tv.clear();
+    latch(scratch->writer, leaf);
+
+    size_t weight = get_node_weight(leaf);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < weight || j < n) {
+        if (j == n || (i < weight && leaf->keys[i] < keys[j])) {
+            tk.push_back(leaf->keys[i]);
+            tv.push_back(leaf->values[i + 1].p);
+            i++;
+        } else if (i == weight || keys[j] < leaf->keys[i]) {
+            tk.push_back(keys[j]);
+            tv.push_back(values[j]);
+            replaced[j] = nullptr;
+            j++;
+        } else {
+            // the key already exists; hand back the old value
+            tk.push_back(keys[j]);
+            tv.push_back(values[j]);
+            replaced[j] = leaf->values[i + 1].p;
+            i++;
+            j++;
+        }
+    }
+
+    size_t total = tk.size();
+    size_t parts = count_split_parts<MAX_WEIGHT>(total, MAX_WEIGHT - 1);
+    BPTreeNode<MAX_WEIGHT>* after = leaf->next;
+    BPTreeNode<MAX_WEIGHT>* curr = leaf;
+    size_t k = 0;
+    for (size_t p = 0; p < parts; p++) {
+        size_t w = total / parts + (p < total % parts);
+        if (p > 0) {
+            auto new_node = make_node(scratch->writer);
+            link_leaf(scratch->writer, curr, new_node);
+            curr = new_node;
+            scratch->lifted.push_back({tk[k], new_node, 0});
+        }
+        memcpy(curr->keys, &(tk[k]), w * sizeof(float));
+        for (size_t x = 0; x < w; x++) {
+            curr->values[x + 1].p = tv[k + x];
+        }
+        for (size_t x = w; x < MAX_WEIGHT; x++) {
+            curr->keys[x] = INFINITY;
+            curr->values[x + 1].p = nullptr;
+        }
+        k += w;
+    }
+    link_leaf(scratch->writer, curr, after);
+}
+
+template<size_t MAX_WEIGHT>
+static void fill_internal_nodes(BPTreeNode<MAX_WEIGHT>* first,
+                                BatchScratch<MAX_WEIGHT>* scratch) {
+    // Write the children in `scratch->children` and the separators in
+    // `scratch->keys` into the internal node `first`. If there are too many
+    // children for one node, split into new siblings and push them onto
+    // `scratch->lifted`.
+
+    auto& tk = scratch->keys;
+    auto& tc = scratch->children;
+    size_t total = tc.size();
+    latch(scratch->writer, first);
+    size_t parts = count_split_parts<MAX_WEIGHT>(total, MAX_WEIGHT);
+    size_t k = 0;
+    for (size_t p = 0; p < parts; p++) {
+        size_t w = total / parts + (p < total % parts);
+        BPTreeNode<MAX_WEIGHT>* node = first;
+        if (p > 0) {
+            node = make_node(scratch->writer);
+            node->next = node;  // mark as internal node
+            scratch->lifted.push_back({tk[k - 1], node, 0});
+        }
+        node->values[0].b = tc[k];
+        for (size_t x = 1; x < w; x++) {
+            node->keys[x - 1] = tk[k + x - 1];
+            node->values[x].b = tc[k + x];
+        }
+        for (size_t x = w - 1; x < MAX_WEIGHT; x++) {
+            node->keys[x] = INFINITY;
+            node->values[x + 1].b = nullptr;
+        }
+        k += w;
+    }
+}
+
+template<size_t MAX_WEIGHT>
+static void batch_insert(BPTreeNode<MAX_WEIGHT>* curr, const float* keys,
+                         void* const* values, void** replaced, size_t n,
+                         BatchScratch<MAX_WEIGHT>* scratch) {
+    // Private recursive method for inserting a sorted run of unique keys
+    // into the subtree at `curr`. Each node on the way is visited once: the
+    // run is partitioned among the children by the separator keys, and the
+    // node is rewritten at most once, after all of its children are done.
+
+    if (curr != curr->next) {
+        batch_insert_leaf(curr, keys, values, replaced, n, scratch);
+        return;
+    }
+
+    auto& lifted = scratch->lifted;
+    size_t mark = lifted.size();
+    size_t weight = get_node_weight(curr);
+    size_t start = 0;
+    for (size_t c = 0; c <= weight && start < n; c++) {
+        // keys in [keys[c - 1], keys[c]) go to child c
+        size_t end = n;
+        if (c < weight) {
+            auto it = std::lower_bound(keys + start, keys + n, curr->keys[c]);
+            end = it - keys;
+        }
+        if (end > start) {
+            size_t before = lifted.size();
+            batch_insert(own_child(scratch->writer, curr, c), keys + start,
+                         values + start, replaced + start, end - start,
+                         scratch);
+            for (size_t x = before; x < lifted.size(); x++) {
+                lifted[x].after = c;
+            }
+        }
+        start = end;
+    }
+    if (lifted.size() == mark)
+        return;  // no child was split
+
+    // Interleave the old children with the split-off ones
+    auto& tk = scratch->keys;
+    auto& tc = scratch->children;
+    tk.clear();
+    tc.clear();
+    tc.push_back(curr->values[0].b);
+    size_t x = mark;
+    for (size_t c = 0; c <= weight; c++) {
+        for (; x < lifted.size() && lifted[x].after == c; x++) {
+            tk.push_back(lifted[x].key);
+            tc.push_back(lifted[x].node);
+        }
+        if (c < weight) {
+            tk.push_back(curr->keys[c]);
+            tc.push_back(curr->values[c + 1].b);
+        }
+    }
+    lifted.resize(mark);
+    fill_internal_nodes(curr, scratch);
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::insert_batch_p(const float* keys, void* const* values,
+                                       void** replaced, size_t n) {
+    // Insert sorted, unique keys in one walk over the tree. Like replace_p,
+    // the old value of a key that already existed is written to
+    // replaced[i]; for a new key, a nullptr is written.
+
+#ifdef DEBUG
+    for (size_t i = 1; i < n; i++) {
+        if (!(keys[i - 1] < keys[i]))
+            throw std::logic_error("batch is not sorted");
+    }
+#endif
+    if (n == 0)
+        return;
+
+    auto w = this->start_write();
+    BatchScratch<MAX_WEIGHT> scratch;
+    scratch.writer = &w;
+    batch_insert(own_root(&w, &(this->root)), keys, values, replaced, n,
+                 &scratch);
+
+    // The root was split; grow new roots until a single node is left
+    auto& lifted = scratch.lifted;
+    while (!lifted.empty()) {
+        scratch.keys.clear();
+        scratch.children.clear();
+        scratch.children.push_back(this->root.load(std::memory_order_relaxed));
+        for (auto& item : lifted) {
+            scratch.keys.push_back(item.key);
+            scratch.children.push_back(item.node);
+        }
+        lifted.clear();
+
+        auto new_root = make_node(&w);
+        new_root->next = new_root;  // mark as internal node
+        fill_internal_nodes(new_root, &scratch);
+        this->root.store(new_root, std::memory_order_release);
+    }
+    unlatch_all(&w);
+}
+
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::is_empty() {
+    if (this->mapped.is_open())
+        return get_mapped_header(&(this->mapped))->root == NO_NODE;
+    Node* root = this->root.load(std::memory_order_relaxed);
+    return root->next != root && isinf(root->keys[0]);
+}
+
+static size_t fill_to_capacity(float fill_factor, size_t lo, size_t hi) {
+    // Scale the fill factor to a number of slots in the range [lo, hi]
+    size_t cap = (size_t) (fill_factor * hi + 0.5f);
+    return std::min(std::max(cap, lo), hi);
+}
+
+static size_t count_bulk_nodes(size_t n, size_t cap, size_t min) {
+    // How many nodes to spread `n` entries over evenly: enough that none
+    // gets more than `cap`, but not so many that one gets fewer than `min`.
+    // The second wins when `cap` < 2 * `min`; a node then gets less than
+    // 2 * `min` entries, which still fits.
+    size_t num_nodes = std::min((n + cap - 1) / cap, n / min);
+    return std::max<size_t>(num_nodes, 1);
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::bulk_load_p(const float* keys, void* const* values,
+                                    size_t n, float fill_factor) {
+    // Build the tree bottom-up from sorted, unique keys: pack the leaves
+    // first, then build each internal level over the one below it until a
+    // single node is left. Every node on a level gets the same weight (give
+    // or take one), so no node ends up underweight at the right edge.
+    //
+    // The tree must be empty.
+
+    if (!(fill_factor > 0.0f && fill_factor <= 1.0f))
+        throw std::invalid_argument("fill factor must be in (0, 1]");
+    if (!this->is_empty())
+        throw std::logic_error("bulk loading requires an empty tree");
+    for (size_t i = 0; i < n; i++) {
+        if (isnan(keys[i]) || isinf(keys[i]))
+            throw std::invalid_argument("keys must be finite");
+        if (i > 0 && !(keys[i - 1] < keys[i]))
+            throw std::invalid_argument("keys must be sorted and unique");
+    }
+    if (n == 0)
+        return;
+
+    auto w = this->start_write();
+    Node* old_root = own_root(&w, &(this->root));
+    latch(&w, old_root);
+
+    // Leaf level
+    // A leaf holds at most MAX_WEIGHT - 1 keys; a full node would be split.
+    size_t cap = fill_to_capacity(fill_factor, MIN_WEIGHT, MAX_WEIGHT - 1);
+    size_t num_nodes = count_bulk_nodes(n, cap, MIN_WEIGHT);
+    std::vector<float> level_keys(num_nodes);  // smallest key of each subtree
+    std::vector<BPTreeNode<MAX_WEIGHT>*> level(num_nodes);
+
+    size_t k = 0;
+    BPTreeNode<MAX_WEIGHT>* prev = nullptr;
+    for (size_t j = 0; j < num_nodes; j++) {
+        size_t weight = n / num_nodes + (j < n % num_nodes);
+        // the (empty) root becomes the leftmost leaf
+        BPTreeNode<MAX_WEIGHT>* leaf = (j == 0)
+            ? old_root
+            : make_node(&w);
+        memcpy(leaf->keys, &(keys[k]), weight * sizeof(float));
+        for (size_t x = 0; x < weight; x++) {
+            leaf->values[x + 1].p = values[k + x];
+        }
+        if (prev != nullptr)
+            prev->next = leaf;
+        leaf->prev = prev;
+        level_keys[j] = keys[k];
+        level[j] = leaf;
+        prev = leaf;
+        k += weight;
+    }
+
+    // Internal levels
+    // An internal node holds at most MAX_WEIGHT children. The parents of a
+    // level are written over the front of the same arrays.
+    cap = fill_to_capacity(fill_factor, MIN_WEIGHT + 1, MAX_WEIGHT);
+    while (num_nodes > 1) {
+        size_t num_parents = count_bulk_nodes(num_nodes, cap, MIN_WEIGHT + 1);
+        size_t c = 0;
+        for (size_t j = 0; j < num_parents; j++) {
+            size_t weight = num_nodes / num_parents
+                + (j < num_nodes % num_parents);
+            auto parent = make_node(&w);
+            parent->next = parent;  // mark as internal node
+            parent->values[0].b = level[c];
+            for (size_t x = 1; x < weight; x++) {
+                parent->keys[x - 1] = level_keys[c + x];
+                parent->values[x].b = level[c + x];
+            }
+            level_keys[j] = level_keys[c];
+            level[j] = parent;
+            c += weight;
+        }
+        num_nodes = num_parents;
+    }
+    this->root.store(level[0], std::memory_order_release);
+    this->links_stale = false;
+    unlatch_all(&w);
+}
+
+template<size_t MAX_WEIGHT>
+static void check_node_weights(BPTreeNode<MAX_WEIGHT>* curr, bool is_root) {
+    size_t weight = get_node_weight(curr);
+    if (!is_root && weight < BPTreeNode<MAX_WEIGHT>::MIN_WEIGHT)
+        throw std::logic_error("node is underweight");
+    if (curr->next != curr)
+        return;
+    for (size_t c = 0; c <= weight; c++) {
+        check_node_weights(curr->values[c].b, false);
+    }
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::test_if_nodes_are_not_underweight() {
+    // Every node but the root holds at least MIN_WEIGHT keys
+    check_node_weights(this->root.load(), true);
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::test_if_root_is_non_degenerate() {
+    Node* root = this->root.load();
+    auto ptr = root->next;
     // One of the following must be true:
     // 1. The root is an internal node.
     // 2. The root is a leaf node with no siblings.
-    if (ptr != this->root && ptr != nullptr)
+    if (ptr != root && ptr != nullptr)
         throw std::logic_error("root node is broken (degenerate)");
 }
 
+template<size_t F, size_t B>
+size_t BasicBPTree<F, B>::get_node_bytes() {
+    return this->node_pool.get_bytes_reserved();
+}
 
-void BaseBPTree::update_p(float old_key, float new_key) {
-    // not implemented
+template<size_t F, size_t B>
+size_t BasicBPTree<F, B>::get_height() {
+    // Number of levels, counting the leaf level
+    size_t height = 1;
+    for (Node* curr = this->root.load(); curr->next == curr;
+         curr = curr->values[0].b)
+        height++;
+    return height;
 }
 
 
-static size_t get_node_weight(BPTreeNode* node) {
-    size_t weight = 0;
-    while (!isinf(node->keys[weight])) weight++;
-    return weight;
+template<size_t MAX_WEIGHT>
+static BPTreeNode<MAX_WEIGHT>* find_leaf_with_bounds(
+        float key, BPTreeNode<MAX_WEIGHT>* curr, float* lo, float* hi) {
+    // Like find_leaf, but also report the separator keys around the path.
+    // Every key in [*lo, *hi) belongs to the returned leaf.
+
+    *lo = -INFINITY;
+    *hi = INFINITY;
+    while (curr->next == curr) {
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, key);
+        if (i > 0)
+            *lo = curr->keys[i - 1];
+        if (!isinf(curr->keys[i]))
+            *hi = curr->keys[i];
+        curr = curr->values[i].b;
+    }
+    return curr;
 }
 
-template<class T>
-static void copy_value(BPTreeNode* self, size_t idst, size_t isrc) {
-    throw std::logic_error("not implemented");
-}
-template<>
-void copy_value<void>(BPTreeNode* self, size_t idst, size_t isrc) {
-    // leaf node
-    self->values[idst].p = self->values[isrc].p;
-}
-template<>
-void copy_value<BPTreeNode>(BPTreeNode* self, size_t idst, size_t isrc) {
-    // internal node
-    self->values[idst].b = self->values[isrc].b;
+template<size_t MAX_WEIGHT>
+static void insertion_sort_right(BPTreeNode<MAX_WEIGHT>* self, size_t idx) {
+    // The mirror image of insertion_sort for leaf nodes: move keys[idx] to
+    // the right until the keys are sorted again
+    float original = self->keys[idx];
+    while (idx + 1 < MAX_WEIGHT && self->keys[idx + 1] < original) {
+        self->keys[idx] = self->keys[idx + 1];
+        self->keys[idx + 1] = original;
+
+        void* temp = self->values[idx + 1].p;
+        self->values[idx + 1].p = self->values[idx + 2].p;
+        self->values[idx + 2].p = temp;
+        idx++;
+    }
 }
 
-template<class T>
-static void clear_value(BPTreeNode* self, size_t idst) {
-    throw std::logic_error("not implemented");
+template<size_t F, size_t B>
+bool BasicBPTree<F, B>::update_p(float old_key, float new_key,
+                                 void* match_value, void** value_out) {
+    // Move the value stored under `old_key` to `new_key`, provided that it
+    // is `match_value`. Return true if the value was moved.
+    //
+    // If `new_key` already had a value, that value is replaced and written
+    // to `value_out` (like replace_p); otherwise a nullptr is written.
+
+    *value_out = nullptr;
+    float lo, hi;
+    Node* root = this->root.load(std::memory_order_relaxed);
+    auto leaf = find_leaf_with_bounds(old_key, root, &lo, &hi);
+    size_t i = count_keys_lt(leaf->keys, MAX_WEIGHT, old_key);
+    if (leaf->keys[i] != old_key || leaf->values[i + 1].p != match_value)
+        return false;
+    if (old_key == new_key)
+        return true;
+
+    size_t j = count_keys_lt(leaf->keys, MAX_WEIGHT, new_key);
+    if (lo <= new_key && new_key < hi && leaf->keys[j] != new_key) {
+        // Fast path: the new key stays within this leaf and is not taken,
+        // so re-sorting the leaf is all we need
+        auto w = this->start_write();
+        if (w.snapshots != nullptr)
+            leaf = own_path(&w, &(this->root), old_key);
+        latch(&w, leaf);
+        leaf->keys[i] = new_key;
+        if (new_key < old_key)
+            insertion_sort(leaf, i);
+        else
+            insertion_sort_right(leaf, i);
+        unlatch_all(&w);
+        return true;
+    }
+
+    void* value;
+    this->delete_p(old_key, &value);
+    *value_out = this->replace_p(new_key, value);
+    return true;
 }
-template<>
-void clear_value<void>(BPTreeNode* self, size_t idst) {
-    // leaf node
-    self->values[idst].p = nullptr;
+
+
+template<class T, size_t MAX_WEIGHT>
+static void copy_value(BPTreeNode<MAX_WEIGHT>* self, size_t idst, size_t isrc) {
+    if constexpr (std::is_void<T>::value) {
+        // leaf node
+        self->values[idst].p = self->values[isrc].p;
+    } else {
+        // internal node
+        self->values[idst].b = self->values[isrc].b;
+    }
 }
-template<>
-void clear_value<BPTreeNode>(BPTreeNode* self, size_t idst) {
-    // internal node
-    self->values[idst].b = nullptr;
+
+template<class T, size_t MAX_WEIGHT>
+static void clear_value(BPTreeNode<MAX_WEIGHT>* self, size_t idst) {
+    if constexpr (std::is_void<T>::value) {
+        // leaf node
+        self->values[idst].p = nullptr;
+    } else {
+        // internal node
+        self->values[idst].b = nullptr;
+    }
 }
 
-template<class T>
-static size_t delete_key_from_node(BPTreeNode* curr, float key) {
+template<class T, size_t MAX_WEIGHT>
+static size_t delete_key_from_node(BPTreeNode<MAX_WEIGHT>* curr, float key) {
     // compute the node's old weight and find the key
     int key_idx = -1;
     size_t weight = 0;
@@ -390,6 +1672,7 @@ static size_t delete_key_from_node(BPTreeNode* curr, float key) {
     }
 }
 
+template<size_t MAX_WEIGHT>
 static size_t compute_nkb(size_t receiver_weight, size_t sender_weight) {
 #ifdef DEBUG
     if (receiver_weight >= sender_weight)
@@ -405,223 +1688,631 @@ static size_t compute_nkb(size_t receiver_weight, size_t sender_weight) {
     return std::min(sender_gives, receiver_wants);
 }
 
-static float borrow_keys_R(BPTreeNode* recv, size_t recv_weight, float ikey) {
-    // Move keys and values from the sender (the node to my right) to the
-    // receiver so that both the receiver and the sender are appropriately
-    // weighted.
+template<size_t MAX_WEIGHT>
+static void borrow_keys_R(BPTreeNode<MAX_WEIGHT>* parent, size_t idx) {
+    // Move keys and values from the sender (the child to the right of the
+    // receiver) to the receiver so that both are appropriately weighted, and
+    // update the separator key between them.
     //
-    // Behavior is undefined if `recv` is the last child of its parent.
-    //
-    // :param recv: pointer to receiver node
-    // :param recv_weight: original weight of the receiver
-    // :param ikey: intermediate key (equals parent[sender_key_index])
-    // :return: the sender's new key
+    // :param parent: the parent of both nodes
+    // :param idx: index of the receiver in the parent
 
-    BPTreeNode* send = recv->next;
+    BPTreeNode<MAX_WEIGHT>* recv = parent->values[idx].b;
+    BPTreeNode<MAX_WEIGHT>* send = parent->values[idx + 1].b;
+    size_t recv_weight = get_node_weight(recv);
     size_t send_weight = get_node_weight(send);
+    size_t nkb = compute_nkb<MAX_WEIGHT>(recv_weight, send_weight);
+    constexpr size_t sz = sizeof(send->values[0]);
 
-    // Compute the number of keys to borrow
-    size_t nkb = compute_nkb(recv_weight, send_weight);
-
-    //        v                  v      (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A| | | | |    |X|Y|Z|W|U|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a| | | | |  |p|x|y|z|w|u|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^                  ^
+    //        Leaf (nkb=2)                  Internal (nkb=2)
     //
-    //         Receiver    Sender
-
-    // Check if we need to keep send->values[0]
-    // Note: if intermediate_key == keys[0] then values[0] is null
-    if (ikey != send->keys[0]) {
-        // this case is only true for internal nodes
-        BPTreeNode* node_ptr = send->values[0].b;
-        if (node_ptr != nullptr) {
-            // do not drop the node_ptr
-            recv->keys[recv_weight] = ikey;
-            recv->values[recv_weight + 1].b = node_ptr;
-            // after weight increment, `nkb` is still safe to use
-            recv_weight++;
-            send->values[0].b = nullptr;
-            // this is because we'll return send->keys[0];
-        }
-    }
-
-    //          v                  v      (nkb=4) (safe)
-    //     +-+-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|I| | | | |    |X|Y|Z|W|U|
-    // ... +-\-\-\-\-\-+-+  +-\-\-\-\-\-+ ...
-    //       |a|p| | | | |  | |x|y|z|w|u|
-    //       +-+-+-+-+-+-+  +-+-+-+-+-+-+
-    //          * ^          0       ^
-    //
-    //           Receiver    Sender
-
-    // copy keys and values
-    size_t size_f = nkb * sizeof(float);
-    size_t size_u = nkb * sizeof(recv->values[0]);
-    memcpy(&(recv->keys[recv_weight]),   &(send->keys[0]),   size_f);
-    memcpy(&(recv->values[recv_weight]), &(send->values[1]), size_u);
-
-    //        v                  v      (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|X|Y|Z|W|    |X|Y|Z|W|U|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a|x|y|z|w|  | |x|y|z|w|u|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^          0       ^
+    //           [P]                              [P]
+    //     +-+-+ / \ +-+-+-+            +-+-+ /     \ +-+-+-+
+    //     |A|B|     |P|Q|R|            |A|B|         |X|Y|Z|
+    //     +-+-+     +-+-+-+            +-+-+         +-+-+-+
+    //                                  a b c        p x y z
+    //             ||                               ||
+    //             \/                               \/
+    //             [R]                              [Y]
+    //     +-+-+-+-+ / \ +-+            +-+-+-+-+ /     \ +-+
+    //     |A|B|P|Q|     |R|            |A|B|P|X|         |Z|
+    //     +-+-+-+-+     +-+            +-+-+-+-+         +-+
+    //                                  a b c p x        y z
+
+    float new_separator;
+    size_t first_value;
+    if (recv->next != recv) {
+        // leaf node
+        memcpy(&(recv->keys[recv_weight]), send->keys, nkb * sizeof(float));
+        memcpy(&(recv->values[recv_weight + 1]), &(send->values[1]), nkb * sz);
+        new_separator = send->keys[nkb];
+        first_value = 1;
+    } else {
+        // internal node: the separator comes down, a key of the sender goes up
+        recv->keys[recv_weight] = parent->keys[idx];
+        memcpy(&(recv->keys[recv_weight + 1]), send->keys,
+               (nkb - 1) * sizeof(float));
+        memcpy(&(recv->values[recv_weight + 1]), send->values, nkb * sz);
+        new_separator = send->keys[nkb - 1];
+        first_value = 0;
+    }
+    parent->keys[idx] = new_separator;
+
+    // close the gap in the sender
+    memmove(send->keys, &(send->keys[nkb]),
+            (send_weight - nkb) * sizeof(float));
+    memmove(&(send->values[first_value]), &(send->values[first_value + nkb]),
+            (send_weight + 1 - nkb - first_value) * sz);
+    for (size_t i = send_weight - nkb; i < send_weight; i++) {
+        send->keys[i] = INFINITY;
+    }
+    memset(&(send->values[send_weight + 1 - nkb]), 0, nkb * sz);
+}
+
+template<size_t MAX_WEIGHT>
+static void borrow_keys_L(BPTreeNode<MAX_WEIGHT>* parent, size_t idx) {
+    // Move keys and values from the sender (the child to the left of the
+    // receiver) to the receiver so that both are appropriately weighted, and
+    // update the separator key between them.
     //
-    //         Receiver    Sender
+    // :param parent: the parent of both nodes
+    // :param idx: index of the receiver in the parent
+
+    BPTreeNode<MAX_WEIGHT>* recv = parent->values[idx].b;
+    BPTreeNode<MAX_WEIGHT>* send = parent->values[idx - 1].b;
+    size_t recv_weight = get_node_weight(recv);
+    size_t send_weight = get_node_weight(send);
+    size_t nkb = compute_nkb<MAX_WEIGHT>(recv_weight, send_weight);
+    constexpr size_t sz = sizeof(send->values[0]);
 
-    // reorganize sender's key
-    for (size_t i = nkb; i < send_weight; i++) {
-        send->keys[i - nkb] = send->keys[i];
+    //        Leaf (nkb=2)                  Internal (nkb=2)
+    //
+    //             [X]                              [X]
+    //     +-+-+-+ / \ +-+              +-+-+-+ /     \ +-+
+    //     |A|B|C|     |X|              |A|B|C|         |Y|
+    //     +-+-+-+     +-+              +-+-+-+         +-+
+    //                                  a b c d        x y
+    //             ||                               ||
+    //             \/                               \/
+    //         [B]                              [B]
+    //     +-+ / \ +-+-+-+              +-+ /     \ +-+-+-+
+    //     |A|     |B|C|X|              |A|         |C|X|Y|
+    //     +-+     +-+-+-+              +-+         +-+-+-+
+    //                                  a b        c d x y
+
+    memmove(&(recv->keys[nkb]), recv->keys, recv_weight * sizeof(float));
+    if (recv->next != recv) {
+        // leaf node
+        memmove(&(recv->values[nkb + 1]), &(recv->values[1]),
+                recv_weight * sz);
+        memcpy(recv->keys, &(send->keys[send_weight - nkb]),
+               nkb * sizeof(float));
+        memcpy(&(recv->values[1]), &(send->values[send_weight + 1 - nkb]),
+               nkb * sz);
+        parent->keys[idx - 1] = recv->keys[0];
+    } else {
+        // internal node: the separator comes down, a key of the sender goes up
+        memmove(&(recv->values[nkb]), recv->values, (recv_weight + 1) * sz);
+        recv->keys[nkb - 1] = parent->keys[idx - 1];
+        memcpy(recv->keys, &(send->keys[send_weight + 1 - nkb]),
+               (nkb - 1) * sizeof(float));
+        memcpy(recv->values, &(send->values[send_weight + 1 - nkb]),
+               nkb * sz);
+        parent->keys[idx - 1] = send->keys[send_weight - nkb];
     }
+
+    // clean up the sender
     for (size_t i = send_weight - nkb; i < send_weight; i++) {
         send->keys[i] = INFINITY;
     }
+    memset(&(send->values[send_weight + 1 - nkb]), 0, nkb * sz);
+}
+
+template<size_t MAX_WEIGHT>
+static void merge_children(BPTreeNode<MAX_WEIGHT>* parent, size_t idx,
+                           BPTreeWriter<MAX_WEIGHT>* w) {
+    // Merge child idx + 1 of the parent into child idx, then remove the
+    // separator between them from the parent and recycle the right node.
+    // The parent must be owned.
+    //
+    // Behavior is undefined if the merged node would not fit.
+
+    BPTreeNode<MAX_WEIGHT>* left = own_child(w, parent, idx);
+    BPTreeNode<MAX_WEIGHT>* right = parent->values[idx + 1].b;
+    size_t left_weight = get_node_weight(left);
+    size_t right_weight = get_node_weight(right);
+    constexpr size_t sz = sizeof(left->values[0]);
 
-    // reorganize sender's value pointers
-    for (size_t i = nkb + 1; i < send_weight + 1; i++) {
-        // send->values[i - nkb] = send->values[i]
-        constexpr size_t sz = sizeof(send->values[0]);
-        memcpy(&(send->values[i - nkb]), &(send->values[i]), sz);
+#ifdef DEBUG
+    if (left_weight + right_weight + 1 >= MAX_WEIGHT)
+        throw std::logic_error("merged node is too heavy");
+#endif
+    latch(w, parent);
+    latch(w, left);
+    latch(w, right);
+
+    if (left->next != left) {
+        // leaf node
+        memcpy(&(left->keys[left_weight]), right->keys,
+               right_weight * sizeof(float));
+        memcpy(&(left->values[left_weight + 1]), &(right->values[1]),
+               right_weight * sz);
+        link_leaf(w, left, right->next);
+    } else {
+        // internal node: the separator comes down between the two halves
+        left->keys[left_weight] = parent->keys[idx];
+        memcpy(&(left->keys[left_weight + 1]), right->keys,
+               right_weight * sizeof(float));
+        memcpy(&(left->values[left_weight + 1]), right->values,
+               (right_weight + 1) * sz);
     }
-    // size_u = sizeof(send->values[0]) * nkb;  /* need not recompute this */
-    memset(&(send->values[send_weight+1 - nkb]), 0, size_u);
 
-    //        v                       v      (nkb=4)
-    //     +-+-+-+-+-+         +-+-+-+-+-+
-    //     |A|X|Y|Z|W|         |U|*|*|*|*|
-    // ... +-\-\-\-\-\-+ ...   +-\-\-\-\-\-+ ...
-    //       |a|x|y|z|w|       | |u|*|*|*|*|
-    //       +-+-+-+-+-+       +-+-+-+-+-+-+
-    //          ^                       ^
-    //
-    //         Receiver         Sender
+    delete_key_from_node<BPTreeNode<MAX_WEIGHT>>(parent, parent->keys[idx]);
+    retire_node(w, right);
+}
 
-    return send->keys[0];
+template<size_t MAX_WEIGHT>
+static void rebalance_child(BPTreeNode<MAX_WEIGHT>* parent, size_t idx,
+                            BPTreeWriter<MAX_WEIGHT>* w) {
+    constexpr size_t MIN_WEIGHT = BPTreeNode<MAX_WEIGHT>::MIN_WEIGHT;
+    // Fix up child idx of the parent after it became underweight: borrow
+    // keys from a sibling that can spare them, or else merge with a sibling.
+    // The parent and the child must be owned.
+
+    size_t parent_weight = get_node_weight(parent);
+    BPTreeNode<MAX_WEIGHT>* left = nullptr;
+    BPTreeNode<MAX_WEIGHT>* right = nullptr;
+    if (idx > 0)
+        left = parent->values[idx - 1].b;
+    if (idx < parent_weight)
+        right = parent->values[idx + 1].b;
+
+    BPTreeNode<MAX_WEIGHT>* child = parent->values[idx].b;
+    if (left != nullptr && get_node_weight(left) > MIN_WEIGHT) {
+        left = own_child(w, parent, idx - 1);
+        latch(w, parent);
+        latch(w, left);
+        latch(w, child);
+        borrow_keys_L(parent, idx);
+    } else if (right != nullptr && get_node_weight(right) > MIN_WEIGHT) {
+        right = own_child(w, parent, idx + 1);
+        latch(w, parent);
+        latch(w, child);
+        latch(w, right);
+        borrow_keys_R(parent, idx);
+    } else if (left != nullptr) {
+        merge_children(parent, idx - 1, w);
+    } else if (right != nullptr) {
+        merge_children(parent, idx, w);
+    }
 }
 
-static float borrow_keys_L(BPTreeNode* sndr, size_t sndr_weight, float ikey) {
-    // Move keys and values from the sender to the receiver so that both the
-    // sender and the receiver are appropriately weighted.
-    //
-    // Behavior is undefined if the receiver is a child of index 0 in its
-    // parent node.
+template<size_t MAX_WEIGHT>
+static bool remove(float key, void** value_out, BPTreeNode<MAX_WEIGHT>* curr,
+                   BPTreeWriter<MAX_WEIGHT>* w) {
+    constexpr size_t MIN_WEIGHT = BPTreeNode<MAX_WEIGHT>::MIN_WEIGHT;
+    // Private recursive method for deleting a key from the tree
     //
-    // :param sndr: the node to the left of the receiver.
-    // :param sndr_weight: original sender weight
-    // :param ikey: intermediate key which equals parent[receiver_key_index]
-    // :return: the receiver's new key
+    // The removed value is written to `value_out`; if the key was not found,
+    // a nullptr is written and the tree is left unchanged. Returns true if
+    // `curr` became underweight, so that its parent has to rebalance it.
 
-    BPTreeNode* recv = sndr->next;
-    size_t recv_weight = get_node_weight(recv);
-    size_t nkb = compute_nkb(recv_weight, sndr_weight);
-
-    //        v                         (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|B|C|D|E|    |X|Y|Z|W|.|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-+-+ ...
-    //       |a|b|c|d|e|  |p|x|y|z|w|.|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^                  *
-    //
-    //           Sender    Receiver
-
-    // move the receiver's keys and values to make space
-    for (int i = recv_weight - 1; i >= 0; i--) {  // we must use "int" here
-        recv->keys[i + nkb] = recv->keys[i];
-    }
-    // Note that we will move values[0] to values[nkb]
-    for (int i = recv_weight; i >= 0; i--) {
-        // recv->values[i + nkb] = recv->values[i];
-        constexpr size_t sz = sizeof(recv->values[0]);
-        memcpy(&(recv->values[i + nkb]), &(recv->values[i]), sz);
-    }
-    // zero out the first value pointer in `recv`
-    // we do this because we will return keys[0]
-    memset(recv->values, 0, sizeof(recv->values[0]));
-
-    //        v                         (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|B|C|D|E|    |.|.|.|.|X|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a|b|c|d|e|  | |.|.|.|p|x|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^          0       *
-    //
-    //           Sender    Receiver
+    if (curr != curr->next) {
+        // base case: leaf node
+        size_t i = count_keys_lt(curr->keys, MAX_WEIGHT, key);
+        if (curr->keys[i] != key) {
+            *value_out = nullptr;
+            return false;
+        }
+        *value_out = curr->values[i + 1].p;
+        latch(w, curr);
+        return delete_key_from_node<void>(curr, key) < MIN_WEIGHT;
+    } else {
+        // internal node case
+        size_t i = count_keys_le(curr->keys, MAX_WEIGHT, key);
+        if (!remove(key, value_out, own_child(w, curr, i), w))
+            return false;
+        rebalance_child(curr, i, w);
+        return get_node_weight(curr) < MIN_WEIGHT;
+    }
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::delete_p(float key, void** value_out) {
+    auto w = this->start_write();
+    Node* old_root = own_root(&w, &(this->root));
+    remove(key, value_out, old_root, &w);
 
-    // Check if we need to pull down the intermediate key
-    if (ikey != recv->keys[nkb] && recv->values[nkb].b != nullptr) {
-        // put the intermediate key into the receiver
-        recv->keys[nkb - 1] = ikey;
-        // since we used a slot, decrease nkb by one
-        nkb--;
+    if (old_root->next == old_root && get_node_weight(old_root) == 0) {
+        // the root has a single child left; make that child the new root
+        this->root.store(old_root->values[0].b, std::memory_order_release);
+        retire_node(&w, old_root);
     }
+    unlatch_all(&w);
+}
 
-    if (nkb == 0) return ikey;
+template<size_t F, size_t B>
+void* BasicBPTree<F, B>::get_p(float key) {
+    auto leaf = find_leaf(key, this->root.load(std::memory_order_relaxed));
+    size_t i = count_keys_lt(leaf->keys, MAX_WEIGHT, key);
+    return (leaf->keys[i] == key) ? leaf->values[i + 1].p : nullptr;
+}
 
-    //          v                       (nkb=3)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|B|C|D|E|    |.|.|.|I|X|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a|b|c|d|e|  | |.|.|.|p|x|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //            ^                *
-    //
-    //           Sender    Receiver
-
-    // move keys
-    // move values (from sender to recv->values[1] etc)
-    size_t size_f = sizeof(float) * nkb;
-    size_t size_u = sizeof(recv->values[0]) * nkb;
-    memcpy(&(recv->keys[0]),   &(sndr->keys[sndr_weight - nkb]),     size_f);
-    memcpy(&(recv->values[1]), &(sndr->values[sndr_weight+1 - nkb]), size_u);
-
-    //        v                         (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A|B|C|D|E|    |B|C|D|E|X|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a|b|c|d|e|  | |b|c|d|e|x|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^                  *
-    //
-    //           Sender    Receiver
+template<size_t F, size_t B>
+void* BasicBPTree<F, B>::get_below_p(float key, float* key_out) {
+    // Go down towards `key`, keeping track of the subtree just left of the
+    // path. If the leaf has no smaller key, the answer is the largest key
+    // of that subtree.
+
+    Node* curr = this->root.load(std::memory_order_relaxed);
+    Node* left = nullptr;
+    while (curr->next == curr) {
+        size_t i = count_keys_lt(curr->keys, MAX_WEIGHT, key);
+        if (i > 0)
+            left = curr->values[i - 1].b;
+        curr = curr->values[i].b;
+    }
+    size_t i = count_keys_lt(curr->keys, MAX_WEIGHT, key);
+    if (i == 0) {
+        if (left == nullptr)
+            return nullptr;
+        curr = left;
+        while (curr->next == curr) {
+            curr = curr->values[get_node_weight(curr)].b;
+        }
+        i = get_node_weight(curr);
+    }
+    if (key_out != nullptr)
+        *key_out = curr->keys[i - 1];
+    return curr->values[i].p;
+}
 
-    // clean up
-    for (size_t i = sndr_weight - nkb; i < sndr_weight; i++) {
-        sndr->keys[i] = INFINITY;
+static size_t round_up_to_line(size_t size) {
+    return (size + 63) / 64 * 64;
+}
+
+template<size_t MAX_WEIGHT>
+static void build_mapped_level(std::vector<MappedNode<MAX_WEIGHT>>* nodes,
+                               std::vector<float>* level_keys,
+                               uint32_t* begin, uint32_t end) {
+    // Make the parents of nodes [*begin, end), whose smallest keys are in
+    // `level_keys`, as full as bulk_load_p would. Afterwards, [*begin, end)
+    // are the new nodes and `level_keys` has their smallest keys.
+
+    size_t num_children = end - *begin;
+    size_t num_parents = (num_children + MAX_WEIGHT - 1) / MAX_WEIGHT;
+    std::vector<float> parent_keys(num_parents);
+    size_t c = 0;
+    for (size_t j = 0; j < num_parents; j++) {
+        size_t weight = num_children / num_parents
+            + (j < num_children % num_parents);
+        MappedNode<MAX_WEIGHT> parent;
+        parent.next = nodes->size();
+        parent.first = 0;
+        for (size_t x = 0; x < MAX_WEIGHT; x++) {
+            parent.keys[x] = INFINITY;
+        }
+        memset(parent.children, 0, sizeof(parent.children));
+        for (size_t x = 0; x < weight; x++) {
+            if (x > 0)
+                parent.keys[x - 1] = (*level_keys)[c + x];
+            parent.children[x] = *begin + c + x;
+        }
+        parent_keys[j] = (*level_keys)[c];
+        nodes->push_back(parent);
+        c += weight;
     }
-    memset(&(sndr->values[sndr_weight+1 - nkb]), 0, size_u);
+    *begin = end;
+    *level_keys = std::move(parent_keys);
+}
 
-    //        v                         (nkb=4)
-    //     +-+-+-+-+-+    +-+-+-+-+-+
-    //     |A| | | | |    |B|C|D|E|X|
-    // ... +-\-\-\-\-\-+  +-\-\-\-\-\-+ ...
-    //       |a| | | | |  | |b|c|d|e|x|
-    //       +-+-+-+-+-+  +-+-+-+-+-+-+
-    //          ^                  *
-    //
-    //           Sender    Receiver
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::save_p(const char* path, size_t record_size,
+                               RecordPacker* packer, LeafKeys leaf_keys) {
+    // Lay the records out in key order, then build a static tree over them
+    // bottom-up, with leaves as full as bulk_load_p makes them. The caller
+    // keeps writers out meanwhile.
+
+    if (this->mapped.is_open())
+        throw std::logic_error("the tree is mapped read-only");
+
+    std::vector<Node*> leaves;
+    collect_leaves(this->root.load(std::memory_order_relaxed), &leaves);
+    std::vector<float> keys;
+    std::vector<char> records;
+    for (Node* leaf : leaves) {
+        size_t weight = get_node_weight(leaf);
+        for (size_t i = 0; i < weight; i++) {
+            void* value = leaf->values[i + 1].p;
+            size_t count = packer->count_records(value);
+            size_t at = records.size();
+            records.resize(at + count * record_size);
+            packer->pack(value, &(records[at]));
+            keys.insert(keys.end(), count, leaf->keys[i]);
+        }
+    }
+
+    size_t n = keys.size();
+    size_t capacity = MAX_WEIGHT - 1;
+    if (leaf_keys == LeafKeys::DELTA16)
+        capacity = MappedPackedLeaf<MAX_WEIGHT, uint16_t>::CAPACITY;
+    else if (leaf_keys == LeafKeys::DELTA8)
+        capacity = MappedPackedLeaf<MAX_WEIGHT, uint8_t>::CAPACITY;
+    size_t num_leaves = (n + capacity - 1) / capacity;
+    if (n >= NO_NODE)
+        throw std::length_error("too many records to save");
+    std::vector<MappedNode<MAX_WEIGHT>> nodes;
+    std::vector<float> level_keys(num_leaves);
+    size_t k = 0;
+    for (size_t j = 0; j < num_leaves; j++) {
+        size_t weight = n / num_leaves + (j < n % num_leaves);
+        uint32_t next = (j + 1 < num_leaves) ? j + 1 : NO_NODE;
+        if (leaf_keys == LeafKeys::DELTA16) {
+            nodes.push_back(make_packed_leaf<MAX_WEIGHT, uint16_t>(
+                &(keys[k]), weight, k, next));
+        } else if (leaf_keys == LeafKeys::DELTA8) {
+            nodes.push_back(make_packed_leaf<MAX_WEIGHT, uint8_t>(
+                &(keys[k]), weight, k, next));
+        } else {
+            MappedNode<MAX_WEIGHT> leaf;
+            leaf.next = next;
+            leaf.first = k;
+            for (size_t x = 0; x < MAX_WEIGHT; x++) {
+                leaf.keys[x] = (x < weight) ? keys[k + x] : INFINITY;
+            }
+            memset(leaf.children, 0, sizeof(leaf.children));
+            nodes.push_back(leaf);
+        }
+        level_keys[j] = keys[k];
+        k += weight;
+    }
+    uint32_t begin = 0;
+    while (nodes.size() - begin > 1) {
+        build_mapped_level(&nodes, &level_keys, &begin, nodes.size());
+    }
 
-    return recv->keys[0];
+    MappedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAPPED_MAGIC, sizeof(header.magic));
+    header.fanout = MAX_WEIGHT;
+    header.record_size = record_size;
+    header.num_records = n;
+    header.num_nodes = nodes.size();
+    header.nodes_offset = round_up_to_line(sizeof(header));
+    header.records_offset = header.nodes_offset
+        + nodes.size() * sizeof(nodes[0]);
+    bool packed = leaf_keys != LeafKeys::FLOAT;
+    if (packed)
+        header.keys_offset = round_up_to_line(header.records_offset
+                                              + records.size());
+    header.root = nodes.empty() ? NO_NODE : nodes.size() - 1;
+    header.leaf_keys = (uint32_t) leaf_keys;
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+        throw std::runtime_error(std::string("cannot open ") + path);
+    char padding[64] = {0};
+    size_t padding_size = header.nodes_offset - sizeof(header);
+    // (an empty tree has no nodes or records, whose data() may be null)
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(padding, 1, padding_size, file) == padding_size
+        && (nodes.empty()
+            || fwrite(nodes.data(), sizeof(nodes[0]), nodes.size(), file)
+                == nodes.size())
+        && (records.empty()
+            || fwrite(records.data(), 1, records.size(), file)
+                == records.size());
+    if (packed) {
+        padding_size = header.keys_offset - header.records_offset
+            - records.size();
+        ok = ok && fwrite(padding, 1, padding_size, file) == padding_size
+            && (n == 0
+                || fwrite(keys.data(), sizeof(float), n, file) == n);
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        throw std::runtime_error(std::string("cannot write ") + path);
 }
 
-template<class T>
-static void delete_key(BPTreeNode* parent, size_t idxk, float* ogkey) {
-    auto curr = parent->values[idxk + 1].b;
-    size_t new_weight = delete_key_from_node<T>(curr, ogkey);
-    if (new_weight < MIN_WEIGHT) {
-    } else {
-        // adjust key (e.g. what if we deleted the smallest key?)
-        parent->keys[idxk] = curr->keys[0];
+template<size_t MAX_WEIGHT, class Delta>
+static bool packed_leaf_is_valid(const MappedNode<MAX_WEIGHT>* node,
+                                 size_t* reach) {
+    // Whether searches of a packed leaf count at most its weight of keys:
+    // unused steps must be the largest one (see make_packed_leaf)
+    auto leaf = reinterpret_cast<const MappedPackedLeaf<MAX_WEIGHT, Delta>*>(
+        node);
+    if (leaf->weight > leaf->CAPACITY || !(leaf->scale >= 0.0f)
+        || isinf(leaf->scale))
+        return false;
+    for (size_t x = leaf->weight; x < leaf->CAPACITY; x++) {
+        if (leaf->deltas[x] != std::numeric_limits<Delta>::max())
+            return false;
+    }
+    *reach = leaf->weight;
+    return true;
+}
+
+template<size_t MAX_WEIGHT>
+static bool mapped_nodes_are_valid(const char* data) {
+    // Whether searches of a mapped file stay inside it: the children of a
+    // node have smaller numbers than the node (so descents end in a leaf),
+    // a leaf links to a leaf with a larger number (so scans end), and the
+    // records that a leaf can return are in the file. The order of the keys
+    // is not checked; a file out of order gives wrong results, but reads
+    // nothing outside the mapping.
+    auto header = reinterpret_cast<const MappedHeader*>(data);
+    auto nodes = reinterpret_cast<const MappedNode<MAX_WEIGHT>*>(
+        data + header->nodes_offset);
+    uint64_t num_nodes = header->num_nodes;
+    for (uint64_t j = 0; j < num_nodes; j++) {
+        const MappedNode<MAX_WEIGHT>* node = &(nodes[j]);
+        if (node->next == j) {
+            for (size_t x = 0; x <= MAX_WEIGHT; x++) {
+                if (node->children[x] >= j)
+                    return false;
+            }
+            continue;
+        }
+        if (node->next != NO_NODE
+            && (node->next <= j || node->next >= num_nodes
+                || nodes[node->next].next == node->next))
+            return false;
+
+        // How many records after `first` a search may return. Searches
+        // stop at FLT_MAX (see range_search_p), so float keys beyond it do
+        // not count.
+        size_t reach = 0;
+        switch ((LeafKeys) header->leaf_keys) {
+        case LeafKeys::FLOAT:
+            for (size_t x = 0; x < MAX_WEIGHT; x++) {
+                if (node->keys[x] <= FLT_MAX)
+                    reach = x + 1;
+            }
+            break;
+        case LeafKeys::DELTA16:
+            if (!packed_leaf_is_valid<MAX_WEIGHT, uint16_t>(node, &reach))
+                return false;
+            break;
+        case LeafKeys::DELTA8:
+            if (!packed_leaf_is_valid<MAX_WEIGHT, uint8_t>(node, &reach))
+                return false;
+            break;
+        }
+        if ((uint64_t) node->first + reach > header->num_records)
+            return false;
+    }
+    return true;
+}
+
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::map_p(const char* path, size_t record_size) {
+    this->clear();
+    this->mapped.open(path);
+
+    // Check that the parts are where the header says they are. The counts
+    // are bounded by the size first, so that the sizes computed from them
+    // cannot overflow.
+    auto header = get_mapped_header(&(this->mapped));
+    size_t size = this->mapped.get_size();
+    bool ok = size >= sizeof(MappedHeader)
+        && memcmp(header->magic, MAPPED_MAGIC, sizeof(header->magic)) == 0
+        && header->fanout == MAX_WEIGHT
+        && record_size > 0
+        && header->record_size == record_size
+        && header->nodes_offset % 64 == 0
+        && header->nodes_offset <= size
+        && header->num_nodes <= size / sizeof(MappedNode<MAX_WEIGHT>)
+        && header->num_nodes < NO_NODE
+        && header->num_records <= size / record_size
+        && header->keys_offset <= size
+        && header->records_offset == header->nodes_offset
+            + header->num_nodes * sizeof(MappedNode<MAX_WEIGHT>)
+        && header->leaf_keys <= (uint32_t) LeafKeys::DELTA8
+        && (header->leaf_keys == (uint32_t) LeafKeys::FLOAT
+            ? header->keys_offset == 0 && header->records_offset
+                + header->num_records * record_size == size
+            : header->keys_offset == round_up_to_line(header->records_offset
+                + header->num_records * record_size)
+              && header->keys_offset
+                + header->num_records * sizeof(float) == size)
+        && (header->root == NO_NODE) == (header->num_nodes == 0)
+        && (header->root == NO_NODE || header->root < header->num_nodes)
+        // and then every node, so that no search reads outside the file
+        && mapped_nodes_are_valid<MAX_WEIGHT>(this->mapped.get_data());
+    if (!ok) {
+        this->mapped.close();
+        throw std::runtime_error(std::string(path)
+                                 + " is not a tree of this kind");
+    }
+}
+
+template<size_t MAX_WEIGHT, class Out>
+static void scan_mapped_leaves(const MappedNode<MAX_WEIGHT>* nodes,
+                               uint32_t index, const char* records,
+                               size_t record_size, float k0, float k1,
+                               Out* out) {
+    // Put the records of keys in [k0, k1] from leaf `index` on
+    while (index != NO_NODE && nodes[index].keys[0] <= k1) {
+        auto leaf = &(nodes[index]);
+        size_t lo = count_keys_lt(leaf->keys, MAX_WEIGHT, k0);
+        size_t hi = count_keys_le(leaf->keys, MAX_WEIGHT, k1);
+        for (size_t i = lo; i < hi; i++) {
+            // (the records are read-only, like the rest of the mapping)
+            out->put(const_cast<char*>(
+                records + (leaf->first + i) * record_size));
+        }
+        index = leaf->next;
+        out->ensure_space();
+    }
+}
+
+template<size_t MAX_WEIGHT, class Delta, class Out>
+static void scan_packed_leaves(const MappedNode<MAX_WEIGHT>* nodes,
+                               uint32_t index, const char* records,
+                               size_t record_size, const float* exact,
+                               float k0, float k1, Out* out) {
+    // The same with packed leaves. These hold more keys than the buffer
+    // has room for after ensure_space, so it is made before every put.
+    auto leaves = reinterpret_cast<const MappedPackedLeaf<MAX_WEIGHT, Delta>*>(
+        nodes);
+    while (index != NO_NODE && leaves[index].base <= k1) {
+        auto leaf = &(leaves[index]);
+        size_t lo = count_packed_keys(leaf, exact, k0, false);
+        size_t hi = count_packed_keys(leaf, exact, k1, true);
+        for (size_t i = lo; i < hi; i++) {
+            out->ensure_space();
+            out->put(const_cast<char*>(
+                records + (leaf->first + i) * record_size));
+        }
+        index = leaf->next;
     }
 }
 
-void BaseBPTree::delete_p(float key, void** value_out) {
-    // Will try to merge, unless we cannot merge the two nodes
+template<size_t F, size_t B>
+void BasicBPTree<F, B>::search_mapped(float k0, float k1, Acc* out) {
+    // range_search_p on the mapped file. Duplicate keys may continue from
+    // one node to the next, so the descent looks for the first key that is
+    // not less than k0 (instead of the last one not greater).
+
+    auto header = get_mapped_header(&(this->mapped));
+    if (header->root == NO_NODE) {
+        out->flush();
+        return;
+    }
+    const char* data = this->mapped.get_data();
+    auto nodes = reinterpret_cast<const MappedNode<MAX_WEIGHT>*>(
+        data + header->nodes_offset);
+    const char* records = data + header->records_offset;
+    size_t record_size = header->record_size;
+
+    uint32_t index = header->root;
+    while (nodes[index].next == index) {
+        size_t i = count_keys_lt(nodes[index].keys, MAX_WEIGHT, k0);
+        index = nodes[index].children[i];
+    }
+    auto exact = reinterpret_cast<const float*>(data + header->keys_offset);
+    switch ((LeafKeys) header->leaf_keys) {
+    case LeafKeys::FLOAT:
+        scan_mapped_leaves(nodes, index, records, record_size, k0, k1, out);
+        break;
+    case LeafKeys::DELTA16:
+        scan_packed_leaves<MAX_WEIGHT, uint16_t>(
+            nodes, index, records, record_size, exact, k0, k1, out);
+        break;
+    case LeafKeys::DELTA8:
+        scan_packed_leaves<MAX_WEIGHT, uint8_t>(
+            nodes, index, records, record_size, exact, k0, k1, out);
+        break;
+    }
+    out->flush();
 }
+
+template class BasicBPTree<19, 80>;
+template class BasicBPTree<39, 160>;
+template class BasicBPTree<83, 336>;
+template class BasicBPTree<339, 1360>;
+
+static_assert(sizeof(BPTreeNode<19>) == 256);
+static_assert(sizeof(BPTreeNode<39>) == 512);
+static_assert(sizeof(BPTreeNode<83>) == 1024);
+static_assert(sizeof(BPTreeNode<339>) == 4096);
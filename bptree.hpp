@@ -1,35 +1,258 @@
 #pragma once
 
 #include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "arena.hpp"
+#include "epoch.hpp"
+#include "mapped_file.hpp"
+#include "snapshot.hpp"
 
-class BaseBPTree {
+template<size_t Fanout>
+struct BPTreeNode;
+template<size_t Fanout>
+struct BPTreeWriter;
+
+// Receives what an iteration buffer collected, one buffer full at a time.
+// The tree itself is the sink of its iteration buffers unless they are
+// given another one, e.g. one per worker thread of a query batch.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    virtual void callback(void** buffer, size_t size) = 0;
+};
+
+// Turns the values of a tree into fixed-size records for a saved tree (see
+// BasicBPTree::save_p). A value may take several records, e.g. a set of
+// values under one key.
+class RecordPacker {
+public:
+    virtual ~RecordPacker() = default;
+    virtual size_t count_records(void* value) = 0;
+    // Write the records of `value` to `out`
+    virtual void pack(void* value, char* out) = 0;
+};
+
+// How the leaves of a saved tree hold their keys (see BasicBPTree::save_p).
+// Packed keys are steps between the smallest and the largest key of a leaf,
+// which fit several times as many keys into a leaf as floats do. Internal
+// nodes hold floats either way.
+enum class LeafKeys : unsigned char {
+    FLOAT,
+    DELTA16,
+    DELTA8,
+};
+
+// B+ tree mapping float keys to opaque pointers
+//
+// `Fanout` is the maximum number of keys in a node (MAX_WEIGHT); a node is
+// split before it gets full, so it holds at most Fanout - 1 keys at rest.
+// `BufferSize` is the number of results that an iteration buffer collects
+// before it calls `callback`.
+//
+// The member functions are defined in bptree.cpp and explicitly
+// instantiated there for the presets below.
+//
+// Thread-safe mode (`set_thread_safe`) lets any number of threads search
+// while writers modify the tree. Writers take turns on a lock that derived
+// classes hold around each of their modifying methods (`lock_for_writing`).
+// Readers do not lock anything: they read nodes optimistically and retry
+// when a node's version changed under them. Each reader thread needs an
+// iteration buffer of its own. A range search sees every key that stays in
+// the tree during the whole search; keys that come and go meanwhile may or
+// may not be seen.
+//
+// Outside of thread-safe mode, `snapshot` freezes the tree as it is: any
+// thread may search the snapshot without locks while one writer goes on
+// modifying the tree. Taking a snapshot is O(1); afterwards, the writer
+// copies each node that a snapshot can see before it modifies it (path
+// copying, O(height) copies per write), and keeps the originals until the
+// snapshots that see them are released.
+//
+// A tree can be saved to a file in which nodes refer to each other by
+// index, and which holds the values themselves, packed into records
+// (`save_p`). `map_p` maps such a file in place of the contents of the tree:
+// searches then run on the file as is, and return pointers to the records.
+// A mapped tree is read-only until it is cleared.
+template<size_t Fanout, size_t BufferSize>
+class BasicBPTree : protected ResultSink {
 public:
+    static constexpr size_t MAX_WEIGHT = Fanout;
+    static constexpr size_t MIN_WEIGHT = Fanout / 2 - 1;
+    static constexpr size_t BUFFER_SIZE = BufferSize;
+
+    static_assert(Fanout >= 6, "nodes must be able to split and merge");
+    static_assert(BufferSize >= 2 * Fanout,
+                  "the buffer must fit a whole leaf above its flush mark");
+
     class Acc;
-    struct Node;
-    virtual ~BaseBPTree();
+    using Node = BPTreeNode<Fanout>;
 
-    Acc* make_iteration_buffer();
+    // Where a range search that is read in batches stands (see
+    // open_range_p). A plain value: nothing to release.
+    struct Cursor {
+        Node* leaf;     // nullptr at the end
+        size_t index;   // of the next key in `leaf`
+        float k1;
+        // In a mapped tree, the records that are left instead
+        size_t next_record;
+        size_t end_record;
+    };
+    virtual ~BasicBPTree();
+
+    // Results go to `sink` if given, to `callback` otherwise
+    Acc* make_iteration_buffer(ResultSink* sink = nullptr);
     void destroy_iteration_buffer(Acc* acc);
+    bool is_empty();
+    // Remove everything in O(1), e.g. to rebuild the tree every frame
+    virtual void clear();
+
+    // Switch thread-safe mode on or off. Only while no other thread uses
+    // the tree, and while there are no snapshots. Walks the tree once.
+    void set_thread_safe(bool thread_safe);
+    bool is_thread_safe();
+
+    // Freeze the tree as it is now (not in thread-safe mode). Returns a
+    // handle with one reference; see Snapshot.
+    Snapshot* snapshot();
+
+    // Whether the contents are a mapped file (see map_p)
+    bool is_mapped();
+
+    // Number of leaves that range searches load ahead of the one they are
+    // in, along with what the values in range point to. 0 (the default)
+    // turns prefetching off; wide searches in trees that do not fit in the
+    // cache want a few. Applies to the plain leaf scan only, not in
+    // thread-safe mode or on snapshots.
+    void set_prefetch_distance(size_t leaves);
+    size_t get_prefetch_distance();
 
     // Unit test helpers
     void test_if_values_are_sorted(float since);
     void test_if_root_is_non_degenerate();
+    void test_if_nodes_are_not_underweight();
+
+    // Benchmark helpers
+    size_t get_height();
+    size_t get_node_bytes();
 
 protected:
-    BaseBPTree();
+    BasicBPTree();
 
     void* replace_p(float key, void* value);
-    void update_p(float old_key, float new_key);
+    void insert_batch_p(const float* keys, void* const* values,
+                        void** replaced, size_t n);
+    void bulk_load_p(const float* keys, void* const* values, size_t n,
+                     float fill_factor);
+    bool update_p(float old_key, float new_key, void* match_value,
+                  void** value_out);
     void delete_p(float key, void** value_out);
+    void* get_p(float key);
+    // The value under the largest key less than `key`, which goes to
+    // `key_out` if given. nullptr if there is no smaller key.
+    void* get_below_p(float key, float* key_out = nullptr);
     void search_p(float key, Acc* out);
     void range_search_p(float k0, float k1, Acc* out);
+    // Search a snapshot of this tree. Any thread, while it holds a reference.
+    void range_search_p(float k0, float k1, Acc* out,
+                        const Snapshot* snapshot);
+
+    // Range search that the caller reads in batches with next_batch_p,
+    // instead of through an iteration buffer. The tree must not be
+    // modified until the caller is done with the cursor. Not in thread-safe
+    // mode (throws std::logic_error).
+    Cursor open_range_p(float k0, float k1);
+    // Write the next values in range to out[0, cap), in key order. Returns
+    // how many there were; fewer than `cap` only at the end.
+    size_t next_batch_p(Cursor* cursor, void** out, size_t cap);
+
+    // Write the tree to `path`, with the values packed into records of
+    // `record_size` bytes. Equal keys are stored once per record. With
+    // packed leaf keys, the file also has the exact keys, which searches
+    // read only for the keys that are in the same step as a search bound.
+    void save_p(const char* path, size_t record_size, RecordPacker* packer,
+                LeafKeys leaf_keys = LeafKeys::FLOAT);
+    // Clear the tree and map the file at `path` in its place. Only while no
+    // other thread uses the tree. Throws std::runtime_error if the file
+    // cannot be mapped or was not saved by this kind of tree with records of
+    // `record_size` bytes. Every node is checked here, which reads the node
+    // part of the file once, so that searches of a damaged file never read
+    // outside it (their results may still be wrong).
+    void map_p(const char* path, size_t record_size);
 
     virtual void callback(void** buffer, size_t size) = 0;
 
+    // Thread-safe mode helpers for derived classes
+    //
+    // Hold the writer lock around every method that modifies the tree (a
+    // no-op unless thread-safe), and retire unlinked objects instead of
+    // releasing them, so that readers still looking at them are safe.
+    std::unique_lock<std::recursive_mutex> lock_for_writing();
+    void retire(void* object, SlabPool* pool);
+
+    // Snapshot helpers for derived classes
+    //
+    // While snapshots may see the tree, objects that hang off the tree must
+    // not be modified in place either: replace them with modified copies,
+    // and `retire` the originals.
+    bool has_snapshots();
+    bool values_are_shared();
+    // Objects that hang off the tree may be copied only when they change
+    // (path copying, as for nodes): stamp each with the generation it was
+    // made in, and copy it if it was stamped at or before the newest
+    // snapshot, which is 0 if there are none.
+    uint32_t get_generation();
+    uint32_t get_newest_snapshot();
+
+    // Searches that derived classes compile in themselves (see
+    // static_hitbox.hpp) may go down from this root and along the leaf
+    // links as they are, without any precautions. nullptr when they may
+    // not: in thread-safe mode, while the links are stale, or when mapped.
+    Node* get_scan_root();
+
 private:
-    Node* root;
+    BPTreeWriter<Fanout> start_write();
+    void search_optimistically(float k0, float k1, Acc* out);
+    void reset_nodes(uint32_t version);
+    void search_mapped(float k0, float k1, Acc* out);
+
+    std::atomic<Node*> root;
+    SlabPool node_pool;
+
+    // Thread-safe mode
+    bool thread_safe;
+    std::recursive_mutex write_mutex;
+    EpochManager epochs;
+    std::vector<Node*> latched;  // by the current writer
+
+    // Snapshots
+    SnapshotManager snapshots;
+    // Copied leaves are not linked from their left siblings, so searches go
+    // down from the root instead of along the leaves, until the last
+    // snapshot is gone and the leaves are linked up again
+    bool links_stale;
+
+    // The saved tree that replaces the nodes, if any
+    MappedFile mapped;
+
+    size_t prefetch_distance;
 };
 
+// Presets, named by node size. The fanouts are odd so that the version
+// counter fits next to the keys, and the leaf back link after it.
+using BPTree256 = BasicBPTree<19, 80>;     // hot indices that fit in L1
+using BPTree512 = BasicBPTree<39, 160>;
+using BPTree1K = BasicBPTree<83, 336>;
+using BPTree4K = BasicBPTree<339, 1360>;   // large, cold indices
+
+using BaseBPTree = BPTree256;
+
+extern template class BasicBPTree<19, 80>;
+extern template class BasicBPTree<39, 160>;
+extern template class BasicBPTree<83, 336>;
+extern template class BasicBPTree<339, 1360>;
+
 
 template<class T>
 constexpr bool struct_size_is_appropriate() {
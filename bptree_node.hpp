@@ -0,0 +1,31 @@
+#pragma once
+
+// The node layout of BasicBPTree, for the tree itself and for searches that
+// are compiled into the caller (see static_hitbox.hpp)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+template<size_t Fanout>
+struct alignas(64) BPTreeNode {
+    static constexpr size_t MIN_WEIGHT = Fanout / 2 - 1;
+
+    union {
+        BPTreeNode* next;
+        size_t index_of_next;
+    };
+    float keys[Fanout];
+    // In thread-safe mode: odd while a writer has the node latched. An
+    // unlinked node stays odd, so readers that still reach it retry.
+    // Otherwise: the generation that the node was made in (for snapshots).
+    std::atomic<uint32_t> version;
+    // Leaves only: the leaf before this one (nullptr for the first), kept
+    // in step with `next` while the leaf links are not stale
+    BPTreeNode* prev;
+    union {
+        void* p;
+        BPTreeNode* b;
+        size_t i;
+    } values[Fanout + 1];
+};
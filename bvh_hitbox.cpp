@@ -0,0 +1,345 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include "bvh_hitbox.hpp"
+
+struct BVHNode {
+    // Grown box for leaves, the union of the children for the others
+    Hitbox box;
+    BVHNode* parent;
+    BVHNode* children[2];
+    // 0 for leaves
+    int32_t height;
+    // Leaves only
+    float key;
+    Hitbox* value;
+
+    bool is_leaf() const { return this->height == 0; }
+};
+
+class BasicBVHHitboxIndex::Acc {
+public:
+    explicit Acc(BasicBVHHitboxIndex* owner) {
+        this->owner = owner;
+        this->size = 0;
+    }
+
+    void put(void* item) {
+        this->buffer[this->size] = item;
+        this->size++;
+        if (this->size == BUFFER_SIZE)
+            this->flush();
+    }
+
+    void flush() {
+        if (this->size > 0) {
+            this->owner->callback(this->buffer, this->size);
+            this->size = 0;
+        }
+    }
+
+    // The nodes yet to be visited by a search
+    std::vector<BVHNode*> stack;
+
+private:
+    BasicBVHHitboxIndex* owner;
+    size_t size;
+    void* buffer[BUFFER_SIZE];
+};
+
+static Hitbox union_of(const Hitbox& l, const Hitbox& r) {
+    return {std::min(l.a1, r.a1), std::max(l.b1, r.b1),
+            std::min(l.a2, r.a2), std::max(l.b2, r.b2)};
+}
+
+static float perimeter(const Hitbox& box) {
+    return 2 * ((box.b1 - box.a1) + (box.b2 - box.a2));
+}
+
+static bool box_contains(const Hitbox& outer, const Hitbox& inner) {
+    return outer.a1 <= inner.a1 && inner.b1 <= outer.b1
+           && outer.a2 <= inner.a2 && inner.b2 <= outer.b2;
+}
+
+static bool box_touches_ball(const Hitbox& box, float x, float y,
+                             float rad) {
+    float dx = std::max(std::max(box.a1 - x, x - box.b1), 0.0f);
+    float dy = std::max(std::max(box.a2 - y, y - box.b2), 0.0f);
+    return dx * dx + dy * dy <= rad * rad;
+}
+
+BasicBVHHitboxIndex::BasicBVHHitboxIndex(float margin)
+    : nodes(sizeof(BVHNode)) {
+    if (!(margin >= 0.0f) || isinf(margin))
+        throw std::invalid_argument("margin must be finite and not negative");
+    this->margin = margin;
+    this->root = nullptr;
+}
+
+BVHNode* BasicBVHHitboxIndex::make_leaf(float key, Hitbox* value) {
+    auto leaf = new (this->nodes.allocate()) BVHNode();
+    leaf->box = {value->a1 - this->margin, value->b1 + this->margin,
+                 value->a2 - this->margin, value->b2 + this->margin};
+    leaf->parent = nullptr;
+    leaf->children[0] = nullptr;
+    leaf->children[1] = nullptr;
+    leaf->height = 0;
+    leaf->key = key;
+    leaf->value = value;
+    return leaf;
+}
+
+void BasicBVHHitboxIndex::replace_child(BVHNode* parent, BVHNode* old_child,
+                                        BVHNode* new_child) {
+    // (nullptr as the parent means the root)
+    if (parent == nullptr)
+        this->root = new_child;
+    else if (parent->children[0] == old_child)
+        parent->children[0] = new_child;
+    else
+        parent->children[1] = new_child;
+}
+
+BVHNode* BasicBVHHitboxIndex::rotate(BVHNode* a) {
+    // If the children of `a` differ in height by more than 1, the taller
+    // one takes its place, and `a` takes the shorter grandchild below it.
+    // Returns the node in the place of `a`.
+    if (a->height < 2)
+        return a;
+    int32_t balance = a->children[1]->height - a->children[0]->height;
+    if (balance >= -1 && balance <= 1)
+        return a;
+
+    size_t up_side = (balance > 1) ? 1 : 0;
+    BVHNode* up = a->children[up_side];
+    BVHNode* stays = a->children[1 - up_side];
+    BVHNode* f = up->children[0];
+    BVHNode* g = up->children[1];
+
+    up->parent = a->parent;
+    this->replace_child(a->parent, a, up);
+    a->parent = up;
+    up->children[0] = a;
+    // The taller grandchild stays with `up`
+    BVHNode* kept = (f->height > g->height) ? f : g;
+    BVHNode* moved = (kept == f) ? g : f;
+    up->children[1] = kept;
+    a->children[up_side] = moved;
+    moved->parent = a;
+
+    a->box = union_of(stays->box, moved->box);
+    a->height = 1 + std::max(stays->height, moved->height);
+    up->box = union_of(a->box, kept->box);
+    up->height = 1 + std::max(a->height, kept->height);
+    return up;
+}
+
+void BasicBVHHitboxIndex::refit_from(BVHNode* node) {
+    // Rebalance `node` and the nodes above it, and bring their boxes and
+    // heights up to date
+    while (node != nullptr) {
+        BVHNode* l = node->children[0];
+        BVHNode* r = node->children[1];
+        node->box = union_of(l->box, r->box);
+        node->height = 1 + std::max(l->height, r->height);
+        node = this->rotate(node)->parent;
+    }
+}
+
+void BasicBVHHitboxIndex::insert_leaf(BVHNode* leaf) {
+    if (this->root == nullptr) {
+        leaf->parent = nullptr;
+        this->root = leaf;
+        return;
+    }
+
+    // Going down, the cost of pairing the leaf with a node is the perimeter
+    // of the new parent, plus what the boxes above it grow by. Stop where
+    // going further down cannot be cheaper.
+    const Hitbox& box = leaf->box;
+    BVHNode* node = this->root;
+    while (!node->is_leaf()) {
+        float combined = perimeter(union_of(node->box, box));
+        float cost = 2 * combined;
+        float inherited = 2 * (combined - perimeter(node->box));
+        float child_costs[2];
+        for (size_t i = 0; i < 2; i++) {
+            BVHNode* child = node->children[i];
+            child_costs[i] = perimeter(union_of(child->box, box)) + inherited;
+            if (!child->is_leaf())
+                child_costs[i] -= perimeter(child->box);
+        }
+        if (cost < child_costs[0] && cost < child_costs[1])
+            break;
+        node = node->children[child_costs[0] < child_costs[1] ? 0 : 1];
+    }
+
+    BVHNode* sibling = node;
+    auto parent = new (this->nodes.allocate()) BVHNode();
+    parent->parent = sibling->parent;
+    this->replace_child(sibling->parent, sibling, parent);
+    parent->children[0] = sibling;
+    parent->children[1] = leaf;
+    parent->key = 0.0f;
+    parent->value = nullptr;
+    sibling->parent = parent;
+    leaf->parent = parent;
+    this->refit_from(parent);
+}
+
+void BasicBVHHitboxIndex::remove_leaf(BVHNode* leaf) {
+    // The parent of the leaf goes too, its other child in its place
+    if (leaf == this->root) {
+        this->root = nullptr;
+        return;
+    }
+    BVHNode* parent = leaf->parent;
+    BVHNode* grandparent = parent->parent;
+    BVHNode* sibling = parent->children[parent->children[0] == leaf ? 1 : 0];
+    this->replace_child(grandparent, parent, sibling);
+    sibling->parent = grandparent;
+    this->nodes.release(parent);
+    this->refit_from(grandparent);
+}
+
+void BasicBVHHitboxIndex::insert(float key, Hitbox* value) {
+    if (this->leaves.count(value) > 0)
+        throw std::invalid_argument("already in the index");
+    BVHNode* leaf = this->make_leaf(key, value);
+    this->leaves[value] = leaf;
+    this->insert_leaf(leaf);
+}
+
+void BasicBVHHitboxIndex::update(float old_key, float new_key,
+                                 Hitbox* value) {
+    // Move `value` to its box now and to `new_key`. Nothing happens if the
+    // value is not stored under `old_key`.
+    auto it = this->leaves.find(value);
+    if (it == this->leaves.end() || it->second->key != old_key)
+        return;
+    BVHNode* leaf = it->second;
+    leaf->key = new_key;
+    if (box_contains(leaf->box, *value))
+        return;
+    this->remove_leaf(leaf);
+    this->nodes.release(leaf);
+    leaf = this->make_leaf(new_key, value);
+    it->second = leaf;
+    this->insert_leaf(leaf);
+}
+
+void BasicBVHHitboxIndex::del(float key, Hitbox* match_value) {
+    // Nothing happens if the value is not stored under `key`
+    auto it = this->leaves.find(match_value);
+    if (it == this->leaves.end() || it->second->key != key)
+        return;
+    this->remove_leaf(it->second);
+    this->nodes.release(it->second);
+    this->leaves.erase(it);
+}
+
+template<class Visit>
+void BasicBVHHitboxIndex::search(Acc* acc, Visit visit) {
+    // Depth first. `visit` tells whether to go below a node, or for a leaf,
+    // whether its hitbox is a result.
+    auto& stack = acc->stack;
+    stack.clear();
+    if (this->root != nullptr)
+        stack.push_back(this->root);
+    while (!stack.empty()) {
+        BVHNode* node = stack.back();
+        stack.pop_back();
+        if (!visit(node))
+            continue;
+        if (node->is_leaf()) {
+            acc->put(node->value);
+        } else {
+            stack.push_back(node->children[1]);
+            stack.push_back(node->children[0]);
+        }
+    }
+    acc->flush();
+}
+
+void BasicBVHHitboxIndex::ball_query(float x, float y, float rad, float R,
+                                     Acc* acc) {
+    this->search(acc, [&](BVHNode* node) {
+        return box_touches_ball(node->box, x, y, rad);
+    });
+}
+
+void BasicBVHHitboxIndex::ball_query(float mag, float rad, float R,
+                                     Acc* acc) {
+    float temp = rad + R;
+    this->range_search(mag - temp, mag + temp, acc);
+}
+
+void BasicBVHHitboxIndex::range_search(float k0, float k1, Acc* acc) {
+    this->search(acc, [&](BVHNode* node) {
+        return !node->is_leaf() || (k0 <= node->key && node->key <= k1);
+    });
+}
+
+BasicBVHHitboxIndex::Acc* BasicBVHHitboxIndex::make_iteration_buffer() {
+    return new Acc(this);
+}
+
+void BasicBVHHitboxIndex::destroy_iteration_buffer(Acc* acc) {
+    delete acc;
+}
+
+bool BasicBVHHitboxIndex::is_empty() {
+    return this->root == nullptr;
+}
+
+void BasicBVHHitboxIndex::clear() {
+    this->nodes.clear();
+    this->root = nullptr;
+    this->leaves.clear();
+}
+
+size_t BasicBVHHitboxIndex::get_height() {
+    return (this->root == nullptr) ? 0 : this->root->height + 1;
+}
+
+void BasicBVHHitboxIndex::test_if_tree_is_consistent() {
+    if (this->root == nullptr) {
+        if (!this->leaves.empty())
+            throw std::logic_error("leaves without a tree");
+        return;
+    }
+    if (this->root->parent != nullptr)
+        throw std::logic_error("root has a parent");
+
+    size_t num_leaves = 0;
+    std::vector<BVHNode*> stack = {this->root};
+    while (!stack.empty()) {
+        BVHNode* node = stack.back();
+        stack.pop_back();
+        if (node->is_leaf()) {
+            auto it = this->leaves.find(node->value);
+            if (it == this->leaves.end() || it->second != node)
+                throw std::logic_error("leaf is not where it was put");
+            if (!box_contains(node->box, *(node->value)))
+                throw std::logic_error("hitbox is out of its leaf");
+            num_leaves++;
+            continue;
+        }
+        BVHNode* l = node->children[0];
+        BVHNode* r = node->children[1];
+        if (l->parent != node || r->parent != node)
+            throw std::logic_error("wrong parent");
+        if (node->height != 1 + std::max(l->height, r->height))
+            throw std::logic_error("wrong height");
+        if (!box_contains(node->box, l->box)
+            || !box_contains(node->box, r->box))
+            throw std::logic_error("box does not cover its children");
+        stack.push_back(l);
+        stack.push_back(r);
+    }
+    if (num_leaves != this->leaves.size())
+        throw std::logic_error("wrong number of leaves");
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <unordered_map>
+#include "arena.hpp"
+#include "hitbox.hpp"
+
+struct BVHNode;
+
+// Hitbox index on a dynamic bounding volume hierarchy: a binary tree whose
+// leaves hold the hitboxes and whose internal nodes hold the union of the
+// boxes below them. For hitboxes of very different sizes, such as big
+// static colliders, whose key says little about their extent: a ball query
+// on magnitude keys needs an `R` as big as the biggest box. Swaps in for
+// HitboxIndex and GridHitboxIndex with the same methods and callback.
+//
+// Each leaf holds the box of its hitbox grown by `margin` on every side, as
+// of the last insert, or of the last update that moved the box out of it;
+// other updates cost a lookup. The caller changes a box first and then
+// calls update, even if its key stays the same. A new leaf goes down to the
+// sibling that grows the total perimeter of the tree the least (a surface
+// area heuristic), and the nodes above it are rebalanced by rotations.
+//
+// Nodes come from a slab pool of the index. Keys are kept for range
+// searches only. Each hitbox is in the index once. Single-threaded only.
+class BasicBVHHitboxIndex {
+public:
+    static constexpr size_t BUFFER_SIZE = 64;
+
+    class Acc;
+
+    void insert(float key, Hitbox* value);
+    void update(float old_key, float new_key, Hitbox* value);
+    void del(float key, Hitbox* match_value);
+
+    // The hitboxes whose grown box is within `rad` of (x, y). `R` is not
+    // needed, as the tree knows the extents; it is there so that callers
+    // of the other backends fit.
+    void ball_query(float x, float y, float rad, float R, Acc* acc);
+    // The same as a ball query of HitboxIndex: by key, so by range search
+    void ball_query(float mag, float rad, float R, Acc* acc);
+    // The hitboxes with keys in [k0, k1], in no particular order. Reads
+    // every leaf: the tree knows nothing of key order.
+    void range_search(float k0, float k1, Acc* acc);
+
+    Acc* make_iteration_buffer();
+    void destroy_iteration_buffer(Acc* acc);
+    bool is_empty();
+    void clear();
+
+    float get_margin() { return this->margin; }
+
+    // Unit test helpers
+    void test_if_tree_is_consistent();
+
+    // Benchmark helpers
+    size_t get_height();
+    size_t get_node_bytes() { return this->nodes.get_bytes_reserved(); }
+
+    virtual ~BasicBVHHitboxIndex() = default;
+
+protected:
+    // Base class is not to be used directly. Boxes are grown by `margin`:
+    // about how far a moving hitbox goes in a few updates, or 0 for static
+    // ones.
+    explicit BasicBVHHitboxIndex(float margin);
+
+    virtual void callback(void** buffer, size_t size) = 0;
+
+private:
+    BVHNode* make_leaf(float key, Hitbox* value);
+    void insert_leaf(BVHNode* leaf);
+    void remove_leaf(BVHNode* leaf);
+    BVHNode* rotate(BVHNode* a);
+    void refit_from(BVHNode* node);
+    void replace_child(BVHNode* parent, BVHNode* old_child,
+                       BVHNode* new_child);
+    template<class Visit>
+    void search(Acc* acc, Visit visit);
+
+    float margin;
+    SlabPool nodes;
+    BVHNode* root;
+    // The leaf of each hitbox
+    std::unordered_map<Hitbox*, BVHNode*> leaves;
+};
+
+template<class CRTP>
+class BVHHitboxIndex : public BasicBVHHitboxIndex {
+    // Implement this in your derived class
+    // void search_callback(HitboxIterator* iter);
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        HitboxIterator iter = HitboxIterator(buffer, size);
+        static_cast<CRTP*>(this)->search_callback(&iter);
+    }
+
+public:
+    explicit BVHHitboxIndex(float margin) : BasicBVHHitboxIndex(margin) {}
+    virtual ~BVHHitboxIndex() = default;
+};
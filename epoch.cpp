@@ -0,0 +1,69 @@
+#include <algorithm>
+#include "epoch.hpp"
+
+// Retired objects are collected in bulk once this many have piled up
+constexpr size_t COLLECT_THRESHOLD = 128;
+
+EpochManager::EpochManager() : global(1) {
+}
+
+void EpochManager::add_slot(EpochSlot* slot) {
+    std::lock_guard<std::mutex> guard(this->slots_mutex);
+    this->slots.push_back(slot);
+}
+
+void EpochManager::remove_slot(EpochSlot* slot) {
+    std::lock_guard<std::mutex> guard(this->slots_mutex);
+    auto it = std::find(this->slots.begin(), this->slots.end(), slot);
+    if (it != this->slots.end())
+        this->slots.erase(it);
+}
+
+bool EpochManager::try_advance() {
+    // Move on to the next epoch if every reader inside entered at the
+    // current one
+    uint64_t current = this->global.load(std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> guard(this->slots_mutex);
+        for (EpochSlot* slot : this->slots) {
+            uint64_t e = slot->epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e != current)
+                return false;
+        }
+    }
+    this->global.store(current + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+void EpochManager::retire(void* object, SlabPool* pool) {
+    uint64_t e = this->global.load(std::memory_order_seq_cst);
+    this->retired.push_back({e, object, pool});
+    if (this->retired.size() >= COLLECT_THRESHOLD)
+        this->collect();
+}
+
+void EpochManager::collect() {
+    this->try_advance();
+    uint64_t current = this->global.load(std::memory_order_seq_cst);
+
+    // `retired` is ordered by epoch; release the prefix that is old enough
+    size_t n = 0;
+    while (n < this->retired.size() && this->retired[n].epoch + 2 <= current) {
+        this->retired[n].pool->release(this->retired[n].object);
+        n++;
+    }
+    this->retired.erase(this->retired.begin(), this->retired.begin() + n);
+}
+
+void EpochManager::synchronize() {
+    // Two advances: the first waits for the readers that entered before the
+    // call, the second for those that raced with the first advance
+    for (int i = 0; i < 2; i++) {
+        while (!this->try_advance())
+            cpu_relax();
+    }
+}
+
+void EpochManager::forget_retired() {
+    this->retired.clear();
+}
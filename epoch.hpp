@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "arena.hpp"
+
+// Per-reader state for epoch-based reclamation. Padded to a cache line so
+// that readers on different cores do not share one.
+struct alignas(64) EpochSlot {
+    // The epoch the reader entered at, or 0 while it is not reading
+    std::atomic<uint64_t> epoch{0};
+};
+
+// Epoch-based reclamation for objects that lock-free readers may still be
+// looking at after a writer unlinked them.
+//
+// Readers bracket their reads with `enter` and `exit` on a slot of their own.
+// The writer (one at a time) hands unlinked objects to `retire`; an object is
+// released to its pool once every reader that could have seen it has left.
+// The global epoch only advances when every reader inside is at the current
+// epoch, so an object retired at epoch e is safe at epoch e + 2.
+class EpochManager {
+public:
+    EpochManager();
+    ~EpochManager() = default;
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Reader side
+    void add_slot(EpochSlot* slot);
+    void remove_slot(EpochSlot* slot);
+    void enter(EpochSlot* slot) {
+        slot->epoch.store(this->global.load(std::memory_order_relaxed),
+                          std::memory_order_seq_cst);
+    }
+    void exit(EpochSlot* slot) {
+        slot->epoch.store(0, std::memory_order_release);
+    }
+
+    // Writer side
+    void retire(void* object, SlabPool* pool);
+    // Release what no reader can see anymore
+    void collect();
+    // Wait until every reader that is inside has left
+    void synchronize();
+    // Drop the retired objects without releasing them, for when their pools
+    // are about to be cleared anyway
+    void forget_retired();
+
+    size_t get_num_retired() const { return this->retired.size(); }
+
+private:
+    struct Retired {
+        uint64_t epoch;
+        void* object;
+        SlabPool* pool;
+    };
+
+    bool try_advance();
+
+    std::atomic<uint64_t> global;
+    std::mutex slots_mutex;
+    std::vector<EpochSlot*> slots;
+    std::vector<Retired> retired;
+};
+
+// Keeps a reader inside an epoch for the lifetime of the guard
+class EpochGuard {
+public:
+    EpochGuard(EpochManager* epochs, EpochSlot* slot) {
+        this->epochs = epochs;
+        this->slot = slot;
+        epochs->enter(slot);
+    }
+    ~EpochGuard() {
+        this->epochs->exit(this->slot);
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+    EpochManager* epochs;
+    EpochSlot* slot;
+};
+
+// Spin-wait hint for the retry loops of optimistic readers
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
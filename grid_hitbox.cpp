@@ -0,0 +1,284 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include "grid_hitbox.hpp"
+#include "hash.hpp"
+
+constexpr size_t INITIAL_TABLE_SIZE = 64;
+// Cell coordinates are clamped to this, so that far away positions share
+// the outermost cells instead of overflowing
+constexpr float MAX_CELL = 1 << 30;
+
+class BasicGridHitboxIndex::Acc {
+public:
+    explicit Acc(BasicGridHitboxIndex* owner) {
+        this->owner = owner;
+        this->size = 0;
+    }
+
+    void put(void* item) {
+        this->buffer[this->size] = item;
+        this->size++;
+        if (this->size == BUFFER_SIZE)
+            this->flush();
+    }
+
+    void flush() {
+        if (this->size > 0) {
+            this->owner->callback(this->buffer, this->size);
+            this->size = 0;
+        }
+    }
+
+private:
+    BasicGridHitboxIndex* owner;
+    size_t size;
+    void* buffer[BUFFER_SIZE];
+};
+
+BasicGridHitboxIndex::BasicGridHitboxIndex(float cell_size) {
+    if (!(cell_size > 0.0f) || isinf(cell_size))
+        throw std::invalid_argument("cells need a finite positive size");
+    this->cell_size = cell_size;
+    this->cells.resize(INITIAL_TABLE_SIZE);
+    this->num_cells = 0;
+    this->num_entries = 0;
+}
+
+uint64_t BasicGridHitboxIndex::cell_key(int32_t cx, int32_t cy) {
+    return ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy;
+}
+
+int32_t BasicGridHitboxIndex::to_cell(float coordinate) {
+    float c = floorf(coordinate / this->cell_size);
+    // (NaN goes to the lowest cell)
+    if (!(c >= -MAX_CELL))
+        c = -MAX_CELL;
+    if (c > MAX_CELL)
+        c = MAX_CELL;
+    return (int32_t) c;
+}
+
+BasicGridHitboxIndex::Cell* BasicGridHitboxIndex::find_cell(int32_t cx,
+                                                            int32_t cy) {
+    // The cell, or nullptr if there is none. Removed cells leave no gaps in
+    // the probe sequences (see remove_cell), so probing stops at the first
+    // unused slot.
+    size_t mask = this->cells.size() - 1;
+    for (size_t i = hash_slot(cell_key(cx, cy), mask);; i = (i + 1) & mask) {
+        Cell* cell = &(this->cells[i]);
+        if (!cell->used)
+            return nullptr;
+        if (cell->cx == cx && cell->cy == cy)
+            return cell;
+    }
+}
+
+BasicGridHitboxIndex::Cell* BasicGridHitboxIndex::get_cell(int32_t cx,
+                                                           int32_t cy) {
+    // The cell, made if there is none
+    Cell* cell = this->find_cell(cx, cy);
+    if (cell != nullptr)
+        return cell;
+    if (2 * (this->num_cells + 1) > this->cells.size())
+        this->grow_table();
+    size_t mask = this->cells.size() - 1;
+    size_t i = hash_slot(cell_key(cx, cy), mask);
+    while (this->cells[i].used) {
+        i = (i + 1) & mask;
+    }
+    cell = &(this->cells[i]);
+    cell->used = true;
+    cell->cx = cx;
+    cell->cy = cy;
+    this->num_cells++;
+    return cell;
+}
+
+void BasicGridHitboxIndex::remove_cell(Cell* cell) {
+    // Free the slot of `cell`, without tombstones (see erase_slot)
+    auto& cells = this->cells;
+    size_t mask = cells.size() - 1;
+    size_t gap = erase_slot(
+        cells.data(), mask, cell - cells.data(),
+        [](const Cell& c) { return c.used; },
+        [&](const Cell& c) { return hash_slot(cell_key(c.cx, c.cy), mask); });
+    // (this frees the entry array as well)
+    cells[gap] = Cell();
+    this->num_cells--;
+}
+
+void BasicGridHitboxIndex::grow_table() {
+    // Twice the slots; the cells move, their entry arrays with them
+    std::vector<Cell> old(2 * this->cells.size());
+    old.swap(this->cells);
+    size_t mask = this->cells.size() - 1;
+    for (Cell& cell : old) {
+        if (!cell.used)
+            continue;
+        size_t i = hash_slot(cell_key(cell.cx, cell.cy), mask);
+        while (this->cells[i].used) {
+            i = (i + 1) & mask;
+        }
+        this->cells[i] = std::move(cell);
+    }
+}
+
+void BasicGridHitboxIndex::add_entry(float key, Hitbox* value) {
+    float x = (value->a1 + value->b1) / 2;
+    float y = (value->a2 + value->b2) / 2;
+    int32_t cx = this->to_cell(x), cy = this->to_cell(y);
+    this->get_cell(cx, cy)->entries.push_back({x, y, key, value});
+    this->located[value] = cell_key(cx, cy);
+    this->num_entries++;
+}
+
+void BasicGridHitboxIndex::remove_entry(Hitbox* value) {
+    // The entry of `value` goes, the last one of its cell in its place, and
+    // the cell goes if it was the only one
+    uint64_t key = this->located[value];
+    Cell* cell = this->find_cell((int32_t) (key >> 32), (int32_t) key);
+    auto& entries = cell->entries;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].value == value) {
+            entries[i] = entries.back();
+            entries.pop_back();
+            break;
+        }
+    }
+    if (entries.empty())
+        this->remove_cell(cell);
+    this->located.erase(value);
+    this->num_entries--;
+}
+
+void BasicGridHitboxIndex::insert(float key, Hitbox* value) {
+    if (this->located.count(value) > 0)
+        throw std::invalid_argument("already in the index");
+    this->add_entry(key, value);
+}
+
+void BasicGridHitboxIndex::update(float old_key, float new_key,
+                                  Hitbox* value) {
+    // Move `value` to its position now and to `new_key`. Nothing happens if
+    // the value is not stored under `old_key`.
+    auto it = this->located.find(value);
+    if (it == this->located.end())
+        return;
+    Cell* cell = this->find_cell((int32_t) (it->second >> 32),
+                                 (int32_t) it->second);
+    for (Entry& entry : cell->entries) {
+        if (entry.value != value)
+            continue;
+        if (entry.key != old_key)
+            return;
+        float x = (value->a1 + value->b1) / 2;
+        float y = (value->a2 + value->b2) / 2;
+        if (this->to_cell(x) == cell->cx && this->to_cell(y) == cell->cy) {
+            // common case: it stays in its cell
+            entry = {x, y, new_key, value};
+            return;
+        }
+        break;
+    }
+    this->remove_entry(value);
+    this->add_entry(new_key, value);
+}
+
+void BasicGridHitboxIndex::del(float key, Hitbox* match_value) {
+    // Nothing happens if the value is not stored under `key`
+    auto it = this->located.find(match_value);
+    if (it == this->located.end())
+        return;
+    Cell* cell = this->find_cell((int32_t) (it->second >> 32),
+                                 (int32_t) it->second);
+    for (Entry& entry : cell->entries) {
+        if (entry.value == match_value && entry.key == key) {
+            this->remove_entry(match_value);
+            return;
+        }
+    }
+}
+
+void BasicGridHitboxIndex::ball_query(float x, float y, float rad, float R,
+                                      Acc* acc) {
+    float reach = rad + R;
+    float reach2 = reach * reach;
+    auto visit = [&](const Cell& cell) {
+        for (const Entry& entry : cell.entries) {
+            float dx = entry.x - x, dy = entry.y - y;
+            if (dx * dx + dy * dy <= reach2)
+                acc->put(entry.value);
+        }
+    };
+
+    // The cells of the square around the ball, or if there are more of
+    // those than there are cells at all, every cell
+    int32_t x0 = this->to_cell(x - reach), x1 = this->to_cell(x + reach);
+    int32_t y0 = this->to_cell(y - reach), y1 = this->to_cell(y + reach);
+    double span = ((double) x1 - x0 + 1) * ((double) y1 - y0 + 1);
+    if (span > this->num_cells) {
+        for (const Cell& cell : this->cells) {
+            if (cell.used)
+                visit(cell);
+        }
+    } else {
+        for (int32_t cy = y0; cy <= y1; cy++) {
+            for (int32_t cx = x0; cx <= x1; cx++) {
+                Cell* cell = this->find_cell(cx, cy);
+                if (cell != nullptr)
+                    visit(*cell);
+            }
+        }
+    }
+    acc->flush();
+}
+
+void BasicGridHitboxIndex::ball_query(float mag, float rad, float R,
+                                      Acc* acc) {
+    float temp = rad + R;
+    this->range_search(mag - temp, mag + temp, acc);
+}
+
+void BasicGridHitboxIndex::range_search(float k0, float k1, Acc* acc) {
+    for (const Cell& cell : this->cells) {
+        if (!cell.used)
+            continue;
+        for (const Entry& entry : cell.entries) {
+            if (k0 <= entry.key && entry.key <= k1)
+                acc->put(entry.value);
+        }
+    }
+    acc->flush();
+}
+
+BasicGridHitboxIndex::Acc* BasicGridHitboxIndex::make_iteration_buffer() {
+    return new Acc(this);
+}
+
+void BasicGridHitboxIndex::destroy_iteration_buffer(Acc* acc) {
+    delete acc;
+}
+
+bool BasicGridHitboxIndex::is_empty() {
+    return this->num_entries == 0;
+}
+
+void BasicGridHitboxIndex::clear() {
+    this->cells.clear();
+    this->cells.resize(INITIAL_TABLE_SIZE);
+    this->num_cells = 0;
+    this->num_entries = 0;
+    this->located.clear();
+}
+
+size_t BasicGridHitboxIndex::get_node_bytes() {
+    size_t bytes = this->cells.size() * sizeof(Cell);
+    for (const Cell& cell : this->cells) {
+        bytes += cell.entries.capacity() * sizeof(Entry);
+    }
+    return bytes;
+}
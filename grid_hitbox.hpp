@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "hitbox.hpp"
+
+// Hitbox index on a uniform grid of square cells, found by a spatial hash:
+// for dense scenes of objects of about one size, where a ball query on
+// magnitude keys gets whole rings. Swaps in for HitboxIndex: the same
+// methods with the same keys, and GridHitboxIndex has the same callback.
+//
+// The position of a hitbox is the center of its box, as of the last insert
+// or update; the caller changes a box first and then calls update, even if
+// its key stays the same. Keys are kept for range searches only. A ball
+// query centered at (x, y) reads the cells that the ball and a margin of
+// `R` overlap, and returns the hitboxes whose position is within rad + R.
+//
+// Cells live in a table with open addressing (linear probing), each with
+// the positions, keys and hitboxes of its entries in one array, so that
+// they are filtered without following any pointer. Each hitbox is in the
+// index once. Single-threaded only.
+class BasicGridHitboxIndex {
+public:
+    static constexpr size_t BUFFER_SIZE = 64;
+
+    class Acc;
+
+    void insert(float key, Hitbox* value);
+    void update(float old_key, float new_key, Hitbox* value);
+    void del(float key, Hitbox* match_value);
+
+    // The hitboxes whose position is within rad + R of (x, y)
+    void ball_query(float x, float y, float rad, float R, Acc* acc);
+    // The same as a ball query of HitboxIndex: by key, so by range search
+    void ball_query(float mag, float rad, float R, Acc* acc);
+    // The hitboxes with keys in [k0, k1], in no particular order. Reads
+    // every cell: the grid knows nothing of key order.
+    void range_search(float k0, float k1, Acc* acc);
+
+    Acc* make_iteration_buffer();
+    void destroy_iteration_buffer(Acc* acc);
+    bool is_empty();
+    void clear();
+
+    float get_cell_size() { return this->cell_size; }
+
+    // Benchmark helpers
+    size_t get_num_cells() { return this->num_cells; }
+    size_t get_node_bytes();
+
+    virtual ~BasicGridHitboxIndex() = default;
+
+protected:
+    // Base class is not to be used directly. Cells are squares of
+    // `cell_size`: about the size of the objects, or of the balls.
+    explicit BasicGridHitboxIndex(float cell_size);
+
+    virtual void callback(void** buffer, size_t size) = 0;
+
+private:
+    struct Entry {
+        float x, y;
+        float key;
+        Hitbox* value;
+    };
+
+    struct Cell {
+        bool used = false;
+        int32_t cx = 0, cy = 0;
+        // never empty: a cell goes along with its last entry
+        std::vector<Entry> entries;
+    };
+
+    static uint64_t cell_key(int32_t cx, int32_t cy);
+    int32_t to_cell(float coordinate);
+    Cell* find_cell(int32_t cx, int32_t cy);
+    Cell* get_cell(int32_t cx, int32_t cy);
+    void remove_cell(Cell* cell);
+    void grow_table();
+    void add_entry(float key, Hitbox* value);
+    void remove_entry(Hitbox* value);
+
+    float cell_size;
+    std::vector<Cell> cells;  // size is a power of 2
+    size_t num_cells;  // in use
+    size_t num_entries;
+    // Which cell each hitbox is in
+    std::unordered_map<Hitbox*, uint64_t> located;
+};
+
+template<class CRTP>
+class GridHitboxIndex : public BasicGridHitboxIndex {
+    // Implement this in your derived class
+    // void search_callback(HitboxIterator* iter);
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        HitboxIterator iter = HitboxIterator(buffer, size);
+        static_cast<CRTP*>(this)->search_callback(&iter);
+    }
+
+public:
+    explicit GridHitboxIndex(float cell_size)
+        : BasicGridHitboxIndex(cell_size) {}
+    virtual ~GridHitboxIndex() = default;
+};
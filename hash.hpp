@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+// Home slot of `key` in an open-addressing table of mask + 1 slots, a power
+// of 2. Fibonacci hashing: the high bits of the product mix all of the key,
+// so keys that differ only in their low bits (such as aligned pointers)
+// still spread out.
+inline size_t hash_slot(uint64_t key, size_t mask) {
+    return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+}
+
+// Free slot `gap` of an open-addressing table with linear probing, of
+// mask + 1 slots. The slots after it that probed past it move back into
+// the gap, so that lookups need no tombstones. `is_used(slot)` tells the
+// slots in use, and `home_of(slot)` is the home slot of one. Returns the
+// slot that ends up free, for the caller to clear.
+template<class T, class IsUsed, class HomeOf>
+inline size_t erase_slot(T* slots, size_t mask, size_t gap, IsUsed is_used,
+                         HomeOf home_of) {
+    for (size_t j = (gap + 1) & mask; is_used(slots[j]); j = (j + 1) & mask) {
+        size_t home = home_of(slots[j]);
+        // whether `home` is in (gap, j], going around the end
+        bool stays = (gap <= j) ? (gap < home && home <= j)
+                                : (gap < home || home <= j);
+        if (!stays) {
+            slots[gap] = std::move(slots[j]);
+            gap = j;
+        }
+    }
+    return gap;
+}
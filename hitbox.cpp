@@ -1,105 +1,299 @@
+#include <float.h>
 #include <math.h>
 #include <stddef.h>
-#ifdef DEBUG
+#include <stdint.h>
+#include <string.h>
+#include <new>
 #include <stdexcept>
-#endif
+#include <algorithm>
+#include <utility>
+#include <vector>
 #include "bptree.hpp"
+#include "bptree_node.hpp"
+#include "hash.hpp"
 #include "hitbox.hpp"
+#include "hitbox_set.hpp"
+#include "keysearch.hpp"
 
-constexpr size_t NODE_DATA_SIZE = 6;
-constexpr size_t HEADER_DATA_SIZE = 5;
+struct SetIndex {
+    // Open addressing with linear probing, at most half full. A slot holds
+    // a hitbox and where it is in the set: the address of its set node with
+    // its index in the node in the low bits, or only the index if it is in
+    // the header.
+    struct Slot {
+        Hitbox* value;  // nullptr if free
+        uintptr_t where;
+    };
 
-
-struct alignas(64) SetNode {
-    Hitbox* data[NODE_DATA_SIZE];
-    SetNode* next;
-    SetNode* prev;
+    // All indices of the pools, so that clearing them drops every index
+    SetIndex* prev;
+    SetIndex* next;
+    size_t size;
+    std::vector<Slot> slots;  // size is a power of 2
 };
 
-struct alignas(64) SetHeader {
-    float label;
-    unsigned char length_of_last_node;
-    SetNode* first;
-    SetNode* last;
-    Hitbox* data[HEADER_DATA_SIZE];
-};
+// (set nodes are aligned, so the low bits of their addresses are free)
+constexpr uintptr_t WHERE_INDEX_MASK = alignof(SetNode) - 1;
+static_assert(NODE_DATA_SIZE <= WHERE_INDEX_MASK);
 
-union MaybeHitbox {
-    float label;
-    Hitbox hb;
-    SetHeader s;
-};
+SetPools::SetPools() : headers(sizeof(SetHeader)), nodes(sizeof(SetNode)) {
+    this->indices = nullptr;
+}
+
+SetPools::~SetPools() {
+    this->drop_indices();
+}
+
+void SetPools::drop_indices() {
+    // Only along with every set: the headers still point to their indices
+    SetIndex* curr = this->indices;
+    while (curr != nullptr) {
+        SetIndex* next = curr->next;
+        delete curr;
+        curr = next;
+    }
+    this->indices = nullptr;
+}
+
+static uintptr_t encode_where(SetNode* node, size_t i) {
+    return reinterpret_cast<uintptr_t>(node) | i;
+}
+
+static SetNode* node_of(uintptr_t where) {
+    return reinterpret_cast<SetNode*>(where & ~WHERE_INDEX_MASK);
+}
+
+static size_t hash_hitbox(Hitbox* value, size_t mask) {
+    return hash_slot(reinterpret_cast<uintptr_t>(value), mask);
+}
+
+static SetIndex::Slot* find_slot(SetIndex* index, Hitbox* value) {
+    // The slot of `value`, or the free slot where it would go
+    size_t mask = index->slots.size() - 1;
+    for (size_t i = hash_hitbox(value, mask);; i = (i + 1) & mask) {
+        SetIndex::Slot* slot = &(index->slots[i]);
+        if (slot->value == value || slot->value == nullptr)
+            return slot;
+    }
+}
+
+static void index_put(SetIndex* index, Hitbox* value, uintptr_t where) {
+    // Add `value`, or move it if it is there already
+    if (2 * (index->size + 1) > index->slots.size()) {
+        std::vector<SetIndex::Slot> old(2 * index->slots.size(),
+                                        SetIndex::Slot{nullptr, 0});
+        old.swap(index->slots);
+        for (const SetIndex::Slot& slot : old) {
+            if (slot.value != nullptr)
+                *find_slot(index, slot.value) = slot;
+        }
+    }
+    SetIndex::Slot* slot = find_slot(index, value);
+    if (slot->value == nullptr) {
+        slot->value = value;
+        index->size++;
+    }
+    slot->where = where;
+}
 
-constexpr bool structs_are_aligned() {
-    return offsetof(Hitbox, a1) == 0
-        && offsetof(SetHeader, label) == 0
-        && offsetof(MaybeHitbox, label) == 0
-        && offsetof(MaybeHitbox, hb) == 0
-        && offsetof(MaybeHitbox, s) == 0;
+static void index_erase(SetIndex* index, Hitbox* value) {
+    // Free the slot of `value`, without tombstones (see erase_slot)
+    auto& slots = index->slots;
+    size_t mask = slots.size() - 1;
+    SetIndex::Slot* slot = find_slot(index, value);
+    if (slot->value == nullptr)
+        return;
+    size_t gap = erase_slot(
+        slots.data(), mask, slot - slots.data(),
+        [](const SetIndex::Slot& s) { return s.value != nullptr; },
+        [&](const SetIndex::Slot& s) { return hash_hitbox(s.value, mask); });
+    slots[gap] = {nullptr, 0};
+    index->size--;
 }
-static_assert(structs_are_aligned());
-static_assert(struct_size_is_appropriate<SetNode>());
-static_assert(struct_size_is_appropriate<SetHeader>());
 
+struct SetWriter {
+    // What the modifying paths of sets need. Objects stamped at or before
+    // `newest` (0 if nothing is) may be seen by readers, so they are copied
+    // before they change, along with the nodes in front of them (path
+    // copying, as for tree nodes). The originals are collected in
+    // `unlinked`, for the index to retire.
+    SetPools* pools;
+    uint32_t generation;  // to stamp new headers and nodes with
+    uint32_t newest;
+    std::vector<std::pair<void*, SlabPool*>> unlinked;
+};
+
+// In thread-safe mode, readers may be in any set of the tree, so all of
+// them are frozen. Objects that the current write makes are stamped with
+// this, and restamped with 0 (age not known, see SnapshotManager::retire)
+// once they are in the tree.
+constexpr uint32_t MADE_BY_THIS_WRITE = UINT32_MAX;
+
+static bool is_frozen(const SetWriter* w, uint32_t birth) {
+    return w->newest != 0 && birth <= w->newest;
+}
 
-static SetHeader* make_set_header(Hitbox* initial_element) {
-    auto result = new SetHeader();
+static SetHeader* make_set_header(Hitbox* initial_element, SetWriter* w) {
+    auto result = new (w->pools->headers.allocate()) SetHeader();
     result->label = NAN;
     result->length_of_last_node = 1;
-    result->first = nullptr;
+    result->birth = w->generation;
     result->last = nullptr;
+    result->index = nullptr;
     result->data[0] = initial_element;
     return result;
 }
 
-static SetNode* make_set_node(Hitbox* value, SetNode* next, SetNode* prev) {
-    auto result = new SetNode();
-    result->next = next;
+static SetNode* make_set_node(Hitbox* value, SetNode* prev, SetWriter* w) {
+    auto result = new (w->pools->nodes.allocate()) SetNode();
     result->prev = prev;
+    result->birth = w->generation;
     result->data[0] = value;
     return result;
 }
 
-static void delete_set_header(SetHeader* self) {
-    delete self;
+static void build_index(SetHeader* self, SetPools* pools) {
+    auto index = new SetIndex();
+    index->prev = nullptr;
+    index->next = pools->indices;
+    if (index->next != nullptr)
+        index->next->prev = index;
+    pools->indices = index;
+    index->size = 0;
+    index->slots.assign(4 * SET_INDEX_MIN_SIZE, SetIndex::Slot{nullptr, 0});
+    self->index = index;
+
+    size_t size = length_of(self, nullptr);
+    for (size_t i = 0; i < size; i++) {
+        index_put(index, self->data[i], encode_where(nullptr, i));
+    }
+    for (SetNode* curr = self->last; curr != nullptr; curr = curr->prev) {
+        size = length_of(self, curr);
+        for (size_t i = 0; i < size; i++) {
+            index_put(index, curr->data[i], encode_where(curr, i));
+        }
+    }
 }
 
-static void delete_set_node(SetNode* self) {
-    delete self;
+static void drop_index(SetHeader* self, SetPools* pools) {
+    SetIndex* index = self->index;
+    if (index == nullptr)
+        return;
+    if (index->prev != nullptr)
+        index->prev->next = index->next;
+    else
+        pools->indices = index->next;
+    if (index->next != nullptr)
+        index->next->prev = index->prev;
+    delete index;
+    self->index = nullptr;
 }
 
-static void add(SetHeader* self, Hitbox* value) {
-    if (self->last == nullptr) {
-        if (self->length_of_last_node < HEADER_DATA_SIZE) {
-            self->data[self->length_of_last_node] = value;
-            self->length_of_last_node++;
-        } else {
-            auto new_node = make_set_node(value, nullptr, nullptr);
-            self->length_of_last_node = 1;
-            self->first = new_node;
-            self->last = new_node;
+static void delete_set_header(SetHeader* self, SetPools* pools) {
+    drop_index(self, pools);
+    pools->headers.release(self);
+}
+
+static void delete_set_node(SetNode* self, SetPools* pools) {
+    pools->nodes.release(self);
+}
+
+static SetHeader* own_header(SetHeader* self, SetWriter* w) {
+    // Copy-on-write: return a header that the writer may modify in place,
+    // which is `self` unless a snapshot can see it. The copy takes over the
+    // index, which readers do not use (the original keeps a pointer to it
+    // that nothing follows). The caller puts the copy in the tree in place
+    // of `self`.
+    if (!is_frozen(w, self->birth))
+        return self;
+    auto copy = new (w->pools->headers.allocate()) SetHeader(*self);
+    copy->birth = w->generation;
+    w->unlinked.push_back({self, &(w->pools->headers)});
+    return copy;
+}
+
+static SetNode* own_node(SetHeader* self, SetNode* node, SetWriter* w) {
+    // The same for a node of `self`, whose header the writer owns already.
+    // A copy is linked in place of `node`, and so are copies of the frozen
+    // nodes in front of it; usually `node` is the one added last, which
+    // the header links to directly.
+    if (!is_frozen(w, node->birth))
+        return node;
+    SetNode** link = &(self->last);
+    while (true) {
+        SetNode* curr = *link;
+        bool found = curr == node;
+        if (is_frozen(w, curr->birth)) {
+            auto copy = new (w->pools->nodes.allocate()) SetNode(*curr);
+            copy->birth = w->generation;
+            if (self->index != nullptr) {
+                size_t size = length_of(self, curr);
+                for (size_t i = 0; i < size; i++) {
+                    index_put(self->index, copy->data[i],
+                              encode_where(copy, i));
+                }
+            }
+            w->unlinked.push_back({curr, &(w->pools->nodes)});
+            *link = copy;
+            curr = copy;
         }
-    } else {
-        if (self->length_of_last_node < NODE_DATA_SIZE) {
-            self->last->data[self->length_of_last_node] = value;
-            self->length_of_last_node++;
+        if (found)
+            return curr;
+        link = &(curr->prev);
+    }
+}
+
+static void unlink_node(SetNode* node, SetWriter* w) {
+    // Recycle a node that left its set: now, unless a snapshot can see it
+    if (is_frozen(w, node->birth))
+        w->unlinked.push_back({node, &(w->pools->nodes)});
+    else
+        delete_set_node(node, w->pools);
+}
+
+static size_t count_values(SetHeader* self) {
+    if (self->last == nullptr)
+        return self->length_of_last_node;
+    size_t count = HEADER_DATA_SIZE + self->length_of_last_node;
+    for (SetNode* curr = self->last->prev; curr != nullptr;
+         curr = curr->prev) {
+        count += NODE_DATA_SIZE;
+    }
+    return count;
+}
+
+static void add(SetHeader* self, Hitbox* value, SetWriter* w) {
+    // The value goes at the end: into the header or the node added last,
+    // or a new node. Where it went is `node` (nullptr for the header) and
+    // `i`. The writer owns `self`.
+    SetNode* node = self->last;
+    size_t i = self->length_of_last_node;
+    bool full = i == ((node == nullptr) ? HEADER_DATA_SIZE : NODE_DATA_SIZE);
+    if (!full) {
+        if (node == nullptr) {
+            self->data[i] = value;
         } else {
-            auto new_node = make_set_node(value, nullptr, self->last);
-            self->last->next = new_node;
-            self->last = new_node;
-            self->length_of_last_node = 1;
+            node = own_node(self, node, w);
+            node->data[i] = value;
         }
+        self->length_of_last_node++;
+    } else {
+        node = make_set_node(value, self->last, w);
+        i = 0;
+        self->last = node;
+        self->length_of_last_node = 1;
     }
+
+    if (self->index != nullptr)
+        index_put(self->index, value, encode_where(node, i));
+    else if (full && count_values(self) >= SET_INDEX_MIN_SIZE)
+        build_index(self, w->pools);
 }
 
 static bool is_singleton(SetHeader* self) {
     return self->last == nullptr && self->length_of_last_node == 1;
 }
 
-static bool is_empty(SetHeader* self) {
-    return self->last == nullptr && self->length_of_last_node == 0;
-}
-
 template<class T, class V>
 static int find_in_node(T* self, V value, size_t size) {
     for (size_t i = 0; i < size; i++) {
@@ -117,75 +311,174 @@ static SetNode* find(SetHeader* self, Hitbox* value, size_t* idxout) {
     //
     // Behavior is undefined if the value is not in the set.
 
-    size_t size = HEADER_DATA_SIZE;
-    if (self->last == nullptr)
-        size = self->length_of_last_node;
+    if (self->index != nullptr) {
+        SetIndex::Slot* slot = find_slot(self->index, value);
+#ifdef DEBUG
+        if (slot->value == nullptr)
+            throw std::logic_error("value not found");
+#endif
+        *idxout = slot->where & WHERE_INDEX_MASK;
+        return node_of(slot->where);
+    }
 
     // iterate through the header first
     int idx;
-    idx = find_in_node(self, value, size);
+    idx = find_in_node(self, value, length_of(self, nullptr));
     if (idx >= 0) {
         *idxout = idx;
         return nullptr;
     }
 
-#ifdef DEBUG
-    if (self->last == nullptr)
-        throw std::logic_error("value not found");
-#endif
-
     // iterate through set nodes
-    SetNode* curr = self->first;
-    while (curr->next != nullptr) {
-        idx = find_in_node(curr, value, NODE_DATA_SIZE);
+    for (SetNode* curr = self->last; curr != nullptr; curr = curr->prev) {
+        idx = find_in_node(curr, value, length_of(self, curr));
         if (idx >= 0) {
             *idxout = idx;
             return curr;
         }
     }
-    // last set node
-    idx = find_in_node(curr, value, self->length_of_last_node);
 #ifdef DEBUG
-    if (idx == -1)
-        throw std::logic_error("value not found");
+    throw std::logic_error("value not found");
 #endif
-    *idxout = idx;
-    return curr;
+    *idxout = 0;
+    return nullptr;
+}
+
+static bool contains(SetHeader* self, Hitbox* value) {
+    if (self->index != nullptr)
+        return find_slot(self->index, value)->value != nullptr;
+    if (find_in_node(self, value, length_of(self, nullptr)) >= 0)
+        return true;
+    for (SetNode* curr = self->last; curr != nullptr; curr = curr->prev) {
+        if (find_in_node(curr, value, length_of(self, curr)) >= 0)
+            return true;
+    }
+    return false;
 }
 
-static void del(SetHeader* self, Hitbox* value) {
-    // Delete a value from the set
+static void del(SetHeader* self, Hitbox* value, SetWriter* w) {
+    // Delete a value from the set, whose header the writer owns
     // Behavior is undefined if the value is not in the set
 
     // find the value
     size_t idx = 0;
     SetNode* node = find(self, value, &idx);
+    if (node != nullptr)
+        node = own_node(self, node, w);
+
+    // the last value moves into the gap
+    SetNode* last = self->last;
+    Hitbox* new_value = (last == nullptr)
+        ? self->data[self->length_of_last_node - 1]
+        : last->data[self->length_of_last_node - 1];
+    if (self->index != nullptr) {
+        if (new_value != value)
+            index_put(self->index, new_value, encode_where(node, idx));
+        index_erase(self->index, value);
+        if (self->index->size < SET_INDEX_MIN_SIZE / 2)
+            drop_index(self, w->pools);
+    }
 
     // fill the gap
-    if (self->last == nullptr) {
-        // only need to modify the header
-        self->data[idx] = self->data[self->length_of_last_node - 1];
-        self->length_of_last_node--;
+    if (node == nullptr)
+        self->data[idx] = new_value;
+    else
+        node->data[idx] = new_value;
+    // shrink the node added last, or let go of it
+    if (last != nullptr && self->length_of_last_node == 1) {
+        self->last = last->prev;
+        unlink_node(last, w);
+        // the node before it (or the header) is full
+        self->length_of_last_node = (self->last == nullptr)
+            ? HEADER_DATA_SIZE
+            : NODE_DATA_SIZE;
     } else {
-        // move the last value into the gap
-        Hitbox* new_value = self->last->data[self->length_of_last_node - 1];
-        if (node == nullptr)
-            self->data[idx] = new_value;
+        self->length_of_last_node--;
+    }
+}
+
+static void add_all(SetHeader* self, SetHeader* other, SetWriter* w) {
+    // Move every value of `other` into `self`, then free `other`, which no
+    // snapshot can see
+
+    for_each_value(other, [&](Hitbox* value) { add(self, value, w); });
+    SetNode* curr = other->last;
+    while (curr != nullptr) {
+        SetNode* prev = curr->prev;
+        delete_set_node(curr, w->pools);
+        curr = prev;
+    }
+    delete_set_header(other, w->pools);
+}
+
+static void* merge_values(void* old_value, void* new_value, SetWriter* w) {
+    // Combine two values stored under the same key. Either of them may be a
+    // single hitbox or a set; a new set is not in the tree yet. Return the
+    // value to store under the key, which may be a copy of the old set.
+
+    auto old_maybe = static_cast<MaybeHitbox*>(old_value);
+    auto new_maybe = static_cast<MaybeHitbox*>(new_value);
+    if (isnan(old_maybe->label)) {
+        SetHeader* set = own_header(&(old_maybe->s), w);
+        if (isnan(new_maybe->label))
+            add_all(set, &(new_maybe->s), w);
         else
-            node->data[idx] = new_value;
-        // shrink node or delete node
-        if (self->length_of_last_node == 1) {
-            auto to_be_freed = self->last;
-            self->last = self->last->prev;
-            if (self->last == nullptr)
-                self->first = nullptr;
-            else
-                self->last->next = nullptr;
-            delete_set_node(to_be_freed);
-            self->length_of_last_node = NODE_DATA_SIZE;
+            add(set, &(new_maybe->hb), w);
+        return set;
+    } else if (isnan(new_maybe->label)) {
+        add(&(new_maybe->s), &(old_maybe->hb), w);
+        return new_maybe;
+    } else {
+        auto new_set = make_set_header(&(old_maybe->hb), w);
+        add(new_set, &(new_maybe->hb), w);
+        return new_set;
+    }
+}
+
+static void settle(void* value, SetWriter* w) {
+    // In thread-safe mode, freeze the objects that this write made for a
+    // value that it put in the tree. They are the header and the nodes in
+    // front of the first one that was there before.
+    auto maybe = static_cast<MaybeHitbox*>(value);
+    if (w->generation != MADE_BY_THIS_WRITE || !isnan(maybe->label))
+        return;
+    SetHeader* set = &(maybe->s);
+    if (set->birth != MADE_BY_THIS_WRITE)
+        return;
+    set->birth = 0;
+    for (SetNode* curr = set->last;
+         curr != nullptr && curr->birth == MADE_BY_THIS_WRITE;
+         curr = curr->prev) {
+        curr->birth = 0;
+    }
+}
+
+static void group_equal_keys(const float* keys, Hitbox* const* values,
+                             size_t n, std::vector<float>* keys_out,
+                             std::vector<void*>* values_out,
+                             SetWriter* w) {
+    // Collapse runs of equal keys (in sorted input) into one entry each. A
+    // run of more than one hitbox becomes a set.
+
+    keys_out->reserve(n);
+    values_out->reserve(n);
+
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && keys[j] == keys[i])
+            j++;
+        if (j - i == 1) {
+            values_out->push_back(values[i]);
         } else {
-            self->length_of_last_node--;
+            auto new_set = make_set_header(values[i], w);
+            for (size_t k = i + 1; k < j; k++) {
+                add(new_set, values[k], w);
+            }
+            values_out->push_back(new_set);
         }
+        keys_out->push_back(keys[i]);
+        i = j;
     }
 }
 
@@ -221,7 +514,7 @@ void HitboxIterator::to_state_in_set_header(void* pointer) {
     this->pointer = pointer;
     auto header = static_cast<SetHeader*>(pointer);
     this->length_of_last_node = header->length_of_last_node;
-    if (header->first == nullptr) {
+    if (header->last == nullptr) {
         this->counter = this->length_of_last_node;
     } else {
         this->counter = HEADER_DATA_SIZE;
@@ -233,15 +526,13 @@ void HitboxIterator::to_state_in_buffer() {
     this->index_buf++;
 }
 
-void HitboxIterator::to_state_in_set_node(void* pointer) {
+void HitboxIterator::to_state_in_set_node(void* pointer,
+                                          unsigned char size) {
+    // Nodes come in the order of the chain, from the one added last, which
+    // holds `length_of_last_node` hitboxes
     this->state = IN_SET_NODE;
     this->pointer = pointer;
-    auto node = static_cast<SetNode*>(pointer);
-    if (node->next == nullptr) {
-        this->counter = this->length_of_last_node;
-    } else {
-        this->counter = NODE_DATA_SIZE;
-    }
+    this->counter = size;
 }
 
 int HitboxIterator::generate_input() {
@@ -271,13 +562,14 @@ int HitboxIterator::generate_input() {
             this->holding_slot = header->data[counter - 1];
             this->counter--;
             return CHAR_ELEMENT;
-        } else if (header->first == nullptr) {
+        } else if (header->last == nullptr) {
             // there are not set nodes
             this->to_state_in_buffer();
             return CHAR_CLOSE;
         } else {
             // go to the first set node
-            this->to_state_in_set_node(header->first);
+            this->to_state_in_set_node(header->last,
+                                       this->length_of_last_node);
             return CHAR_COLON;
         }
     }
@@ -289,13 +581,13 @@ int HitboxIterator::generate_input() {
             this->holding_slot = node->data[counter - 1];
             this->counter--;
             return CHAR_ELEMENT;
-        } else if (node->next == nullptr) {
+        } else if (node->prev == nullptr) {
             // this is the last node
             this->to_state_in_buffer();
             return CHAR_CLOSE;
         } else {
             // go to the next node
-            this->to_state_in_set_node(node->next);
+            this->to_state_in_set_node(node->prev, NODE_DATA_SIZE);
             return CHAR_ARROW;
         }
     }
@@ -317,35 +609,733 @@ bool HitboxIterator::has_next() {
 }
 
 
-using super = BaseBPTree;
-using Acc = BaseBPTree::Acc;
+void flatten_hitboxes(void* const* buffer, size_t size,
+                      std::vector<Hitbox*>* out) {
+    // Every value is at least one hitbox, so `out` is grown by `size` up
+    // front, and only again for sets: by their size, less the one slot that
+    // was made for them
 
-void BaseHitboxIndex::insert(float key, Hitbox* value) {
-    auto maybe = (MaybeHitbox*) (this->super::replace_p(key, value));
-    if (maybe != nullptr) {
-        // Something got replaced. Need to re-add
-        if (isnan(maybe->label)) {
-            // it is a set that got replaced
-            add(&(maybe->s), value);
-            this->super::replace_p(key, maybe);
+    size_t at = out->size();
+    out->resize(at + size);
+    for (size_t i = 0; i < size; i++) {
+        auto maybe = static_cast<MaybeHitbox*>(buffer[i]);
+        if (!isnan(maybe->label)) {
+            (*out)[at++] = &(maybe->hb);
+            continue;
+        }
+        // HitboxIterator goes through each node of a set backwards
+        SetHeader* set = &(maybe->s);
+        size_t length = length_of(set, nullptr);
+        size_t extra = length - 1;
+        for (SetNode* curr = set->last; curr != nullptr; curr = curr->prev) {
+            extra += length_of(set, curr);
+        }
+        out->resize(out->size() + extra);
+        Hitbox** dest = out->data() + at;
+        dest = std::reverse_copy(set->data, set->data + length, dest);
+        for (SetNode* curr = set->last; curr != nullptr; curr = curr->prev) {
+            length = length_of(set, curr);
+            dest = std::reverse_copy(curr->data, curr->data + length, dest);
+        }
+        at = dest - out->data();
+    }
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::retire_value(void* value) {
+    // Recycle a value that is no longer in the tree. Sets go back to the
+    // pools, node by node; hitboxes belong to the user.
+
+    auto maybe = static_cast<MaybeHitbox*>(value);
+    if (!isnan(maybe->label))
+        return;
+    // (readers only iterate sets, so the index may go right away)
+    drop_index(&(maybe->s), &(this->sets));
+    SetNode* curr = maybe->s.last;
+    while (curr != nullptr) {
+        SetNode* prev = curr->prev;
+        this->retire(curr, &(this->sets.nodes));
+        curr = prev;
+    }
+    this->retire(&(maybe->s), &(this->sets.headers));
+}
+
+template<class Tree>
+SetWriter BasicHitboxIndex<Tree>::start_set_write() {
+    if (this->is_thread_safe())
+        return {&(this->sets), MADE_BY_THIS_WRITE, MADE_BY_THIS_WRITE - 1, {}};
+    return {&(this->sets), this->get_generation(),
+            this->get_newest_snapshot(), {}};
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::finish_set_write(SetWriter* w) {
+    for (auto& unlinked : w->unlinked) {
+        this->retire(unlinked.first, unlinked.second);
+    }
+    w->unlinked.clear();
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::insert(float key, Hitbox* value) {
+    auto lock = this->lock_for_writing();
+    SetWriter w = this->start_set_write();
+
+    if (this->is_thread_safe()) {
+        // Store the grown value in one step, so that readers never miss the
+        // values that were there before
+        void* old_value = this->Tree::get_p(key);
+        if (old_value == nullptr) {
+            this->Tree::replace_p(key, value);
         } else {
-            // it is hitbox that got replaced
-            auto new_set = make_set_header(&(maybe->hb));
-            add(new_set, value);
-            this->super::replace_p(key, new_set);
+            void* merged = merge_values(old_value, value, &w);
+            this->Tree::replace_p(key, merged);
+            settle(merged, &w);
+            this->finish_set_write(&w);
         }
+        return;
+    }
+
+    void* replaced = this->Tree::replace_p(key, value);
+    if (replaced != nullptr) {
+        // Something got replaced. Need to re-add
+        this->Tree::replace_p(key, merge_values(replaced, value, &w));
+        this->finish_set_write(&w);
     }
 }
 
-void BaseHitboxIndex::update(float old_key, float new_key, Hitbox* value) {
-    // not implemented
+class ValueCollector : public ResultSink {
+public:
+    std::vector<void*> values;
+
+    void callback(void** buffer, size_t size) override {
+        this->values.insert(this->values.end(), buffer, buffer + size);
+    }
+};
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::clear() {
+    if (this->is_mapped()) {
+        // there are no sets; only the file to let go of
+        this->Tree::clear();
+        return;
+    }
+    auto lock = this->lock_for_writing();
+    if (!this->has_snapshots()) {
+        this->Tree::clear();
+        this->sets.drop_indices();
+        this->sets.headers.clear();
+        this->sets.nodes.clear();
+        return;
+    }
+
+    // Snapshots may still see the sets; retire them one by one
+    ValueCollector collector;
+    auto acc = this->make_iteration_buffer(&collector);
+    this->range_search_p(-FLT_MAX, FLT_MAX, acc);
+    this->destroy_iteration_buffer(acc);
+    for (void* value : collector.values) {
+        this->retire_value(value);
+    }
+    this->Tree::clear();
 }
 
-void BaseHitboxIndex::del(float key, Hitbox* match_value) {
-    // not implemented
+class HitboxPacker : public RecordPacker {
+public:
+    // A set is saved as one record per hitbox, under the same key
+    size_t count_records(void* value) override {
+        auto maybe = static_cast<MaybeHitbox*>(value);
+        if (!isnan(maybe->label))
+            return 1;
+        size_t count = 0;
+        for_each_value(&(maybe->s), [&](Hitbox*) { count++; });
+        return count;
+    }
+
+    void pack(void* value, char* out) override {
+        auto maybe = static_cast<MaybeHitbox*>(value);
+        if (!isnan(maybe->label)) {
+            memcpy(out, &(maybe->hb), sizeof(Hitbox));
+            return;
+        }
+        for_each_value(&(maybe->s), [&](Hitbox* hitbox) {
+            memcpy(out, hitbox, sizeof(Hitbox));
+            out += sizeof(Hitbox);
+        });
+    }
+};
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::save(const char* path, LeafKeys leaf_keys) {
+    auto lock = this->lock_for_writing();
+    HitboxPacker packer;
+    this->Tree::save_p(path, sizeof(Hitbox), &packer, leaf_keys);
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::map(const char* path) {
+    this->Tree::map_p(path, sizeof(Hitbox));
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::bulk_load(const float* keys,
+                                       Hitbox* const* values, size_t n,
+                                       float fill_factor) {
+    // Build the index from arrays sorted by key. Runs of equal keys are
+    // grouped into sets before the B+ tree is built.
+
+    auto lock = this->lock_for_writing();
+    if (!this->is_empty())
+        throw std::logic_error("bulk loading requires an empty index");
+    for (size_t i = 1; i < n; i++) {
+        if (!(keys[i - 1] <= keys[i]))
+            throw std::invalid_argument("keys must be sorted");
+    }
+
+    std::vector<float> unique_keys;
+    std::vector<void*> unique_values;
+    SetWriter w = this->start_set_write();
+    group_equal_keys(keys, values, n, &unique_keys, &unique_values, &w);
+
+    this->Tree::bulk_load_p(unique_keys.data(), unique_values.data(),
+                             unique_keys.size(), fill_factor);
+    for (void* value : unique_values) {
+        settle(value, &w);
+    }
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::insert_batch(const float* keys,
+                                          Hitbox* const* values, size_t n) {
+    // Insert many hitboxes with one walk over the B+ tree. The batch is
+    // sorted, runs of equal keys are grouped into sets, and keys that
+    // already exist in the tree are merged with their old values afterwards.
+    //
+    // In thread-safe mode, the old values are merged in beforehand instead,
+    // so that readers never see a key without its old values.
+
+    for (size_t i = 0; i < n; i++) {
+        if (isnan(keys[i]) || isinf(keys[i]))
+            throw std::invalid_argument("keys must be finite");
+    }
+
+    std::vector<std::pair<float, Hitbox*>> sorted(n);
+    for (size_t i = 0; i < n; i++) {
+        sorted[i] = {keys[i], values[i]};
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+        return a.first < b.first;
+    });
+    std::vector<float> sorted_keys(n);
+    std::vector<Hitbox*> sorted_values(n);
+    for (size_t i = 0; i < n; i++) {
+        sorted_keys[i] = sorted[i].first;
+        sorted_values[i] = sorted[i].second;
+    }
+
+    std::vector<float> unique_keys;
+    std::vector<void*> unique_values;
+    auto lock = this->lock_for_writing();
+    SetWriter w = this->start_set_write();
+    group_equal_keys(sorted_keys.data(), sorted_values.data(), n,
+                     &unique_keys, &unique_values, &w);
+
+    size_t size = unique_keys.size();
+    bool shared = this->is_thread_safe();
+    if (shared) {
+        for (size_t i = 0; i < size; i++) {
+            void* old_value = this->Tree::get_p(unique_keys[i]);
+            if (old_value != nullptr) {
+                unique_values[i] = merge_values(old_value, unique_values[i],
+                                                &w);
+            }
+        }
+    }
+
+    std::vector<void*> replaced(size);
+    this->Tree::insert_batch_p(unique_keys.data(), unique_values.data(),
+                                replaced.data(), size);
+
+    if (shared) {
+        for (void* value : unique_values) {
+            settle(value, &w);
+        }
+        this->finish_set_write(&w);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (replaced[i] != nullptr) {
+            // Something got replaced. Need to re-add
+            void* merged = merge_values(replaced[i], unique_values[i], &w);
+            this->Tree::replace_p(unique_keys[i], merged);
+        }
+    }
+    this->finish_set_write(&w);
 }
 
-void BaseHitboxIndex::ball_query(float mag, float rad, float R, Acc* acc) {
+template<class Tree>
+void BasicHitboxIndex<Tree>::update(float old_key, float new_key,
+                                    Hitbox* value) {
+    // Move `value` from `old_key` to `new_key`. Nothing happens if the value
+    // is not stored under `old_key`.
+
+    if (old_key == new_key)
+        return;
+    auto lock = this->lock_for_writing();
+
+    // Common case: the hitbox is alone under its key; move the whole entry.
+    // Not onto a taken key in thread-safe mode: readers would see the key
+    // without its old values until the merge below.
+    bool may_merge = this->is_thread_safe()
+        && this->Tree::get_p(new_key) != nullptr;
+    void* replaced;
+    if (!may_merge
+            && this->Tree::update_p(old_key, new_key, value, &replaced)) {
+        if (replaced != nullptr) {
+            // Something got replaced. Need to re-add
+            SetWriter w = this->start_set_write();
+            void* merged = merge_values(replaced, value, &w);
+            this->Tree::replace_p(new_key, merged);
+            this->finish_set_write(&w);
+        }
+        return;
+    }
+
+    // Otherwise it may be in a set; only this one hitbox moves
+    auto maybe = (MaybeHitbox*) (this->Tree::get_p(old_key));
+    if (maybe == nullptr)
+        return;
+    if (&(maybe->hb) == value
+            || (isnan(maybe->label) && ::contains(&(maybe->s), value))) {
+        this->del(old_key, value);
+        this->insert(new_key, value);
+    }
+}
+
+template<class Tree>
+bool BasicHitboxIndex<Tree>::contains(float key, Hitbox* value) {
+    auto lock = this->lock_for_writing();
+    auto maybe = (MaybeHitbox*) (this->Tree::get_p(key));
+    if (maybe == nullptr)
+        return false;
+    if (isnan(maybe->label))
+        return ::contains(&(maybe->s), value);
+    return &(maybe->hb) == value;
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::del(float key, Hitbox* match_value) {
+    // Remove `match_value` from under `key`. Nothing happens if the value is
+    // not stored under that key.
+
+    auto lock = this->lock_for_writing();
+    auto maybe = (MaybeHitbox*) (this->Tree::get_p(key));
+    if (maybe == nullptr)
+        return;
+
+    if (isnan(maybe->label)) {
+        // it is a set
+        auto set = &(maybe->s);
+        if (!::contains(set, match_value))
+            return;
+        // (a set that readers may see is replaced by a smaller copy in one
+        // step, which shares the nodes that do not change)
+        SetWriter w = this->start_set_write();
+        SetHeader* owned = own_header(set, &w);
+        ::del(owned, match_value, &w);
+        if (is_singleton(owned)) {
+            // a set of one goes back to being a plain hitbox
+            this->Tree::replace_p(key, owned->data[0]);
+            delete_set_header(owned, &(this->sets));
+        } else if (owned != set) {
+            this->Tree::replace_p(key, owned);
+            settle(owned, &w);
+        }
+        this->finish_set_write(&w);
+    } else if (&(maybe->hb) == match_value) {
+        // it is the hitbox itself
+        void* removed;
+        this->Tree::delete_p(key, &removed);
+    }
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::ball_query(float mag, float rad, float R,
+                                        typename Tree::Acc* acc) {
     float temp = rad + R;
     this->range_search_p(mag - temp, mag + temp, acc);
 }
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::ball_query(float mag, float rad, float R,
+                                        typename Tree::Acc* acc,
+                                        const Snapshot* snapshot) {
+    float temp = rad + R;
+    this->range_search_p(mag - temp, mag + temp, acc, snapshot);
+}
+
+template<class Cursor>
+static size_t take_from_set(Cursor* cursor, Hitbox** out, size_t cap) {
+    // Return the set of the cursor from where it stands, as far as `cap`
+    // allows. Drops the set once it is all returned.
+
+    SetHeader* set = cursor->set;
+    size_t n = 0;
+    while (n < cap) {
+        SetNode* node = cursor->set_node;
+        bool is_last = (node == nullptr) ? set->last == nullptr
+                                         : node->prev == nullptr;
+        size_t size = length_of(set, node);
+        Hitbox* const* data = (node == nullptr) ? set->data : node->data;
+        size_t count = std::min(size - cursor->set_index, cap - n);
+        std::copy(data + cursor->set_index, data + cursor->set_index + count,
+                  out + n);
+        n += count;
+        cursor->set_index += count;
+        if (cursor->set_index < size)
+            break;
+        if (is_last) {
+            cursor->set = nullptr;
+            break;
+        }
+        cursor->set_node = (node == nullptr) ? set->last : node->prev;
+        cursor->set_index = 0;
+    }
+    return n;
+}
+
+template<class Tree>
+typename BasicHitboxIndex<Tree>::Cursor BasicHitboxIndex<Tree>::open_range(
+        float k0, float k1) {
+    Cursor cursor;
+    cursor.values = this->Tree::open_range_p(k0, k1);
+    cursor.set = nullptr;
+    cursor.set_node = nullptr;
+    cursor.set_index = 0;
+    cursor.next_pending = 0;
+    cursor.num_pending = 0;
+    return cursor;
+}
+
+template<class Tree>
+size_t BasicHitboxIndex<Tree>::next_batch(Cursor* cursor, Hitbox** out,
+                                          size_t cap) {
+    // Values go straight to `out`, where plain hitboxes stay. At the first
+    // set, the values after it wait in the cursor while the set is copied
+    // to where it was.
+
+    size_t n = 0;
+    while (n < cap) {
+        if (cursor->set != nullptr) {
+            n += take_from_set(cursor, out + n, cap - n);
+            continue;
+        }
+        auto values = reinterpret_cast<void**>(out + n);
+        size_t count;
+        bool from_pending = cursor->next_pending < cursor->num_pending;
+        if (from_pending) {
+            count = std::min(cap - n,
+                             cursor->num_pending - cursor->next_pending);
+            std::copy(cursor->pending + cursor->next_pending,
+                      cursor->pending + cursor->next_pending + count, values);
+            cursor->next_pending += count;
+        } else {
+            count = this->Tree::next_batch_p(
+                &(cursor->values), values, std::min(cap - n, CURSOR_CHUNK));
+            if (count == 0)
+                break;
+        }
+
+        size_t i = 0;
+        while (i < count && !isnan(static_cast<MaybeHitbox*>(values[i])->label))
+            i++;
+        if (i < count) {
+            cursor->set = &(static_cast<MaybeHitbox*>(values[i])->s);
+            cursor->set_node = nullptr;
+            cursor->set_index = 0;
+            size_t rest = count - i - 1;
+            if (from_pending) {
+                cursor->next_pending -= rest;
+            } else {
+                std::copy(values + i + 1, values + count, cursor->pending);
+                cursor->next_pending = 0;
+                cursor->num_pending = rest;
+            }
+        }
+        n += i;
+    }
+    return n;
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::run_batch(const BallQuery* queries, size_t n,
+                                       QueryPool* pool,
+                                       BatchSink* const* sinks) {
+    size_t num_workers = pool->get_num_workers();
+    std::vector<Acc*> accs(num_workers);
+    for (size_t w = 0; w < num_workers; w++) {
+        accs[w] = this->make_iteration_buffer(sinks[w]);
+    }
+
+    pool->run(n, [&](size_t worker, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            // (each search flushes its buffer, so results stay per query)
+            sinks[worker]->query = i;
+            this->ball_query(queries[i].mag, queries[i].rad, queries[i].R,
+                             accs[worker]);
+        }
+    });
+
+    for (size_t w = 0; w < num_workers; w++) {
+        this->destroy_iteration_buffer(accs[w]);
+    }
+}
+
+class HitCollector : public BatchSink {
+public:
+    std::vector<BatchHit>* hits;
+
+    void callback(void** buffer, size_t size) override {
+        HitboxIterator iter = HitboxIterator(buffer, size);
+        while (iter.has_next()) {
+            this->hits->push_back({this->query, iter.next()});
+        }
+    }
+};
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::query_batch(
+        const BallQuery* queries, size_t n, QueryPool* pool,
+        std::vector<std::vector<BatchHit>>* hits) {
+    size_t num_workers = pool->get_num_workers();
+    hits->resize(num_workers);
+    std::vector<HitCollector> sinks(num_workers);
+    std::vector<BatchSink*> sink_ptrs;
+    for (size_t w = 0; w < num_workers; w++) {
+        sinks[w].hits = &((*hits)[w]);
+        sink_ptrs.push_back(&(sinks[w]));
+    }
+    this->run_batch(queries, n, pool, sink_ptrs.data());
+}
+
+// Leaves per stripe of a parallel pair sweep: a worker takes chunks of
+// QueryPool::CHUNK_SIZE stripes, and goes back 2 R in key before each chunk
+constexpr size_t PAIR_STRIPE_LEAVES = 64;
+
+class PairSweep {
+    // The active set of a sweep in key order: the hitboxes of the last
+    // `reach` of keys, with copies of their boxes to test against
+public:
+    PairSweep(float reach, std::vector<HitboxPair>* pairs) {
+        this->reach = reach;
+        this->pairs = pairs;
+        this->start = 0;
+    }
+
+    // Add the hitboxes of a value. Only tested against the active set if
+    // `test`, i.e. if they are the sweep's own and not just a lead-in.
+    void add_value(float key, void* value, bool test) {
+        auto maybe = static_cast<MaybeHitbox*>(value);
+        if (!isnan(maybe->label)) {
+            this->add(key, &(maybe->hb), test);
+            return;
+        }
+        for_each_value(&(maybe->s), [&](Hitbox* hb) {
+            this->add(key, hb, test);
+        });
+    }
+
+private:
+    struct Active {
+        float key;
+        Hitbox box;
+        Hitbox* hitbox;
+    };
+
+    void add(float key, Hitbox* hb, bool test) {
+        while (this->start < this->active.size()
+               && this->active[this->start].key < key - this->reach) {
+            this->start++;
+        }
+        if (test) {
+            Hitbox box = *hb;
+            for (size_t i = this->start; i < this->active.size(); i++) {
+                if (boxes_overlap(this->active[i].box, box))
+                    this->pairs->push_back({this->active[i].hitbox, hb});
+            }
+        }
+        // (drop the inactive front now and then)
+        if (this->start >= 64 && 2 * this->start >= this->active.size()) {
+            this->active.erase(this->active.begin(),
+                               this->active.begin() + this->start);
+            this->start = 0;
+        }
+        this->active.push_back({key, *hb, hb});
+    }
+
+    float reach;
+    std::vector<HitboxPair>* pairs;
+    std::vector<Active> active;
+    size_t start;
+};
+
+template<class Tree>
+static void sweep_leaves(typename Tree::Node* lead_in,
+                         typename Tree::Node* first, typename Tree::Node* end,
+                         float reach, std::vector<HitboxPair>* pairs) {
+    // Sweep the leaves [first, end), after the leaves [lead_in, first) that
+    // only fill the active set
+    constexpr size_t MAX_WEIGHT = Tree::MAX_WEIGHT;
+    PairSweep sweep(reach, pairs);
+    bool test = (lead_in == first);
+    for (auto curr = lead_in; curr != end; curr = curr->next) {
+        test |= (curr == first);
+        size_t weight = count_keys_le(curr->keys, MAX_WEIGHT, FLT_MAX);
+        for (size_t i = 0; i < weight; i++) {
+            sweep.add_value(curr->keys[i], curr->values[i + 1].p, test);
+        }
+    }
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::find_pairs(float R,
+                                        std::vector<HitboxPair>* pairs) {
+    using Node = typename Tree::Node;
+    Node* curr = this->get_scan_root();
+    if (curr == nullptr)
+        throw std::logic_error("pairs are swept along plain leaf links");
+    while (curr->next == curr) {
+        curr = curr->values[0].b;
+    }
+    sweep_leaves<Tree>(curr, curr, nullptr, 2 * R, pairs);
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::find_pairs(
+        float R, QueryPool* pool,
+        std::vector<std::vector<HitboxPair>>* pairs) {
+    using Node = typename Tree::Node;
+    constexpr size_t MAX_WEIGHT = Tree::MAX_WEIGHT;
+    Node* root = this->get_scan_root();
+    if (root == nullptr)
+        throw std::logic_error("pairs are swept along plain leaf links");
+    std::vector<Node*> stripes;
+    Node* curr = root;
+    while (curr->next == curr) {
+        curr = curr->values[0].b;
+    }
+    for (size_t i = 0; curr != nullptr; curr = curr->next, i++) {
+        if (i % PAIR_STRIPE_LEAVES == 0)
+            stripes.push_back(curr);
+    }
+
+    pairs->resize(pool->get_num_workers());
+    pool->run(stripes.size(), [&](size_t worker, size_t begin, size_t end) {
+        // Lead in from the leaf that the keys 2 R before the first one of
+        // the stripe are in
+        Node* first = stripes[begin];
+        Node* lead_in = root;
+        float k0 = first->keys[0] - 2 * R;
+        if (!(k0 < first->keys[0]))
+            lead_in = first;
+        while (lead_in->next == lead_in) {
+            lead_in = lead_in->values[count_keys_le(lead_in->keys,
+                                                    MAX_WEIGHT, k0)].b;
+        }
+        Node* stop = (end < stripes.size()) ? stripes[end] : nullptr;
+        sweep_leaves<Tree>(lead_in, first, stop, 2 * R, &((*pairs)[worker]));
+    });
+}
+
+static float distance_to_box(const Hitbox& box, float x, float y) {
+    float dx = std::max(std::max(box.a1 - x, x - box.b1), 0.0f);
+    float dy = std::max(std::max(box.a2 - y, y - box.b2), 0.0f);
+    return sqrtf(dx * dx + dy * dy);
+}
+
+static bool is_nearer(const HitboxNeighbor& l, const HitboxNeighbor& r) {
+    return l.distance < r.distance;
+}
+
+template<class Tree>
+void BasicHitboxIndex<Tree>::knn(float x, float y, size_t k, float R,
+                                 std::vector<HitboxNeighbor>* out) {
+    using Node = typename Tree::Node;
+    constexpr size_t MAX_WEIGHT = Tree::MAX_WEIGHT;
+    Node* curr = this->get_scan_root();
+    if (curr == nullptr)
+        throw std::logic_error("neighbors are found along plain leaf links");
+    out->clear();
+    float mag = sqrtf(x * x + y * y);
+    if (k == 0 || isnan(mag))
+        return;
+
+    // The k nearest so far, as a max-heap: the k-th distance is at the top
+    auto& heap = *out;
+    auto offer = [&](Hitbox* hb) {
+        float d = distance_to_box(*hb, x, y);
+        if (isnan(d))
+            return;
+        if (heap.size() < k) {
+            heap.push_back({hb, d});
+            std::push_heap(heap.begin(), heap.end(), is_nearer);
+        } else if (d < heap.front().distance) {
+            std::pop_heap(heap.begin(), heap.end(), is_nearer);
+            heap.back() = {hb, d};
+            std::push_heap(heap.begin(), heap.end(), is_nearer);
+        }
+    };
+    auto offer_value = [&](void* value) {
+        auto maybe = static_cast<MaybeHitbox*>(value);
+        if (!isnan(maybe->label))
+            offer(&(maybe->hb));
+        else
+            for_each_value(&(maybe->s), offer);
+    };
+
+    // Two cursors from the key of the point: `right` at the first key not
+    // less than it, `left` one before (at `left_i` - 1)
+    while (curr->next == curr) {
+        curr = curr->values[count_keys_le(curr->keys, MAX_WEIGHT, mag)].b;
+    }
+    Node* right = curr;
+    size_t right_i = count_keys_lt(curr->keys, MAX_WEIGHT, mag);
+    Node* left = curr;
+    size_t left_i = right_i;
+    auto weight_of = [&](Node* leaf) {
+        return count_keys_le(leaf->keys, MAX_WEIGHT, FLT_MAX);
+    };
+    while (true) {
+        // Step off the ends of leaves, and past empty ones
+        while (right != nullptr && right_i >= weight_of(right)) {
+            right = right->next;
+            right_i = 0;
+        }
+        while (left != nullptr && left_i == 0) {
+            left = left->prev;
+            left_i = (left != nullptr) ? weight_of(left) : 0;
+        }
+        float right_gap = (right != nullptr)
+            ? right->keys[right_i] - mag : INFINITY;
+        float left_gap = (left != nullptr)
+            ? mag - left->keys[left_i - 1] : INFINITY;
+        float gap = std::min(right_gap, left_gap);
+        if (gap == INFINITY)
+            break;
+        if (heap.size() == k && gap > heap.front().distance + R)
+            break;
+        if (right_gap <= left_gap) {
+            offer_value(right->values[right_i + 1].p);
+            right_i++;
+        } else {
+            left_i--;
+            offer_value(left->values[left_i + 1].p);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), is_nearer);
+}
+
+template class BasicHitboxIndex<BPTree256>;
+template class BasicHitboxIndex<BPTree512>;
+template class BasicHitboxIndex<BPTree1K>;
+template class BasicHitboxIndex<BPTree4K>;
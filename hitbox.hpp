@@ -1,12 +1,21 @@
 #pragma once
 
+#include <math.h>
+#include <vector>
+#include "ball_filter.hpp"
 #include "bptree.hpp"
+#include "query_pool.hpp"
 
 struct Hitbox {
     // W = [a1, b1] X [a2, b2]
     float a1, b1, a2, b2;
 };
 
+// Whether two boxes share a point (touching edges count)
+inline bool boxes_overlap(const Hitbox& l, const Hitbox& r) {
+    return l.a1 <= r.b1 && r.a1 <= l.b1 && l.a2 <= r.b2 && r.a2 <= l.b2;
+}
+
 class HitboxIterator {
 public:
     HitboxIterator(void** buffer, size_t size);
@@ -25,7 +34,7 @@ private:
     void* operator new(size_t size) = delete;
     void to_state_in_set_header(void* pointer);
     void to_state_in_buffer();
-    void to_state_in_set_node(void* pointer);
+    void to_state_in_set_node(void* pointer, unsigned char size);
     int generate_input();
 
     void** buffer;
@@ -38,24 +47,202 @@ private:
     unsigned char state;
 };
 
-class BaseHitboxIndex : public BaseBPTree {
+// Append the hitboxes that an iteration buffer holds to `out`, sets
+// expanded, in the order that HitboxIterator would return them
+void flatten_hitboxes(void* const* buffer, size_t size,
+                      std::vector<Hitbox*>* out);
+
+// One query of a batch: the hitboxes that may touch a ball of radius `rad`
+// at `mag`, as in ball_query
+struct BallQuery {
+    float mag, rad, R;
+};
+
+// One result of a batch, as collected into per-worker buffers
+struct BatchHit {
+    size_t query;
+    Hitbox* hitbox;
+};
+
+// Two hitboxes that may overlap, as found by find_pairs: `a` comes first in
+// key order (in any order if their keys are equal)
+struct HitboxPair {
+    Hitbox* a;
+    Hitbox* b;
+};
+
+// One result of knn: a hitbox and how far its box is from the point (0 if
+// the point is inside)
+struct HitboxNeighbor {
+    Hitbox* hitbox;
+    float distance;
+};
+
+// Where the iteration buffer of one batch worker delivers to. `query` is
+// the index of the query that the worker is running.
+class BatchSink : public ResultSink {
 public:
+    size_t query = 0;
+};
+
+struct SetHeader;
+struct SetNode;
+struct SetIndex;
+struct SetWriter;
+
+struct SetPools {
+    // Storage for the duplicate-key sets of one index
+    SetPools();
+    ~SetPools();
+    SlabPool headers;
+    SlabPool nodes;
+    // The indices of the big sets, which are on the heap. Dropped along
+    // with the pools when they are cleared.
+    SetIndex* indices;
+
+    void drop_indices();
+};
+
+// Hitbox index on top of any B+ tree preset (see bptree.hpp). Defined in
+// hitbox.cpp for the presets only.
+//
+// In thread-safe mode, the modifying methods take turns on the writer lock,
+// and a set of hitboxes under one key is never modified in place: a changed
+// copy replaces it, because readers may be iterating the old one. The same
+// goes for sets that snapshots may see. Either way, only the header and the
+// nodes that change are copied; the rest is shared with the old set.
+template<class Tree>
+class BasicHitboxIndex : public Tree {
+public:
+    using Acc = typename Tree::Acc;
+
+    // Values that a cursor takes from the tree at a time
+    static constexpr size_t CURSOR_CHUNK = 64;
+
+    // Where a range search that is read in batches stands (see open_range)
+    struct Cursor {
+        typename Tree::Cursor values;
+        // A set whose hitboxes are being returned: the node they are in
+        // (nullptr while in the header) and the index of the next one
+        SetHeader* set;
+        SetNode* set_node;
+        size_t set_index;
+        // Values taken from the tree along with the set, to be returned
+        // after it: pending[next_pending, num_pending)
+        size_t next_pending;
+        size_t num_pending;
+        void* pending[CURSOR_CHUNK];
+    };
+
     void insert(float key, Hitbox* value);
+    void insert_batch(const float* keys, Hitbox* const* values, size_t n);
+    void bulk_load(const float* keys, Hitbox* const* values, size_t n,
+                   float fill_factor = 1.0f);
     void update(float old_key, float new_key, Hitbox* value);
     void del(float key, Hitbox* match_value);
-    void ball_query(float mag, float rad, float R, BaseBPTree::Acc* acc);
+    // Whether `value` is stored under `key`
+    bool contains(float key, Hitbox* value);
+    void ball_query(float mag, float rad, float R, Acc* acc);
+    // The same as of a snapshot (see BasicBPTree::snapshot). Any thread.
+    void ball_query(float mag, float rad, float R, Acc* acc,
+                    const Snapshot* snapshot);
+    void clear() override;
 
-    virtual ~BaseHitboxIndex() = default;
+    // Range search without callbacks: open a cursor, then have next_batch
+    // write the hitboxes to arrays of your own until it returns 0. Results
+    // are the same as those of range_search. The index must not be modified
+    // while the cursor is in use, and not be in thread-safe mode.
+    Cursor open_range(float k0, float k1);
+    // Write up to `cap` hitboxes to `out`. Returns how many; fewer than
+    // `cap` only at the end.
+    size_t next_batch(Cursor* cursor, Hitbox** out, size_t cap);
+
+    // Write the index to `path`, with copies of the hitboxes in it. Packed
+    // leaf keys make a smaller file with fewer levels (see LeafKeys).
+    void save(const char* path, LeafKeys leaf_keys = LeafKeys::FLOAT);
+    // Replace the contents with the index saved at `path`, mapped as it is
+    // (see BasicBPTree::map_p). Searches then return pointers to the saved
+    // hitboxes, which are read-only; so is the index until it is cleared.
+    void map(const char* path);
+
+    // Run queries[0, n) on the workers of `pool`, each worker with an
+    // iteration buffer of its own. The results go into (*hits)[worker],
+    // which is resized to the number of workers and appended to.
+    // Searches are read-only, so this needs no thread-safe mode unless
+    // other threads modify the index meanwhile.
+    void query_batch(const BallQuery* queries, size_t n, QueryPool* pool,
+                     std::vector<std::vector<BatchHit>>* hits);
+
+    // Broad phase: append every pair of hitboxes whose boxes overlap to
+    // `pairs`, each pair once. Each hitbox is within `R` of a point whose
+    // magnitude is its key, as in ball queries, so pairs are at most 2 R
+    // apart in key. One sweep along the leaves, testing each hitbox against
+    // those of the last 2 R of keys, instead of a ball query per hitbox.
+    // Not in thread-safe mode, while snapshots keep the leaf links stale,
+    // or when mapped (throws std::logic_error).
+    void find_pairs(float R, std::vector<HitboxPair>* pairs);
+    // The same, with the leaves split into stripes that the workers of
+    // `pool` sweep. The pairs go into (*pairs)[worker], which is resized to
+    // the number of workers and appended to.
+    void find_pairs(float R, QueryPool* pool,
+                    std::vector<std::vector<HitboxPair>>* pairs);
+
+    // The `k` hitboxes whose boxes are nearest to (x, y), nearest first,
+    // in place of the contents of `out` (fewer if there are fewer). Each
+    // hitbox is within `R` of a point whose magnitude is its key, as in
+    // ball queries. Starts at the leaf of the key |(x, y)| and walks the
+    // leaf links both ways, the nearer key first, until the keys left are
+    // further off than the k-th distance plus R. Not in thread-safe mode,
+    // while snapshots keep the leaf links stale, or when mapped (throws
+    // std::logic_error).
+    void knn(float x, float y, size_t k, float R,
+             std::vector<HitboxNeighbor>* out);
+
+    virtual ~BasicHitboxIndex() = default;
 
 protected:
     // Base class is not to be used directly
-    BaseHitboxIndex() = default;
+    BasicHitboxIndex() = default;
+
+    // Run a query batch with sinks[worker] receiving the worker's results
+    void run_batch(const BallQuery* queries, size_t n, QueryPool* pool,
+                   BatchSink* const* sinks);
+
+private:
+    void retire_value(void* value);
+    // Bracket every change to the sets: the sets that snapshots may see are
+    // copied, and the originals retired at the end
+    SetWriter start_set_write();
+    void finish_set_write(SetWriter* w);
+
+    SetPools sets;
 };
 
-template<class CRTP>
-class HitboxIndex : public BaseHitboxIndex {
+extern template class BasicHitboxIndex<BPTree256>;
+extern template class BasicHitboxIndex<BPTree512>;
+extern template class BasicHitboxIndex<BPTree1K>;
+extern template class BasicHitboxIndex<BPTree4K>;
+
+using BaseHitboxIndex = BasicHitboxIndex<BaseBPTree>;
+
+template<class CRTP, class Tree = BaseBPTree>
+class HitboxIndex : public BasicHitboxIndex<Tree> {
     // Implement this in your derived class
     // void search_callback(HitboxIterator* iter);
+    //
+    // and this one to use query_batch without output buffers. It is called
+    // from the worker threads, but for each query from one of them only.
+    // void batch_callback(size_t query, HitboxIterator* iter);
+
+    class CRTPBatchSink : public BatchSink {
+    public:
+        CRTP* index;
+
+        void callback(void** buffer, size_t size) override {
+            HitboxIterator iter = HitboxIterator(buffer, size);
+            this->index->batch_callback(this->query, &iter);
+        }
+    };
 
 protected:
     void callback(void** buffer, size_t size) override {
@@ -64,10 +251,153 @@ protected:
     }
 
 public:
+    using Acc = typename Tree::Acc;
+
     HitboxIndex() = default;
     virtual ~HitboxIndex() = default;
 
-    void range_search(float k0, float k1, BaseBPTree::Acc* acc) {
+    void range_search(float k0, float k1, Acc* acc) {
         this->range_search_p(k0, k1, acc);
     }
+
+    void range_search(float k0, float k1, Acc* acc, const Snapshot* snapshot) {
+        this->range_search_p(k0, k1, acc, snapshot);
+    }
+
+    using BasicHitboxIndex<Tree>::ball_query;
+    // A ball query centered at (x, y), on the magnitude of the center, as
+    // GridHitboxIndex takes it: either backend fits the same caller
+    void ball_query(float x, float y, float rad, float R, Acc* acc) {
+        this->ball_query(sqrtf(x * x + y * y), rad, R, acc);
+    }
+
+    // Like the query_batch of the base class, but delivers the results of
+    // each query to `batch_callback`
+    using BasicHitboxIndex<Tree>::query_batch;
+    void query_batch(const BallQuery* queries, size_t n, QueryPool* pool) {
+        std::vector<CRTPBatchSink> sinks(pool->get_num_workers());
+        std::vector<BatchSink*> sink_ptrs;
+        for (auto& sink : sinks) {
+            sink.index = static_cast<CRTP*>(this);
+            sink_ptrs.push_back(&sink);
+        }
+        this->run_batch(queries, n, pool, sink_ptrs.data());
+    }
+};
+
+// Like HitboxIndex, but the search callback gets the results of each buffer
+// as one flat array (see flatten_hitboxes) instead of an iterator
+template<class CRTP, class Tree = BaseBPTree>
+class FlatHitboxIndex : public BasicHitboxIndex<Tree> {
+    // Implement this in your derived class
+    // void search_callback(Hitbox* const* hitboxes, size_t n);
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        // (one array per thread, for searches in thread-safe mode)
+        thread_local std::vector<Hitbox*> flat;
+        flat.clear();
+        flatten_hitboxes(buffer, size, &flat);
+        static_cast<CRTP*>(this)->search_callback(flat.data(), flat.size());
+    }
+
+public:
+    using Acc = typename Tree::Acc;
+
+    FlatHitboxIndex() = default;
+    virtual ~FlatHitboxIndex() = default;
+
+    void range_search(float k0, float k1, Acc* acc) {
+        this->range_search_p(k0, k1, acc);
+    }
+
+    void range_search(float k0, float k1, Acc* acc, const Snapshot* snapshot) {
+        this->range_search_p(k0, k1, acc, snapshot);
+    }
+};
+
+// How selective the exact test of a ball query was: the hitboxes in the
+// key range, and those of them that touch the ball
+struct BallFilterStats {
+    size_t candidates;
+    size_t hits;
+};
+
+// Like FlatHitboxIndex, but ball queries take the center of the ball, and
+// only the hitboxes that touch it reach the search callback (see
+// filter_ball_hits). The key of a hitbox is the magnitude of a point that
+// is within `R` of all of the box. Range searches are not filtered.
+template<class CRTP, class Tree = BaseBPTree>
+class ExactHitboxIndex : public BasicHitboxIndex<Tree> {
+    // Implement this in your derived class
+    // void search_callback(Hitbox* const* hitboxes, size_t n);
+
+    // The innermost search running on this thread, if any. Only the
+    // results of a ball query of the index itself are filtered; searches
+    // started from search_callback get a Ball of their own, and a range
+    // search has no owner.
+    struct Ball {
+        float x, y, rad;
+        BallFilterStats stats;
+        const ExactHitboxIndex* owner;
+        Ball* outer;
+
+        ~Ball() { ExactHitboxIndex::ball = this->outer; }
+    };
+
+    static inline thread_local Ball* ball = nullptr;
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        thread_local std::vector<Hitbox*> flat;
+        flat.clear();
+        flatten_hitboxes(buffer, size, &flat);
+        size_t n = flat.size();
+        Ball* b = ExactHitboxIndex::ball;
+        if (b != nullptr && b->owner == this) {
+            n = filter_ball_hits(flat.data(), n, b->x, b->y, b->rad,
+                                 flat.data());
+            b->stats.candidates += flat.size();
+            b->stats.hits += n;
+        }
+        if (n > 0)
+            static_cast<CRTP*>(this)->search_callback(flat.data(), n);
+    }
+
+public:
+    using Acc = typename Tree::Acc;
+
+    ExactHitboxIndex() = default;
+    virtual ~ExactHitboxIndex() = default;
+
+    void range_search(float k0, float k1, Acc* acc) {
+        Ball b = {0, 0, 0, {0, 0}, nullptr, ExactHitboxIndex::ball};
+        ExactHitboxIndex::ball = &b;
+        this->range_search_p(k0, k1, acc);
+    }
+
+    void range_search(float k0, float k1, Acc* acc, const Snapshot* snapshot) {
+        Ball b = {0, 0, 0, {0, 0}, nullptr, ExactHitboxIndex::ball};
+        ExactHitboxIndex::ball = &b;
+        this->range_search_p(k0, k1, acc, snapshot);
+    }
+
+    // The hitboxes that touch the disc of radius `rad` at (x, y)
+    BallFilterStats ball_query(float x, float y, float rad, float R,
+                               Acc* acc) {
+        Ball b = {x, y, rad, {0, 0}, this, ExactHitboxIndex::ball};
+        ExactHitboxIndex::ball = &b;
+        float mag = sqrtf(x * x + y * y);
+        this->BasicHitboxIndex<Tree>::ball_query(mag, rad, R, acc);
+        return b.stats;
+    }
+
+    BallFilterStats ball_query(float x, float y, float rad, float R,
+                               Acc* acc, const Snapshot* snapshot) {
+        Ball b = {x, y, rad, {0, 0}, this, ExactHitboxIndex::ball};
+        ExactHitboxIndex::ball = &b;
+        float mag = sqrtf(x * x + y * y);
+        this->BasicHitboxIndex<Tree>::ball_query(mag, rad, R, acc, snapshot);
+        return b.stats;
+    }
 };
@@ -0,0 +1,82 @@
+#pragma once
+
+// The layout of the sets of hitboxes that share a key, for hitbox.cpp and
+// for searches that are compiled into the caller (see static_hitbox.hpp).
+// A value in the tree is either a Hitbox or a SetHeader, which is told
+// apart by its label: NaN where a hitbox has `a1`.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hitbox.hpp"
+
+constexpr size_t NODE_DATA_SIZE = 6;
+constexpr size_t HEADER_DATA_SIZE = 4;
+// A set of this many hitboxes gets an index; it loses it again at half as
+// many
+constexpr size_t SET_INDEX_MIN_SIZE = 32;
+
+// The hitboxes of a set are in the header, and then in a chain of nodes
+// from the one added last to the first one. Only the node added last may
+// be partly filled. Since nodes link only to older ones, a writer that
+// changes a node copies the node and the ones in front of it, and nothing
+// else (see hitbox.cpp).
+struct alignas(64) SetNode {
+    Hitbox* data[NODE_DATA_SIZE];
+    SetNode* prev;   // the node added before this one
+    uint32_t birth;  // generation it was made in (see SnapshotManager)
+};
+
+struct alignas(64) SetHeader {
+    float label;
+    // The number of hitboxes in the node added last, or in the header if
+    // there are no nodes
+    unsigned char length_of_last_node;
+    uint32_t birth;
+    SetNode* last;
+    // Where each hitbox is, by address, for finding and deleting hitboxes
+    // in O(1) (see hitbox.cpp); nullptr while the set is small. Iteration
+    // does not need it.
+    SetIndex* index;
+    Hitbox* data[HEADER_DATA_SIZE];
+};
+
+union MaybeHitbox {
+    float label;
+    Hitbox hb;
+    SetHeader s;
+};
+
+constexpr bool structs_are_aligned() {
+    return offsetof(Hitbox, a1) == 0
+        && offsetof(SetHeader, label) == 0
+        && offsetof(MaybeHitbox, label) == 0
+        && offsetof(MaybeHitbox, hb) == 0
+        && offsetof(MaybeHitbox, s) == 0;
+}
+static_assert(structs_are_aligned());
+static_assert(struct_size_is_appropriate<SetNode>());
+static_assert(struct_size_is_appropriate<SetHeader>());
+
+inline size_t length_of(const SetHeader* self, const SetNode* node) {
+    // The number of hitboxes in `node` of the set, or in the header if
+    // `node` is nullptr
+    if (node == nullptr)
+        return (self->last == nullptr) ? self->length_of_last_node
+                                       : HEADER_DATA_SIZE;
+    return (node == self->last) ? self->length_of_last_node : NODE_DATA_SIZE;
+}
+
+template<class F>
+inline void for_each_value(SetHeader* self, F f) {
+    // Call `f` on each hitbox of the set
+    size_t size = length_of(self, nullptr);
+    for (size_t i = 0; i < size; i++) {
+        f(self->data[i]);
+    }
+    for (SetNode* curr = self->last; curr != nullptr; curr = curr->prev) {
+        size = length_of(self, curr);
+        for (size_t i = 0; i < size; i++) {
+            f(curr->data[i]);
+        }
+    }
+}
@@ -0,0 +1,363 @@
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include "inline_hitbox.hpp"
+#include "keysearch.hpp"
+
+constexpr size_t PAGE_CAPACITY = 41;
+
+struct alignas(64) InlinePage {
+    // Entries [0, size) in key order; unused keys are INFINITY, as in the
+    // nodes of the tree. The tree maps the first key of a page to the page,
+    // unless an earlier page starts with the same key.
+    InlinePage* next;
+    InlinePage* prev;
+    uint32_t size;
+    float keys[PAGE_CAPACITY];
+    InlineHitbox boxes[PAGE_CAPACITY];
+};
+
+static_assert(sizeof(InlineHitbox) == 20);
+static_assert(sizeof(InlinePage) == 1024);
+
+static float last_key(const InlinePage* page) {
+    return page->keys[page->size - 1];
+}
+
+static void put_entry(InlinePage* page, float key, const Hitbox& box,
+                      uint32_t id) {
+    // Insert after the equal keys. The page has room.
+    size_t i = count_keys_le(page->keys, PAGE_CAPACITY, key);
+    size_t n = page->size - i;
+    memmove(&(page->keys[i + 1]), &(page->keys[i]), n * sizeof(float));
+    memmove(&(page->boxes[i + 1]), &(page->boxes[i]),
+            n * sizeof(InlineHitbox));
+    page->keys[i] = key;
+    page->boxes[i] = {box, id};
+    page->size++;
+}
+
+template<class Tree>
+BasicInlineHitboxIndex<Tree>::BasicInlineHitboxIndex()
+    : pages(sizeof(InlinePage)) {
+    this->first_page = nullptr;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::callback(void** buffer, size_t size) {
+}
+
+template<class Tree>
+InlinePage* BasicInlineHitboxIndex<Tree>::make_page(InlinePage* prev) {
+    // An empty page, linked in after `prev` (first if nullptr)
+    auto page = new (this->pages.allocate()) InlinePage();
+    page->size = 0;
+    for (size_t i = 0; i < PAGE_CAPACITY; i++) {
+        page->keys[i] = INFINITY;
+    }
+    page->prev = prev;
+    page->next = (prev != nullptr) ? prev->next : this->first_page;
+    if (page->next != nullptr)
+        page->next->prev = page;
+    if (prev != nullptr)
+        prev->next = page;
+    else
+        this->first_page = page;
+    return page;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::index_key(float key, InlinePage* near) {
+    // Point the tree at the first page that starts with `key`, or take
+    // `key` out of the tree if no page does. Pages that start with `key`
+    // are next to `near`, if there are any.
+
+    if (near == nullptr) {
+        void* removed;
+        this->Tree::delete_p(key, &removed);
+        return;
+    }
+    InlinePage* page = near;
+    while (page->prev != nullptr && page->prev->keys[0] >= key)
+        page = page->prev;
+    while (page != nullptr && page->keys[0] < key)
+        page = page->next;
+    if (page != nullptr && page->keys[0] == key) {
+        this->Tree::replace_p(key, page);
+    } else {
+        void* removed;
+        this->Tree::delete_p(key, &removed);
+    }
+}
+
+template<class Tree>
+InlinePage* BasicInlineHitboxIndex<Tree>::find_start(float key) {
+    // The page to look for `key` from: the first page of the largest first
+    // key below `key`, or the first page. Entries less than `key` may go on
+    // for a few pages after it.
+    auto page = static_cast<InlinePage*>(this->Tree::get_below_p(key));
+    return (page != nullptr) ? page : this->first_page;
+}
+
+template<class Tree>
+InlinePage* BasicInlineHitboxIndex<Tree>::find(float key, uint32_t id,
+                                               size_t* index_out) {
+    // The page and index of entry (key, id), or nullptr
+    for (InlinePage* page = this->find_start(key);
+         page != nullptr && page->keys[0] <= key; page = page->next) {
+        size_t i = count_keys_lt(page->keys, PAGE_CAPACITY, key);
+        for (; i < page->size && page->keys[i] == key; i++) {
+            if (page->boxes[i].id == id) {
+                *index_out = i;
+                return page;
+            }
+        }
+    }
+    return nullptr;
+}
+
+template<class Tree>
+InlinePage* BasicInlineHitboxIndex<Tree>::split_page(InlinePage* page,
+                                                     float key) {
+    // Move the upper half of a full page to a new page after it. Returns
+    // the one of the two that `key` goes to.
+
+    InlinePage* right = this->make_page(page);
+    size_t half = PAGE_CAPACITY / 2;
+    size_t n = PAGE_CAPACITY - half;
+    memcpy(right->keys, &(page->keys[half]), n * sizeof(float));
+    memcpy(right->boxes, &(page->boxes[half]), n * sizeof(InlineHitbox));
+    right->size = n;
+    for (size_t i = half; i < PAGE_CAPACITY; i++) {
+        page->keys[i] = INFINITY;
+    }
+    page->size = half;
+    this->index_key(right->keys[0], right);
+    return (key < right->keys[0]) ? page : right;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::insert(float key, const Hitbox& box,
+                                          uint32_t id) {
+    if (isnan(key) || isinf(key))
+        throw std::invalid_argument("keys must be finite");
+    if (this->first_page == nullptr) {
+        InlinePage* page = this->make_page(nullptr);
+        put_entry(page, key, box, id);
+        this->Tree::replace_p(key, page);
+        return;
+    }
+
+    // Go on to the last page that `key` may go to, unless one on the way
+    // has room and is followed by a page that starts with `key`
+    InlinePage* page = this->find_start(key);
+    while (page->next != nullptr && page->next->keys[0] <= key) {
+        if (page->size < PAGE_CAPACITY && page->next->keys[0] == key)
+            break;
+        page = page->next;
+    }
+    if (page->size == PAGE_CAPACITY)
+        page = this->split_page(page, key);
+
+    float old_first = page->keys[0];
+    put_entry(page, key, box, id);
+    if (page->keys[0] != old_first) {
+        this->index_key(key, page);
+        this->index_key(old_first, page);
+    }
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::merge_next(InlinePage* page) {
+    // Move the entries of the next page to the end of `page`, which has
+    // room for them, and free the next page
+    InlinePage* next = page->next;
+    float next_first = next->keys[0];
+    memcpy(&(page->keys[page->size]), next->keys,
+           next->size * sizeof(float));
+    memcpy(&(page->boxes[page->size]), next->boxes,
+           next->size * sizeof(InlineHitbox));
+    page->size += next->size;
+    page->next = next->next;
+    if (page->next != nullptr)
+        page->next->prev = page;
+    this->pages.release(next);
+    this->index_key(next_first, page);
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::remove_entry(InlinePage* page, size_t i) {
+    float old_first = page->keys[0];
+    size_t n = page->size - i - 1;
+    memmove(&(page->keys[i]), &(page->keys[i + 1]), n * sizeof(float));
+    memmove(&(page->boxes[i]), &(page->boxes[i + 1]),
+            n * sizeof(InlineHitbox));
+    page->size--;
+    page->keys[page->size] = INFINITY;
+
+    if (page->size == 0) {
+        InlinePage* near = (page->next != nullptr) ? page->next : page->prev;
+        if (page->prev != nullptr)
+            page->prev->next = page->next;
+        else
+            this->first_page = page->next;
+        if (page->next != nullptr)
+            page->next->prev = page->prev;
+        this->pages.release(page);
+        this->index_key(old_first, near);
+        return;
+    }
+    if (page->keys[0] != old_first) {
+        this->index_key(old_first, page);
+        this->index_key(page->keys[0], page);
+    }
+    // Keep pages at least a quarter full on average
+    if (page->next != nullptr
+            && page->size + page->next->size <= PAGE_CAPACITY / 2)
+        this->merge_next(page);
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::update(float old_key, float new_key,
+                                          uint32_t id) {
+    if (isnan(new_key) || isinf(new_key))
+        throw std::invalid_argument("keys must be finite");
+    size_t i;
+    InlinePage* page = this->find(old_key, id, &i);
+    if (page == nullptr || old_key == new_key)
+        return;
+
+    // Common case: the hitbox moves a little, and its neighbors do not
+    // change. Then only the key is written.
+    float lo = (i > 0) ? page->keys[i - 1]
+        : (page->prev != nullptr) ? last_key(page->prev) : -INFINITY;
+    float hi = (i + 1 < page->size) ? page->keys[i + 1]
+        : (page->next != nullptr) ? page->next->keys[0] : INFINITY;
+    if (lo <= new_key && new_key <= hi) {
+        page->keys[i] = new_key;
+        if (i == 0) {
+            this->index_key(old_key, page);
+            this->index_key(new_key, page);
+        }
+        return;
+    }
+
+    Hitbox box = page->boxes[i].box;
+    this->remove_entry(page, i);
+    this->insert(new_key, box, id);
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::update_box(float key, uint32_t id,
+                                              const Hitbox& box) {
+    size_t i;
+    InlinePage* page = this->find(key, id, &i);
+    if (page != nullptr)
+        page->boxes[i].box = box;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::del(float key, uint32_t id) {
+    size_t i;
+    InlinePage* page = this->find(key, id, &i);
+    if (page != nullptr)
+        this->remove_entry(page, i);
+}
+
+template<class Tree>
+const InlineHitbox* BasicInlineHitboxIndex<Tree>::get(float key,
+                                                      uint32_t id) {
+    size_t i;
+    InlinePage* page = this->find(key, id, &i);
+    return (page != nullptr) ? &(page->boxes[i]) : nullptr;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::range_search(float k0, float k1) {
+    for (InlinePage* page = this->find_start(k0);
+         page != nullptr && page->keys[0] <= k1; page = page->next) {
+        // (infinite bounds would count the unused keys too)
+        size_t lo = std::min<size_t>(
+            count_keys_lt(page->keys, PAGE_CAPACITY, k0), page->size);
+        size_t hi = std::min<size_t>(
+            count_keys_le(page->keys, PAGE_CAPACITY, k1), page->size);
+        if (lo < hi)
+            this->inline_callback(&(page->keys[lo]), &(page->boxes[lo]),
+                                  hi - lo);
+    }
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::ball_query(float mag, float rad, float R) {
+    float temp = rad + R;
+    this->range_search(mag - temp, mag + temp);
+}
+
+template<class Tree>
+bool BasicInlineHitboxIndex<Tree>::is_empty() {
+    return this->first_page == nullptr;
+}
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::clear() {
+    this->Tree::clear();
+    this->pages.clear();
+    this->first_page = nullptr;
+}
+
+class PageCollector : public ResultSink {
+public:
+    std::vector<void*> pages;
+
+    void callback(void** buffer, size_t size) override {
+        this->pages.insert(this->pages.end(), buffer, buffer + size);
+    }
+};
+
+template<class Tree>
+void BasicInlineHitboxIndex<Tree>::test_if_pages_are_consistent() {
+    // Keys are sorted along the pages, and the tree maps the first key of
+    // each page to the first page that starts with it
+    float last = -INFINITY;
+    InlinePage* prev = nullptr;
+    std::vector<void*> first_pages;
+    for (InlinePage* page = this->first_page; page != nullptr;
+         page = page->next) {
+        if (page->prev != prev)
+            throw std::logic_error("broken page links");
+        if (page->size == 0 || page->size > PAGE_CAPACITY)
+            throw std::logic_error("wrong page size");
+        for (size_t i = 0; i < PAGE_CAPACITY; i++) {
+            if (i < page->size ? page->keys[i] < last
+                               : !isinf(page->keys[i]))
+                throw std::logic_error("not sorted!");
+            if (i < page->size)
+                last = page->keys[i];
+        }
+        if (prev == nullptr || prev->keys[0] != page->keys[0])
+            first_pages.push_back(page);
+        prev = page;
+    }
+
+    PageCollector collector;
+    auto acc = this->Tree::make_iteration_buffer(&collector);
+    this->Tree::range_search_p(-FLT_MAX, FLT_MAX, acc);
+    this->Tree::destroy_iteration_buffer(acc);
+    if (collector.pages != first_pages)
+        throw std::logic_error("the tree does not map the pages");
+}
+
+template<class Tree>
+size_t BasicInlineHitboxIndex<Tree>::get_node_bytes() {
+    return this->Tree::get_node_bytes() + this->pages.get_bytes_reserved();
+}
+
+template class BasicInlineHitboxIndex<BPTree256>;
+template class BasicInlineHitboxIndex<BPTree512>;
+template class BasicInlineHitboxIndex<BPTree1K>;
+template class BasicInlineHitboxIndex<BPTree4K>;
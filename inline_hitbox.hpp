@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include "arena.hpp"
+#include "bptree.hpp"
+#include "hitbox.hpp"
+
+// A hitbox stored by value, with an ID of the user's choosing that tells
+// hitboxes under the same key apart
+struct InlineHitbox {
+    Hitbox box;
+    uint32_t id;
+};
+
+struct InlinePage;
+
+// Hitbox index that holds the hitboxes themselves instead of pointers to
+// them. Defined in inline_hitbox.cpp for the presets only.
+//
+// The hitboxes are kept in key order in pages of a few dozen, and the tree
+// maps the first key of each page to the page. A search goes down the tree
+// once and then reads pages one after the other: keys and hitboxes are
+// contiguous within a page, so the callback gets them as plain arrays, with
+// no pointer to follow per hitbox. Equal keys are simply adjacent entries
+// and may continue over several pages, so there are no sets. Keys are
+// finite: insert and update throw std::invalid_argument otherwise.
+//
+// Single-threaded only: there is no thread-safe mode, snapshots or saving.
+template<class Tree>
+class BasicInlineHitboxIndex : private Tree {
+public:
+    // Store a copy of `box` under `key`. Each (key, id) pair is meant to be
+    // stored once; which of several equal pairs the other methods find is
+    // unspecified.
+    void insert(float key, const Hitbox& box, uint32_t id);
+    // Move hitbox `id` from `old_key` to `new_key`. Nothing happens if it
+    // is not stored under `old_key`. The same as del and insert, but in
+    // place when the order allows it.
+    void update(float old_key, float new_key, uint32_t id);
+    // Overwrite the stored copy of hitbox `id` under `key`, if there is one
+    void update_box(float key, uint32_t id, const Hitbox& box);
+    void del(float key, uint32_t id);
+    // The stored copy, or nullptr. Valid until the index is modified.
+    const InlineHitbox* get(float key, uint32_t id);
+
+    // Results go to `inline_callback`, in key order
+    void range_search(float k0, float k1);
+    void ball_query(float mag, float rad, float R);
+
+    bool is_empty();
+    void clear() override;
+
+    // Unit test helpers
+    void test_if_pages_are_consistent();
+
+    // Benchmark helpers
+    using Tree::get_height;
+    size_t get_node_bytes();
+
+    virtual ~BasicInlineHitboxIndex() = default;
+
+protected:
+    // Base class is not to be used directly
+    BasicInlineHitboxIndex();
+
+    // Receives the hitboxes in range, a run of n contiguous ones at a time
+    virtual void inline_callback(const float* keys, const InlineHitbox* boxes,
+                                 size_t n) = 0;
+
+private:
+    // Pages are searched directly, not through iteration buffers
+    void callback(void** buffer, size_t size) override;
+
+    InlinePage* find_start(float key);
+    InlinePage* find(float key, uint32_t id, size_t* index_out);
+    InlinePage* make_page(InlinePage* prev);
+    InlinePage* split_page(InlinePage* page, float key);
+    void remove_entry(InlinePage* page, size_t i);
+    void merge_next(InlinePage* page);
+    void index_key(float key, InlinePage* near);
+
+    SlabPool pages;
+    InlinePage* first_page;
+};
+
+extern template class BasicInlineHitboxIndex<BPTree256>;
+extern template class BasicInlineHitboxIndex<BPTree512>;
+extern template class BasicInlineHitboxIndex<BPTree1K>;
+extern template class BasicInlineHitboxIndex<BPTree4K>;
+
+template<class CRTP, class Tree = BaseBPTree>
+class InlineHitboxIndex : public BasicInlineHitboxIndex<Tree> {
+    // Implement this in your derived class
+    // void search_callback(const float* keys, const InlineHitbox* boxes,
+    //                      size_t n);
+
+protected:
+    void inline_callback(const float* keys, const InlineHitbox* boxes,
+                         size_t n) override {
+        static_cast<CRTP*>(this)->search_callback(keys, boxes, n);
+    }
+
+public:
+    InlineHitboxIndex() = default;
+    virtual ~InlineHitboxIndex() = default;
+};
@@ -0,0 +1,192 @@
+#include <stddef.h>
+#include "keysearch.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KEYSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+
+// Scalar fallback
+//
+// Since the keys are sorted, we can stop at the first key that fails the
+// comparison. This is the same loop we used before the SIMD versions existed.
+
+static size_t scalar_le(const float* keys, size_t n, float key) {
+    size_t i = 0;
+    while (i < n && keys[i] <= key)
+        i++;
+    return i;
+}
+
+static size_t scalar_lt(const float* keys, size_t n, float key) {
+    size_t i = 0;
+    while (i < n && keys[i] < key)
+        i++;
+    return i;
+}
+
+#ifdef KEYSEARCH_X86
+
+// SIMD versions
+//
+// Compare a whole vector of keys against the search key and count the bits
+// of the resulting mask. This has no data-dependent branch, so the result
+// does not depend on the branch predictor guessing where the key lands.
+//
+// Node keys are only 8-byte aligned (they follow the `next` pointer), hence
+// the unaligned loads.
+
+static size_t sse2_hsum(__m128i counts) {
+    // each lane holds a count; add the lanes together
+    counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, 0x4e));
+    counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, 0xb1));
+    return (size_t) _mm_cvtsi128_si32(counts);
+}
+
+static size_t sse2_le(const float* keys, size_t n, float key) {
+    // SSE2 has no popcnt, so subtract the all-ones compare masks (-1 per
+    // matching lane) from per-lane counters instead
+    __m128 k = _mm_set1_ps(key);
+    __m128i counts = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(&(keys[i]));
+        counts = _mm_sub_epi32(counts, _mm_castps_si128(_mm_cmple_ps(v, k)));
+    }
+    size_t count = sse2_hsum(counts);
+    for (; i < n; i++)
+        count += (keys[i] <= key);
+    return count;
+}
+
+static size_t sse2_lt(const float* keys, size_t n, float key) {
+    __m128 k = _mm_set1_ps(key);
+    __m128i counts = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(&(keys[i]));
+        counts = _mm_sub_epi32(counts, _mm_castps_si128(_mm_cmplt_ps(v, k)));
+    }
+    size_t count = sse2_hsum(counts);
+    for (; i < n; i++)
+        count += (keys[i] < key);
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t avx2_le(const float* keys, size_t n, float key) {
+    __m256 k8 = _mm256_set1_ps(key);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(&(keys[i]));
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, k8, _CMP_LE_OQ));
+        count += __builtin_popcount(mask);
+    }
+    if (i + 4 <= n) {
+        __m128 v = _mm_loadu_ps(&(keys[i]));
+        __m128 k4 = _mm256_castps256_ps128(k8);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_cmple_ps(v, k4)));
+        i += 4;
+    }
+    for (; i < n; i++)
+        count += (keys[i] <= key);
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t avx2_lt(const float* keys, size_t n, float key) {
+    __m256 k8 = _mm256_set1_ps(key);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(&(keys[i]));
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, k8, _CMP_LT_OQ));
+        count += __builtin_popcount(mask);
+    }
+    if (i + 4 <= n) {
+        __m128 v = _mm_loadu_ps(&(keys[i]));
+        __m128 k4 = _mm256_castps256_ps128(k8);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(v, k4)));
+        i += 4;
+    }
+    for (; i < n; i++)
+        count += (keys[i] < key);
+    return count;
+}
+
+#endif  // KEYSEARCH_X86
+
+
+// Dispatch
+//
+// The pointers start out as the scalar versions, so they are valid even
+// during static initialization of other translation units.
+
+KeySearchFn key_search_le = scalar_le;
+KeySearchFn key_search_lt = scalar_lt;
+static KeySearchImpl current_impl = KeySearchImpl::SCALAR;
+
+static bool is_supported(KeySearchImpl impl) {
+    switch (impl) {
+    case KeySearchImpl::SCALAR:
+        return true;
+#ifdef KEYSEARCH_X86
+    case KeySearchImpl::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case KeySearchImpl::AVX2:
+        return __builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("popcnt");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool set_key_search_impl(KeySearchImpl impl) {
+    if (!is_supported(impl))
+        return false;
+
+    switch (impl) {
+#ifdef KEYSEARCH_X86
+    case KeySearchImpl::SSE2:
+        key_search_le = sse2_le;
+        key_search_lt = sse2_lt;
+        break;
+    case KeySearchImpl::AVX2:
+        key_search_le = avx2_le;
+        key_search_lt = avx2_lt;
+        break;
+#endif
+    default:
+        key_search_le = scalar_le;
+        key_search_lt = scalar_lt;
+        break;
+    }
+    current_impl = impl;
+    return true;
+}
+
+KeySearchImpl get_key_search_impl() {
+    return current_impl;
+}
+
+const char* key_search_impl_name(KeySearchImpl impl) {
+    switch (impl) {
+    case KeySearchImpl::SSE2: return "sse2";
+    case KeySearchImpl::AVX2: return "avx2";
+    default:                  return "scalar";
+    }
+}
+
+static bool pick_best_impl() {
+#ifdef KEYSEARCH_X86
+    __builtin_cpu_init();
+#endif
+    return set_key_search_impl(KeySearchImpl::AVX2)
+        || set_key_search_impl(KeySearchImpl::SSE2)
+        || set_key_search_impl(KeySearchImpl::SCALAR);
+}
+
+[[maybe_unused]] static bool picked_best_impl = pick_best_impl();
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+// Searching inside the sorted key array of a B+ tree node.
+//
+// All functions assume that `keys[0..n)` is sorted in ascending order. Unused
+// slots hold INFINITY, so they sort after every real key.
+
+enum class KeySearchImpl : unsigned char {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+using KeySearchFn = size_t (*)(const float* keys, size_t n, float key);
+
+extern KeySearchFn key_search_le;
+extern KeySearchFn key_search_lt;
+
+// Number of keys that are less than or equal to `key`. In an internal node,
+// this is the index of the child to descend into.
+inline size_t count_keys_le(const float* keys, size_t n, float key) {
+    return key_search_le(keys, n, key);
+}
+
+// Number of keys that are strictly less than `key`. This is the slot where
+// `key` is stored, or where it would be inserted.
+inline size_t count_keys_lt(const float* keys, size_t n, float key) {
+    return key_search_lt(keys, n, key);
+}
+
+// The implementation is picked once at startup by CPU feature detection. The
+// setter exists for benchmarks; it returns false (and changes nothing) if the
+// CPU does not support the requested implementation.
+KeySearchImpl get_key_search_impl();
+bool set_key_search_impl(KeySearchImpl impl);
+const char* key_search_impl_name(KeySearchImpl impl);
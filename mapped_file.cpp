@@ -0,0 +1,45 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+#include "mapped_file.hpp"
+
+MappedFile::MappedFile() {
+    this->data = nullptr;
+    this->size = 0;
+}
+
+MappedFile::~MappedFile() {
+    this->close();
+}
+
+void MappedFile::open(const char* path) {
+    this->close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(std::string("cannot open ") + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error(std::string("cannot map ") + path);
+    }
+    void* result = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file open by itself
+    ::close(fd);
+    if (result == MAP_FAILED)
+        throw std::runtime_error(std::string("cannot map ") + path);
+
+    this->data = static_cast<const char*>(result);
+    this->size = st.st_size;
+}
+
+void MappedFile::close() {
+    if (this->data == nullptr)
+        return;
+    munmap(const_cast<char*>(this->data), this->size);
+    this->data = nullptr;
+    this->size = 0;
+}
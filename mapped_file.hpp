@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+// A whole file mapped read-only into memory. The mapping is shared with the
+// page cache, so mapping a large file costs next to nothing until its pages
+// are touched.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map the file at `path`, in place of the one mapped before. Throws
+    // std::runtime_error if it cannot be opened or mapped.
+    void open(const char* path);
+    void close();
+
+    bool is_open() const { return this->data != nullptr; }
+    const char* get_data() const { return this->data; }
+    size_t get_size() const { return this->size; }
+
+private:
+    const char* data;
+    size_t size;
+};
@@ -0,0 +1,290 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "pair_tracker.hpp"
+
+float PairTracker::bound(const Hitbox& box, size_t axis, bool is_max) {
+    if (axis == 0)
+        return is_max ? box.b1 : box.a1;
+    return is_max ? box.b2 : box.a2;
+}
+
+bool PairTracker::comes_before(const Endpoint& l, const Endpoint& r) {
+    // A minimum goes before an equal maximum: touching intervals overlap
+    if (l.value != r.value)
+        return l.value < r.value;
+    return !(l.tag & 1) && (r.tag & 1);
+}
+
+uint64_t PairTracker::pair_key(uint32_t l, uint32_t r) {
+    if (l > r)
+        std::swap(l, r);
+    return ((uint64_t) l << 32) | r;
+}
+
+void PairTracker::place(size_t axis, size_t at) {
+    // Tell the owner of the endpoint at `at` where it is
+    uint32_t tag = this->axes[axis][at].tag;
+    this->tracked[tag >> 1].at[axis][tag & 1] = at;
+}
+
+void PairTracker::swap_endpoints(size_t axis, size_t at) {
+    // Swap the endpoints at `at` and `at` + 1
+    auto& list = this->axes[axis];
+    std::swap(list[at], list[at + 1]);
+    this->place(axis, at);
+    this->place(axis, at + 1);
+    this->num_swaps++;
+}
+
+static void remove_partner(std::vector<uint32_t>* partners, uint32_t id) {
+    auto it = std::find(partners->begin(), partners->end(), id);
+    *it = partners->back();
+    partners->pop_back();
+}
+
+void PairTracker::start_pair(uint32_t l, uint32_t r) {
+    if (!this->pairs.insert(this->pair_key(l, r)).second)
+        return;
+    this->tracked[l].partners.push_back(r);
+    this->tracked[r].partners.push_back(l);
+    this->started.push_back({this->tracked[l].value,
+                             this->tracked[r].value});
+}
+
+void PairTracker::stop_pair(uint32_t l, uint32_t r) {
+    if (this->pairs.erase(this->pair_key(l, r)) == 0)
+        return;
+    remove_partner(&(this->tracked[l].partners), r);
+    remove_partner(&(this->tracked[r].partners), l);
+    this->stopped.push_back({this->tracked[l].value,
+                             this->tracked[r].value});
+}
+
+void PairTracker::compact() {
+    // Drop the endpoints of deleted boxes, whose ids are then free again
+    auto is_dead = [&](const Endpoint& e) {
+        return this->tracked[e.tag >> 1].value == nullptr;
+    };
+    for (size_t axis = 0; axis < 2; axis++) {
+        auto& list = this->axes[axis];
+        list.erase(std::remove_if(list.begin(), list.end(), is_dead),
+                   list.end());
+        for (size_t at = 0; at < list.size(); at++) {
+            this->place(axis, at);
+        }
+    }
+    this->free_ids.insert(this->free_ids.end(), this->dead_ids.begin(),
+                          this->dead_ids.end());
+    this->dead_ids.clear();
+}
+
+void PairTracker::sift(size_t axis, uint32_t at) {
+    // Move the endpoint at `at` to where it belongs, to the left or the
+    // right until it is in order. Each maximum that a minimum passes (and
+    // vice versa) is where the intervals of two boxes start or stop
+    // overlapping on this axis. Endpoints of deleted boxes are passed by.
+    auto& list = this->axes[axis];
+    auto cross = [&](size_t moving, size_t passed, bool left) {
+        uint32_t m = list[moving].tag, p = list[passed].tag;
+        if ((m >> 1) == (p >> 1) || (m & 1) == (p & 1)
+            || this->tracked[p >> 1].value == nullptr)
+            return;
+        // A minimum that gets before a maximum starts an overlap, and a
+        // maximum that gets after a minimum does too
+        bool starts = (left != (bool) (m & 1));
+        if (!starts)
+            this->stop_pair(m >> 1, p >> 1);
+        else if (boxes_overlap(this->tracked[m >> 1].box,
+                               this->tracked[p >> 1].box))
+            this->start_pair(m >> 1, p >> 1);
+    };
+
+    while (at > 0 && comes_before(list[at], list[at - 1])) {
+        cross(at, at - 1, true);
+        this->swap_endpoints(axis, at - 1);
+        at--;
+    }
+    while (at + 1 < list.size() && comes_before(list[at + 1], list[at])) {
+        cross(at, at + 1, false);
+        this->swap_endpoints(axis, at);
+        at++;
+    }
+}
+
+void PairTracker::insert(Hitbox* value) {
+    if (this->ids.count(value) > 0)
+        throw std::invalid_argument("already tracked");
+
+    uint32_t id;
+    if (this->free_ids.empty()) {
+        id = this->tracked.size();
+        this->tracked.emplace_back();
+    } else {
+        id = this->free_ids.back();
+        this->free_ids.pop_back();
+    }
+    this->ids[value] = id;
+    Tracked& t = this->tracked[id];
+    t.value = value;
+    t.box = *value;
+    for (size_t axis = 0; axis < 2; axis++) {
+        // The minimum goes in first: the maximum cannot pass it
+        auto& list = this->axes[axis];
+        list.push_back({bound(t.box, axis, false), id << 1});
+        list.push_back({bound(t.box, axis, true), (id << 1) | 1});
+        this->place(axis, list.size() - 2);
+        this->place(axis, list.size() - 1);
+        this->sift(axis, t.at[axis][0]);
+        this->sift(axis, t.at[axis][1]);
+    }
+}
+
+void PairTracker::insert_batch(Hitbox* const* values, size_t n) {
+    // The whole batch is checked before anything changes
+    std::unordered_set<Hitbox*> batch;
+    for (size_t i = 0; i < n; i++) {
+        if (this->ids.count(values[i]) > 0 || !batch.insert(values[i]).second)
+            throw std::invalid_argument("already tracked");
+    }
+
+    // (the lists are sorted anew anyway, and the sweep below must not see
+    // deleted boxes)
+    if (!this->dead_ids.empty())
+        this->compact();
+    for (size_t i = 0; i < n; i++) {
+        uint32_t id = this->tracked.size();
+        this->ids[values[i]] = id;
+        this->tracked.push_back({values[i], {}, *(values[i])});
+        for (size_t axis = 0; axis < 2; axis++) {
+            this->axes[axis].push_back({bound(*(values[i]), axis, false),
+                                        id << 1});
+            this->axes[axis].push_back({bound(*(values[i]), axis, true),
+                                        (id << 1) | 1});
+        }
+    }
+    for (size_t axis = 0; axis < 2; axis++) {
+        auto& list = this->axes[axis];
+        std::sort(list.begin(), list.end(), comes_before);
+        for (size_t at = 0; at < list.size(); at++) {
+            this->place(axis, at);
+        }
+    }
+
+    // One sweep along the first axis finds the pairs again, with the boxes
+    // whose interval is open as the active set
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> active_at(this->tracked.size());
+    for (const Endpoint& e : this->axes[0]) {
+        uint32_t id = e.tag >> 1;
+        if (e.tag & 1) {
+            uint32_t at = active_at[id];
+            active[at] = active.back();
+            active_at[active[at]] = at;
+            active.pop_back();
+            continue;
+        }
+        for (uint32_t other : active) {
+            if (boxes_overlap(this->tracked[id].box, this->tracked[other].box))
+                this->start_pair(other, id);
+        }
+        active_at[id] = active.size();
+        active.push_back(id);
+    }
+}
+
+void PairTracker::update(Hitbox* value) {
+    auto it = this->ids.find(value);
+    if (it == this->ids.end())
+        throw std::invalid_argument("not tracked");
+
+    Tracked& t = this->tracked[it->second];
+    t.box = *value;
+    for (size_t axis = 0; axis < 2; axis++) {
+        this->axes[axis][t.at[axis][0]].value = bound(t.box, axis, false);
+        this->axes[axis][t.at[axis][1]].value = bound(t.box, axis, true);
+        // (the minimum cannot pass the maximum, so it goes again if the
+        // maximum made way)
+        this->sift(axis, t.at[axis][0]);
+        this->sift(axis, t.at[axis][1]);
+        this->sift(axis, t.at[axis][0]);
+    }
+}
+
+void PairTracker::del(Hitbox* value) {
+    auto it = this->ids.find(value);
+    if (it == this->ids.end())
+        throw std::invalid_argument("not tracked");
+
+    // Its pairs stop, and its endpoints are left for compact, so this costs
+    // as much as the box has pairs
+    uint32_t id = it->second;
+    Tracked& t = this->tracked[id];
+    while (!t.partners.empty()) {
+        this->stop_pair(id, t.partners.back());
+    }
+    t.value = nullptr;
+    this->ids.erase(it);
+    this->dead_ids.push_back(id);
+    if (this->dead_ids.size() > this->ids.size())
+        this->compact();
+}
+
+void PairTracker::clear() {
+    this->axes[0].clear();
+    this->axes[1].clear();
+    this->tracked.clear();
+    this->free_ids.clear();
+    this->dead_ids.clear();
+    this->ids.clear();
+    this->pairs.clear();
+    this->started.clear();
+    this->stopped.clear();
+}
+
+bool PairTracker::contains(Hitbox* value) {
+    return this->ids.count(value) > 0;
+}
+
+size_t PairTracker::get_num_pairs() {
+    return this->pairs.size();
+}
+
+void PairTracker::get_pairs(std::vector<HitboxPair>* out) {
+    for (uint64_t key : this->pairs) {
+        out->push_back({this->tracked[key >> 32].value,
+                        this->tracked[key & UINT32_MAX].value});
+    }
+}
+
+void PairTracker::take_changes(std::vector<HitboxPair>* started,
+                               std::vector<HitboxPair>* stopped) {
+    started->insert(started->end(), this->started.begin(),
+                    this->started.end());
+    stopped->insert(stopped->end(), this->stopped.begin(),
+                    this->stopped.end());
+    this->started.clear();
+    this->stopped.clear();
+}
+
+void PairTracker::test_if_lists_are_sorted() {
+    for (size_t axis = 0; axis < 2; axis++) {
+        auto& list = this->axes[axis];
+        if (list.size() != 2 * (this->ids.size() + this->dead_ids.size()))
+            throw std::logic_error("wrong number of endpoints");
+        for (size_t at = 0; at < list.size(); at++) {
+            uint32_t tag = list[at].tag;
+            const Tracked& t = this->tracked[tag >> 1];
+            if (t.at[axis][tag & 1] != at)
+                throw std::logic_error("endpoint is not where it was put");
+            if (list[at].value != bound(t.box, axis, tag & 1))
+                throw std::logic_error("endpoint is out of date");
+            if (at > 0 && comes_before(list[at], list[at - 1]))
+                throw std::logic_error("not sorted!");
+        }
+    }
+}
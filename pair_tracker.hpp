@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hitbox.hpp"
+
+// Incremental broad phase: the set of overlapping pairs of some hitboxes,
+// kept up to date as they move (sweep and prune).
+//
+// Both axes of the boxes have a list of the interval endpoints in order.
+// When a box moves, each of its endpoints is moved along its list by
+// swapping it with its neighbors, as insertion sort would: a minimum that
+// passes a maximum is where two intervals start or stop overlapping, and
+// only there do pairs change. Between ticks boxes move little, so a tick
+// costs about as many swaps as there is motion, however many boxes there
+// are. Pairs that started and stopped overlapping are reported as changes.
+//
+// Boxes touching at an edge overlap, as in find_pairs. Extents must not be
+// NaN. Each box is identified by its address.
+class PairTracker {
+public:
+    PairTracker() = default;
+
+    PairTracker(const PairTracker&) = delete;
+    PairTracker& operator=(const PairTracker&) = delete;
+
+    // Start tracking `value`. Its endpoints go in from the far end of the
+    // lists, so this costs a swap per endpoint that they pass; see
+    // insert_batch for many boxes at once.
+    void insert(Hitbox* value);
+    // Start tracking values[0, n) by sorting the lists anew. Throws
+    // std::invalid_argument, changing nothing, if any of them is tracked
+    // already or is in the batch twice.
+    void insert_batch(Hitbox* const* values, size_t n);
+    // Call after the box of `value` changed
+    void update(Hitbox* value);
+    // Stop tracking `value`: its pairs stop at once. Its endpoints stay in
+    // the lists, skipped over, until deleted boxes outnumber the others;
+    // then the lists are compacted in one pass.
+    void del(Hitbox* value);
+    // Forget every box and pair, and the changes
+    void clear();
+
+    bool contains(Hitbox* value);
+    size_t get_num_pairs();
+    // Append the pairs that overlap now to `out`
+    void get_pairs(std::vector<HitboxPair>* out);
+    // Append the pairs that started and that stopped overlapping since the
+    // last call, and forget them. A pair may be in both, if it overlapped
+    // only for a while; pairs with a deleted box are in `stopped`.
+    void take_changes(std::vector<HitboxPair>* started,
+                      std::vector<HitboxPair>* stopped);
+
+    // Swaps done since the tracker was made (benchmark helper)
+    size_t get_num_swaps() { return this->num_swaps; }
+
+    // Unit test helper
+    void test_if_lists_are_sorted();
+
+private:
+    struct Endpoint {
+        float value;
+        // (id << 1) | is_max
+        uint32_t tag;
+    };
+
+    struct Tracked {
+        Hitbox* value;  // nullptr once deleted
+        // Where the minimum and the maximum are in the list of each axis
+        uint32_t at[2][2];
+        Hitbox box;
+        // The ids of the boxes it overlaps
+        std::vector<uint32_t> partners;
+    };
+
+    static float bound(const Hitbox& box, size_t axis, bool is_max);
+    static bool comes_before(const Endpoint& l, const Endpoint& r);
+    uint64_t pair_key(uint32_t l, uint32_t r);
+
+    void place(size_t axis, size_t at);
+    void swap_endpoints(size_t axis, size_t at);
+    void sift(size_t axis, uint32_t at);
+    void start_pair(uint32_t l, uint32_t r);
+    void stop_pair(uint32_t l, uint32_t r);
+    void compact();
+
+    std::vector<Endpoint> axes[2];
+    std::vector<Tracked> tracked;
+    std::vector<uint32_t> free_ids;
+    // Deleted boxes whose endpoints are still in the lists
+    std::vector<uint32_t> dead_ids;
+    std::unordered_map<Hitbox*, uint32_t> ids;
+    std::unordered_set<uint64_t> pairs;
+    std::vector<HitboxPair> started;
+    std::vector<HitboxPair> stopped;
+    size_t num_swaps = 0;
+};
+
+// Hitbox index that keeps a PairTracker of its hitboxes: inserting,
+// updating and deleting go to both. The caller changes a box first and
+// then calls update, even if its key stays the same. Not for mapped
+// indices, whose hitboxes are copies in the file.
+//
+// Inserts go to the tracker first, which rejects hitboxes that are there
+// already, and are taken back from it if the index throws (their pairs then
+// show up as started and stopped); either way the two keep the same
+// hitboxes.
+template<class CRTP, class Tree = BaseBPTree>
+class TrackingHitboxIndex : public HitboxIndex<CRTP, Tree> {
+public:
+    TrackingHitboxIndex() = default;
+    virtual ~TrackingHitboxIndex() = default;
+
+    void insert(float key, Hitbox* value) {
+        this->pairs.insert(value);
+        try {
+            this->HitboxIndex<CRTP, Tree>::insert(key, value);
+        } catch (...) {
+            this->pairs.del(value);
+            throw;
+        }
+    }
+
+    void insert_batch(const float* keys, Hitbox* const* values, size_t n) {
+        this->pairs.insert_batch(values, n);
+        try {
+            this->HitboxIndex<CRTP, Tree>::insert_batch(keys, values, n);
+        } catch (...) {
+            this->untrack(values, n);
+            throw;
+        }
+    }
+
+    void bulk_load(const float* keys, Hitbox* const* values, size_t n,
+                   float fill_factor = 1.0f) {
+        this->pairs.insert_batch(values, n);
+        try {
+            this->HitboxIndex<CRTP, Tree>::bulk_load(keys, values, n,
+                                                     fill_factor);
+        } catch (...) {
+            this->untrack(values, n);
+            throw;
+        }
+    }
+
+    void update(float old_key, float new_key, Hitbox* value) {
+        this->HitboxIndex<CRTP, Tree>::update(old_key, new_key, value);
+        this->pairs.update(value);
+    }
+
+    void del(float key, Hitbox* match_value) {
+        // (nothing happens if the value is not stored under `key`)
+        if (!this->contains(key, match_value))
+            return;
+        this->HitboxIndex<CRTP, Tree>::del(key, match_value);
+        this->pairs.del(match_value);
+    }
+
+    void clear() override {
+        this->HitboxIndex<CRTP, Tree>::clear();
+        this->pairs.clear();
+    }
+
+    PairTracker* get_pair_tracker() { return &(this->pairs); }
+
+private:
+    void untrack(Hitbox* const* values, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            this->pairs.del(values[i]);
+        }
+    }
+
+    PairTracker pairs;
+};
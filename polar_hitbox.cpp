@@ -0,0 +1,195 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include "polar_hitbox.hpp"
+
+// The share of a turn that the direction of (x, y) is at, in [0, 1]
+static double turn_of(double x, double y) {
+    return (atan2(y, x) + M_PI) / (2 * M_PI);
+}
+
+static float magnitude(float x, float y) {
+    return sqrtf(x * x + y * y);
+}
+
+template<class Tree>
+class BasicPolarHitboxIndex<Tree>::Sector : public BasicHitboxIndex<Tree> {
+public:
+    explicit Sector(BasicPolarHitboxIndex* owner) {
+        this->owner = owner;
+    }
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        this->owner->callback(buffer, size);
+    }
+
+private:
+    BasicPolarHitboxIndex* owner;
+};
+
+template<class Tree>
+class BasicPolarHitboxIndex<Tree>::Acc {
+public:
+    // One iteration buffer per sector, each bound to its tree
+    std::vector<typename Tree::Acc*> sector_accs;
+};
+
+template<class Tree>
+BasicPolarHitboxIndex<Tree>::BasicPolarHitboxIndex(size_t num_sectors) {
+    if (num_sectors == 0)
+        throw std::invalid_argument("no sectors");
+    for (size_t i = 0; i < num_sectors; i++) {
+        this->sectors.push_back(new Sector(this));
+    }
+}
+
+template<class Tree>
+BasicPolarHitboxIndex<Tree>::~BasicPolarHitboxIndex() {
+    for (Sector* sector : this->sectors) {
+        delete sector;
+    }
+}
+
+template<class Tree>
+size_t BasicPolarHitboxIndex<Tree>::sector_of(float x, float y) {
+    size_t num = this->sectors.size();
+    auto i = (size_t) (turn_of(x, y) * num);
+    return (i < num) ? i : num - 1;
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::find_sectors(float x, float y, float reach,
+                                               size_t* first, size_t* last) {
+    // Seen from the origin, a disc of radius `reach` at distance d spans
+    // asin(reach / d) to either side of its center. The span is widened a
+    // little against rounding, which sector_of does in the same way.
+    size_t num = this->sectors.size();
+    double d = magnitude(x, y);
+    if (!(d > reach)) {
+        *first = 0;
+        *last = num - 1;
+        return;
+    }
+    double half = asin(reach / d) / (2 * M_PI) + 1e-6;
+    if (2 * half * num + 2 >= num) {
+        *first = 0;
+        *last = num - 1;
+        return;
+    }
+    double center = turn_of(x, y);
+    // (in [-1, 2] turns; the sector is that modulo one turn)
+    auto lo = (long) floor((center - half) * num);
+    auto hi = (long) floor((center + half) * num);
+    *first = (size_t) ((lo + (long) num) % (long) num);
+    *last = (size_t) (std::min(hi, 2 * (long) num - 1) % (long) num);
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::insert(float x, float y, Hitbox* value) {
+    this->sectors[this->sector_of(x, y)]->insert(magnitude(x, y), value);
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::update(float old_x, float old_y,
+                                         float new_x, float new_y,
+                                         Hitbox* value) {
+    size_t from = this->sector_of(old_x, old_y);
+    size_t to = this->sector_of(new_x, new_y);
+    if (from == to) {
+        this->sectors[from]->update(magnitude(old_x, old_y),
+                                    magnitude(new_x, new_y), value);
+        return;
+    }
+    // (nothing happens if the value is not stored at the old position)
+    float old_mag = magnitude(old_x, old_y);
+    if (!this->sectors[from]->contains(old_mag, value))
+        return;
+    this->sectors[from]->del(old_mag, value);
+    this->sectors[to]->insert(magnitude(new_x, new_y), value);
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::del(float x, float y, Hitbox* value) {
+    this->sectors[this->sector_of(x, y)]->del(magnitude(x, y), value);
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::ball_query(float x, float y, float rad,
+                                             float R, Acc* acc) {
+    float reach = rad + R;
+    float mag = magnitude(x, y);
+    size_t first, last;
+    this->find_sectors(x, y, reach, &first, &last);
+    size_t num = this->sectors.size();
+    for (size_t i = first;; i = (i + 1) % num) {
+        this->sectors[i]->ball_query(mag, rad, R, acc->sector_accs[i]);
+        if (i == last)
+            break;
+    }
+}
+
+template<class Tree>
+size_t BasicPolarHitboxIndex<Tree>::count_sectors_searched(float x, float y,
+                                                           float rad,
+                                                           float R) {
+    size_t first, last;
+    this->find_sectors(x, y, rad + R, &first, &last);
+    size_t num = this->sectors.size();
+    return (last + num - first) % num + 1;
+}
+
+template<class Tree>
+typename BasicPolarHitboxIndex<Tree>::Acc*
+BasicPolarHitboxIndex<Tree>::make_iteration_buffer() {
+    auto acc = new Acc();
+    for (Sector* sector : this->sectors) {
+        acc->sector_accs.push_back(sector->make_iteration_buffer());
+    }
+    return acc;
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::destroy_iteration_buffer(Acc* acc) {
+    for (size_t i = 0; i < this->sectors.size(); i++) {
+        this->sectors[i]->destroy_iteration_buffer(acc->sector_accs[i]);
+    }
+    delete acc;
+}
+
+template<class Tree>
+bool BasicPolarHitboxIndex<Tree>::is_empty() {
+    for (Sector* sector : this->sectors) {
+        if (!sector->is_empty())
+            return false;
+    }
+    return true;
+}
+
+template<class Tree>
+void BasicPolarHitboxIndex<Tree>::clear() {
+    for (Sector* sector : this->sectors) {
+        sector->clear();
+    }
+}
+
+template<class Tree>
+size_t BasicPolarHitboxIndex<Tree>::get_num_sectors() {
+    return this->sectors.size();
+}
+
+template<class Tree>
+size_t BasicPolarHitboxIndex<Tree>::get_node_bytes() {
+    size_t bytes = 0;
+    for (Sector* sector : this->sectors) {
+        bytes += sector->get_node_bytes();
+    }
+    return bytes;
+}
+
+template class BasicPolarHitboxIndex<BPTree256>;
+template class BasicPolarHitboxIndex<BPTree512>;
+template class BasicPolarHitboxIndex<BPTree1K>;
+template class BasicPolarHitboxIndex<BPTree4K>;
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include "bptree.hpp"
+#include "hitbox.hpp"
+
+// Hitbox index on the plane, keyed on the position of each hitbox in polar
+// coordinates: a point within `R` of all of the box, as for ball queries.
+// Defined in polar_hitbox.cpp for the presets only.
+//
+// A ball query of a plain index gets the whole ring of magnitudes that the
+// ball spans, and costs as many hitboxes as the ring holds. Here the plane
+// is cut into equal sectors around the origin, each with an index of its
+// own keyed on magnitude as usual, and a ball query searches only the
+// sectors that the ball overlaps: the ring less what is far away in angle.
+// Near the origin, balls overlap every sector.
+//
+// Positions are finite. Single-threaded only: there is no thread-safe
+// mode, snapshots or saving.
+template<class Tree>
+class BasicPolarHitboxIndex {
+public:
+    // Iteration buffers for all of the sectors
+    class Acc;
+
+    void insert(float x, float y, Hitbox* value);
+    // Move `value` from position (old_x, old_y) to (new_x, new_y). Nothing
+    // happens if it is not stored at the old position.
+    void update(float old_x, float old_y, float new_x, float new_y,
+                Hitbox* value);
+    void del(float x, float y, Hitbox* value);
+    // The hitboxes that may touch the ball of radius `rad` at (x, y), each
+    // of them within `R` of its position. Results go to `callback`, sector
+    // by sector, in key order within each.
+    void ball_query(float x, float y, float rad, float R, Acc* acc);
+
+    Acc* make_iteration_buffer();
+    void destroy_iteration_buffer(Acc* acc);
+    bool is_empty();
+    void clear();
+
+    size_t get_num_sectors();
+    // The sectors that a ball query searches (benchmark helper)
+    size_t count_sectors_searched(float x, float y, float rad, float R);
+
+    // Benchmark helpers
+    size_t get_node_bytes();
+
+    virtual ~BasicPolarHitboxIndex();
+
+protected:
+    // Base class is not to be used directly
+    explicit BasicPolarHitboxIndex(size_t num_sectors);
+
+    // Receives the results of ball queries, as the callback of a tree does
+    virtual void callback(void** buffer, size_t size) = 0;
+
+private:
+    class Sector;
+
+    size_t sector_of(float x, float y);
+    // The first and the last sector that a ball query searches, going
+    // counterclockwise; `last` may be less than `first` (wrap around)
+    void find_sectors(float x, float y, float reach, size_t* first,
+                      size_t* last);
+
+    std::vector<Sector*> sectors;
+};
+
+extern template class BasicPolarHitboxIndex<BPTree256>;
+extern template class BasicPolarHitboxIndex<BPTree512>;
+extern template class BasicPolarHitboxIndex<BPTree1K>;
+extern template class BasicPolarHitboxIndex<BPTree4K>;
+
+template<class CRTP, class Tree = BaseBPTree>
+class PolarHitboxIndex : public BasicPolarHitboxIndex<Tree> {
+    // Implement this in your derived class
+    // void search_callback(HitboxIterator* iter);
+
+protected:
+    void callback(void** buffer, size_t size) override {
+        HitboxIterator iter = HitboxIterator(buffer, size);
+        static_cast<CRTP*>(this)->search_callback(&iter);
+    }
+
+public:
+    // More sectors prune more of the ring, but a ball query goes down the
+    // tree of each sector it overlaps, as near the origin all of them (see
+    // bench/bench_polar)
+    explicit PolarHitboxIndex(size_t num_sectors = 64)
+        : BasicPolarHitboxIndex<Tree>(num_sectors) {}
+    virtual ~PolarHitboxIndex() = default;
+};
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include "query_pool.hpp"
+
+QueryPool::QueryPool(size_t num_workers) : shares(
+        (num_workers > 0)
+            ? num_workers
+            : std::max(1u, std::thread::hardware_concurrency())) {
+    this->task = nullptr;
+    this->generation = 0;
+    this->num_busy = 0;
+    this->stopping = false;
+    for (size_t w = 1; w < this->shares.size(); w++) {
+        this->threads.emplace_back(&QueryPool::thread_main, this, w);
+    }
+}
+
+QueryPool::~QueryPool() {
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto& t : this->threads) {
+        t.join();
+    }
+}
+
+void QueryPool::run(size_t n, const Task& task) {
+    size_t num_workers = this->shares.size();
+    for (size_t w = 0; w < num_workers; w++) {
+        this->shares[w].next.store(n * w / num_workers,
+                                   std::memory_order_relaxed);
+        this->shares[w].end = n * (w + 1) / num_workers;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->task = &task;
+        this->num_busy = num_workers - 1;
+        this->generation++;
+    }
+    this->wake.notify_all();
+
+    this->work(0);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->done.wait(lock, [this]() { return this->num_busy == 0; });
+    this->task = nullptr;
+}
+
+void QueryPool::work(size_t worker) {
+    // Drain the own share first, then go around the others
+    size_t num_workers = this->shares.size();
+    for (size_t k = 0; k < num_workers; k++) {
+        Share& share = this->shares[(worker + k) % num_workers];
+        for (;;) {
+            size_t begin = share.next.fetch_add(CHUNK_SIZE,
+                                                std::memory_order_relaxed);
+            if (begin >= share.end)
+                break;
+            (*(this->task))(worker, begin, std::min(begin + CHUNK_SIZE,
+                                                    share.end));
+        }
+    }
+}
+
+void QueryPool::thread_main(size_t worker) {
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [&]() {
+                return this->stopping || this->generation != seen;
+            });
+            if (this->stopping)
+                return;
+            seen = this->generation;
+        }
+
+        this->work(worker);
+
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if (--(this->num_busy) == 0)
+            this->done.notify_one();
+    }
+}
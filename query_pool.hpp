@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool for running many independent queries at once.
+//
+// `run` splits the index range [0, n) evenly over the workers. Each worker
+// takes small chunks from the front of its own share; a worker that is done
+// steals chunks from the shares of the others, so uneven queries still
+// balance out. The calling thread is worker 0.
+class QueryPool {
+public:
+    // Chunks are this many indices, so that stealing stays cheap
+    static constexpr size_t CHUNK_SIZE = 16;
+
+    // `num_workers` counts the calling thread; 0 means one per core
+    explicit QueryPool(size_t num_workers = 0);
+    ~QueryPool();
+
+    QueryPool(const QueryPool&) = delete;
+    QueryPool& operator=(const QueryPool&) = delete;
+
+    // Call task(worker, begin, end) until every index in [0, n) was handed
+    // out once, and wait for it to finish. `worker` is in
+    // [0, get_num_workers()); a worker runs one task at a time.
+    using Task = std::function<void(size_t worker, size_t begin, size_t end)>;
+    void run(size_t n, const Task& task);
+
+    size_t get_num_workers() const { return this->shares.size(); }
+
+private:
+    struct alignas(64) Share {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+
+    void work(size_t worker);
+    void thread_main(size_t worker);
+
+    std::vector<Share> shares;
+    std::vector<std::thread> threads;
+    const Task* task;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t generation;
+    size_t num_busy;
+    bool stopping;
+};
@@ -0,0 +1,61 @@
+#include "snapshot.hpp"
+
+SnapshotManager::SnapshotManager() {
+    // Generation 0 is left for objects of unknown age
+    this->generation = 1;
+    this->newest = 0;
+}
+
+SnapshotManager::~SnapshotManager() {
+    // Handles that are still out there stay valid until their last release;
+    // their objects go away with the pools of the tree
+    for (Snapshot* snapshot : this->snapshots) {
+        snapshot->release();
+    }
+}
+
+Snapshot* SnapshotManager::take(void* root) {
+    auto snapshot = new Snapshot(root, this->generation);
+    this->snapshots.push_back(snapshot);
+    this->newest = this->generation;
+    this->generation++;
+    return snapshot;
+}
+
+void SnapshotManager::retire(void* object, SlabPool* pool, uint32_t birth) {
+    if (this->snapshots.empty() || birth > this->newest) {
+        // no snapshot has it
+        pool->release(object);
+        return;
+    }
+    this->retired.push_back({this->generation, object, pool});
+}
+
+void SnapshotManager::collect() {
+    size_t kept = 0;
+    for (Snapshot* snapshot : this->snapshots) {
+        // (only the manager's own reference left: nobody else can take
+        // another one)
+        if (snapshot->refs.load(std::memory_order_acquire) == 1)
+            snapshot->release();
+        else
+            this->snapshots[kept++] = snapshot;
+    }
+    this->snapshots.resize(kept);
+    this->newest = this->snapshots.empty()
+        ? 0
+        : this->snapshots.back()->generation;
+
+    // An object unlinked in generation g is visible to the snapshots taken
+    // before g only. `retired` is ordered by generation; release the prefix
+    // that is older than the oldest snapshot left.
+    uint32_t oldest = this->snapshots.empty()
+        ? this->generation
+        : this->snapshots.front()->generation;
+    size_t n = 0;
+    while (n < this->retired.size() && this->retired[n].generation <= oldest) {
+        this->retired[n].pool->release(this->retired[n].object);
+        n++;
+    }
+    this->retired.erase(this->retired.begin(), this->retired.begin() + n);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "arena.hpp"
+
+// A frozen view of a tree, as of the moment it was taken.
+//
+// Handles are reference counted: `snapshot` returns one reference, and any
+// thread may take more with `retain` and drop them with `release`. A handle
+// must not be used after its last reference is dropped. The tree holds a
+// reference of its own until it forgets the snapshot, so a handle may
+// outlive its tree; only `retain` and `release` are valid on it then, since
+// the nodes it froze went away with the tree.
+class Snapshot {
+public:
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    void retain() {
+        this->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() {
+        if (this->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    // The root node of the frozen tree (of the tree's node type)
+    void* get_root() const { return this->root; }
+    uint32_t get_generation() const { return this->generation; }
+
+private:
+    friend class SnapshotManager;
+    // One reference for the caller of `take` and one for the manager
+    Snapshot(void* root, uint32_t generation)
+        : root(root), generation(generation), refs(2) {}
+    ~Snapshot() = default;
+
+    void* root;
+    uint32_t generation;
+    std::atomic<uint32_t> refs;
+};
+
+// Copy-on-write bookkeeping for the snapshots of one tree.
+//
+// Time is counted in generations: taking a snapshot starts a new one, and
+// the writer stamps every object it makes with the current generation. An
+// object stamped at or before the newest live snapshot may be seen by a
+// snapshot, so the writer copies it instead of modifying it in place, and
+// `retire` keeps it until every snapshot taken before it was unlinked is
+// gone. Everything but `Snapshot::retain`/`release` is for the writer only.
+class SnapshotManager {
+public:
+    SnapshotManager();
+    ~SnapshotManager();
+
+    SnapshotManager(const SnapshotManager&) = delete;
+    SnapshotManager& operator=(const SnapshotManager&) = delete;
+
+    // Freeze the tree at `root`. Returns a handle with one reference.
+    Snapshot* take(void* root);
+
+    // The generation to stamp new objects with
+    uint32_t get_generation() const { return this->generation; }
+    // Objects stamped at or before this are frozen; 0 if there are no
+    // snapshots. Up to date as of the last `collect`.
+    uint32_t get_newest() const { return this->newest; }
+    bool has_snapshots() const { return !this->snapshots.empty(); }
+
+    // Recycle an unlinked object that was stamped at `birth` (0 if not
+    // known), now or once no snapshot can see it anymore
+    void retire(void* object, SlabPool* pool, uint32_t birth);
+    // Forget the snapshots that were released, and release the objects
+    // that only they could see
+    void collect();
+
+    size_t get_num_retired() const { return this->retired.size(); }
+
+private:
+    struct Retired {
+        uint32_t generation;  // when it was unlinked
+        void* object;
+        SlabPool* pool;
+    };
+
+    uint32_t generation;
+    uint32_t newest;
+    std::vector<Snapshot*> snapshots;  // oldest first
+    std::vector<Retired> retired;      // ordered by generation
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include "bptree_node.hpp"
+#include "hitbox.hpp"
+#include "hitbox_set.hpp"
+#include "keysearch.hpp"
+
+// Hitbox index whose searches take the visitor as a template argument and
+// are compiled into the caller, so that the visitor is inlined into the
+// leaf scan: no virtual callback, no HitboxIterator. The visitor is called
+// as visit(Hitbox*) for each hitbox in range, in key order (hitboxes that
+// share a key in any order).
+//
+// Only the plain leaf scan is compiled in. In thread-safe mode, while
+// snapshots make the leaf links stale, and on mapped trees, the searches
+// go through an iteration buffer of their own instead, made per search.
+// The searches of BasicHitboxIndex that deliver through iteration buffers
+// are deleted: this index has no callback for them.
+template<class Tree = BaseBPTree>
+class StaticHitboxIndex : public BasicHitboxIndex<Tree> {
+public:
+    StaticHitboxIndex() = default;
+    virtual ~StaticHitboxIndex() = default;
+
+    template<class Visitor>
+    void range_search(float k0, float k1, Visitor&& visit);
+
+    template<class Visitor>
+    void ball_query(float mag, float rad, float R, Visitor&& visit) {
+        float temp = rad + R;
+        this->range_search(mag - temp, mag + temp, visit);
+    }
+
+    using Acc = typename BasicHitboxIndex<Tree>::Acc;
+    void ball_query(float mag, float rad, float R, Acc* acc) = delete;
+    void ball_query(float mag, float rad, float R, Acc* acc,
+                    const Snapshot* snapshot) = delete;
+    void query_batch(const BallQuery* queries, size_t n, QueryPool* pool,
+                     std::vector<std::vector<BatchHit>>* hits) = delete;
+
+protected:
+    void callback(void** buffer, size_t size) override {}
+
+private:
+    template<class Visitor>
+    static void visit_value(void* value, Visitor& visit) {
+        auto maybe = static_cast<MaybeHitbox*>(value);
+        if (!isnan(maybe->label))
+            visit(&(maybe->hb));
+        else
+            for_each_value(&(maybe->s), [&](Hitbox* hb) { visit(hb); });
+    }
+
+    template<class Visitor>
+    class VisitorSink : public ResultSink {
+    public:
+        Visitor* visit;
+
+        void callback(void** buffer, size_t size) override {
+            for (size_t i = 0; i < size; i++) {
+                visit_value(buffer[i], *(this->visit));
+            }
+        }
+    };
+};
+
+template<class Tree>
+template<class Visitor>
+void StaticHitboxIndex<Tree>::range_search(float k0, float k1,
+                                           Visitor&& visit) {
+    using Node = typename Tree::Node;
+    constexpr size_t MAX_WEIGHT = Tree::MAX_WEIGHT;
+
+    Node* curr = this->get_scan_root();
+    if (curr == nullptr) {
+        VisitorSink<std::remove_reference_t<Visitor>> sink;
+        sink.visit = &visit;
+        auto acc = this->make_iteration_buffer(&sink);
+        this->range_search_p(k0, k1, acc);
+        this->destroy_iteration_buffer(acc);
+        return;
+    }
+
+    // The same scan as range_search_p. Unused keys are INFINITY, so an
+    // infinite k1 would count them as well.
+    k1 = std::min(k1, FLT_MAX);
+    while (curr->next == curr) {
+        curr = curr->values[count_keys_le(curr->keys, MAX_WEIGHT, k0)].b;
+    }
+    for (; curr != nullptr && curr->keys[0] <= k1; curr = curr->next) {
+        size_t lo = count_keys_lt(curr->keys, MAX_WEIGHT, k0);
+        size_t hi = count_keys_le(curr->keys, MAX_WEIGHT, k1);
+        for (size_t i = lo; i < hi; i++) {
+            visit_value(curr->values[i + 1].p, visit);
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+#include "../ball_filter.hpp"
+#include "../hitbox.hpp"
+
+static bool touches_exactly(const Hitbox& hb, float x, float y, float rad) {
+    // in doubles, on the nearest point of the box
+    if (isnan(hb.a1) || isnan(hb.b1) || isnan(hb.a2) || isnan(hb.b2))
+        return false;
+    double nx = std::clamp((double) x, (double) hb.a1, (double) hb.b1);
+    double ny = std::clamp((double) y, (double) hb.a2, (double) hb.b2);
+    return (nx - x) * (nx - x) + (ny - y) * (ny - y)
+        <= (double) rad * rad;
+}
+
+TEST(TestBallFilter, AllImplementationsAgree) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+    std::vector<Hitbox> boxes(101);
+    for (auto& hb : boxes) {
+        float x = coord(rng), y = coord(rng);
+        hb = {x, x + 2.0f, y, y + 1.0f};
+    }
+    boxes[3].a2 = NAN;
+    boxes[4].b1 = NAN;
+    boxes[50] = {-INFINITY, INFINITY, 0.0f, 0.0f};
+    // a box that the disc touches on its corner
+    boxes[51] = {3.0f, 4.0f, 4.0f, 5.0f};
+    std::vector<Hitbox*> ptrs;
+    for (auto& hb : boxes) {
+        ptrs.push_back(&hb);
+    }
+    const BallFilterImpl best = get_ball_filter_impl();
+
+    for (auto impl : {BallFilterImpl::SCALAR, BallFilterImpl::AVX2}) {
+        if (!set_ball_filter_impl(impl))
+            continue;
+        for (float rad : {0.0f, 1.0f, 5.0f, 30.0f}) {
+            for (size_t n : {0, 7, 8, 101}) {
+                std::vector<Hitbox*> expected;
+                for (size_t i = 0; i < n; i++) {
+                    if (touches_exactly(*ptrs[i], 0.0f, 0.0f, rad))
+                        expected.push_back(ptrs[i]);
+                }
+                // in place
+                std::vector<Hitbox*> out(ptrs.begin(), ptrs.begin() + n);
+                out.resize(filter_ball_hits(out.data(), n, 0.0f, 0.0f,
+                                            rad, out.data()));
+                EXPECT_EQ(out, expected)
+                    << ball_filter_impl_name(impl) << " rad=" << rad;
+            }
+            // a NaN center touches nothing
+            std::vector<Hitbox*> out(ptrs.size());
+            EXPECT_EQ(filter_ball_hits(ptrs.data(), ptrs.size(), NAN, 0.0f,
+                                       rad, out.data()), 0u)
+                << ball_filter_impl_name(impl);
+        }
+    }
+    set_ball_filter_impl(best);
+}
+
+class ExactHitboxes : public ExactHitboxIndex<ExactHitboxes> {
+public:
+    std::vector<Hitbox*> found;
+    // Run once from the next callback, before its hitboxes are added
+    std::function<void()> nested;
+
+    void search_callback(Hitbox* const* hitboxes, size_t n) {
+        if (this->nested) {
+            auto nested = std::move(this->nested);
+            this->nested = nullptr;
+            nested();
+        }
+        this->found.insert(this->found.end(), hitboxes, hitboxes + n);
+    }
+};
+
+TEST(TestBallFilter, BallQueriesDeliverExactlyTheHits) {
+    // Unit squares around points in a disc of radius 100, some of them at
+    // the same magnitude; R = sqrt(2) / 2 covers the squares
+    constexpr size_t SIZE = 3000;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coord(-70.0f, 70.0f);
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new ExactHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        float x = coord(rng), y = coord(rng);
+        if (i % 10 == 1)
+            x = boxes[i - 1].a1 + 0.5f, y = -(boxes[i - 1].a2 + 0.5f);
+        boxes[i] = {x - 0.5f, x + 0.5f, y - 0.5f, y + 0.5f};
+        index->insert(sqrtf(x * x + y * y), &(boxes[i]));
+    }
+    const float R = 0.7072f;
+
+    auto acc = index->make_iteration_buffer();
+    for (int q = 0; q < 20; q++) {
+        float x = coord(rng), y = coord(rng);
+        float rad = (float) q;
+        std::vector<Hitbox*> expected;
+        for (auto& hb : boxes) {
+            if (touches_exactly(hb, x, y, rad))
+                expected.push_back(&hb);
+        }
+        index->found.clear();
+        BallFilterStats stats = index->ball_query(x, y, rad, R, acc);
+        std::sort(index->found.begin(), index->found.end());
+        EXPECT_EQ(index->found, expected) << "q=" << q;
+        EXPECT_EQ(stats.hits, expected.size());
+        EXPECT_GE(stats.candidates, stats.hits);
+    }
+
+    // range searches are not filtered
+    index->found.clear();
+    index->range_search(-1.0f, 200.0f, acc);
+    EXPECT_EQ(index->found.size(), SIZE);
+
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+TEST(TestBallFilter, SearchesFromTheCallbackAreNotFilteredByTheOuterBall) {
+    constexpr size_t SIZE = 200;
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new ExactHitboxes();
+    auto other = new ExactHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        float x = (float) i;
+        boxes[i] = {x - 0.5f, x + 0.5f, -0.5f, 0.5f};
+        index->insert(x, &(boxes[i]));
+        other->insert(x, &(boxes[i]));
+    }
+    auto acc = index->make_iteration_buffer();
+    auto inner_acc = index->make_iteration_buffer();
+    auto other_acc = other->make_iteration_buffer();
+
+    size_t same_index = 0, other_index = 0, other_ball = 0;
+    index->nested = [&]() {
+        index->range_search(-1.0f, 300.0f, inner_acc);
+        same_index = index->found.size();
+        other->range_search(-1.0f, 300.0f, other_acc);
+        other_index = other->found.size();
+        other->found.clear();
+        other->ball_query(0.0f, 0.0f, 10.0f, 1.0f, other_acc);
+        other_ball = other->found.size();
+    };
+    index->ball_query(100.0f, 0.0f, 2.0f, 1.0f, acc);
+    EXPECT_EQ(same_index, SIZE);
+    EXPECT_EQ(other_index, SIZE);
+    EXPECT_EQ(other_ball, 11u);
+    // and the outer query is still filtered afterwards
+    EXPECT_EQ(index->found.size(), SIZE + 5);
+
+    index->destroy_iteration_buffer(acc);
+    index->destroy_iteration_buffer(inner_acc);
+    other->destroy_iteration_buffer(other_acc);
+    delete index;
+    delete other;
+}
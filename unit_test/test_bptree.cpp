@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 #include <math.h>
+#include <algorithm>
+#include <utility>
 #include <stdexcept>
 #include <numeric>
 #include <vector>
 #include <random>
 #include "../hitbox.hpp"
+#include "../static_hitbox.hpp"
 
 class MyHitboxes : public HitboxIndex<MyHitboxes> {
 public:
@@ -229,6 +232,347 @@ TEST(TestBPlusTree, InsertingManyKeysInRandomOrder) {
     delete indices;
 }
 
+TEST(TestBPlusTree, PrefetchingRangeSearch) {
+    constexpr size_t SIZE = 1000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto indices = make_shuffled_vector(SIZE);
+    auto bptree = new MyHitboxes();
+    for (size_t i : *indices) {
+        bptree->insert(i * 3, &(array[i]));
+    }
+
+    auto acc = bptree->make_iteration_buffer();
+    // Each key is marked exactly once, whether the prefetching runs out of
+    // leaves or not
+    bptree->set_prefetch_distance(4);
+    bptree->range_search(100.0f, 333.3f, acc);
+    bptree->range_search(0.0f, 99.5f, acc);
+    bptree->set_prefetch_distance(1000);
+    bptree->range_search(333.4f, 1234.5f, acc);
+    bptree->range_search(1234.25f, 9999.0f, acc);
+    EXPECT_ALL_MARKED(array, SIZE);
+    bptree->range_search(9000.0f, 9012.0f, acc);
+
+    bptree->destroy_iteration_buffer(acc);
+    delete bptree;
+    delete[] array;
+    delete indices;
+}
+
+class CollectingHitboxes : public HitboxIndex<CollectingHitboxes> {
+public:
+    std::vector<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            this->found.push_back(iter->next());
+        }
+    }
+
+    std::vector<Hitbox*> search(float k0, float k1) {
+        auto acc = this->make_iteration_buffer();
+        this->found.clear();
+        this->range_search(k0, k1, acc);
+        this->destroy_iteration_buffer(acc);
+        std::sort(this->found.begin(), this->found.end());
+        return this->found;
+    }
+
+    std::vector<Hitbox*> read_cursor(float k0, float k1, size_t cap) {
+        std::vector<Hitbox*> result;
+        std::vector<Hitbox*> batch(cap);
+        auto cursor = this->open_range(k0, k1);
+        size_t n;
+        do {
+            n = this->next_batch(&cursor, batch.data(), cap);
+            EXPECT_LE(n, cap);
+            result.insert(result.end(), batch.begin(), batch.begin() + n);
+        } while (n == cap);
+        EXPECT_EQ(this->next_batch(&cursor, batch.data(), cap), 0u);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+};
+
+TEST(TestBPlusTree, CursorReadsInBatches) {
+    // Few distinct keys, so that most hitboxes are in sets, some of which
+    // are larger than a batch
+    constexpr size_t SIZE = 3000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new CollectingHitboxes();
+    std::mt19937 rng{11};
+    std::uniform_int_distribution<int> key(0, 400);
+    for (size_t i = 0; i < SIZE; i++) {
+        bptree->insert(i < 100 ? 200.0f : key(rng), &(array[i]));
+    }
+
+    auto check = [&]() {
+        std::uniform_real_distribution<float> point(-10.0f, 410.0f);
+        for (size_t cap : {1, 3, 64, 100, 5000}) {
+            ASSERT_EQ(bptree->read_cursor(-INFINITY, INFINITY, cap).size(),
+                      SIZE);
+            ASSERT_EQ(bptree->read_cursor(200.0f, 200.0f, cap),
+                      bptree->search(200.0f, 200.0f));
+            for (int q = 0; q < 20; q++) {
+                float k0 = point(rng);
+                float k1 = k0 + point(rng) / 4.0f;
+                ASSERT_EQ(bptree->read_cursor(k0, k1, cap),
+                          bptree->search(k0, k1)) << k0 << " " << k1;
+                ASSERT_TRUE(bptree->read_cursor(k0, k0 - 1.0f, cap).empty());
+            }
+        }
+    };
+    check();
+
+    // Leaves copied for a snapshot are not linked
+    Snapshot* snapshot = bptree->snapshot();
+    for (int i = 0; i < 400; i += 7) {
+        bptree->del((float) i, &(array[SIZE - 1]));
+        bptree->insert(i + 0.5f, &(array[SIZE - 1]));
+        bptree->del(i + 0.5f, &(array[SIZE - 1]));
+    }
+    check();
+    snapshot->release();
+
+    delete bptree;
+    delete[] array;
+}
+
+TEST(TestBPlusTree, CursorOnEmptyTree) {
+    auto bptree = new CollectingHitboxes();
+    EXPECT_TRUE(bptree->read_cursor(-INFINITY, INFINITY, 8).empty());
+    bptree->set_thread_safe(true);
+    EXPECT_THROW(bptree->open_range(0.0f, 1.0f), std::logic_error);
+    delete bptree;
+}
+
+TEST(TestBPlusTree, VisitorSearchesInEveryMode) {
+    constexpr size_t SIZE = 3000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto reference = new CollectingHitboxes();
+    auto bptree = new StaticHitboxIndex<>();
+    std::mt19937 rng{13};
+    std::uniform_int_distribution<int> key(0, 1000);
+    std::vector<float> keys(SIZE);
+    for (size_t i = 0; i < SIZE; i++) {
+        keys[i] = key(rng);
+        reference->insert(keys[i], &(array[i]));
+        bptree->insert(keys[i], &(array[i]));
+    }
+
+    auto check = [&]() {
+        std::uniform_real_distribution<float> point(-10.0f, 1010.0f);
+        for (int q = 0; q < 50; q++) {
+            float k0 = point(rng);
+            float k1 = k0 + std::abs(point(rng)) / 8.0f;
+            std::vector<Hitbox*> found;
+            bptree->range_search(k0, k1, [&](Hitbox* hb) {
+                found.push_back(hb);
+            });
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(found, reference->search(k0, k1));
+        }
+        size_t count = 0;
+        bptree->ball_query(500.0f, INFINITY, 1.0f, [&](Hitbox*) { count++; });
+        EXPECT_EQ(count, SIZE);
+    };
+    check();
+    Snapshot* snapshot = bptree->snapshot();
+    bptree->del(keys[0], &(array[0]));
+    bptree->insert(keys[0], &(array[0]));
+    check();
+    snapshot->release();
+    bptree->set_thread_safe(true);
+    check();
+
+    delete bptree;
+    delete reference;
+    delete[] array;
+}
+
+class FlatHitboxes : public FlatHitboxIndex<FlatHitboxes> {
+public:
+    std::vector<Hitbox*> found;
+
+    void search_callback(Hitbox* const* hitboxes, size_t n) {
+        this->found.insert(this->found.end(), hitboxes, hitboxes + n);
+    }
+};
+
+TEST(TestBPlusTree, FlattenedBuffersMatchTheIterator) {
+    // Sets of every size up to a few set nodes
+    constexpr size_t NUM_KEYS = 40;
+    Hitbox* array = make_hitbox_array(NUM_KEYS * (NUM_KEYS + 1) / 2);
+    auto iterated = new CollectingHitboxes();
+    auto flat = new FlatHitboxes();
+    size_t n = 0;
+    for (size_t k = 0; k < NUM_KEYS; k++) {
+        for (size_t j = 0; j <= k; j++) {
+            iterated->insert(k, &(array[n]));
+            flat->insert(k, &(array[n]));
+            n++;
+        }
+    }
+
+    auto acc = iterated->make_iteration_buffer();
+    auto flat_acc = flat->make_iteration_buffer();
+    for (float k0 : {-1.0f, 0.0f, 7.5f, 20.0f}) {
+        iterated->found.clear();
+        flat->found.clear();
+        iterated->range_search(k0, k0 + 25.0f, acc);
+        flat->range_search(k0, k0 + 25.0f, flat_acc);
+        ASSERT_EQ(flat->found, iterated->found);
+    }
+    EXPECT_EQ(flat->found.size(), n - 20 * 21 / 2);
+
+    iterated->destroy_iteration_buffer(acc);
+    flat->destroy_iteration_buffer(flat_acc);
+    delete iterated;
+    delete flat;
+    delete[] array;
+}
+
+static std::vector<std::pair<Hitbox*, Hitbox*>> sorted_pairs(
+        const std::vector<HitboxPair>& pairs) {
+    std::vector<std::pair<Hitbox*, Hitbox*>> result;
+    for (auto& pair : pairs) {
+        result.push_back(std::minmax(pair.a, pair.b));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+TEST(TestBPlusTree, FindPairsMatchesBruteForce) {
+    // Hitboxes of random sizes along a line, a few in sets of equal keys
+    constexpr size_t SIZE = 20000;
+    constexpr float R = 1.5f;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> size(0.0f, R);
+    std::uniform_real_distribution<float> offset(-R / 2, R / 2);
+    std::vector<float> keys(SIZE);
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new MyHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        keys[i] = (float) (i % 7 == 0 ? i - 1 : i) / 4;
+        float x = keys[i], y = offset(rng), h = size(rng) / 2;
+        array[i] = {x - h, x + h, y - h, y + h};
+        bptree->insert(keys[i], &(array[i]));
+    }
+
+    std::vector<HitboxPair> expected;
+    for (size_t i = 0; i < SIZE; i++) {
+        for (size_t j = i + 1; j < SIZE && keys[j] - keys[i] <= 2 * R; j++) {
+            Hitbox& l = array[i];
+            Hitbox& r = array[j];
+            if (l.a1 <= r.b1 && r.a1 <= l.b1 && l.a2 <= r.b2 && r.a2 <= l.b2)
+                expected.push_back({&l, &r});
+        }
+    }
+    ASSERT_GT(expected.size(), SIZE / 2);
+
+    std::vector<HitboxPair> pairs;
+    bptree->find_pairs(R, &pairs);
+    EXPECT_EQ(pairs.size(), expected.size());
+    EXPECT_EQ(sorted_pairs(pairs), sorted_pairs(expected));
+
+    // in stripes, over workers that steal each other's
+    QueryPool pool(3);
+    std::vector<std::vector<HitboxPair>> per_worker;
+    bptree->find_pairs(R, &pool, &per_worker);
+    ASSERT_EQ(per_worker.size(), 3u);
+    pairs.clear();
+    for (auto& worker_pairs : per_worker) {
+        pairs.insert(pairs.end(), worker_pairs.begin(), worker_pairs.end());
+    }
+    EXPECT_EQ(sorted_pairs(pairs), sorted_pairs(expected));
+
+    bptree->set_thread_safe(true);
+    EXPECT_THROW(bptree->find_pairs(R, &pairs), std::logic_error);
+    delete bptree;
+    delete[] array;
+}
+
+static std::vector<float> nearest_distances(const std::vector<Hitbox*>& boxes,
+                                            float x, float y, size_t k) {
+    std::vector<float> result;
+    for (Hitbox* hb : boxes) {
+        float dx = std::max(std::max(hb->a1 - x, x - hb->b1), 0.0f);
+        float dy = std::max(std::max(hb->a2 - y, y - hb->b2), 0.0f);
+        result.push_back(sqrtf(dx * dx + dy * dy));
+    }
+    std::sort(result.begin(), result.end());
+    result.resize(std::min(k, result.size()));
+    return result;
+}
+
+TEST(TestBPlusTree, KnnMatchesBruteForce) {
+    // Hitboxes in a disk keyed by the magnitude of their centers, a few in
+    // sets of equal keys, with leaves merged by deletes in between
+    constexpr size_t SIZE = 5000;
+    constexpr float R = 1.0f;
+    std::mt19937 rng(24);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.0f, R);
+    Hitbox* array = make_hitbox_array(SIZE);
+    std::vector<float> keys(SIZE);
+    auto bptree = new MyHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        float x = coord(rng), y = coord(rng);
+        if (i % 9 == 1) {
+            // the same center as the one before
+            x = (array[i - 1].a1 + array[i - 1].b1) / 2;
+            y = (array[i - 1].a2 + array[i - 1].b2) / 2;
+        }
+        float h = size(rng) / 2;
+        array[i] = {x - h, x + h, y - h, y + h};
+        keys[i] = sqrtf(x * x + y * y);
+        bptree->insert(keys[i], &(array[i]));
+    }
+
+    std::vector<Hitbox*> present;
+    for (size_t i = 0; i < SIZE; i++) {
+        present.push_back(&(array[i]));
+    }
+    std::vector<HitboxNeighbor> out;
+    for (int round = 0; round < 2; round++) {
+        bptree->test_if_values_are_sorted(-INFINITY);
+        for (int q = 0; q < 100; q++) {
+            float x = coord(rng), y = coord(rng);
+            size_t k = (q % 4 == 0) ? 1 : 8 * (q % 4);
+            bptree->knn(x, y, k, R, &out);
+            auto expected = nearest_distances(present, x, y, k);
+            ASSERT_EQ(out.size(), expected.size());
+            for (size_t j = 0; j < out.size(); j++) {
+                EXPECT_FLOAT_EQ(out[j].distance, expected[j]);
+                if (j > 0) {
+                    EXPECT_LE(out[j - 1].distance, out[j].distance);
+                }
+            }
+        }
+        // Far outside, and more than there are
+        bptree->knn(1000.0f, -1000.0f, 3, R, &out);
+        EXPECT_EQ(out.size(), 3u);
+        bptree->knn(0.0f, 0.0f, 0, R, &out);
+        EXPECT_TRUE(out.empty());
+
+        // keep one in four
+        present.clear();
+        for (size_t i = 0; i < SIZE; i++) {
+            if (i % 4 == 0)
+                present.push_back(&(array[i]));
+            else if (round == 0)
+                bptree->del(keys[i], &(array[i]));
+        }
+    }
+    bptree->knn(0.0f, 0.0f, SIZE, R, &out);
+    EXPECT_EQ(out.size(), present.size());
+
+    bptree->set_thread_safe(true);
+    EXPECT_THROW(bptree->knn(0.0f, 0.0f, 1, R, &out), std::logic_error);
+    delete bptree;
+    delete[] array;
+}
+
 TEST(TestBPlusTree, RangeSearchInEmptyTree) {
     class DoNotCall : public HitboxIndex<MyHitboxes> {
     public:
@@ -263,3 +607,395 @@ TEST(TestBPlusTree, RangeSearchInSingleElementTree) {
     delete bptree;
     delete hitbox;
 }
+
+TEST(TestBPlusTree, BulkLoading) {
+    constexpr size_t SIZE = 5000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    std::vector<float> keys(SIZE);
+    std::vector<Hitbox*> values(SIZE);
+    for (size_t i = 0; i < SIZE; i++) {
+        // every 7th key is shared by a run of 3 hitboxes
+        keys[i] = (float) (i - i % 7 / 5 * (i % 7 - 4));
+        values[i] = &(array[i]);
+    }
+
+    for (float fill_factor : {1.0f, 0.7f, 0.01f}) {
+        auto bptree = new MyHitboxes();
+        bptree->bulk_load(keys.data(), values.data(), SIZE, fill_factor);
+        bptree->test_if_values_are_sorted(-1.0f);
+        bptree->test_if_root_is_non_degenerate();
+        bptree->test_if_nodes_are_not_underweight();
+
+        // the tree must still accept insertions afterwards
+        Hitbox extra = {0, 0, 0, 0};
+        bptree->insert(2.5f, &extra);
+
+        auto acc = bptree->make_iteration_buffer();
+        bptree->range_search(-1.0f, 1e9f, acc);
+        EXPECT_ALL_MARKED(array, SIZE);
+        EXPECT_TRUE(isinf(extra.a2));
+        bptree->destroy_iteration_buffer(acc);
+        delete bptree;
+
+        for (size_t i = 0; i < SIZE; i++) {
+            array[i].a2 = 0;
+        }
+    }
+    delete[] array;
+}
+
+TEST(TestBPlusTree, BulkLoadedNodesAreNotUnderweight) {
+    // Low fill factors leave less than twice the minimum weight per node,
+    // so evenly spread levels must not have more nodes than that allows
+    constexpr size_t SIZE = 20000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    std::vector<float> keys(SIZE);
+    std::vector<Hitbox*> values(SIZE);
+    for (size_t i = 0; i < SIZE; i++) {
+        keys[i] = (float) i;
+        values[i] = &(array[i]);
+    }
+    for (float fill_factor : {0.5f, 0.7f}) {
+        for (size_t n : {1u, 5u, 10u, 17u, 40u, 333u, 10000u, 20000u}) {
+            auto bptree = new MyHitboxes();
+            bptree->bulk_load(keys.data(), values.data(), n, fill_factor);
+            bptree->test_if_nodes_are_not_underweight();
+            bptree->test_if_values_are_sorted(-1.0f);
+            delete bptree;
+        }
+    }
+    delete[] array;
+}
+
+TEST(TestBPlusTree, BulkLoadingRejectsUnsortedKeys) {
+    Hitbox array[3] = {};
+    float keys[3] = {1.0f, 3.0f, 2.0f};
+    Hitbox* values[3] = {&(array[0]), &(array[1]), &(array[2])};
+    auto bptree = new MyHitboxes();
+    EXPECT_THROW(bptree->bulk_load(keys, values, 3), std::invalid_argument);
+    EXPECT_TRUE(bptree->is_empty());
+    delete bptree;
+}
+
+TEST(TestBPlusTree, BatchInsertion) {
+    constexpr size_t SIZE = 3000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto indices = make_shuffled_vector(SIZE);
+    auto bptree = new MyHitboxes();
+
+    // a few single insertions first, so batches also hit existing keys
+    for (size_t i = 0; i < 50; i++) {
+        size_t idx = (*indices)[i];
+        bptree->insert((float) (idx % 1200), &(array[idx]));
+    }
+
+    // the rest in shuffled batches of growing size; keys repeat, both within
+    // a batch and across batches
+    std::vector<float> keys;
+    std::vector<Hitbox*> values;
+    size_t start = 50;
+    for (size_t batch = 1; start < SIZE; batch *= 3) {
+        size_t end = std::min(SIZE, start + batch);
+        keys.clear();
+        values.clear();
+        for (size_t i = start; i < end; i++) {
+            size_t idx = (*indices)[i];
+            keys.push_back((float) (idx % 1200));
+            values.push_back(&(array[idx]));
+        }
+        bptree->insert_batch(keys.data(), values.data(), keys.size());
+        bptree->test_if_values_are_sorted(-1.0f);
+        bptree->test_if_root_is_non_degenerate();
+        start = end;
+    }
+
+    auto acc = bptree->make_iteration_buffer();
+    bptree->range_search(-1.0f, 5000.0f, acc);
+    EXPECT_ALL_MARKED(array, SIZE);
+    bptree->destroy_iteration_buffer(acc);
+
+    delete bptree;
+    delete[] array;
+    delete indices;
+}
+
+TEST(TestBPlusTree, ClearAndRebuild) {
+    constexpr size_t SIZE = 500;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new MyHitboxes();
+
+    for (int frame = 0; frame < 3; frame++) {
+        bptree->clear();
+        EXPECT_TRUE(bptree->is_empty());
+        for (size_t i = 0; i < SIZE; i++) {
+            array[i].a2 = 0;
+            // pairs of hitboxes share a key, so sets get allocated too
+            bptree->insert((float) (i / 2), &(array[i]));
+        }
+        bptree->test_if_values_are_sorted(-1.0f);
+        bptree->test_if_root_is_non_degenerate();
+
+        auto acc = bptree->make_iteration_buffer();
+        bptree->range_search(-1.0f, (float) SIZE, acc);
+        EXPECT_ALL_MARKED(array, SIZE);
+        bptree->destroy_iteration_buffer(acc);
+    }
+
+    delete bptree;
+    delete[] array;
+}
+
+TEST(TestBPlusTree, DeletingKeysInRandomOrder) {
+    constexpr size_t SIZE = 2000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new MyHitboxes();
+    auto indices = make_shuffled_vector(SIZE);
+    for (size_t i : *indices) {
+        bptree->insert((float) i, &(array[i]));
+    }
+
+    // delete two thirds of the keys
+    delete indices;
+    indices = make_shuffled_vector(SIZE);
+    size_t count = 0;
+    for (size_t i : *indices) {
+        if (i % 3 == 0)
+            continue;
+        bptree->del((float) i, &(array[i]));
+        if (++count % 50 == 0) {
+            bptree->test_if_values_are_sorted(-1.0f);
+            bptree->test_if_root_is_non_degenerate();
+        }
+    }
+    // deleting a missing key or a mismatched value does nothing
+    bptree->del(1.0f, &(array[1]));
+    bptree->del(3.0f, &(array[6]));
+
+    auto acc = bptree->make_iteration_buffer();
+    bptree->range_search(-1.0f, (float) SIZE, acc);
+    for (size_t i = 0; i < SIZE; i++) {
+        EXPECT_EQ(isinf(array[i].a2), i % 3 == 0) << "i=" << i;
+    }
+
+    // delete the rest; the tree should shrink back to a single leaf
+    for (size_t i = 0; i < SIZE; i += 3) {
+        bptree->del((float) i, &(array[i]));
+    }
+    EXPECT_TRUE(bptree->is_empty());
+    EXPECT_EQ(bptree->get_height(), 1u);
+    bptree->range_search(-1.0f, (float) SIZE, acc);
+
+    bptree->destroy_iteration_buffer(acc);
+    delete bptree;
+    delete[] array;
+    delete indices;
+}
+
+TEST(TestBPlusTree, DeletingFromSets) {
+    constexpr size_t SIZE = 40;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new MyHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        bptree->insert((float) (i % 2), &(array[i]));
+    }
+
+    // remove all but one hitbox from the set under key 0, in an order that
+    // empties set nodes from the middle of the chain
+    for (size_t i = 10; i < SIZE; i += 2) {
+        bptree->del(0.0f, &(array[i]));
+    }
+    for (size_t i = 2; i < 10; i += 2) {
+        bptree->del(0.0f, &(array[i]));
+    }
+    bptree->del(0.0f, &(array[1]));  // not in this set
+
+    auto acc = bptree->make_iteration_buffer();
+    bptree->range_search(-1.0f, 2.0f, acc);
+    for (size_t i = 0; i < SIZE; i++) {
+        EXPECT_EQ(isinf(array[i].a2), i == 0 || i % 2 == 1) << "i=" << i;
+    }
+
+    bptree->del(0.0f, &(array[0]));
+    for (size_t i = 1; i < SIZE; i += 2) {
+        bptree->del(1.0f, &(array[i]));
+    }
+    EXPECT_TRUE(bptree->is_empty());
+
+    bptree->destroy_iteration_buffer(acc);
+    delete bptree;
+    delete[] array;
+}
+
+TEST(TestBPlusTree, DeletingFromBigSets) {
+    // Big sets are indexed, and the index follows the hitboxes that move
+    // into the gaps left by deletions. The set under key 0 shrinks until it
+    // loses its index, then grows until it gets a new one.
+    constexpr size_t SIZE = 2000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new CollectingHitboxes();
+    std::mt19937 rng{25};
+    std::vector<size_t> order(SIZE);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    std::vector<Hitbox*> in_set;
+    for (size_t i : order) {
+        bptree->insert(0.0f, &(array[i]));
+        in_set.push_back(&(array[i]));
+    }
+    auto expect_set = [&]() {
+        std::vector<Hitbox*> expected = in_set;
+        std::sort(expected.begin(), expected.end());
+        EXPECT_EQ(bptree->search(0.0f, 0.0f), expected);
+    };
+
+    auto take_random = [&]() {
+        size_t at = rng() % in_set.size();
+        Hitbox* value = in_set[at];
+        in_set[at] = in_set.back();
+        in_set.pop_back();
+        return value;
+    };
+    while (in_set.size() > SIZE / 2) {
+        bptree->del(0.0f, take_random());
+    }
+    expect_set();
+
+    // Hitboxes that are not in the set change nothing
+    Hitbox other = {0, 0, 0, 0};
+    bptree->del(0.0f, &other);
+    bptree->update(0.0f, 1.0f, &other);
+    expect_set();
+
+    std::vector<Hitbox*> moved;
+    while (in_set.size() > 3) {
+        Hitbox* value = take_random();
+        bptree->update(0.0f, 1.0f, value);
+        moved.push_back(value);
+    }
+    expect_set();
+    while (!moved.empty()) {
+        bptree->update(1.0f, 0.0f, moved.back());
+        in_set.push_back(moved.back());
+        moved.pop_back();
+    }
+    expect_set();
+
+    // Copies of the set for a snapshot are indexed too
+    Snapshot* snapshot = bptree->snapshot();
+    for (int i = 0; i < 100; i++) {
+        bptree->del(0.0f, take_random());
+    }
+    expect_set();
+    snapshot->release();
+    for (int i = 0; i < 100; i++) {
+        bptree->del(0.0f, take_random());
+    }
+    expect_set();
+
+    bptree->clear();
+    EXPECT_TRUE(bptree->is_empty());
+    for (size_t i = 0; i < 100; i++) {
+        bptree->insert(0.0f, &(array[i]));
+    }
+    for (size_t i = 0; i < 100; i++) {
+        bptree->del(0.0f, &(array[i]));
+    }
+    EXPECT_TRUE(bptree->is_empty());
+
+    delete bptree;
+    delete[] array;
+}
+
+TEST(TestBPlusTree, UpdatingKeys) {
+    constexpr size_t SIZE = 1000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    std::vector<float> keys(SIZE);
+    auto bptree = new MyHitboxes();
+    for (size_t i = 0; i < SIZE; i++) {
+        keys[i] = (float) (i * 4);
+        bptree->insert(keys[i], &(array[i]));
+    }
+    // two hitboxes share a key, so one of the updates below moves a set
+    // member and another one merges into a set
+    bptree->insert(keys[7], &(array[SIZE - 1]));
+    bptree->del(keys[SIZE - 1], &(array[SIZE - 1]));
+    keys[SIZE - 1] = keys[7];
+
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> small(-1.5f, 1.5f);
+    std::uniform_real_distribution<float> large(0.0f, SIZE * 4.0f);
+    for (int round = 0; round < 20; round++) {
+        for (size_t i = 0; i < SIZE; i++) {
+            // mostly small moves that stay in the leaf, some far jumps, and
+            // some collisions with the key of another hitbox
+            float new_key = keys[i] + small(rng);
+            if (i % 10 == 3)
+                new_key = large(rng);
+            else if (i % 50 == 7)
+                new_key = keys[(i + 1) % SIZE];
+            bptree->update(keys[i], new_key, &(array[i]));
+            keys[i] = new_key;
+        }
+        bptree->test_if_values_are_sorted(-INFINITY);
+        bptree->test_if_root_is_non_degenerate();
+    }
+
+    // every hitbox must be found exactly under its current key
+    auto acc = bptree->make_iteration_buffer();
+    for (size_t i = 0; i < SIZE; i++) {
+        if (!isinf(array[i].a2))
+            bptree->range_search(keys[i], keys[i], acc);
+        EXPECT_TRUE(isinf(array[i].a2)) << "i=" << i;
+    }
+    bptree->destroy_iteration_buffer(acc);
+
+    delete bptree;
+    delete[] array;
+}
+
+template<class Tree>
+class MarkingIndex : public HitboxIndex<MarkingIndex<Tree>, Tree> {
+public:
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            iter->next()->a2 = INFINITY;
+        }
+    }
+};
+
+template<class Tree>
+class TestPresets : public ::testing::Test {};
+
+using Presets = ::testing::Types<BPTree256, BPTree512, BPTree1K, BPTree4K>;
+TYPED_TEST_SUITE(TestPresets, Presets);
+
+TYPED_TEST(TestPresets, InsertingSearchingAndDeleting) {
+    // enough keys for a few levels even with the widest nodes
+    constexpr size_t SIZE = 20000;
+    Hitbox* array = make_hitbox_array(SIZE);
+    auto bptree = new MarkingIndex<TypeParam>();
+    auto indices = make_shuffled_vector(SIZE);
+    for (size_t i : *indices) {
+        bptree->insert((float) i, &(array[i]));
+    }
+    bptree->test_if_values_are_sorted(-1.0f);
+    bptree->test_if_root_is_non_degenerate();
+    EXPECT_GE(bptree->get_height(), 2u);
+
+    for (size_t i = 0; i < SIZE; i += 2) {
+        bptree->del((float) i, &(array[i]));
+    }
+    bptree->test_if_values_are_sorted(-1.0f);
+    bptree->test_if_root_is_non_degenerate();
+
+    auto acc = bptree->make_iteration_buffer();
+    bptree->range_search(-1.0f, (float) SIZE, acc);
+    for (size_t i = 0; i < SIZE; i++) {
+        EXPECT_EQ(isinf(array[i].a2), i % 2 == 1) << "i=" << i;
+    }
+    bptree->destroy_iteration_buffer(acc);
+
+    delete bptree;
+    delete[] array;
+    delete indices;
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+#include "../bvh_hitbox.hpp"
+
+class BVHHitboxes : public BVHHitboxIndex<BVHHitboxes> {
+public:
+    using BVHHitboxIndex::BVHHitboxIndex;
+
+    std::set<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            EXPECT_TRUE(this->found.insert(iter->next()).second);
+        }
+    }
+};
+
+static float distance_to(const Hitbox& box, float x, float y) {
+    float dx = std::max(std::max(box.a1 - x, x - box.b1), 0.0f);
+    float dy = std::max(std::max(box.a2 - y, y - box.b2), 0.0f);
+    return sqrtf(dx * dx + dy * dy);
+}
+
+static void expect_ball_query(BVHHitboxes* index, BVHHitboxes::Acc* acc,
+                              std::vector<Hitbox>& boxes, float x, float y,
+                              float rad) {
+    // Every hitbox that touches the ball must be found, and only those
+    // whose box grown by the margin (twice, for boxes that moved) does
+    index->found.clear();
+    index->ball_query(x, y, rad, 0.0f, acc);
+    for (size_t i = 0; i < boxes.size(); i++) {
+        float d = distance_to(boxes[i], x, y);
+        bool found = index->found.count(&(boxes[i])) > 0;
+        if (d <= rad) {
+            EXPECT_TRUE(found) << i << " from (" << x << ", " << y << ")";
+        }
+        if (found) {
+            EXPECT_LE(d, rad + 2 * index->get_margin() + 1e-3f);
+        }
+    }
+}
+
+static Hitbox random_box(std::mt19937& rng) {
+    // Mostly small boxes, with a few big ones
+    std::uniform_real_distribution<float> coord(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> small(0.1f, 3.0f);
+    std::uniform_real_distribution<float> big(50.0f, 400.0f);
+    float x = coord(rng), y = coord(rng);
+    bool is_big = rng() % 50 == 0;
+    float w = is_big ? big(rng) : small(rng);
+    float h = is_big ? big(rng) : small(rng);
+    return {x, x + w, y, y + h};
+}
+
+TEST(TestBVH, BallQueriesFindEverythingTouching) {
+    constexpr size_t SIZE = 5000;
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> coord(-500.0f, 500.0f);
+    std::vector<Hitbox> boxes(SIZE);
+    for (float margin : {0.0f, 2.0f}) {
+        auto index = new BVHHitboxes(margin);
+        for (size_t i = 0; i < SIZE; i++) {
+            boxes[i] = random_box(rng);
+            index->insert((float) i, &(boxes[i]));
+        }
+        index->test_if_tree_is_consistent();
+        // a balanced tree of 5000 leaves is not much higher than log2(5000)
+        EXPECT_LE(index->get_height(), 20);
+        auto acc = index->make_iteration_buffer();
+        for (int q = 0; q < 50; q++) {
+            expect_ball_query(index, acc, boxes, coord(rng), coord(rng),
+                              q % 2 == 0 ? 5.0f : 80.0f);
+        }
+        index->destroy_iteration_buffer(acc);
+        delete index;
+    }
+}
+
+TEST(TestBVH, UpdateAndDelKeepTheTreeConsistent) {
+    constexpr size_t SIZE = 2000;
+    std::mt19937 rng(24);
+    std::uniform_real_distribution<float> coord(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> step(-2.0f, 2.0f);
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    auto index = new BVHHitboxes(1.0f);
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = random_box(rng);
+        keys[i] = (float) i;
+        index->insert(keys[i], &(boxes[i]));
+    }
+    EXPECT_THROW(index->insert(0.0f, &(boxes[0])), std::invalid_argument);
+
+    auto acc = index->make_iteration_buffer();
+    for (int tick = 0; tick < 10; tick++) {
+        for (size_t i = 0; i < SIZE; i++) {
+            float dx = step(rng), dy = step(rng);
+            boxes[i] = {boxes[i].a1 + dx, boxes[i].b1 + dx,
+                        boxes[i].a2 + dy, boxes[i].b2 + dy};
+            float key = (i % 2 == 0) ? keys[i] : keys[i] + 1.0f;
+            index->update(keys[i], key, &(boxes[i]));
+            keys[i] = key;
+        }
+        index->test_if_tree_is_consistent();
+        expect_ball_query(index, acc, boxes, coord(rng), coord(rng), 20.0f);
+    }
+
+    // Wrong keys change nothing
+    index->del(keys[0] + 0.5f, &(boxes[0]));
+    index->update(keys[0] + 0.5f, 0.0f, &(boxes[0]));
+    index->found.clear();
+    index->range_search(keys[0], keys[0], acc);
+    EXPECT_EQ(index->found.count(&(boxes[0])), 1);
+
+    for (size_t i = 0; i < SIZE; i += 2) {
+        index->del(keys[i], &(boxes[i]));
+    }
+    index->test_if_tree_is_consistent();
+    index->found.clear();
+    index->range_search(-INFINITY, INFINITY, acc);
+    EXPECT_EQ(index->found.size(), SIZE / 2);
+    index->found.clear();
+    index->ball_query(0.0f, 0.0f, 100.0f, 0.0f, acc);
+    for (size_t i = 0; i < SIZE; i++) {
+        bool touches = distance_to(boxes[i], 0.0f, 0.0f) <= 100.0f;
+        EXPECT_EQ(index->found.count(&(boxes[i])) > 0, touches && i % 2 == 1)
+            << i;
+    }
+
+    for (size_t i = 1; i < SIZE; i += 2) {
+        index->del(keys[i], &(boxes[i]));
+    }
+    index->test_if_tree_is_consistent();
+    EXPECT_TRUE(index->is_empty());
+    index->insert(0.0f, &(boxes[0]));
+    index->clear();
+    EXPECT_TRUE(index->is_empty());
+    index->insert(0.0f, &(boxes[0]));
+    index->test_if_tree_is_consistent();
+
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+TEST(TestBVH, RejectsBadMargins) {
+    EXPECT_THROW(new BVHHitboxes(-1.0f), std::invalid_argument);
+    EXPECT_THROW(new BVHHitboxes(NAN), std::invalid_argument);
+    EXPECT_THROW(new BVHHitboxes(INFINITY), std::invalid_argument);
+}
@@ -0,0 +1,337 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../hitbox.hpp"
+
+class SharedHitboxes : public HitboxIndex<SharedHitboxes> {
+public:
+    // Each reader thread collects into its own vector
+    static thread_local std::vector<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            found.push_back(iter->next());
+        }
+    }
+};
+
+thread_local std::vector<Hitbox*> SharedHitboxes::found;
+
+TEST(TestConcurrency, ReadersSeeStableKeysWhileWriterChurns) {
+    // Stable hitboxes sit on even keys and never move. The writer inserts,
+    // deletes and moves the churning ones all over the key range, also onto
+    // even keys, so that sets with a stable hitbox in them are rewritten.
+    // Readers must find every stable hitbox exactly once in every search.
+
+    constexpr size_t STABLE = 3000;
+    constexpr size_t CHURN = 3000;
+    constexpr size_t NUM_OPS = 150000;
+    constexpr size_t NUM_READERS = 3;
+
+    std::vector<Hitbox> stable(STABLE);
+    std::vector<Hitbox> churn(CHURN);
+    std::vector<float> churn_key(CHURN, NAN);  // NAN if not in the index
+
+    auto index = new SharedHitboxes();
+    for (size_t i = 0; i < STABLE; i++) {
+        index->insert((float) (2 * i), &(stable[i]));
+    }
+    index->set_thread_safe(true);
+
+    std::atomic<bool> writing{true};
+    std::atomic<size_t> num_searches{0};
+    auto reader = [&](unsigned seed) {
+        auto acc = index->make_iteration_buffer();
+        std::mt19937 rng{seed};
+        std::uniform_int_distribution<size_t> pick(0, STABLE - 1);
+        auto& found = SharedHitboxes::found;
+        while (writing.load()) {
+            // a full scan every now and then, short ranges otherwise
+            size_t lo = 0;
+            size_t hi = STABLE - 1;
+            if (num_searches.fetch_add(1) % 8 != 0) {
+                lo = pick(rng);
+                hi = std::min(STABLE - 1, lo + 40);
+            }
+            found.clear();
+            index->range_search((float) (2 * lo) - 0.5f,
+                                (float) (2 * hi) + 0.5f, acc);
+
+            // (a churning hitbox may show up twice, if it jumped ahead of
+            // the search)
+            std::sort(found.begin(), found.end());
+            size_t num_stable = 0;
+            Hitbox* last = nullptr;
+            for (Hitbox* box : found) {
+                bool is_stable = box >= &(stable[0])
+                    && box <= &(stable[STABLE - 1]);
+                bool is_churn = box >= &(churn[0])
+                    && box <= &(churn[CHURN - 1]);
+                ASSERT_TRUE(is_stable || is_churn) << "not a hitbox";
+                if (is_stable) {
+                    size_t i = box - &(stable[0]);
+                    ASSERT_TRUE(lo <= i && i <= hi) << "out of range";
+                    ASSERT_NE(box, last) << "found twice";
+                    num_stable++;
+                }
+                last = box;
+            }
+            ASSERT_EQ(num_stable, hi - lo + 1);
+        }
+        index->destroy_iteration_buffer(acc);
+    };
+
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < NUM_READERS; r++) {
+        readers.emplace_back(reader, r + 1);
+    }
+
+    std::mt19937 rng{7};
+    std::uniform_int_distribution<size_t> pick(0, CHURN - 1);
+    std::uniform_int_distribution<int> key(-10, 2 * STABLE + 10);
+    std::uniform_int_distribution<int> op(0, 9);
+    std::vector<float> batch_keys;
+    std::vector<Hitbox*> batch_values;
+    for (size_t n = 0; n < NUM_OPS; n++) {
+        size_t j = pick(rng);
+        int o = op(rng);
+        if (o == 0) {
+            // a batch of the absent ones after j
+            batch_keys.clear();
+            batch_values.clear();
+            for (size_t x = j; x < std::min(CHURN, j + 60); x++) {
+                if (isnan(churn_key[x])) {
+                    churn_key[x] = (float) key(rng);
+                    batch_keys.push_back(churn_key[x]);
+                    batch_values.push_back(&(churn[x]));
+                }
+            }
+            index->insert_batch(batch_keys.data(), batch_values.data(),
+                                batch_keys.size());
+        } else if (isnan(churn_key[j])) {
+            churn_key[j] = (float) key(rng);
+            index->insert(churn_key[j], &(churn[j]));
+        } else if (o < 5) {
+            index->del(churn_key[j], &(churn[j]));
+            churn_key[j] = NAN;
+        } else {
+            // small moves, and jumps (some onto the key of a stable one)
+            float new_key = (o < 8)
+                ? churn_key[j] + 0.25f
+                : (float) key(rng) + 0.5f * (o == 8);
+            index->update(churn_key[j], new_key, &(churn[j]));
+            churn_key[j] = new_key;
+        }
+    }
+    writing.store(false);
+    for (auto& t : readers) {
+        t.join();
+    }
+    EXPECT_GT(num_searches.load(), 0u);
+
+    // Back in single-threaded mode, everything must be where we left it
+    index->set_thread_safe(false);
+    index->test_if_values_are_sorted(-INFINITY);
+    index->test_if_root_is_non_degenerate();
+    auto acc = index->make_iteration_buffer();
+    SharedHitboxes::found.clear();
+    index->range_search(-1e9f, 1e9f, acc);
+    size_t num_churn = std::count_if(churn_key.begin(), churn_key.end(),
+                                     [](float k) { return !isnan(k); });
+    EXPECT_EQ(SharedHitboxes::found.size(), STABLE + num_churn);
+    for (size_t j = 0; j < CHURN; j++) {
+        if (isnan(churn_key[j]))
+            continue;
+        SharedHitboxes::found.clear();
+        index->range_search(churn_key[j], churn_key[j], acc);
+        auto& found = SharedHitboxes::found;
+        EXPECT_TRUE(std::find(found.begin(), found.end(), &(churn[j]))
+                    != found.end()) << "j=" << j;
+    }
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+TEST(TestConcurrency, ClearingWhileReadersSearch) {
+    constexpr size_t SIZE = 5000;
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new SharedHitboxes();
+    index->set_thread_safe(true);
+
+    std::atomic<bool> writing{true};
+    std::thread reader([&]() {
+        auto acc = index->make_iteration_buffer();
+        while (writing.load()) {
+            SharedHitboxes::found.clear();
+            index->range_search(-1.0f, (float) SIZE, acc);
+            ASSERT_LE(SharedHitboxes::found.size(), SIZE);
+        }
+        index->destroy_iteration_buffer(acc);
+    });
+
+    for (int frame = 0; frame < 30; frame++) {
+        index->clear();
+        for (size_t i = 0; i < SIZE; i++) {
+            index->insert((float) (i / 2), &(boxes[i]));
+        }
+    }
+    writing.store(false);
+    reader.join();
+    delete index;
+}
+
+TEST(TestConcurrency, ReadersSeeWholeSetWhileWriterEditsIt) {
+    // One key holds a big set. The writer adds and removes hitboxes on that
+    // key, so each write copies only a part of the set, and readers must
+    // still see every stable hitbox in it exactly once.
+
+    constexpr size_t STABLE = 500;
+    constexpr size_t CHURN = 200;
+    constexpr size_t NUM_OPS = 20000;
+
+    std::vector<Hitbox> stable(STABLE);
+    std::vector<Hitbox> churn(CHURN);
+    std::vector<bool> is_in(CHURN, false);
+
+    auto index = new SharedHitboxes();
+    for (size_t i = 0; i < STABLE; i++) {
+        index->insert(1.0f, &(stable[i]));
+    }
+    index->set_thread_safe(true);
+
+    std::atomic<bool> writing{true};
+    std::thread reader([&]() {
+        auto acc = index->make_iteration_buffer();
+        auto& found = SharedHitboxes::found;
+        while (writing.load()) {
+            found.clear();
+            index->range_search(1.0f, 1.0f, acc);
+            std::sort(found.begin(), found.end());
+            ASSERT_TRUE(std::adjacent_find(found.begin(), found.end())
+                        == found.end()) << "found twice";
+            size_t num_stable = std::count_if(
+                found.begin(), found.end(), [&](Hitbox* box) {
+                    return box >= &(stable[0])
+                        && box <= &(stable[STABLE - 1]);
+                });
+            ASSERT_EQ(num_stable, STABLE);
+        }
+        index->destroy_iteration_buffer(acc);
+    });
+
+    std::mt19937 rng{11};
+    std::uniform_int_distribution<size_t> pick(0, CHURN - 1);
+    for (size_t n = 0; n < NUM_OPS; n++) {
+        size_t j = pick(rng);
+        if (is_in[j]) {
+            index->del(1.0f, &(churn[j]));
+        } else {
+            index->insert(1.0f, &(churn[j]));
+        }
+        is_in[j] = !is_in[j];
+    }
+    writing.store(false);
+    reader.join();
+
+    index->set_thread_safe(false);
+    auto acc = index->make_iteration_buffer();
+    SharedHitboxes::found.clear();
+    index->range_search(1.0f, 1.0f, acc);
+    size_t num_churn = std::count(is_in.begin(), is_in.end(), true);
+    EXPECT_EQ(SharedHitboxes::found.size(), STABLE + num_churn);
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+class BatchedHitboxes : public HitboxIndex<BatchedHitboxes> {
+public:
+    std::vector<std::vector<Hitbox*>> found;  // per query
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            found[0].push_back(iter->next());
+        }
+    }
+
+    void batch_callback(size_t query, HitboxIterator* iter) {
+        while (iter->has_next()) {
+            found[query].push_back(iter->next());
+        }
+    }
+};
+
+TEST(TestConcurrency, QueryBatchMatchesOneByOneQueries) {
+    constexpr size_t SIZE = 20000;
+    constexpr size_t NUM_QUERIES = 3000;
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new BatchedHitboxes();
+    std::mt19937 rng{3};
+    std::uniform_int_distribution<int> key(0, 5000);
+    for (size_t i = 0; i < SIZE; i++) {
+        index->insert((float) key(rng), &(boxes[i]));
+    }
+
+    // Query sizes vary a lot, so that the workers have to steal
+    std::vector<BallQuery> queries;
+    std::uniform_real_distribution<float> rad(0.0f, 20.0f);
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+        float r = (q % 100 == 0) ? 500.0f : rad(rng);
+        queries.push_back({(float) key(rng), r, 0.5f});
+    }
+
+    auto acc = index->make_iteration_buffer();
+    std::vector<std::vector<Hitbox*>> expected(NUM_QUERIES);
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+        index->found.assign(1, {});
+        index->ball_query(queries[q].mag, queries[q].rad, queries[q].R, acc);
+        expected[q] = index->found[0];
+        std::sort(expected[q].begin(), expected[q].end());
+    }
+    index->destroy_iteration_buffer(acc);
+
+    QueryPool pool(4);
+    index->found.assign(NUM_QUERIES, {});
+    index->query_batch(queries.data(), NUM_QUERIES, &pool);
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+        std::sort(index->found[q].begin(), index->found[q].end());
+        ASSERT_EQ(index->found[q], expected[q]) << "query " << q;
+    }
+
+    // And the same again into per-worker buffers
+    std::vector<std::vector<BatchHit>> hits;
+    index->query_batch(queries.data(), NUM_QUERIES, &pool, &hits);
+    ASSERT_EQ(hits.size(), 4u);
+    std::vector<std::vector<Hitbox*>> merged(NUM_QUERIES);
+    for (auto& worker_hits : hits) {
+        for (BatchHit hit : worker_hits) {
+            merged[hit.query].push_back(hit.hitbox);
+        }
+    }
+    for (size_t q = 0; q < NUM_QUERIES; q++) {
+        std::sort(merged[q].begin(), merged[q].end());
+        ASSERT_EQ(merged[q], expected[q]) << "query " << q;
+    }
+    delete index;
+}
+
+TEST(TestConcurrency, QueryPoolHandsOutEveryIndexOnce) {
+    QueryPool pool(3);
+    EXPECT_EQ(pool.get_num_workers(), 3u);
+    for (size_t n : {0, 1, 15, 16, 17, 1000}) {
+        std::vector<std::atomic<int>> seen(n);
+        pool.run(n, [&](size_t worker, size_t begin, size_t end) {
+            ASSERT_LT(worker, 3u);
+            ASSERT_LE(end - begin, QueryPool::CHUNK_SIZE);
+            for (size_t i = begin; i < end; i++) {
+                seen[i]++;
+            }
+        });
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_EQ(seen[i].load(), 1) << "n=" << n << " i=" << i;
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+#include "../grid_hitbox.hpp"
+
+class GridHitboxes : public GridHitboxIndex<GridHitboxes> {
+public:
+    using GridHitboxIndex::GridHitboxIndex;
+
+    std::set<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            EXPECT_TRUE(this->found.insert(iter->next()).second);
+        }
+    }
+};
+
+static Hitbox box_at(float x, float y) {
+    return {x - 0.5f, x + 0.5f, y - 0.5f, y + 0.5f};
+}
+
+static void expect_ball_query(GridHitboxes* index, GridHitboxes::Acc* acc,
+                              std::vector<Hitbox>& boxes, float x, float y,
+                              float rad, float R) {
+    // Exactly the hitboxes whose center is within reach must be found
+    index->found.clear();
+    index->ball_query(x, y, rad, R, acc);
+    size_t expected = 0;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        float dx = (boxes[i].a1 + boxes[i].b1) / 2 - x;
+        float dy = (boxes[i].a2 + boxes[i].b2) / 2 - y;
+        bool in_reach = dx * dx + dy * dy <= (rad + R) * (rad + R);
+        expected += in_reach;
+        EXPECT_EQ(index->found.count(&(boxes[i])) > 0, in_reach)
+            << i << " from (" << x << ", " << y << ")";
+    }
+    EXPECT_EQ(index->found.size(), expected);
+}
+
+TEST(TestGrid, BallQueriesMatchBruteForce) {
+    constexpr size_t SIZE = 5000;
+    std::mt19937 rng(22);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+    std::vector<Hitbox> boxes(SIZE);
+    for (float cell_size : {0.5f, 4.0f, 300.0f}) {
+        auto index = new GridHitboxes(cell_size);
+        for (size_t i = 0; i < SIZE; i++) {
+            float x = coord(rng), y = coord(rng);
+            boxes[i] = box_at(x, y);
+            index->insert(sqrtf(x * x + y * y), &(boxes[i]));
+        }
+        auto acc = index->make_iteration_buffer();
+        for (int q = 0; q < 50; q++) {
+            expect_ball_query(index, acc, boxes, coord(rng), coord(rng),
+                              q % 2 == 0 ? 3.0f : 40.0f, 1.0f);
+        }
+        // a ball covering more cells than there are takes every cell
+        expect_ball_query(index, acc, boxes, 0.0f, 0.0f, 1e6f, 0.0f);
+        index->destroy_iteration_buffer(acc);
+        delete index;
+    }
+}
+
+TEST(TestGrid, UpdateMovesBetweenCells) {
+    constexpr size_t SIZE = 1000;
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> step(-3.0f, 3.0f);
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    auto index = new GridHitboxes(2.0f);
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = box_at(coord(rng), coord(rng));
+        keys[i] = (float) i;
+        index->insert(keys[i], &(boxes[i]));
+    }
+    auto acc = index->make_iteration_buffer();
+    for (int tick = 0; tick < 10; tick++) {
+        for (size_t i = 0; i < SIZE; i++) {
+            float dx = step(rng), dy = step(rng);
+            boxes[i] = {boxes[i].a1 + dx, boxes[i].b1 + dx,
+                        boxes[i].a2 + dy, boxes[i].b2 + dy};
+            // half of them keep their key
+            float key = (i % 2 == 0) ? keys[i] : keys[i] + 1.0f;
+            index->update(keys[i], key, &(boxes[i]));
+            keys[i] = key;
+        }
+        expect_ball_query(index, acc, boxes, coord(rng), coord(rng), 10.0f,
+                          0.0f);
+        // the cells that hitboxes left are gone
+        std::set<std::pair<float, float>> occupied;
+        for (const Hitbox& box : boxes) {
+            occupied.insert({floorf((box.a1 + box.b1) / 2 / 2.0f),
+                             floorf((box.a2 + box.b2) / 2 / 2.0f)});
+        }
+        EXPECT_EQ(index->get_num_cells(), occupied.size());
+    }
+
+    // A wrong old key changes nothing
+    Hitbox old = boxes[0];
+    boxes[0] = box_at(1000.0f, 1000.0f);
+    index->update(keys[0] + 0.5f, 0.0f, &(boxes[0]));
+    boxes[0] = old;
+    expect_ball_query(index, acc, boxes, old.a1, old.a2, 5.0f, 0.0f);
+
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+TEST(TestGrid, RangeSearchAndDel) {
+    constexpr size_t SIZE = 2000;
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new GridHitboxes(1.0f);
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = box_at((float) (i % 40), (float) (i / 40));
+        index->insert((float) i, &(boxes[i]));
+    }
+    EXPECT_THROW(index->insert(1.0f, &(boxes[1])), std::invalid_argument);
+
+    auto acc = index->make_iteration_buffer();
+    index->range_search(100.0f, 299.0f, acc);
+    EXPECT_EQ(index->found.size(), 200);
+    for (size_t i = 100; i < 300; i++) {
+        EXPECT_EQ(index->found.count(&(boxes[i])), 1);
+    }
+
+    // Deleting under a wrong key does nothing
+    index->del(7.0f, &(boxes[6]));
+    for (size_t i = 0; i < SIZE; i += 2) {
+        index->del((float) i, &(boxes[i]));
+    }
+    index->found.clear();
+    index->range_search(0.0f, SIZE, acc);
+    EXPECT_EQ(index->found.size(), SIZE / 2);
+    for (size_t i = 1; i < SIZE; i += 2) {
+        EXPECT_EQ(index->found.count(&(boxes[i])), 1);
+    }
+
+    // By key, ball queries are range searches: the odd keys in [495, 505]
+    index->found.clear();
+    index->ball_query(500.0f, 4.0f, 1.0f, acc);
+    EXPECT_EQ(index->found.size(), 6);
+
+    EXPECT_FALSE(index->is_empty());
+    for (size_t i = 1; i < SIZE; i += 2) {
+        index->del((float) i, &(boxes[i]));
+    }
+    EXPECT_TRUE(index->is_empty());
+    EXPECT_EQ(index->get_num_cells(), 0);
+    index->insert(0.0f, &(boxes[0]));
+    index->clear();
+    EXPECT_TRUE(index->is_empty());
+    EXPECT_EQ(index->get_num_cells(), 0);
+    index->insert(0.0f, &(boxes[0]));
+    index->found.clear();
+    index->ball_query(0.0f, 0.0f, 1.0f, 0.0f, acc);
+    EXPECT_EQ(index->found.size(), 1);
+
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
+
+TEST(TestGrid, RejectsBadCellSizes) {
+    EXPECT_THROW(new GridHitboxes(0.0f), std::invalid_argument);
+    EXPECT_THROW(new GridHitboxes(-1.0f), std::invalid_argument);
+    EXPECT_THROW(new GridHitboxes(NAN), std::invalid_argument);
+    EXPECT_THROW(new GridHitboxes(INFINITY), std::invalid_argument);
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+#include "../inline_hitbox.hpp"
+
+using Entry = std::tuple<float, uint32_t, float>;
+
+template<class Tree>
+class InlineHitboxes : public InlineHitboxIndex<InlineHitboxes<Tree>, Tree> {
+public:
+    std::vector<Entry> found;
+    float last_key = -INFINITY;
+
+    void search_callback(const float* keys, const InlineHitbox* boxes,
+                         size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_LE(this->last_key, keys[i]);
+            this->last_key = keys[i];
+            this->found.push_back({keys[i], boxes[i].id, boxes[i].box.a1});
+        }
+    }
+
+    std::vector<Entry> search(float k0, float k1) {
+        this->found.clear();
+        this->last_key = -INFINITY;
+        this->range_search(k0, k1);
+        std::sort(this->found.begin(), this->found.end());
+        return this->found;
+    }
+};
+
+// What the index should hold: (key, id) -> a1 of the box
+using Reference = std::multimap<std::pair<float, uint32_t>, float>;
+
+static std::vector<Entry> search(const Reference& reference, float k0,
+                                 float k1) {
+    std::vector<Entry> result;
+    for (auto& [key_id, a1] : reference) {
+        if (key_id.first >= k0 && key_id.first <= k1)
+            result.push_back({key_id.first, key_id.second, a1});
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+template<class Tree>
+static void check_random_operations(int num_keys) {
+    // Few distinct keys make long runs of duplicates over several pages
+    std::mt19937 rng{7};
+    std::uniform_int_distribution<int> key(0, num_keys - 1);
+    std::uniform_real_distribution<float> point(-5.0f, num_keys + 5.0f);
+    auto index = new InlineHitboxes<Tree>();
+    Reference reference;
+    std::vector<std::pair<float, uint32_t>> stored;
+
+    for (int step = 0; step < 20000; step++) {
+        int op = rng() % 10;
+        if (op < 5 || stored.empty()) {
+            float k = key(rng);
+            uint32_t id = step;
+            index->insert(k, {(float) step, 0.0f, 0.0f, 0.0f}, id);
+            reference.insert({{k, id}, (float) step});
+            stored.push_back({k, id});
+            continue;
+        }
+        size_t which = rng() % stored.size();
+        auto [k, id] = stored[which];
+        if (op < 7) {
+            index->del(k, id);
+            reference.erase({k, id});
+            stored[which] = stored.back();
+            stored.pop_back();
+        } else if (op < 9) {
+            float new_k = (rng() % 2) ? key(rng) : k + 0.25f;
+            index->update(k, new_k, id);
+            float a1 = reference.find({k, id})->second;
+            reference.erase({k, id});
+            reference.insert({{new_k, id}, a1});
+            stored[which].first = new_k;
+        } else {
+            index->update_box(k, id, {-1.0f * step, 0.0f, 0.0f, 0.0f});
+            reference.find({k, id})->second = -1.0f * step;
+            ASSERT_EQ(index->get(k, id)->box.a1, -1.0f * step);
+        }
+        if (step % 500 == 0) {
+            index->test_if_pages_are_consistent();
+            float k0 = point(rng);
+            float k1 = k0 + point(rng) / 10.0f;
+            ASSERT_EQ(index->search(k0, k1), search(reference, k0, k1));
+        }
+    }
+    index->test_if_pages_are_consistent();
+    EXPECT_EQ(index->search(-INFINITY, INFINITY),
+              search(reference, -INFINITY, INFINITY));
+    for (int k = 0; k < num_keys; k++) {
+        ASSERT_EQ(index->search(k, k), search(reference, k, k));
+    }
+
+    // Empty it again
+    for (auto [k, id] : stored) {
+        index->del(k, id);
+    }
+    index->test_if_pages_are_consistent();
+    EXPECT_TRUE(index->is_empty());
+    EXPECT_TRUE(index->search(-INFINITY, INFINITY).empty());
+    delete index;
+}
+
+TEST(TestInlineHitbox, RandomOperations) {
+    check_random_operations<BPTree256>(5000);
+    check_random_operations<BPTree4K>(5000);
+}
+
+TEST(TestInlineHitbox, RandomOperationsOnFewKeys) {
+    check_random_operations<BPTree256>(20);
+}
+
+TEST(TestInlineHitbox, MissingHitboxesAndClear) {
+    auto index = new InlineHitboxes<BaseBPTree>();
+    Hitbox box = {1.0f, 2.0f, 3.0f, 4.0f};
+    index->insert(1.0f, box, 7);
+    index->del(1.0f, 8);
+    index->del(2.0f, 7);
+    index->update(2.0f, 3.0f, 7);
+    index->update_box(1.0f, 8, {});
+    EXPECT_EQ(index->get(1.0f, 8), nullptr);
+    EXPECT_EQ(index->get(1.0f, 7)->box.b2, 4.0f);
+    EXPECT_EQ(index->search(-INFINITY, INFINITY).size(), 1u);
+
+    EXPECT_THROW(index->insert(INFINITY, box, 8), std::invalid_argument);
+    EXPECT_THROW(index->insert(NAN, box, 8), std::invalid_argument);
+    EXPECT_THROW(index->update(1.0f, -INFINITY, 7), std::invalid_argument);
+    EXPECT_EQ(index->get(1.0f, 7)->box.b2, 4.0f);
+    index->test_if_pages_are_consistent();
+
+    index->clear();
+    EXPECT_TRUE(index->is_empty());
+    index->insert(5.0f, box, 7);
+    index->test_if_pages_are_consistent();
+    EXPECT_EQ(index->search(5.0f, 5.0f).size(), 1u);
+    delete index;
+}
@@ -0,0 +1,32 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include "../keysearch.hpp"
+
+TEST(TestKeySearch, AllImplementationsAgree) {
+    // 20 slots like a B+ tree node: 13 sorted keys, then INFINITY padding
+    float keys[20];
+    for (size_t i = 0; i < 20; i++) {
+        keys[i] = (i < 13) ? (float) (i * 2) : INFINITY;
+    }
+    const float probes[] = {-1.0f, 0.0f, 1.0f, 7.0f, 8.0f, 24.0f, 99.0f,
+                            INFINITY, NAN};
+    const KeySearchImpl best = get_key_search_impl();
+
+    for (auto impl : {KeySearchImpl::SSE2, KeySearchImpl::AVX2}) {
+        if (!set_key_search_impl(impl))
+            continue;
+        for (float probe : probes) {
+            for (size_t n : {20, 13, 7, 3}) {
+                size_t le = count_keys_le(keys, n, probe);
+                size_t lt = count_keys_lt(keys, n, probe);
+                set_key_search_impl(KeySearchImpl::SCALAR);
+                EXPECT_EQ(le, count_keys_le(keys, n, probe))
+                    << key_search_impl_name(impl) << " probe=" << probe;
+                EXPECT_EQ(lt, count_keys_lt(keys, n, probe))
+                    << key_search_impl_name(impl) << " probe=" << probe;
+                set_key_search_impl(impl);
+            }
+        }
+    }
+    set_key_search_impl(best);
+}
@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../hitbox.hpp"
+
+using Box = std::tuple<float, float, float, float>;
+
+template<class Tree>
+class LevelHitboxes : public HitboxIndex<LevelHitboxes<Tree>, Tree> {
+public:
+    std::vector<Box> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            Hitbox* hb = iter->next();
+            this->found.push_back({hb->a1, hb->b1, hb->a2, hb->b2});
+        }
+    }
+
+    // Saved hitboxes are copies, so compare them by value
+    std::vector<Box> search(float k0, float k1) {
+        auto acc = this->make_iteration_buffer();
+        this->found.clear();
+        this->range_search(k0, k1, acc);
+        this->destroy_iteration_buffer(acc);
+        std::sort(this->found.begin(), this->found.end());
+        return this->found;
+    }
+
+    std::vector<Box> read_cursor(float k0, float k1) {
+        std::vector<Box> result;
+        Hitbox* batch[7];
+        auto cursor = this->open_range(k0, k1);
+        while (size_t n = this->next_batch(&cursor, batch, 7)) {
+            for (size_t i = 0; i < n; i++) {
+                Hitbox* hb = batch[i];
+                result.push_back({hb->a1, hb->b1, hb->a2, hb->b2});
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::vector<Box> ball(float mag, float rad, float R) {
+        auto acc = this->make_iteration_buffer();
+        this->found.clear();
+        this->ball_query(mag, rad, R, acc);
+        this->destroy_iteration_buffer(acc);
+        std::sort(this->found.begin(), this->found.end());
+        return this->found;
+    }
+};
+
+static std::string temp_path(const char* name) {
+    return testing::TempDir() + name;
+}
+
+template<class Tree>
+static void check_saved_index_answers_like_the_original(
+    LeafKeys leaf_keys = LeafKeys::FLOAT) {
+    // Small integer keys, so that many of them are in sets, some of which
+    // are spread over several leaves of the saved tree
+    constexpr size_t SIZE = 5000;
+    std::vector<Hitbox> boxes(SIZE);
+    std::mt19937 rng{3};
+    std::uniform_int_distribution<int> key(0, 600);
+    auto original = new LevelHitboxes<Tree>();
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = {(float) i, (float) i + 1, 0.0f, 1.0f};
+        original->insert((float) key(rng), &(boxes[i]));
+    }
+    for (size_t i = 0; i < 40; i++) {
+        original->insert(300.0f, &(boxes[i]));
+    }
+
+    std::string path = temp_path("test_mapped_level.bpt");
+    original->save(path.c_str(), leaf_keys);
+    auto mapped = new LevelHitboxes<Tree>();
+    mapped->insert(1.0f, &(boxes[0]));
+    mapped->map(path.c_str());
+    EXPECT_TRUE(mapped->is_mapped());
+    EXPECT_FALSE(mapped->is_empty());
+
+    EXPECT_EQ(mapped->search(-1e9f, 1e9f).size(), SIZE + 40);
+    std::uniform_real_distribution<float> point(-20.0f, 620.0f);
+    for (int q = 0; q < 300; q++) {
+        float k0 = point(rng);
+        float k1 = k0 + point(rng) / 20.0f;
+        ASSERT_EQ(mapped->search(k0, k1), original->search(k0, k1)) << k0;
+        ASSERT_EQ(mapped->search(k0, k0), original->search(k0, k0)) << k0;
+        float k = (float) key(rng);
+        ASSERT_EQ(mapped->search(k, k), original->search(k, k)) << k;
+        ASSERT_EQ(mapped->ball(k0, 2.0f, 1.5f), original->ball(k0, 2.0f, 1.5f));
+        ASSERT_EQ(mapped->read_cursor(k0, k1), original->search(k0, k1));
+        ASSERT_EQ(mapped->read_cursor(k, k), original->search(k, k));
+    }
+
+    delete original;
+    delete mapped;
+    remove(path.c_str());
+}
+
+TEST(TestMapped, SavedIndexAnswersLikeTheOriginal) {
+    check_saved_index_answers_like_the_original<BPTree256>();
+    check_saved_index_answers_like_the_original<BPTree4K>();
+}
+
+TEST(TestMapped, PackedLeafKeysAnswerLikeTheOriginal) {
+    for (LeafKeys leaf_keys : {LeafKeys::DELTA16, LeafKeys::DELTA8}) {
+        check_saved_index_answers_like_the_original<BPTree256>(leaf_keys);
+        check_saved_index_answers_like_the_original<BPTree4K>(leaf_keys);
+    }
+}
+
+TEST(TestMapped, PackedLeafKeysOverWideRanges) {
+    // Keys spread over many orders of magnitude, so that most of them share
+    // the lowest step of their leaf with others
+    constexpr size_t SIZE = 20000;
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> keys(SIZE);
+    std::mt19937 rng{5};
+    std::uniform_real_distribution<float> exponent(-10.0f, 10.0f);
+    auto original = new LevelHitboxes<BPTree512>();
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = {(float) i, 0.0f, 0.0f, 0.0f};
+        keys[i] = expf(exponent(rng));
+        original->insert(keys[i], &(boxes[i]));
+    }
+
+    std::string path = temp_path("test_mapped_packed.bpt");
+    for (LeafKeys leaf_keys : {LeafKeys::DELTA16, LeafKeys::DELTA8}) {
+        original->save(path.c_str(), leaf_keys);
+        auto mapped = new LevelHitboxes<BPTree512>();
+        mapped->map(path.c_str());
+        EXPECT_EQ(mapped->search(-INFINITY, INFINITY).size(), SIZE);
+        for (int q = 0; q < 300; q++) {
+            float k0 = keys[rng() % SIZE];
+            float k1 = keys[rng() % SIZE];
+            ASSERT_EQ(mapped->search(k0, k1), original->search(k0, k1));
+            ASSERT_EQ(mapped->search(k0, k0), original->search(k0, k0));
+            float k = expf(exponent(rng));
+            ASSERT_EQ(mapped->search(k, k * 1.001f),
+                      original->search(k, k * 1.001f));
+        }
+        delete mapped;
+    }
+    delete original;
+    remove(path.c_str());
+}
+
+TEST(TestMapped, MappedIndexIsReadOnlyUntilCleared) {
+    Hitbox box = {1.0f, 2.0f, 3.0f, 4.0f};
+    auto index = new LevelHitboxes<BaseBPTree>();
+    index->insert(5.0f, &box);
+    std::string path = temp_path("test_mapped_read_only.bpt");
+    index->save(path.c_str());
+    index->map(path.c_str());
+
+    EXPECT_THROW(index->insert(6.0f, &box), std::logic_error);
+    EXPECT_THROW(index->del(5.0f, &box), std::logic_error);
+    EXPECT_THROW(index->snapshot(), std::logic_error);
+    EXPECT_EQ(index->search(5.0f, 5.0f).size(), 1u);
+
+    index->clear();
+    EXPECT_FALSE(index->is_mapped());
+    EXPECT_TRUE(index->is_empty());
+    index->insert(6.0f, &box);
+    EXPECT_EQ(index->search(-1e9f, 1e9f).size(), 1u);
+    delete index;
+    remove(path.c_str());
+}
+
+TEST(TestMapped, EmptyIndexAndWrongFiles) {
+    auto index = new LevelHitboxes<BaseBPTree>();
+    std::string path = temp_path("test_mapped_empty.bpt");
+    index->save(path.c_str());
+    index->map(path.c_str());
+    EXPECT_TRUE(index->is_empty());
+    EXPECT_TRUE(index->search(-1e9f, 1e9f).empty());
+    index->clear();
+    index->save(path.c_str(), LeafKeys::DELTA16);
+    index->map(path.c_str());
+    EXPECT_TRUE(index->is_empty());
+
+    // Saved by another preset
+    auto other = new LevelHitboxes<BPTree512>();
+    EXPECT_THROW(other->map(path.c_str()), std::runtime_error);
+    EXPECT_FALSE(other->is_mapped());
+    EXPECT_THROW(other->map(temp_path("no_such_file.bpt").c_str()),
+                 std::runtime_error);
+
+    delete index;
+    delete other;
+    remove(path.c_str());
+}
+
+static std::vector<char> read_file(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    std::vector<char> bytes;
+    char chunk[4096];
+    while (size_t n = fread(chunk, 1, sizeof(chunk), file)) {
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return bytes;
+}
+
+static void write_file(const std::string& path,
+                       const std::vector<char>& bytes) {
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+}
+
+template<class T>
+static T read_at(const std::vector<char>& bytes, size_t offset) {
+    T value;
+    memcpy(&value, bytes.data() + offset, sizeof(value));
+    return value;
+}
+
+template<class T>
+static void write_at(std::vector<char>* bytes, size_t offset, T value) {
+    memcpy(bytes->data() + offset, &value, sizeof(value));
+}
+
+TEST(TestMapped, DamagedFilesAreNotMapped) {
+    // Offsets into the header and the nodes as laid out by save (see
+    // MappedHeader and MappedNode in bptree.cpp). Leaves are the first
+    // nodes, and the root is the last one.
+    constexpr size_t FANOUT = 8, NUM_NODES = 24, NODES_OFFSET = 32,
+                     RECORDS_OFFSET = 40, ROOT = 56;
+    std::vector<Hitbox> boxes(2000);
+    auto index = new LevelHitboxes<BaseBPTree>();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        boxes[i] = {(float) i, (float) i + 1, 0.0f, 1.0f};
+        index->insert((float) i, &(boxes[i]));
+    }
+    std::string path = temp_path("test_mapped_damaged.bpt");
+    std::string damaged_path = temp_path("test_mapped_damaged_copy.bpt");
+    auto mapped = new LevelHitboxes<BaseBPTree>();
+    for (LeafKeys leaf_keys : {LeafKeys::FLOAT, LeafKeys::DELTA16}) {
+        index->save(path.c_str(), leaf_keys);
+        std::vector<char> bytes = read_file(path);
+        uint32_t fanout = read_at<uint32_t>(bytes, FANOUT);
+        uint64_t nodes = read_at<uint64_t>(bytes, NODES_OFFSET);
+        uint64_t node_size = (read_at<uint64_t>(bytes, RECORDS_OFFSET)
+                              - nodes) / read_at<uint64_t>(bytes, NUM_NODES);
+        uint32_t root = read_at<uint32_t>(bytes, ROOT);
+        size_t root_children = nodes + root * node_size + 8 + 4 * fanout;
+        ASSERT_GT(root, 0u);
+
+        auto expect_rejected = [&](std::vector<char> damaged) {
+            write_file(damaged_path, damaged);
+            EXPECT_THROW(mapped->map(damaged_path.c_str()),
+                         std::runtime_error);
+            EXPECT_FALSE(mapped->is_mapped());
+        };
+        std::vector<char> damaged = bytes;
+        damaged.resize(bytes.size() - 4);
+        expect_rejected(damaged);
+        damaged = bytes;
+        write_at<uint64_t>(&damaged, NUM_NODES, UINT64_MAX / 2);
+        expect_rejected(damaged);
+        // A child that is the root itself, so a descent would never end
+        damaged = bytes;
+        write_at<uint32_t>(&damaged, root_children, root);
+        expect_rejected(damaged);
+        // The first leaf linked to a node past the end
+        damaged = bytes;
+        write_at<uint32_t>(&damaged, nodes, 1u << 30);
+        expect_rejected(damaged);
+        // The records of the first leaf past the end
+        damaged = bytes;
+        write_at<uint32_t>(&damaged, nodes + 4, boxes.size());
+        expect_rejected(damaged);
+
+        write_file(damaged_path, bytes);
+        mapped->map(damaged_path.c_str());
+        EXPECT_EQ(mapped->search(-1e9f, 1e9f).size(), boxes.size());
+        mapped->clear();
+    }
+
+    delete index;
+    delete mapped;
+    remove(path.c_str());
+    remove(damaged_path.c_str());
+}
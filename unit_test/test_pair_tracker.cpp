@@ -0,0 +1,229 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "../pair_tracker.hpp"
+
+using PairSet = std::set<std::pair<Hitbox*, Hitbox*>>;
+
+static PairSet as_set(const std::vector<HitboxPair>& pairs) {
+    PairSet result;
+    for (auto& pair : pairs) {
+        EXPECT_TRUE(result.insert(std::minmax(pair.a, pair.b)).second);
+    }
+    return result;
+}
+
+static PairSet brute_force_pairs(std::vector<Hitbox>& boxes,
+                                 const std::vector<bool>& present) {
+    PairSet result;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        for (size_t j = i + 1; j < boxes.size(); j++) {
+            Hitbox& l = boxes[i];
+            Hitbox& r = boxes[j];
+            if (present[i] && present[j] && l.a1 <= r.b1 && r.a1 <= l.b1
+                && l.a2 <= r.b2 && r.a2 <= l.b2)
+                result.insert(std::minmax(&l, &r));
+        }
+    }
+    return result;
+}
+
+static PairSet tracked_pairs(PairTracker* tracker) {
+    std::vector<HitboxPair> pairs;
+    tracker->get_pairs(&pairs);
+    return as_set(pairs);
+}
+
+TEST(TestPairTracker, ChangesFollowTheMotion) {
+    // Boxes on a small grid, so that edges touch now and then
+    constexpr size_t SIZE = 300;
+    std::mt19937 rng(17);
+    std::uniform_int_distribution<int> cell(0, 80);
+    std::uniform_int_distribution<int> step(-1, 1);
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<bool> present(SIZE, true);
+    auto random_box = [&]() {
+        float x = cell(rng), y = cell(rng);
+        return Hitbox{x, x + 1 + cell(rng) % 4, y, y + 1 + cell(rng) % 4};
+    };
+
+    PairTracker tracker;
+    std::vector<Hitbox*> first_half;
+    for (size_t i = 0; i < SIZE; i++) {
+        boxes[i] = random_box();
+        if (i < SIZE / 2)
+            first_half.push_back(&(boxes[i]));
+    }
+    tracker.insert_batch(first_half.data(), first_half.size());
+    for (size_t i = SIZE / 2; i < SIZE; i++) {
+        tracker.insert(&(boxes[i]));
+    }
+    tracker.test_if_lists_are_sorted();
+    PairSet expected = brute_force_pairs(boxes, present);
+    ASSERT_EQ(tracked_pairs(&tracker), expected);
+    std::vector<HitboxPair> started, stopped;
+    tracker.take_changes(&started, &stopped);
+    EXPECT_EQ(as_set(started), expected);
+    EXPECT_TRUE(stopped.empty());
+
+    for (int tick = 0; tick < 30; tick++) {
+        for (size_t i = 0; i < SIZE; i++) {
+            if (i % 3 == (size_t) tick % 3) {
+                float dx = step(rng), dy = step(rng);
+                boxes[i] = {boxes[i].a1 + dx, boxes[i].b1 + dx,
+                            boxes[i].a2 + dy, boxes[i].b2 + dy + step(rng)};
+                boxes[i].b2 = std::max(boxes[i].a2, boxes[i].b2);
+                if (present[i])
+                    tracker.update(&(boxes[i]));
+            }
+        }
+        // some boxes leave and come back
+        size_t i = (tick * 7) % SIZE;
+        if (present[i])
+            tracker.del(&(boxes[i]));
+        else
+            tracker.insert(&(boxes[i]));
+        present[i] = !present[i];
+        tracker.test_if_lists_are_sorted();
+
+        PairSet now = brute_force_pairs(boxes, present);
+        ASSERT_EQ(tracked_pairs(&tracker), now) << "tick " << tick;
+        started.clear();
+        stopped.clear();
+        tracker.take_changes(&started, &stopped);
+        // A pair may start and stop (and start again) within a tick, so
+        // only the difference of the two counts tells
+        std::map<std::pair<Hitbox*, Hitbox*>, int> net;
+        for (auto& p : expected) {
+            net[p]++;
+        }
+        for (auto& p : started) {
+            net[std::minmax(p.a, p.b)]++;
+        }
+        for (auto& p : stopped) {
+            net[std::minmax(p.a, p.b)]--;
+        }
+        for (auto& [p, count] : net) {
+            EXPECT_EQ(count, (int) now.count(p)) << "tick " << tick;
+        }
+        expected = now;
+    }
+
+    EXPECT_THROW(tracker.insert(&(boxes[1])), std::invalid_argument);
+    // A bad batch changes nothing
+    Hitbox extra[2] = {{0.0f, 1.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}};
+    size_t num_pairs = tracker.get_num_pairs();
+    std::vector<Hitbox*> repeated = {&(extra[0]), &(extra[1]), &(extra[0])};
+    EXPECT_THROW(tracker.insert_batch(repeated.data(), repeated.size()),
+                 std::invalid_argument);
+    std::vector<Hitbox*> known = {&(extra[0]), &(boxes[1])};
+    EXPECT_THROW(tracker.insert_batch(known.data(), known.size()),
+                 std::invalid_argument);
+    EXPECT_FALSE(tracker.contains(&(extra[0])));
+    EXPECT_EQ(tracker.get_num_pairs(), num_pairs);
+    tracker.test_if_lists_are_sorted();
+    Hitbox stranger = {0.0f, 1.0f, 0.0f, 1.0f};
+    EXPECT_THROW(tracker.update(&stranger), std::invalid_argument);
+    tracker.clear();
+    EXPECT_EQ(tracker.get_num_pairs(), 0u);
+}
+
+TEST(TestPairTracker, ManyDeletesAndReinserts) {
+    // Most boxes leave, so that the lists are compacted, while the others
+    // move; then they come back, on the ids that were freed
+    constexpr size_t SIZE = 400;
+    std::mt19937 rng(21);
+    std::uniform_int_distribution<int> cell(0, 60);
+    std::uniform_int_distribution<int> step(-1, 1);
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<bool> present(SIZE, true);
+    PairTracker tracker;
+    for (size_t i = 0; i < SIZE; i++) {
+        float x = cell(rng), y = cell(rng);
+        boxes[i] = {x, x + 1 + cell(rng) % 4, y, y + 1 + cell(rng) % 4};
+        tracker.insert(&(boxes[i]));
+    }
+    auto move_all = [&]() {
+        for (size_t i = 0; i < SIZE; i++) {
+            float dx = step(rng), dy = step(rng);
+            boxes[i] = {boxes[i].a1 + dx, boxes[i].b1 + dx,
+                        boxes[i].a2 + dy, boxes[i].b2 + dy};
+            if (present[i])
+                tracker.update(&(boxes[i]));
+        }
+    };
+
+    for (size_t round = 0; round < 4; round++) {
+        for (size_t i = round; i < SIZE; i += 5) {
+            tracker.del(&(boxes[i]));
+            present[i] = false;
+        }
+        move_all();
+        tracker.test_if_lists_are_sorted();
+        ASSERT_EQ(tracked_pairs(&tracker), brute_force_pairs(boxes, present))
+            << "round " << round;
+    }
+    std::vector<Hitbox*> returning;
+    for (size_t i = 0; i < SIZE; i++) {
+        if (present[i])
+            continue;
+        if (i % 2 == 0)
+            tracker.insert(&(boxes[i]));
+        else
+            returning.push_back(&(boxes[i]));
+        present[i] = true;
+    }
+    tracker.insert_batch(returning.data(), returning.size());
+    move_all();
+    tracker.test_if_lists_are_sorted();
+    EXPECT_EQ(tracked_pairs(&tracker), brute_force_pairs(boxes, present));
+}
+
+class TrackedHitboxes : public TrackingHitboxIndex<TrackedHitboxes> {
+public:
+    void search_callback(HitboxIterator* iter) {}
+};
+
+TEST(TestPairTracker, IndexFeedsTheTracker) {
+    std::vector<Hitbox> boxes = {{0, 2, 0, 2}, {1, 3, 1, 3}, {5, 6, 5, 6}};
+    auto index = new TrackedHitboxes();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        index->insert((float) i, &(boxes[i]));
+    }
+    PairTracker* tracker = index->get_pair_tracker();
+    EXPECT_EQ(tracker->get_num_pairs(), 1u);
+
+    boxes[2] = {2, 3, 2, 3};
+    index->update(2.0f, 1.5f, &(boxes[2]));
+    EXPECT_EQ(tracker->get_num_pairs(), 3u);
+    index->del(1.0f, &(boxes[0]));  // not under this key
+    EXPECT_EQ(tracker->get_num_pairs(), 3u);
+    index->del(0.0f, &(boxes[0]));
+    EXPECT_EQ(tracker->get_num_pairs(), 1u);
+
+    std::vector<HitboxPair> started, stopped;
+    tracker->take_changes(&started, &stopped);
+    EXPECT_EQ(started.size(), 3u);
+    EXPECT_EQ(stopped.size(), 2u);
+
+    // The index and the tracker agree after failed inserts
+    Hitbox more[2] = {{0, 2, 0, 2}, {1, 2, 1, 2}};
+    Hitbox* more_ptrs[2] = {&(more[0]), &(more[1])};
+    float bad_keys[2] = {1.0f, NAN};
+    EXPECT_THROW(index->insert_batch(bad_keys, more_ptrs, 2),
+                 std::invalid_argument);
+    EXPECT_FALSE(tracker->contains(&(more[0])));
+    EXPECT_FALSE(index->contains(1.0f, &(more[0])));
+    EXPECT_THROW(index->insert(3.0f, &(boxes[1])), std::invalid_argument);
+    EXPECT_TRUE(index->contains(1.0f, &(boxes[1])));
+    EXPECT_FALSE(index->contains(3.0f, &(boxes[1])));
+    EXPECT_EQ(tracker->get_num_pairs(), 1u);
+    index->clear();
+    EXPECT_EQ(tracker->get_num_pairs(), 0u);
+    delete index;
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+#include "../polar_hitbox.hpp"
+
+class PolarHitboxes : public PolarHitboxIndex<PolarHitboxes> {
+public:
+    using PolarHitboxIndex::PolarHitboxIndex;
+
+    std::set<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            EXPECT_TRUE(this->found.insert(iter->next()).second);
+        }
+    }
+};
+
+struct Point {
+    float x, y;
+};
+
+static void expect_ball_query(PolarHitboxes* index, PolarHitboxes::Acc* acc,
+                              const std::vector<Point>& points,
+                              std::vector<Hitbox>& boxes, Point c, float rad,
+                              float R) {
+    // Every hitbox whose position is within reach must be found, and only
+    // those in the ring of magnitudes may be
+    index->found.clear();
+    index->ball_query(c.x, c.y, rad, R, acc);
+    float mag = sqrtf(c.x * c.x + c.y * c.y);
+    for (size_t i = 0; i < points.size(); i++) {
+        float dx = points[i].x - c.x, dy = points[i].y - c.y;
+        float p = sqrtf(points[i].x * points[i].x + points[i].y * points[i].y);
+        bool found = index->found.count(&(boxes[i])) > 0;
+        if (sqrtf(dx * dx + dy * dy) <= rad + R) {
+            EXPECT_TRUE(found) << i << " from (" << c.x << ", " << c.y << ")";
+        }
+        if (found) {
+            EXPECT_LE(fabsf(p - mag), rad + R);
+        }
+    }
+}
+
+TEST(TestPolar, BallQueriesFindEverythingInReach) {
+    constexpr size_t SIZE = 5000;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+    std::vector<Point> points(SIZE);
+    std::vector<Hitbox> boxes(SIZE);
+    for (auto num_sectors : {1, 7, 64}) {
+        auto index = new PolarHitboxes(num_sectors);
+        for (size_t i = 0; i < SIZE; i++) {
+            points[i] = {coord(rng), coord(rng)};
+            // some on the negative x axis, where the angle wraps around
+            if (i % 50 == 0)
+                points[i].y = (i % 100 == 0) ? 0.0f : -0.0f;
+            index->insert(points[i].x, points[i].y, &(boxes[i]));
+        }
+        ASSERT_EQ(index->get_num_sectors(), num_sectors);
+
+        auto acc = index->make_iteration_buffer();
+        for (int q = 0; q < 40; q++) {
+            Point c = {coord(rng), coord(rng)};
+            if (q % 4 == 0)
+                c.y = 0.0f, c.x = -fabsf(c.x);
+            expect_ball_query(index, acc, points, boxes, c, (float) (q % 10),
+                              0.5f);
+        }
+        // around the origin
+        expect_ball_query(index, acc, points, boxes, {0.0f, 0.0f}, 10.0f,
+                          0.0f);
+        expect_ball_query(index, acc, points, boxes, {3.0f, 4.0f}, 4.0f,
+                          2.0f);
+        index->destroy_iteration_buffer(acc);
+        delete index;
+    }
+}
+
+TEST(TestPolar, UpdatesMoveHitboxesBetweenSectors) {
+    constexpr size_t SIZE = 500;
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+    std::vector<Point> points(SIZE);
+    std::vector<Hitbox> boxes(SIZE);
+    auto index = new PolarHitboxes(16);
+    for (size_t i = 0; i < SIZE; i++) {
+        points[i] = {coord(rng), coord(rng)};
+        index->insert(points[i].x, points[i].y, &(boxes[i]));
+    }
+    for (size_t i = 0; i < SIZE; i++) {
+        // small steps stay in the sector, some of the others leave it
+        Point to = (i % 2 == 0)
+            ? Point{points[i].x + 0.01f, points[i].y}
+            : Point{coord(rng), coord(rng)};
+        index->update(points[i].x, points[i].y, to.x, to.y, &(boxes[i]));
+        points[i] = to;
+    }
+    // Hitboxes that are not at the old position stay where they are
+    Hitbox other = {0, 0, 0, 0};
+    index->update(10.0f, 0.0f, -10.0f, 0.0f, &other);
+    index->update(-points[0].x, -points[0].y, 10.0f, 0.0f, &(boxes[0]));
+
+    auto acc = index->make_iteration_buffer();
+    for (int q = 0; q < 20; q++) {
+        expect_ball_query(index, acc, points, boxes, {coord(rng), coord(rng)},
+                          8.0f, 0.0f);
+    }
+    for (size_t i = 0; i < SIZE; i++) {
+        index->del(points[i].x, points[i].y, &(boxes[i]));
+    }
+    EXPECT_TRUE(index->is_empty());
+    index->found.clear();
+    index->ball_query(0.0f, 0.0f, 100.0f, 0.0f, acc);
+    EXPECT_TRUE(index->found.empty());
+    index->destroy_iteration_buffer(acc);
+    delete index;
+}
@@ -0,0 +1,270 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "../hitbox.hpp"
+
+class FrameHitboxes : public HitboxIndex<FrameHitboxes> {
+public:
+    // Each reader thread collects into its own vector
+    static thread_local std::vector<Hitbox*> found;
+
+    void search_callback(HitboxIterator* iter) {
+        while (iter->has_next()) {
+            found.push_back(iter->next());
+        }
+    }
+
+    std::vector<Hitbox*> search_all(const Snapshot* snapshot) {
+        auto acc = this->make_iteration_buffer();
+        found.clear();
+        if (snapshot != nullptr)
+            this->range_search(-1e9f, 1e9f, acc, snapshot);
+        else
+            this->range_search(-1e9f, 1e9f, acc);
+        this->destroy_iteration_buffer(acc);
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+};
+
+thread_local std::vector<Hitbox*> FrameHitboxes::found;
+
+// Random modifications, mirrored in `model` (key of each hitbox, NAN if it
+// is not in the index). Keys are small integers up to `max_key`, so there
+// are many sets.
+static void churn(FrameHitboxes* index, std::vector<Hitbox>* boxes,
+                  std::vector<float>* model, std::mt19937* rng,
+                  size_t num_ops, int max_key = 400) {
+    std::uniform_int_distribution<size_t> pick(0, boxes->size() - 1);
+    std::uniform_int_distribution<int> key(0, max_key);
+    std::uniform_int_distribution<int> op(0, 9);
+    std::vector<float> batch_keys;
+    std::vector<Hitbox*> batch_values;
+    for (size_t n = 0; n < num_ops; n++) {
+        size_t j = pick(*rng);
+        float& k = (*model)[j];
+        int o = op(*rng);
+        if (o == 0) {
+            batch_keys.clear();
+            batch_values.clear();
+            for (size_t x = j; x < std::min(boxes->size(), j + 30); x++) {
+                if (isnan((*model)[x])) {
+                    (*model)[x] = (float) key(*rng);
+                    batch_keys.push_back((*model)[x]);
+                    batch_values.push_back(&((*boxes)[x]));
+                }
+            }
+            index->insert_batch(batch_keys.data(), batch_values.data(),
+                                batch_keys.size());
+        } else if (isnan(k)) {
+            k = (float) key(*rng);
+            index->insert(k, &((*boxes)[j]));
+        } else if (o < 5) {
+            index->del(k, &((*boxes)[j]));
+            k = NAN;
+        } else {
+            float new_key = (o < 8) ? k + 0.5f : (float) key(*rng);
+            index->update(k, new_key, &((*boxes)[j]));
+            k = new_key;
+        }
+    }
+}
+
+static std::vector<Hitbox*> expected_from(std::vector<Hitbox>* boxes,
+                                          const std::vector<float>& model) {
+    std::vector<Hitbox*> result;
+    for (size_t j = 0; j < model.size(); j++) {
+        if (!isnan(model[j]))
+            result.push_back(&((*boxes)[j]));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+TEST(TestSnapshot, SnapshotsKeepTheirContentsWhileTheTreeChanges) {
+    constexpr size_t SIZE = 4000;
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> model(SIZE, NAN);
+    std::mt19937 rng{11};
+    auto index = new FrameHitboxes();
+    churn(index, &boxes, &model, &rng, 20000);
+
+    // A few frames, each with a snapshot of the one before
+    std::vector<Snapshot*> snapshots;
+    std::vector<std::vector<Hitbox*>> frozen;
+    for (int frame = 0; frame < 5; frame++) {
+        snapshots.push_back(index->snapshot());
+        frozen.push_back(expected_from(&boxes, model));
+        churn(index, &boxes, &model, &rng, 5000);
+
+        ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+        index->test_if_values_are_sorted(-INFINITY);
+        index->test_if_root_is_non_degenerate();
+        for (size_t s = 0; s < snapshots.size(); s++) {
+            ASSERT_EQ(index->search_all(snapshots[s]), frozen[s])
+                << "frame " << frame << ", snapshot " << s;
+        }
+    }
+
+    // Release out of order; the others stay intact
+    snapshots[2]->release();
+    snapshots[0]->release();
+    churn(index, &boxes, &model, &rng, 5000);
+    for (size_t s : {1, 3, 4}) {
+        ASSERT_EQ(index->search_all(snapshots[s]), frozen[s]) << s;
+    }
+
+    // Clearing keeps them as well
+    index->clear();
+    EXPECT_TRUE(index->search_all(nullptr).empty());
+    std::fill(model.begin(), model.end(), NAN);
+    churn(index, &boxes, &model, &rng, 5000);
+    ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+    for (size_t s : {1, 3, 4}) {
+        ASSERT_EQ(index->search_all(snapshots[s]), frozen[s]) << s;
+    }
+    for (size_t s : {1, 3, 4}) {
+        snapshots[s]->release();
+    }
+
+    // Without snapshots, the tree is modified in place again
+    churn(index, &boxes, &model, &rng, 5000);
+    ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+    index->test_if_values_are_sorted(-INFINITY);
+    delete index;
+}
+
+TEST(TestSnapshot, BigSetsKeepTheirContentsWhileTheyChange) {
+    // Hundreds of hitboxes under each key, so that the sets have indices
+    // and long chains of nodes, of which only some are copied
+    constexpr size_t SIZE = 3000;
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> model(SIZE, NAN);
+    std::mt19937 rng{13};
+    auto index = new FrameHitboxes();
+    churn(index, &boxes, &model, &rng, 6000, 4);
+
+    std::vector<Snapshot*> snapshots;
+    std::vector<std::vector<Hitbox*>> frozen;
+    for (int frame = 0; frame < 6; frame++) {
+        snapshots.push_back(index->snapshot());
+        frozen.push_back(expected_from(&boxes, model));
+        churn(index, &boxes, &model, &rng, 300 + 200 * frame, 4);
+
+        ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+        for (size_t s = 0; s < snapshots.size(); s++) {
+            ASSERT_EQ(index->search_all(snapshots[s]), frozen[s])
+                << "frame " << frame << ", snapshot " << s;
+        }
+    }
+    for (size_t s = 0; s < snapshots.size(); s += 2) {
+        snapshots[s]->release();
+    }
+    churn(index, &boxes, &model, &rng, 2000, 4);
+    ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+    for (size_t s = 1; s < snapshots.size(); s += 2) {
+        ASSERT_EQ(index->search_all(snapshots[s]), frozen[s]) << s;
+        snapshots[s]->release();
+    }
+    churn(index, &boxes, &model, &rng, 2000, 4);
+    ASSERT_EQ(index->search_all(nullptr), expected_from(&boxes, model));
+    delete index;
+}
+
+TEST(TestSnapshot, ReadersSearchSnapshotsWhileWriterChurns) {
+    constexpr size_t SIZE = 3000;
+    constexpr size_t NUM_READERS = 3;
+    std::vector<Hitbox> boxes(SIZE);
+    std::vector<float> model(SIZE, NAN);
+    std::mt19937 rng{5};
+    auto index = new FrameHitboxes();
+    churn(index, &boxes, &model, &rng, 10000);
+
+    // The writer publishes a snapshot after each frame; readers always
+    // search the latest one
+    std::atomic<Snapshot*> latest{index->snapshot()};
+    std::vector<std::vector<Hitbox*>> frozen;
+    frozen.push_back(expected_from(&boxes, model));
+    std::atomic<size_t> published{0};
+    std::atomic<bool> writing{true};
+    std::mutex handoff;
+
+    auto reader = [&]() {
+        auto acc = index->make_iteration_buffer();
+        auto& found = FrameHitboxes::found;
+        while (writing.load()) {
+            Snapshot* snapshot;
+            size_t frame;
+            {
+                // (taking a reference must not race with the writer
+                // dropping its own)
+                std::lock_guard<std::mutex> guard(handoff);
+                snapshot = latest.load();
+                frame = published.load();
+                snapshot->retain();
+            }
+            found.clear();
+            index->range_search(-1e9f, 1e9f, acc, snapshot);
+            std::sort(found.begin(), found.end());
+            bool same;
+            {
+                std::lock_guard<std::mutex> guard(handoff);
+                same = (found == frozen[frame]);
+            }
+            snapshot->release();
+            ASSERT_TRUE(same) << "frame " << frame;
+        }
+        index->destroy_iteration_buffer(acc);
+    };
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < NUM_READERS; r++) {
+        readers.emplace_back(reader);
+    }
+    for (int frame = 0; frame < 40; frame++) {
+        churn(index, &boxes, &model, &rng, 500);
+        Snapshot* next = index->snapshot();
+        std::lock_guard<std::mutex> guard(handoff);
+        frozen.push_back(expected_from(&boxes, model));
+        latest.load()->release();
+        latest.store(next);
+        published.store(frozen.size() - 1);
+    }
+    writing.store(false);
+    for (auto& t : readers) {
+        t.join();
+    }
+    latest.load()->release();
+    delete index;
+}
+
+TEST(TestSnapshot, NotInThreadSafeMode) {
+    auto index = new FrameHitboxes();
+    Snapshot* snapshot = index->snapshot();
+    EXPECT_THROW(index->set_thread_safe(true), std::logic_error);
+    snapshot->release();
+    index->set_thread_safe(true);
+    EXPECT_THROW(index->snapshot(), std::logic_error);
+    delete index;
+}
+
+TEST(TestSnapshot, HandlesOutliveTheTree) {
+    std::vector<Hitbox> boxes(100);
+    auto index = new FrameHitboxes();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        index->insert((float) i, &(boxes[i]));
+    }
+    Snapshot* kept = index->snapshot();
+    kept->retain();
+    index->snapshot()->release();
+    delete index;
+    kept->release();
+    EXPECT_EQ(kept->get_generation(), 1u);
+    kept->release();
+}